@@ -0,0 +1,43 @@
+#include "AudioRateController.h"
+
+AudioRateController::AudioRateController()
+{
+    Reset();
+}
+
+void AudioRateController::Reset()
+{
+    _averageDepth = 0;
+    _hasDepth = false;
+}
+
+double AudioRateController::Update(u32 queueDepth, u32 targetDepth)
+{
+    if (targetDepth == 0)
+    {
+        return 1.0;
+    }
+
+    if (!_hasDepth)
+    {
+        _averageDepth = queueDepth;
+        _hasDepth = true;
+    }
+    else
+    {
+        _averageDepth += (queueDepth - _averageDepth) * Smoothing;
+    }
+
+    // a fuller queue than the target means samples are produced too fast, so fewer are made per frame
+    double error = (_averageDepth - targetDepth) / targetDepth;
+    if (error > 1.0)
+    {
+        error = 1.0;
+    }
+    else if (error < -1.0)
+    {
+        error = -1.0;
+    }
+
+    return 1.0 + (error * MaxAdjustment);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "shared.h"
+
+// Dynamic rate control: the emulated audio clock is nudged so the host's audio queue settles around
+// a target depth, instead of the host blocking whenever emulation is paced by something else (like
+// vsync) and runs slightly ahead or behind the audio device. The adjustment is small enough (0.5%)
+// that the change in pitch can't be heard, but covers a 60 Hz display against the Game Boy's ~59.73 Hz.
+class AudioRateController
+{
+private:
+    static constexpr double MaxAdjustment = 0.005;
+
+    // weight of each new queue depth, smooths over the device pulling whole buffers at a time
+    static constexpr double Smoothing = 1.0 / 32;
+
+    double _averageDepth;
+    bool _hasDepth;
+public:
+    AudioRateController();
+
+    void Reset();
+
+    // returns the factor the audio clock rate is multiplied by, above 1 produces fewer samples per frame
+    double Update(u32 queueDepth, u32 targetDepth);
+};
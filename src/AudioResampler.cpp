@@ -0,0 +1,215 @@
+#include "AudioResampler.h"
+#include "WindowedSinc.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+AudioResampler::AudioResampler()
+{
+    _taps = 0;
+    _capacity = 0;
+    _buffered = 0;
+    _position = 0;
+    _step = 0;
+    _inputRate = 0;
+    _outputRate = 0;
+}
+
+u32 AudioResampler::GetTaps(ResamplerQuality quality)
+{
+    switch (quality)
+    {
+        case ResamplerQuality::Low:
+            return 8;
+        case ResamplerQuality::Medium:
+            return 16;
+        case ResamplerQuality::High:
+            return 32;
+        default:
+            return 0;
+    }
+}
+
+void AudioResampler::Configure(u32 inputRate, u32 outputRate, ResamplerQuality quality, u32 maxInputFrames)
+{
+    _taps = GetTaps(quality);
+    _inputRate = inputRate;
+    _outputRate = outputRate;
+    _step = ((u64)inputRate << 32) / outputRate;
+
+    // cut off below the lower of the two nyquist frequencies, further below it with fewer taps
+    // since the transition band gets wider
+    double rolloff = (_taps >= 32) ? 0.95 : ((_taps >= 16) ? 0.9 : 0.8);
+    double cutoff = ((outputRate < inputRate) ? ((double)outputRate / inputRate) : 1.0) * rolloff;
+    double half = _taps / 2;
+
+    _filter.resize((Phases + 1) * _taps);
+    for (u32 phase = 0; phase <= Phases; phase++)
+    {
+        float *row = &_filter[phase * _taps];
+        double sum = 0;
+
+        for (u32 tap = 0; tap < _taps; tap++)
+        {
+            // distance of the tap from the output sample, which sits phase/Phases after tap (half - 1)
+            double x = tap - (half - 1) - ((double)phase / Phases);
+            row[tap] = (float)WindowedSinc(x, cutoff, half);
+            sum += row[tap];
+        }
+
+        // unity gain for every phase, otherwise the interpolation between rows adds ripple
+        for (u32 tap = 0; tap < _taps; tap++)
+        {
+            row[tap] = (float)(row[tap] / sum);
+        }
+    }
+
+    _capacity = _taps + maxInputFrames;
+    _left.resize(_capacity);
+    _right.resize(_capacity);
+    Reset();
+}
+
+void AudioResampler::Reset()
+{
+    // starts on silence, the first output frames have the history before the first input frame they need
+    _buffered = _taps / 2;
+    std::fill(_left.begin(), _left.begin() + _buffered, 0.0f);
+    std::fill(_right.begin(), _right.begin() + _buffered, 0.0f);
+    _position = 0;
+}
+
+u32 AudioResampler::GetMaxOutputFrames(u32 inputFrames)
+{
+    return (u32)(((u64)inputFrames * _outputRate) / _inputRate) + 2;
+}
+
+void AudioResampler::Filter(const float *filter0, const float *filter1, float phaseFrac, const float *left,
+    const float *right, u32 taps, float &outLeft, float &outRight)
+{
+#if defined(__SSE2__)
+    __m128 frac = _mm_set1_ps(phaseFrac);
+    __m128 sumLeft = _mm_setzero_ps();
+    __m128 sumRight = _mm_setzero_ps();
+    for (u32 tap = 0; tap < taps; tap += 4)
+    {
+        __m128 coeff0 = _mm_loadu_ps(filter0 + tap);
+        __m128 coeff = _mm_add_ps(coeff0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(filter1 + tap), coeff0), frac));
+        sumLeft = _mm_add_ps(sumLeft, _mm_mul_ps(coeff, _mm_loadu_ps(left + tap)));
+        sumRight = _mm_add_ps(sumRight, _mm_mul_ps(coeff, _mm_loadu_ps(right + tap)));
+    }
+
+    // left and right sums side by side, then the pairs of lanes added up
+    __m128 sums = _mm_add_ps(_mm_unpacklo_ps(sumLeft, sumRight), _mm_unpackhi_ps(sumLeft, sumRight));
+    sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+    outLeft = _mm_cvtss_f32(sums);
+    outRight = _mm_cvtss_f32(_mm_shuffle_ps(sums, sums, 1));
+#elif defined(__ARM_NEON)
+    float32x4_t sumLeft = vdupq_n_f32(0);
+    float32x4_t sumRight = vdupq_n_f32(0);
+    for (u32 tap = 0; tap < taps; tap += 4)
+    {
+        float32x4_t coeff0 = vld1q_f32(filter0 + tap);
+        float32x4_t coeff = vmlaq_n_f32(coeff0, vsubq_f32(vld1q_f32(filter1 + tap), coeff0), phaseFrac);
+        sumLeft = vmlaq_f32(sumLeft, coeff, vld1q_f32(left + tap));
+        sumRight = vmlaq_f32(sumRight, coeff, vld1q_f32(right + tap));
+    }
+
+    float32x2_t sums = vpadd_f32(
+        vadd_f32(vget_low_f32(sumLeft), vget_high_f32(sumLeft)),
+        vadd_f32(vget_low_f32(sumRight), vget_high_f32(sumRight)));
+    outLeft = vget_lane_f32(sums, 0);
+    outRight = vget_lane_f32(sums, 1);
+#else
+    FilterScalar(filter0, filter1, phaseFrac, left, right, taps, outLeft, outRight);
+#endif
+}
+
+void AudioResampler::FilterScalar(const float *filter0, const float *filter1, float phaseFrac, const float *left,
+    const float *right, u32 taps, float &outLeft, float &outRight)
+{
+    outLeft = 0;
+    outRight = 0;
+    for (u32 tap = 0; tap < taps; tap++)
+    {
+        float coeff = filter0[tap] + (filter1[tap] - filter0[tap]) * phaseFrac;
+        outLeft += coeff * left[tap];
+        outRight += coeff * right[tap];
+    }
+}
+
+static inline s16 ClampSample(float sample)
+{
+    s32 rounded = (s32)lrintf(sample);
+    return (rounded > 32767) ? 32767 : ((rounded < -32768) ? -32768 : rounded);
+}
+
+u32 AudioResampler::Process(const s16 *input, u32 inputFrames, s16 *output, u32 maxOutputFrames)
+{
+    u32 produced = 0;
+
+    while (inputFrames > 0)
+    {
+        u32 count = _capacity - _buffered;
+        if (count == 0)
+        {
+            // output is full and nothing more fits, the rest of the input is dropped
+            break;
+        }
+        if (count > inputFrames)
+        {
+            count = inputFrames;
+        }
+
+        float *left = &_left[_buffered];
+        float *right = &_right[_buffered];
+        for (u32 i = 0; i < count; i++)
+        {
+            left[i] = input[i * 2];
+            right[i] = input[i * 2 + 1];
+        }
+        input += count * 2;
+        inputFrames -= count;
+        _buffered += count;
+
+        while (produced < maxOutputFrames)
+        {
+            u32 index = (u32)(_position >> 32);
+            if ((index + _taps) > _buffered)
+            {
+                break;
+            }
+
+            u32 frac = (u32)_position;
+            u32 phase = frac >> (32 - PhaseBits);
+            float phaseFrac = (frac & ((1u << (32 - PhaseBits)) - 1)) * (1.0f / (1u << (32 - PhaseBits)));
+            const float *filter0 = &_filter[phase * _taps];
+
+            float outLeft, outRight;
+            Filter(filter0, filter0 + _taps, phaseFrac, &_left[index], &_right[index], _taps, outLeft, outRight);
+            output[produced * 2] = ClampSample(outLeft);
+            output[produced * 2 + 1] = ClampSample(outRight);
+
+            produced++;
+            _position += _step;
+        }
+
+        // input that no output frame needs anymore is dropped, less than _taps frames stay
+        u32 consumed = (u32)(_position >> 32);
+        if (consumed > _buffered)
+        {
+            consumed = _buffered;
+        }
+        memmove(&_left[0], &_left[consumed], (_buffered - consumed) * sizeof(float));
+        memmove(&_right[0], &_right[consumed], (_buffered - consumed) * sizeof(float));
+        _buffered -= consumed;
+        _position -= (u64)consumed << 32;
+    }
+
+    return produced;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "shared.h"
+#include <vector>
+
+enum class ResamplerQuality
+{
+    Off,    // the APU synthesizes at the host's rate directly
+    Low,    // 8 taps
+    Medium, // 16 taps
+    High,   // 32 taps
+};
+
+// Windowed-sinc resampler for interleaved stereo samples. The filter is a polyphase table with Phases
+// rows of taps, an output sample between two rows interpolates their coefficients so any ratio works.
+// More taps give a steeper cutoff and cost more per sample, the latency is half the taps (in input frames).
+class AudioResampler
+{
+private:
+    static constexpr u32 PhaseBits = 8;
+    static constexpr u32 Phases = 1 << PhaseBits;
+
+    u32 _taps;
+    std::vector<float> _filter; // Phases + 1 rows of _taps coefficients
+
+    // input history, split by channel so the filter can run on both with the same coefficients
+    std::vector<float> _left;
+    std::vector<float> _right;
+    u32 _capacity;
+    u32 _buffered; // frames in the history
+
+    // position of the next output frame in the history and the distance between output frames,
+    // both in input frames as 32.32 fixed point
+    u64 _position;
+    u64 _step;
+
+    u32 _inputRate;
+    u32 _outputRate;
+
+public:
+    AudioResampler();
+
+    // one output frame from taps input frames, with the coefficients between two rows of the table (taps
+    // is a multiple of 4). Filter uses SSE2 or NEON when the build has them, the sums are added up in
+    // another order so it can be off from FilterScalar by float rounding
+    static void Filter(const float *filter0, const float *filter1, float phaseFrac, const float *left,
+        const float *right, u32 taps, float &outLeft, float &outRight);
+    static void FilterScalar(const float *filter0, const float *filter1, float phaseFrac, const float *left,
+        const float *right, u32 taps, float &outLeft, float &outRight);
+
+    static u32 GetTaps(ResamplerQuality quality);
+
+    // maxInputFrames is the most Process is given at once
+    void Configure(u32 inputRate, u32 outputRate, ResamplerQuality quality, u32 maxInputFrames);
+    void Reset();
+
+    u32 GetLatency() { return _taps / 2; }
+    u32 GetMaxOutputFrames(u32 inputFrames);
+
+    // returns the number of frames written to output
+    u32 Process(const s16 *input, u32 inputFrames, s16 *output, u32 maxOutputFrames);
+};
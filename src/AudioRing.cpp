@@ -0,0 +1,77 @@
+#include "AudioRing.h"
+#include <cstring>
+
+AudioRing::AudioRing(u32 capacity, u32 maxWriteFrames)
+{
+    _capacity = 1;
+    while (_capacity < capacity)
+    {
+        _capacity <<= 1;
+    }
+    _maxWriteFrames = (maxWriteFrames < _capacity) ? maxWriteFrames : _capacity;
+
+    _buffer = new s16[(_capacity + _maxWriteFrames) * 2];
+    memset(_buffer, 0, sizeof(s16) * (_capacity + _maxWriteFrames) * 2);
+
+    _head = 0;
+    _tail = 0;
+    _underruns = 0;
+    _overruns = 0;
+}
+
+AudioRing::~AudioRing()
+{
+    delete[] _buffer;
+}
+
+s16 *AudioRing::BeginWrite(u32 &frames)
+{
+    u32 head = _head.load(std::memory_order_relaxed);
+    u32 free = _capacity - (head - _tail.load(std::memory_order_acquire));
+    u32 granted = (frames < free) ? frames : free;
+    if (granted > _maxWriteFrames)
+    {
+        granted = _maxWriteFrames;
+    }
+
+    if (granted < frames)
+    {
+        _overruns.store(GetOverruns() + (frames - granted), std::memory_order_relaxed);
+    }
+    frames = granted;
+
+    return _buffer + ((head & (_capacity - 1)) * 2);
+}
+
+void AudioRing::EndWrite(u32 frames)
+{
+    u32 head = _head.load(std::memory_order_relaxed);
+    u32 start = head & (_capacity - 1);
+
+    if ((start + frames) > _capacity)
+    {
+        // wrapped into the room past the end, those frames belong at the start
+        memcpy(_buffer, _buffer + (_capacity * 2), (start + frames - _capacity) * 2 * sizeof(s16));
+    }
+
+    _head.store(head + frames, std::memory_order_release);
+}
+
+void AudioRing::Read(s16 *output, u32 frames)
+{
+    u32 tail = _tail.load(std::memory_order_relaxed);
+    u32 queued = _head.load(std::memory_order_acquire) - tail;
+    u32 count = (frames < queued) ? frames : queued;
+
+    u32 start = tail & (_capacity - 1);
+    u32 first = ((start + count) > _capacity) ? (_capacity - start) : count;
+    memcpy(output, _buffer + (start * 2), first * 2 * sizeof(s16));
+    memcpy(output + (first * 2), _buffer, (count - first) * 2 * sizeof(s16));
+    _tail.store(tail + count, std::memory_order_release);
+
+    if (count < frames)
+    {
+        memset(output + (count * 2), 0, (frames - count) * 2 * sizeof(s16));
+        _underruns.store(GetUnderruns() + (frames - count), std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "shared.h"
+#include <atomic>
+
+// Single-producer/single-consumer ring of interleaved stereo frames between the emulation thread and
+// the audio callback, without locks. The producer borrows a contiguous region to write into: the buffer
+// has room for maxWriteFrames past its end, and what lands there is copied to the start when the write ends.
+class AudioRing
+{
+private:
+    u32 _capacity; // frames, a power of two
+    u32 _maxWriteFrames;
+    s16 *_buffer;
+
+    // frame counts that wrap around, head - tail is the number of frames queued
+    std::atomic<u32> _head; // written by the producer
+    std::atomic<u32> _tail; // written by the consumer
+
+    std::atomic<u32> _underruns; // frames the consumer wanted that weren't queued yet
+    std::atomic<u32> _overruns; // frames the producer dropped because the ring was full
+public:
+    AudioRing(u32 capacity, u32 maxWriteFrames);
+    ~AudioRing();
+
+    u32 GetCapacity() { return _capacity; }
+    u32 GetQueuedFrames() { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+
+    u32 GetUnderruns() { return _underruns.load(std::memory_order_relaxed); }
+    u32 GetOverruns() { return _overruns.load(std::memory_order_relaxed); }
+
+    // producer: frames is lowered to what fits, the frames that don't are counted as overruns
+    s16 *BeginWrite(u32 &frames);
+    void EndWrite(u32 frames);
+
+    // consumer: what isn't queued is filled with silence and counted as underruns
+    void Read(s16 *output, u32 frames);
+};
@@ -13,7 +13,8 @@ CircleKernel::CircleKernel()
     : CStdlibAppStdio("BearGB"),
     _pwmSoundDevice(&mInterrupt, SoundSampleRate, SoundChunkSize),
     _powerButtonPin(0x1A, GPIOModeInput),
-    _powerEnablePin(0x1B, GPIOModeOutput)
+    _powerEnablePin(0x1B, GPIOModeOutput),
+    _lastPixelBuffer(nullptr)
 {
 }
 
@@ -66,6 +67,21 @@ bool CircleKernel::Initialize()
         result = false;
     }
 
+    // scale up by the largest integer factor that fits the screen (Scale2x for even factors)
+    u32 scale = mScreen.GetWidth() / 160;
+    if ((mScreen.GetHeight() / 144) < scale)
+    {
+        scale = mScreen.GetHeight() / 144;
+    }
+    if (scale > 4)
+    {
+        scale = 4;
+    }
+    if (scale > 1)
+    {
+        _postProcessor.SetFilter((scale & 1) ? PostFilter::Nearest : PostFilter::Scale2x, scale);
+    }
+
     return result;
 }
 
@@ -192,10 +208,24 @@ void CircleKernel::LoadRomFile(const char *romFile)
     _menuEnable = false;
 }
 
-void CircleKernel::QueueAudio(s16 *buffer, u32 sampleCount)
+u32 CircleKernel::GetAudioSampleRate()
 {
-    size_t bytesToWrite = sampleCount * 2 * sizeof(s16);
-    _pwmSoundDevice.Write(buffer, bytesToWrite);
+    return SoundSampleRate;
+}
+
+s16 *CircleKernel::BeginAudioWrite(u32 &frames)
+{
+    if (frames > AudioBufferFrames)
+    {
+        frames = AudioBufferFrames;
+    }
+    return _audioBuffer;
+}
+
+void CircleKernel::EndAudioWrite(u32 frames)
+{
+    size_t bytesToWrite = frames * 2 * sizeof(s16);
+    _pwmSoundDevice.Write(_audioBuffer, bytesToWrite);
 }
 
 void CircleKernel::SyncAudio()
@@ -203,12 +233,51 @@ void CircleKernel::SyncAudio()
     // keep the queue around half full
     unsigned maxFrames = _pwmSoundDevice.GetQueueSizeFrames() / 2;
 
+    // start skipping frames if the queue shows that emulation can't keep up
+    _gameBoy->SetFrameSkip(_frameSkip.Update(_pwmSoundDevice.GetQueueFramesAvail(), maxFrames));
+
+    // frames aren't synced to the display here so the sound device is the only clock, no rate control is
+    // needed. the PWM interrupt drains the queue, sleep until the next interrupt instead of spinning
     while (_pwmSoundDevice.GetQueueFramesAvail() > maxFrames)
     {
+        asm volatile ("wfi");
+    }
+}
+
+void CircleKernel::PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat)
+{
+    if (repeat && (pixelBuffer == _lastPixelBuffer))
+    {
+        // screen already has this frame
+        return;
+    }
+
+    // screen holds something else (i.e. the menu), convert everything
+    bool allDirty = (dirtyLines == nullptr) || (pixelBuffer != _lastPixelBuffer);
+    _lastPixelBuffer = pixelBuffer;
+
+    if (_postProcessor.IsEnabled())
+    {
+        // no worker thread here, so the frame is processed right away
+        PostFrame frame;
+        _postProcessor.Submit(pixelBuffer);
+        if (_postProcessor.AcquireOutput(frame))
+        {
+            DrawFrame(frame.pixels, frame.width, frame.height, nullptr);
+        }
+    }
+    else
+    {
+        DrawFrame(pixelBuffer, 160, 144, allDirty ? nullptr : dirtyLines);
     }
 }
 
-void CircleKernel::PushVideoFrame(u32 *pixelBuffer)
+void CircleKernel::SkipVideoFrame()
+{
+    // screen keeps the last frame
+}
+
+void CircleKernel::DrawFrame(const u32 *pixels, u32 frameWidth, u32 frameHeight, const u32 *dirtyLines)
 {
     CBcmFrameBuffer *frameBuffer = mScreen.GetFrameBuffer();
 
@@ -217,17 +286,25 @@ void CircleKernel::PushVideoFrame(u32 *pixelBuffer)
     u32 width = frameBuffer->GetWidth();
     u32 height = frameBuffer->GetHeight();
 
-    int cx = width > 160 ? width / 2 - 160 / 2 : 0;
-    int cy = height > 144 ? height / 2 - 144 / 2 : 0;
+    int cx = width > frameWidth ? width / 2 - frameWidth / 2 : 0;
+    int cy = height > frameHeight ? height / 2 - frameHeight / 2 : 0;
 
-    for (int x = 0; x < 160; x++)
-    for (int y = 0; y < 144; y++)
+    for (u32 y = 0; y < frameHeight; y++)
     {
-        u32 gbColor = pixelBuffer[y * 160 + x];
-        u8 r = gbColor >> 24;
-        u8 g = gbColor >> 16;
-        u8 b = gbColor >> 8;
+        if ((dirtyLines != nullptr) && ((dirtyLines[y >> 5] & ((u32)1 << (y & 0x1F))) == 0))
+        {
+            // line is unchanged since the last frame
+            continue;
+        }
 
-        frameBufferBuffer[(x + cx) + ((y + cy) * pitch)] = COLOR16(r >> 3, g >> 3, b >> 3);
+        for (u32 x = 0; x < frameWidth; x++)
+        {
+            u32 gbColor = pixels[y * frameWidth + x];
+            u8 r = gbColor >> 24;
+            u8 g = gbColor >> 16;
+            u8 b = gbColor >> 8;
+
+            frameBufferBuffer[(x + cx) + ((y + cy) * pitch)] = COLOR16(r >> 3, g >> 3, b >> 3);
+        }
     }
-}
\ No newline at end of file
+}
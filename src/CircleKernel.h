@@ -1,6 +1,8 @@
 #pragma once
 
 #include "GameBoy.h"
+#include "FrameSkipController.h"
+#include "FramePostProcessor.h"
 #include "IHostSystem.h"
 #include <circle_stdlib_app.h>
 #include <circle/cputhrottle.h>
@@ -19,7 +21,11 @@ private:
     CCPUThrottle _cpuThrottle;
     CPWMSoundBaseDevice	_pwmSoundDevice;
 
+    FrameSkipController _frameSkip;
+    FramePostProcessor _postProcessor;
+
     void StartSoundQueue();
+    void DrawFrame(const u32 *pixels, u32 frameWidth, u32 frameHeight, const u32 *dirtyLines);
 
     // unused
     TShutdownMode Run() override { return TShutdownMode::ShutdownHalt; }
@@ -30,6 +36,11 @@ private:
     CGPIOPin _powerEnablePin;
 
     bool _menuEnable;
+    u32 *_lastPixelBuffer;
+
+    // the PWM device copies into its own queue, the APU writes here first
+    static constexpr u32 AudioBufferFrames = 4096;
+    s16 _audioBuffer[AudioBufferFrames * 2];
 public:
     CircleKernel();
 
@@ -37,7 +48,10 @@ public:
     bool IsButtonPressed(HostButton button) override;
     void LoadRomFile(const char *romFile) override;
     HostExitCode RunApp(int argc, const char *argv[]) override;
-    virtual void QueueAudio(s16 *buffer, u32 sampleCount) override;
+    virtual u32 GetAudioSampleRate() override;
+    virtual s16 *BeginAudioWrite(u32 &frames) override;
+    virtual void EndAudioWrite(u32 frames) override;
     virtual void SyncAudio() override;
-    virtual void PushVideoFrame(u32 *pixelBuffer) override;
+    virtual void PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat) override;
+    virtual void SkipVideoFrame() override;
 };
\ No newline at end of file
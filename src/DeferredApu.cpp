@@ -0,0 +1,173 @@
+#include "DeferredApu.h"
+#include <sstream>
+
+DeferredApu::DeferredApu(GameBoy *gameBoy, IHostSystem *host, GameBoyApu *apu)
+{
+    _apu = apu;
+
+    // the replica writes its audio to the real host
+    _replica.reset(new GameBoyApu(gameBoy, host));
+    _replica->SetResamplerQuality(_apu->GetResamplerQuality());
+    _replica->SetSynthesisEnabled(_apu->IsSynthesisEnabled());
+    _replica->SetAdjustedClockRate(_apu->GetAdjustedClockRate());
+#ifdef USE_STEP_SYNTH
+    _replica->SetSynthQuality(_apu->GetSynthQuality());
+#endif
+
+    _log = new ApuLogEntry[LogSize];
+    _logHead = 0;
+    _writeHead = 0;
+    _holding = false;
+    _logTail = 0;
+    _audioThreadSleeping = false;
+    _stopAudioThread = false;
+
+    CopyEmulatedApu();
+    _apu->SetSynthesisEnabled(false);
+
+    _audioThread = std::thread(&DeferredApu::RunAudioThread, this);
+}
+
+DeferredApu::~DeferredApu()
+{
+    StopAudioThread();
+
+    delete[] _log;
+}
+
+void DeferredApu::StopAudioThread()
+{
+    if (!_audioThread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopAudioThread = true;
+    }
+    _wake.notify_one();
+    _audioThread.join();
+}
+
+void DeferredApu::WakeAudioThread()
+{
+    // the audio thread holds the lock until it's waiting, so the wakeup can't get lost
+    std::lock_guard<std::mutex> lock(_mutex);
+    _wake.notify_one();
+}
+
+void DeferredApu::CopyEmulatedApu()
+{
+    std::stringstream state;
+    _apu->SaveState(state);
+    _replica->LoadState(state);
+
+    _replayedCycle = _apu->GetCycleCount();
+}
+
+void DeferredApu::RunAudioThread()
+{
+    u32 idleSpins = 0;
+
+    while (true)
+    {
+        u32 tail = _logTail.load(std::memory_order_relaxed);
+        if (tail == _logHead.load(std::memory_order_acquire))
+        {
+            // more writes usually follow shortly, sleeping and waking up for each of them costs more
+            if (idleSpins < AudioThreadSpins)
+            {
+                idleSpins++;
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _audioThreadSleeping.store(true, std::memory_order_seq_cst);
+            _wake.wait(lock, [this, tail]
+            {
+                return _stopAudioThread || (tail != _logHead.load(std::memory_order_seq_cst));
+            });
+            _audioThreadSleeping.store(false, std::memory_order_relaxed);
+
+            if (_stopAudioThread && (tail == _logHead.load(std::memory_order_acquire)))
+            {
+                break;
+            }
+            continue;
+        }
+        idleSpins = 0;
+
+        const ApuLogEntry &entry = _log[tail & (LogSize - 1)];
+        Replay(entry);
+        bool sync = (entry.type == ApuLogType::Sync);
+        _logTail.store(tail + 1, std::memory_order_release);
+
+        if (sync)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _caughtUp.notify_all();
+        }
+    }
+}
+
+void DeferredApu::Replay(const ApuLogEntry &entry)
+{
+    // the replica executes at the same points as the emulated APU, with the cycles it had pending there
+    _replica->AddCycles((s32)(entry.cycle - _replayedCycle));
+    _replayedCycle = entry.cycle;
+
+    switch (entry.type)
+    {
+        case ApuLogType::Register:
+            _replica->WriteRegister(entry.addr, (u8)entry.value);
+            break;
+        case ApuLogType::TimerTick:
+            _replica->TimerTick();
+            break;
+        case ApuLogType::Execute:
+            _replica->Execute();
+            break;
+        case ApuLogType::RateAdjustment:
+            _replica->SetAdjustedClockRate(entry.value);
+            break;
+        case ApuLogType::Resampler:
+            _replica->SetResamplerQuality((ResamplerQuality)entry.value);
+            break;
+        case ApuLogType::Synthesis:
+            _replica->SetSynthesisEnabled(entry.value != 0);
+            break;
+#ifdef USE_STEP_SYNTH
+        case ApuLogType::SynthQuality:
+            _replica->SetSynthQuality((StepSynthQuality)entry.value);
+            break;
+#endif
+    }
+}
+
+void DeferredApu::WaitForReplica()
+{
+    LogWrite(ApuLogType::Sync, 0, 0, _apu->GetCycleCount());
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _caughtUp.wait(lock, [this]
+    {
+        return _logTail.load(std::memory_order_acquire) == _logHead.load(std::memory_order_relaxed);
+    });
+}
+
+void DeferredApu::Resync()
+{
+    WaitForReplica();
+    CopyEmulatedApu();
+}
+
+void DeferredApu::HandBack()
+{
+    WaitForReplica();
+    StopAudioThread();
+
+    // the emulated APU has the same state, only the synthesis setting lives in the replica
+    _apu->SetSynthesisEnabled(_replica->IsSynthesisEnabled());
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "shared.h"
+#include "IHostSystem.h"
+#include "GameBoyApu.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class GameBoy;
+
+struct ApuLogEntry
+{
+    u64 cycle; // emulated APU cycle count when it happened
+    u32 value;
+    u16 addr;
+    u8 type; // ApuLogType
+};
+
+// Synthesizes audio on an audio thread. The emulated APU runs without synthesis, which still keeps
+// everything software can read (NR52, lengths, wave RAM) exact, and every register write, frame
+// sequencer tick and end of frame is logged with the cycle it happened at. A replica APU replays the
+// log on the audio thread, executing at the same cycles, so it writes exactly the audio the emulated
+// APU would have to the host.
+//
+// While the CPU runs ahead on predicted PPU timing (see GameBoy::SetSpeculativePpu) the entries are
+// held back, the replica only gets them once the run is known to be right.
+class DeferredApu
+{
+private:
+    static constexpr u32 LogSize = 1 << 14;
+    static constexpr u32 AudioThreadSpins = 1000; // times the audio thread yields before sleeping
+
+    GameBoyApu *_apu;
+
+    // owned by the audio thread while it's running
+    std::unique_ptr<GameBoyApu> _replica;
+    u64 _replayedCycle; // emulated cycle the replica was given cycles up to
+
+    ApuLogEntry *_log;
+    std::atomic<u32> _logHead; // next entry written by the emulation thread
+    std::atomic<u32> _logTail; // next entry replayed by the audio thread
+    u32 _writeHead; // next entry written, ahead of _logHead while entries are held back
+    bool _holding;
+
+    std::thread _audioThread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _caughtUp;
+    std::atomic<bool> _audioThreadSleeping;
+    bool _stopAudioThread;
+
+    void RunAudioThread();
+    void Replay(const ApuLogEntry &entry);
+    void CopyEmulatedApu();
+    void StopAudioThread();
+    void WakeAudioThread();
+public:
+    DeferredApu(GameBoy *gameBoy, IHostSystem *host, GameBoyApu *apu);
+    ~DeferredApu();
+
+    void LogWrite(u8 type, u16 addr, u32 val, u64 cycle)
+    {
+        u32 head = _writeHead;
+        while ((head - _logTail.load(std::memory_order_acquire)) >= LogSize)
+        {
+            // audio thread is a whole log behind
+            std::this_thread::yield();
+        }
+
+        _log[head & (LogSize - 1)] = { cycle, val, addr, type };
+        _writeHead = head + 1;
+        if (!_holding)
+        {
+            Publish();
+        }
+    }
+
+    void Publish()
+    {
+        _logHead.store(_writeHead, std::memory_order_seq_cst);
+        if (_audioThreadSleeping.load(std::memory_order_seq_cst))
+        {
+            WakeAudioThread();
+        }
+    }
+
+    // entries logged from here on wait for Commit, or are thrown away by Discard
+    void Hold() { _holding = true; }
+    void Commit()
+    {
+        _holding = false;
+        Publish();
+    }
+    void Discard()
+    {
+        _holding = false;
+        _writeHead = _logHead.load(std::memory_order_relaxed);
+    }
+
+    // held back entries fill half the log, the run has to end before LogWrite waits for room that never comes
+    bool IsHoldFull() { return (_writeHead - _logHead.load(std::memory_order_relaxed)) >= LogSize / 2; }
+
+    // waits until the replica replayed everything
+    void WaitForReplica();
+
+    // replace the replica's state after the emulated APU was loaded
+    void Resync();
+
+    // the emulated APU synthesizes audio itself again
+    void HandBack();
+};
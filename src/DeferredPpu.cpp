@@ -0,0 +1,393 @@
+#include "DeferredPpu.h"
+#include <cstring>
+#include <sstream>
+
+void DeferredPpu::ReplicaHost::PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat)
+{
+    this->pixelBuffer = pixelBuffer;
+    this->repeat = repeat;
+    allDirty = (dirtyLines == nullptr);
+    if (!allDirty)
+    {
+        memcpy(this->dirtyLines, dirtyLines, sizeof(this->dirtyLines));
+    }
+    pushed = true;
+}
+
+DeferredPpu::DeferredPpu(GameBoy *gameBoy, IHostSystem *host, GameBoyPpu *ppu, const u8 *videoRam, u32 videoRamSize, const u8 *oamRam)
+{
+    _gameBoy = gameBoy;
+    _host = host;
+    _ppu = ppu;
+    _emulatedVideoRam = videoRam;
+    _emulatedOamRam = oamRam;
+    _videoRamSize = videoRamSize;
+
+    _videoRam = new u8[videoRamSize];
+    _oamRam = new u8[0xA0];
+    _replica.reset(new GameBoyPpu(gameBoy, &_replicaHost, _videoRam, _oamRam));
+    _replica->SetReplica(true);
+
+    _log = new PpuLogEntry[LogSize];
+    _logHead = 0;
+    _logTail = 0;
+    _renderThreadSleeping = false;
+    _stopRenderThread = false;
+    _checking = false;
+    _replicaIrqs = 0;
+    _replicaIrqCycle = 0;
+    _mispredicted = false;
+    _mispredictedCycle = 0;
+    _mispredictedType = 0;
+    _mispredictedAddr = 0;
+
+    // the emulated PPU drew everything up to now itself
+    CopyEmulatedPpu();
+    _ppu->SetHost(this);
+    _ppu->SetDeferred(true);
+
+    _renderThread = std::thread(&DeferredPpu::RunRenderThread, this);
+}
+
+DeferredPpu::~DeferredPpu()
+{
+    StopRenderThread();
+
+    delete[] _log;
+    delete[] _videoRam;
+    delete[] _oamRam;
+}
+
+void DeferredPpu::StopRenderThread()
+{
+    if (!_renderThread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopRenderThread = true;
+    }
+    _wake.notify_one();
+    _renderThread.join();
+}
+
+void DeferredPpu::WakeRenderThread()
+{
+    // the render thread holds the lock until it's waiting, so the wakeup can't get lost
+    std::lock_guard<std::mutex> lock(_mutex);
+    _wake.notify_one();
+}
+
+void DeferredPpu::CopyEmulatedPpu()
+{
+    std::stringstream state;
+    _ppu->SaveState(state);
+    _replica->LoadState(state);
+
+    memcpy(_videoRam, _emulatedVideoRam, _videoRamSize);
+    memcpy(_oamRam, _emulatedOamRam, 0xA0);
+
+    // skips the same frames the emulated PPU expects it to
+    _replica->CopyFrameSkip(*_ppu);
+
+    _replicaSleepCycles = 0;
+    _cycleOffset = _ppu->GetCycleCount() - _replica->GetCycleCount();
+    _replicaHost.pushed = false;
+    _replicaHost.skipped = false;
+}
+
+void DeferredPpu::RunRenderThread()
+{
+    u32 idleSpins = 0;
+
+    while (true)
+    {
+        u32 tail = _logTail.load(std::memory_order_relaxed);
+        if (tail == _logHead.load(std::memory_order_acquire))
+        {
+            // more writes usually follow shortly, sleeping and waking up for each of them costs more
+            if (idleSpins < RenderThreadSpins)
+            {
+                idleSpins++;
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _renderThreadSleeping.store(true, std::memory_order_seq_cst);
+            _wake.wait(lock, [this, tail]
+            {
+                return _stopRenderThread || (tail != _logHead.load(std::memory_order_seq_cst));
+            });
+            _renderThreadSleeping.store(false, std::memory_order_relaxed);
+
+            if (_stopRenderThread && (tail == _logHead.load(std::memory_order_acquire)))
+            {
+                break;
+            }
+            continue;
+        }
+        idleSpins = 0;
+
+        const PpuLogEntry &entry = _log[tail & (LogSize - 1)];
+        Replay(entry);
+        bool sync = (entry.type == PpuWriteType::Sync);
+        _logTail.store(tail + 1, std::memory_order_release);
+
+        if (sync)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _caughtUp.notify_all();
+        }
+    }
+}
+
+void DeferredPpu::RunReplicaUntil(u64 cycle)
+{
+    // steps the replica the same way GameBoy steps the emulated PPU, sleeping cycles included
+    u64 target = cycle - _cycleOffset;
+    u64 current = _replica->GetCycleCount() - _replicaSleepCycles;
+
+    while (current < target)
+    {
+        if (_replicaSleepCycles > 0)
+        {
+            u64 remaining = target - current;
+            u32 slept = (remaining < _replicaSleepCycles) ? (u32)remaining : _replicaSleepCycles;
+            _replicaSleepCycles -= slept;
+        }
+        else
+        {
+            _replica->ExecuteCycle();
+
+            u8 irqs = _replica->TakeReplicaIrqs();
+            if (irqs != 0)
+            {
+                if (_replicaIrqs == 0)
+                {
+                    _replicaIrqCycle = _replica->GetCycleCount() + _cycleOffset;
+                }
+                _replicaIrqs |= irqs;
+            }
+
+            _replicaSleepCycles += _replica->TakeSleepCycles();
+        }
+        current = _replica->GetCycleCount() - _replicaSleepCycles;
+    }
+
+    if (_replicaSleepCycles > 0)
+    {
+        _replica->ReturnSleepCycles(_replicaSleepCycles);
+        _replicaSleepCycles = 0;
+    }
+}
+
+void DeferredPpu::Replay(const PpuLogEntry &entry)
+{
+    if (_mispredicted.load(std::memory_order_relaxed))
+    {
+        // everything after a wrong prediction is rolled back
+        return;
+    }
+
+    RunReplicaUntil(entry.cycle);
+
+    if (_checking && !CheckPrediction(entry))
+    {
+        return;
+    }
+
+    switch (entry.type)
+    {
+        case PpuWriteType::Register:
+            _replica->WriteRegister(entry.addr, entry.value);
+            break;
+        case PpuWriteType::VideoRam:
+            _replica->WriteVideoRam(entry.addr, entry.value);
+            break;
+        case PpuWriteType::OamRam:
+            _replica->WriteOamRam(entry.addr, entry.value, false /*dmaBypass*/);
+            break;
+        case PpuWriteType::OamDma:
+            _replica->WriteOamRam(entry.addr, entry.value, true /*dmaBypass*/);
+            break;
+        case PpuWriteType::FrameSkip:
+            _replica->SetFrameSkip(entry.value);
+            break;
+        case PpuWriteType::Headless:
+            _replica->SetHeadless(entry.value != 0);
+            break;
+        case PpuWriteType::RequestFrame:
+            _replica->RequestFrame();
+            break;
+    }
+}
+
+bool DeferredPpu::CheckPrediction(const PpuLogEntry &entry)
+{
+    if (entry.type == PpuWriteType::PredictedIrq)
+    {
+        // same interrupts on the same dot
+        bool predicted = (_replicaIrqs == entry.value) && (_replicaIrqCycle == entry.cycle);
+        _replicaIrqs = 0;
+        if (!predicted)
+        {
+            Mispredict(entry.type, entry.addr, entry.cycle);
+            return false;
+        }
+        return true;
+    }
+
+    if (_replicaIrqs != 0)
+    {
+        // raised by the replica before this access and not predicted
+        Mispredict(PpuWriteType::PredictedIrq, 0, _replicaIrqCycle);
+        return false;
+    }
+
+    bool predicted;
+    if ((entry.type == PpuWriteType::PredictedRead) && ((entry.addr == 0xFF41) || (entry.addr == 0xFF44)))
+    {
+        predicted = (_replica->ReadRegister(entry.addr) == entry.value);
+    }
+    else
+    {
+        predicted = (entry.mode == PpuNoPrediction) || (entry.mode == _replica->GetState().lcdMode);
+    }
+
+    if (!predicted)
+    {
+        Mispredict(entry.type, entry.addr, entry.cycle);
+    }
+    return predicted;
+}
+
+void DeferredPpu::Mispredict(u8 type, u16 addr, u64 cycle)
+{
+    _mispredictedType = type;
+    _mispredictedAddr = addr;
+    _mispredictedCycle = cycle;
+    _mispredicted.store(true, std::memory_order_release);
+}
+
+void DeferredPpu::WaitForReplica()
+{
+    WaitForReplica(_ppu->GetCycleCount());
+}
+
+void DeferredPpu::WaitForReplica(u64 cycle)
+{
+    LogWrite(PpuWriteType::Sync, 0, 0, cycle);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _caughtUp.wait(lock, [this]
+    {
+        return _logTail.load(std::memory_order_acquire) == _logHead.load(std::memory_order_relaxed);
+    });
+}
+
+void DeferredPpu::Reset()
+{
+    WaitForReplica();
+
+    _replica->Reset();
+    memcpy(_videoRam, _emulatedVideoRam, _videoRamSize);
+    memcpy(_oamRam, _emulatedOamRam, 0xA0);
+
+    _replicaSleepCycles = 0;
+    _cycleOffset = _ppu->GetCycleCount() - _replica->GetCycleCount();
+    _replicaHost.pushed = false;
+    _replicaHost.skipped = false;
+}
+
+void DeferredPpu::Resync()
+{
+    WaitForReplica();
+    CopyEmulatedPpu();
+}
+
+void DeferredPpu::SaveState(std::ostream &outState)
+{
+    WaitForReplica();
+    _replica->SaveState(outState);
+}
+
+void DeferredPpu::HandBack()
+{
+    WaitForReplica();
+    StopRenderThread();
+
+    std::stringstream state;
+    _replica->SaveState(state);
+    _ppu->SetDeferred(false);
+    _ppu->LoadState(state);
+    _ppu->SetHost(_host);
+}
+
+void DeferredPpu::StartChecking()
+{
+    _replica->TakeReplicaIrqs();
+    _replicaIrqs = 0;
+    _checking = true;
+}
+
+bool DeferredPpu::FinishChecking(u64 cycle)
+{
+    WaitForReplica(cycle);
+    _checking = false;
+    return !_mispredicted.load(std::memory_order_acquire);
+}
+
+void DeferredPpu::SaveReplicaCheckpoint(PpuCheckpoint &checkpoint)
+{
+    _replica->SaveCheckpoint(checkpoint);
+    checkpoint.cycleCount += _cycleOffset;
+}
+
+void DeferredPpu::RollBack(const PpuCheckpoint &checkpoint)
+{
+    // replica stopped at the wrong prediction, VRAM/OAM have to be there before lines are drawn again
+    memcpy(_videoRam, _emulatedVideoRam, _videoRamSize);
+    memcpy(_oamRam, _emulatedOamRam, 0xA0);
+
+    PpuCheckpoint replica = checkpoint;
+    replica.cycleCount -= _cycleOffset;
+    _replica->LoadCheckpoint(replica, false);
+
+    _replicaSleepCycles = 0;
+    _replicaHost.pushed = false;
+    _replicaHost.skipped = false;
+    _replicaIrqs = 0;
+    _checking = false;
+    _mispredicted.store(false, std::memory_order_relaxed);
+}
+
+void DeferredPpu::SetKeepDrawingEnds(bool keep)
+{
+    WaitForReplica();
+    _replica->SetKeepDrawingEnds(keep);
+}
+
+void DeferredPpu::PushVideoFrame(u32 *, const u32 *, bool)
+{
+    // the replica reaches the same point and pushes the frame it drew there
+    WaitForReplica();
+    PresentFrame();
+}
+
+void DeferredPpu::PresentFrame()
+{
+    // skips that weren't waited for were already passed on by the emulated PPU, only this frame's counts
+    if (_replicaHost.pushed)
+    {
+        _host->PushVideoFrame(_replicaHost.pixelBuffer, _replicaHost.allDirty ? nullptr : _replicaHost.dirtyLines, _replicaHost.repeat);
+    }
+    else if (_replicaHost.skipped)
+    {
+        _host->SkipVideoFrame();
+    }
+    _replicaHost.pushed = false;
+    _replicaHost.skipped = false;
+}
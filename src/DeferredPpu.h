@@ -0,0 +1,185 @@
+#pragma once
+
+#include "shared.h"
+#include "IHostSystem.h"
+#include "GameBoyPpu.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class GameBoy;
+
+// mode of a logged access that doesn't depend on predicted timing
+constexpr u8 PpuNoPrediction = 0xFF;
+
+struct PpuLogEntry
+{
+    u64 cycle; // emulated PPU cycle count when the write happened
+    u16 addr;
+    u8 value;
+    u8 type; // PpuWriteType
+    u8 mode; // LCD mode the access was allowed or blocked by on predicted timing, or PpuNoPrediction
+};
+
+// Draws frames on a render thread. The emulated PPU only runs timing, every write to its registers,
+// VRAM and OAM is logged with the cycle it happened at. A replica PPU with its own copy of VRAM/OAM
+// replays the log and runs to the same cycles, so it draws exactly what the emulated PPU would have.
+// The emulated PPU uses this as its host, when it reaches a point where a frame is pushed the replica
+// is caught up and its frame is handed to the real host. Frames the replica skips (frame skip, headless)
+// aren't waited for, so it can fall behind by up to a whole log.
+//
+// When the CPU runs ahead on predicted timing (see GameBoy::SetSpeculativePpu) the replica is the real
+// PPU, it checks each logged prediction against its own state and stops at the first wrong one.
+class DeferredPpu : public IHostSystem
+{
+private:
+    // host of the replica, holds on to the frame it pushed until the emulation thread presents it
+    class ReplicaHost : public IHostSystem
+    {
+    public:
+        u32 *pixelBuffer = nullptr;
+        u32 dirtyLines[DirtyLineWords] = {};
+        bool allDirty = false;
+        bool repeat = false;
+        bool pushed = false;
+        bool skipped = false;
+
+        bool Initialize() override { return true; }
+        bool IsButtonPressed(HostButton) override { return false; }
+        void LoadRomFile(const char *) override { }
+        HostExitCode RunApp(int, const char *[]) override { return HostExitCode::Success; }
+        u32 GetAudioSampleRate() override { return 44100; }
+        s16 *BeginAudioWrite(u32 &frames) override { frames = 0; return nullptr; }
+        void EndAudioWrite(u32) override { }
+        void SyncAudio() override { }
+        void PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat) override;
+        void SkipVideoFrame() override { skipped = true; }
+    };
+
+    static constexpr u32 LogSize = 1 << 16;
+    static constexpr u32 RenderThreadSpins = 1000; // times the render thread yields before sleeping
+
+    GameBoy *_gameBoy;
+    IHostSystem *_host;
+    GameBoyPpu *_ppu;
+
+    // emulated VRAM/OAM, only read while the replica is caught up
+    const u8 *_emulatedVideoRam;
+    const u8 *_emulatedOamRam;
+    u32 _videoRamSize;
+
+    // replica and its copy of VRAM/OAM, owned by the render thread while it's running
+    u8 *_videoRam;
+    u8 *_oamRam;
+    std::unique_ptr<GameBoyPpu> _replica;
+    ReplicaHost _replicaHost;
+    u32 _replicaSleepCycles;
+    u64 _cycleOffset; // emulated cycle count - replica cycle count
+
+    PpuLogEntry *_log;
+    std::atomic<u32> _logHead; // next entry written by the emulation thread
+    std::atomic<u32> _logTail; // next entry replayed by the render thread
+
+    std::thread _renderThread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _caughtUp;
+    std::atomic<bool> _renderThreadSleeping;
+    bool _stopRenderThread;
+
+    // predictions are checked, only changed while the replica is caught up
+    bool _checking;
+    u8 _replicaIrqs; // raised by the replica and not predicted yet
+    u64 _replicaIrqCycle;
+
+    // first wrong prediction, the rest of the log isn't replayed until the replica is rolled back
+    std::atomic<bool> _mispredicted;
+    u64 _mispredictedCycle;
+    u8 _mispredictedType;
+    u16 _mispredictedAddr;
+
+    void RunRenderThread();
+    void Replay(const PpuLogEntry &entry);
+    bool CheckPrediction(const PpuLogEntry &entry);
+    void Mispredict(u8 type, u16 addr, u64 cycle);
+    void RunReplicaUntil(u64 cycle);
+    void CopyEmulatedPpu();
+    void StopRenderThread();
+    void WakeRenderThread();
+public:
+    DeferredPpu(GameBoy *gameBoy, IHostSystem *host, GameBoyPpu *ppu, const u8 *videoRam, u32 videoRamSize, const u8 *oamRam);
+    ~DeferredPpu();
+
+    void LogWrite(u8 type, u16 addr, u8 val, u64 cycle, u8 mode = PpuNoPrediction)
+    {
+        u32 head = _logHead.load(std::memory_order_relaxed);
+        while ((head - _logTail.load(std::memory_order_acquire)) >= LogSize)
+        {
+            // render thread is a whole log behind
+            std::this_thread::yield();
+        }
+
+        _log[head & (LogSize - 1)] = { cycle, addr, val, type, mode };
+        _logHead.store(head + 1, std::memory_order_seq_cst);
+        if (_renderThreadSleeping.load(std::memory_order_seq_cst))
+        {
+            WakeRenderThread();
+        }
+    }
+
+    // only read it while the replica is caught up (when it's pushed)
+    u32 *GetPixelBuffer() { return _replica->GetPixelBuffer(); }
+
+    // waits until the replica replayed everything and ran up to the emulated PPU's current cycle
+    void WaitForReplica();
+    void WaitForReplica(u64 cycle);
+
+    // hands the frame the replica pushed to the host, or tells it the replica skipped one, the replica has to
+    // be caught up
+    void PresentFrame();
+
+    // the replica checks the predictions logged from here on, it has to be caught up
+    void StartChecking();
+
+    // waits for the replica to reach the cycle, false if a prediction up to there was wrong
+    bool FinishChecking(u64 cycle);
+
+    bool IsMispredicted() { return _mispredicted.load(std::memory_order_acquire); }
+    u64 GetMispredictedCycle() { return _mispredictedCycle; }
+    u8 GetMispredictedType() { return _mispredictedType; }
+    u16 GetMispredictedAddr() { return _mispredictedAddr; }
+
+    // machine state of the caught up replica, in emulated cycles
+    void SaveReplicaCheckpoint(PpuCheckpoint &checkpoint);
+
+    // puts the replica back to a checkpoint of it, with VRAM/OAM copied from the emulated ones again
+    void RollBack(const PpuCheckpoint &checkpoint);
+
+    // drawing ends the replica saw, they're only kept when asked for and only read while it's caught up
+    void SetKeepDrawingEnds(bool keep);
+    const u16 *GetLineDrawingEnds() { return _replica->GetLineDrawingEnds(); }
+
+    // replace the replica's state after the emulated PPU was reset or loaded
+    void Reset();
+    void Resync();
+
+    // saves the replica's state, the emulated one doesn't have any of the drawing state
+    void SaveState(std::ostream &outState);
+
+    // gives the replica's drawing state back to the emulated PPU, which draws frames itself again
+    void HandBack();
+
+    // host of the emulated PPU
+    bool Initialize() override { return _host->Initialize(); }
+    bool IsButtonPressed(HostButton button) override { return _host->IsButtonPressed(button); }
+    void LoadRomFile(const char *romFile) override { _host->LoadRomFile(romFile); }
+    HostExitCode RunApp(int argc, const char *argv[]) override { return _host->RunApp(argc, argv); }
+    u32 GetAudioSampleRate() override { return _host->GetAudioSampleRate(); }
+    s16 *BeginAudioWrite(u32 &frames) override { return _host->BeginAudioWrite(frames); }
+    void EndAudioWrite(u32 frames) override { _host->EndAudioWrite(frames); }
+    void SyncAudio() override { _host->SyncAudio(); }
+    void PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat) override;
+    void SkipVideoFrame() override { _host->SkipVideoFrame(); }
+};
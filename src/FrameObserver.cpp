@@ -0,0 +1,207 @@
+#include "FrameObserver.h"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+constexpr u32 FrameWidth = 160;
+constexpr u32 FrameHeight = 144;
+
+FrameObserver::FrameObserver()
+{
+    _format = PpuOutputFormat::Shade;
+    _scale = 1;
+    _width = FrameWidth;
+    _height = FrameHeight;
+    _stackSize = 0;
+    _buffer = nullptr;
+    _frameCount = 0;
+}
+
+bool FrameObserver::Configure(PpuOutputFormat format, u32 scale, u32 stackSize, u8 *buffer, u32 bufferSize)
+{
+    if ((format == PpuOutputFormat::Rgba) ||
+        ((scale != 1) && (scale != 2) && (scale != 4)) ||
+        ((format == PpuOutputFormat::PaletteIndex) && (scale != 1)) ||
+        (stackSize == 0) || (buffer == nullptr) ||
+        (bufferSize < stackSize * (FrameWidth / scale) * (FrameHeight / scale)))
+    {
+        return false;
+    }
+
+    _format = format;
+    _scale = scale;
+    _width = FrameWidth / scale;
+    _height = FrameHeight / scale;
+    _stackSize = stackSize;
+    _buffer = buffer;
+    _frameCount = 0;
+    return true;
+}
+
+void FrameObserver::PushFrame(const u8 *frame, bool repeat)
+{
+    if (_buffer == nullptr)
+    {
+        return;
+    }
+
+    u32 frameSize = GetFrameSize();
+    u8 *dest = _buffer + ((_frameCount % _stackSize) * frameSize);
+
+    if (repeat && (_frameCount > 0))
+    {
+        // same as the previous observation, which is smaller than the frame when scaled
+        memcpy(dest, GetSlot(GetNewestSlot()), frameSize);
+    }
+    else if (_scale == 2)
+    {
+        Downscale2x(frame, dest, FrameWidth, FrameHeight);
+    }
+    else if (_scale == 4)
+    {
+        Downscale4x(frame, dest, FrameWidth, FrameHeight);
+    }
+    else
+    {
+        memcpy(dest, frame, frameSize);
+    }
+
+    _frameCount++;
+}
+
+void FrameObserver::Downscale2x(const u8 *src, u8 *dest, u32 width, u32 height)
+{
+    // each output is the rounded average of a 2x2 block
+    for (u32 y = 0; y < height; y += 2)
+    {
+        const u8 *row0 = src + y * width;
+        const u8 *row1 = row0 + width;
+        u8 *destRow = dest + (y / 2) * (width / 2);
+        u32 x = 0;
+
+#if defined(__SSE2__)
+        // even and odd bytes of a 16-bit lane are horizontal neighbours
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        const __m128i round = _mm_set1_epi16(2);
+        for (; (x + 32) <= width; x += 32)
+        {
+            __m128i sums[2];
+            for (int i = 0; i < 2; i++)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i *)(row0 + x + i * 16));
+                __m128i b = _mm_loadu_si128((const __m128i *)(row1 + x + i * 16));
+                __m128i sum = _mm_add_epi16(
+                    _mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8)),
+                    _mm_add_epi16(_mm_and_si128(b, low), _mm_srli_epi16(b, 8)));
+                sums[i] = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+            }
+            _mm_storeu_si128((__m128i *)(destRow + x / 2), _mm_packus_epi16(sums[0], sums[1]));
+        }
+#elif defined(__ARM_NEON)
+        for (; (x + 16) <= width; x += 16)
+        {
+            uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(row0 + x)), vpaddlq_u8(vld1q_u8(row1 + x)));
+            vst1_u8(destRow + x / 2, vrshrn_n_u16(sum, 2));
+        }
+#endif
+
+        for (; x < width; x += 2)
+        {
+            destRow[x / 2] = (row0[x] + row0[x + 1] + row1[x] + row1[x + 1] + 2) >> 2;
+        }
+    }
+}
+
+void FrameObserver::Downscale4x(const u8 *src, u8 *dest, u32 width, u32 height)
+{
+    // each output is the rounded average of a 4x4 block
+    for (u32 y = 0; y < height; y += 4)
+    {
+        const u8 *rows = src + y * width;
+        u8 *destRow = dest + (y / 4) * (width / 4);
+        u32 x = 0;
+
+#if defined(__SSE2__)
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i round = _mm_set1_epi32(8);
+        for (; (x + 32) <= width; x += 32)
+        {
+            __m128i sums[2];
+            for (int i = 0; i < 2; i++)
+            {
+                // 2x4 blocks in 16-bit lanes, then neighbouring lanes are added to 4x4 blocks
+                __m128i sum = _mm_setzero_si128();
+                for (int row = 0; row < 4; row++)
+                {
+                    __m128i a = _mm_loadu_si128((const __m128i *)(rows + row * width + x + i * 16));
+                    sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8)));
+                }
+                sums[i] = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(sum, ones), round), 4);
+            }
+            __m128i packed = _mm_packs_epi32(sums[0], sums[1]);
+            _mm_storel_epi64((__m128i *)(destRow + x / 4), _mm_packus_epi16(packed, packed));
+        }
+#elif defined(__ARM_NEON)
+        for (; (x + 32) <= width; x += 32)
+        {
+            uint16x4_t sums[2];
+            for (int i = 0; i < 2; i++)
+            {
+                uint16x8_t sum = vdupq_n_u16(0);
+                for (int row = 0; row < 4; row++)
+                {
+                    sum = vaddq_u16(sum, vpaddlq_u8(vld1q_u8(rows + row * width + x + i * 16)));
+                }
+                sums[i] = vrshrn_n_u32(vpaddlq_u16(sum), 4);
+            }
+            vst1_u8(destRow + x / 4, vmovn_u16(vcombine_u16(sums[0], sums[1])));
+        }
+#endif
+
+        for (; x < width; x += 4)
+        {
+            u32 sum = 8;
+            for (int row = 0; row < 4; row++)
+            {
+                const u8 *pixels = rows + row * width + x;
+                sum += pixels[0] + pixels[1] + pixels[2] + pixels[3];
+            }
+            destRow[x / 4] = sum >> 4;
+        }
+    }
+}
+
+void FrameObserver::Downscale2xScalar(const u8 *src, u8 *dest, u32 width, u32 height)
+{
+    for (u32 y = 0; y < height; y += 2)
+    {
+        const u8 *row0 = src + y * width;
+        const u8 *row1 = row0 + width;
+        for (u32 x = 0; x < width; x += 2)
+        {
+            *dest++ = (row0[x] + row0[x + 1] + row1[x] + row1[x + 1] + 2) >> 2;
+        }
+    }
+}
+
+void FrameObserver::Downscale4xScalar(const u8 *src, u8 *dest, u32 width, u32 height)
+{
+    for (u32 y = 0; y < height; y += 4)
+    {
+        for (u32 x = 0; x < width; x += 4)
+        {
+            u32 sum = 8;
+            for (u32 row = 0; row < 4; row++)
+            {
+                const u8 *pixels = src + (y + row) * width + x;
+                sum += pixels[0] + pixels[1] + pixels[2] + pixels[3];
+            }
+            *dest++ = sum >> 4;
+        }
+    }
+}
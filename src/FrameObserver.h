@@ -0,0 +1,46 @@
+#pragma once
+
+#include "shared.h"
+#include "GameBoyPpu.h"
+
+// Turns frames drawn in one of the byte formats (shade, palette index or luma) into observations:
+// optionally box filtered down 2x or 4x and kept as a stack of the last N frames in a buffer the
+// caller owns. The stack is a ring, frame n is in slot (n % stackSize), so nothing is shifted around.
+class FrameObserver
+{
+private:
+    PpuOutputFormat _format;
+    u32 _scale;
+    u32 _width;
+    u32 _height;
+    u32 _stackSize;
+    u8 *_buffer;
+    u64 _frameCount;
+public:
+    FrameObserver();
+
+    // rounded averages of 2x2 or 4x4 blocks of a width x height image, width and height are multiples of the
+    // block size. SSE2 or NEON when the build has them, the scalar versions give the same bytes
+    static void Downscale2x(const u8 *src, u8 *dest, u32 width, u32 height);
+    static void Downscale4x(const u8 *src, u8 *dest, u32 width, u32 height);
+    static void Downscale2xScalar(const u8 *src, u8 *dest, u32 width, u32 height);
+    static void Downscale4xScalar(const u8 *src, u8 *dest, u32 width, u32 height);
+
+    // buffer needs room for stackSize * GetFrameSize() bytes, returns false if the settings aren't supported
+    // (RGBA can't be observed, palette indices can't be averaged so they can't be scaled)
+    bool Configure(PpuOutputFormat format, u32 scale, u32 stackSize, u8 *buffer, u32 bufferSize);
+
+    PpuOutputFormat GetFormat() { return _format; }
+    u32 GetWidth() { return _width; }
+    u32 GetHeight() { return _height; }
+    u32 GetFrameSize() { return _width * _height; }
+    u32 GetStackSize() { return _stackSize; }
+
+    // frames observed so far and the slot holding the newest one
+    u64 GetFrameCount() { return _frameCount; }
+    u32 GetNewestSlot() { return (u32)((_frameCount + _stackSize - 1) % _stackSize); }
+    const u8 *GetSlot(u32 slot) { return _buffer + (slot * GetFrameSize()); }
+
+    // called by the PPU with a 160x144 frame in the configured format
+    void PushFrame(const u8 *frame, bool repeat);
+};
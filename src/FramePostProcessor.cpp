@@ -0,0 +1,431 @@
+#include "FramePostProcessor.h"
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+constexpr u32 FrameWidth = 160;
+constexpr u32 FrameHeight = 144;
+constexpr u32 FrameSize = FrameWidth * FrameHeight;
+
+FramePostProcessor::FramePostProcessor()
+{
+    _settings = { PostFilter::None, 1, false };
+
+    _ghostFrame = new u32[FrameSize];
+    _ghostValid = false;
+    _scale2xFrame = new u32[FrameSize * 4];
+    _outputReady = new u32[MaxOutputSize];
+    _readyFrame = { _outputReady, FrameWidth, FrameHeight };
+    _outputAvailable = false;
+    _droppedFrames = 0;
+
+#ifdef USE_SDL
+    _outputBack = new u32[MaxOutputSize];
+    _outputFront = new u32[MaxOutputSize];
+    _pendingFrame = new u32[FrameSize];
+    _workFrame = new u32[FrameSize];
+    _framePending = false;
+    _stopWorker = false;
+
+    _worker = std::thread(&FramePostProcessor::RunWorker, this);
+#endif
+}
+
+FramePostProcessor::~FramePostProcessor()
+{
+#ifdef USE_SDL
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopWorker = true;
+    }
+    _wake.notify_one();
+    _worker.join();
+
+    delete[] _outputBack;
+    delete[] _outputFront;
+    delete[] _pendingFrame;
+    delete[] _workFrame;
+#endif
+
+    delete[] _ghostFrame;
+    delete[] _scale2xFrame;
+    delete[] _outputReady;
+}
+
+void FramePostProcessor::SetFilter(PostFilter filter, u8 scale)
+{
+    if (scale < 1)
+    {
+        scale = 1;
+    }
+    else if (scale > MaxScale)
+    {
+        scale = MaxScale;
+    }
+
+    switch (filter)
+    {
+        case PostFilter::None:
+            scale = 1;
+            break;
+        case PostFilter::Scale2x:
+            // Scale2x doubles the size, anything beyond that is an integer scale of its output
+            scale = (scale > 2) ? 4 : 2;
+            break;
+        default:
+            break;
+    }
+
+    _settings.filter = filter;
+    _settings.scale = scale;
+}
+
+void FramePostProcessor::SetGhosting(bool enable)
+{
+    _settings.ghosting = enable;
+}
+
+bool FramePostProcessor::Submit(const u32 *pixelBuffer)
+{
+    if (!IsEnabled())
+    {
+        return false;
+    }
+
+#ifdef USE_SDL
+    std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        // worker is swapping buffers, drop the frame instead of waiting for it
+        _droppedFrames++;
+        return false;
+    }
+
+    if (_framePending)
+    {
+        // worker didn't get to the previous frame yet, replace it
+        _droppedFrames++;
+    }
+
+    memcpy(_pendingFrame, pixelBuffer, FrameSize * sizeof(u32));
+    _pendingSettings = _settings;
+    _framePending = true;
+
+    lock.unlock();
+    _wake.notify_one();
+#else
+    _readyFrame = Process(pixelBuffer, _settings, _outputReady);
+    _outputAvailable = true;
+#endif
+
+    return true;
+}
+
+bool FramePostProcessor::AcquireOutput(PostFrame &frame)
+{
+#ifdef USE_SDL
+    std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+    if (!lock.owns_lock() || !_outputAvailable)
+    {
+        return false;
+    }
+
+    std::swap(_outputFront, _outputReady);
+    frame = _readyFrame;
+    frame.pixels = _outputFront;
+#else
+    if (!_outputAvailable)
+    {
+        return false;
+    }
+
+    frame = _readyFrame;
+#endif
+
+    _outputAvailable = false;
+    return true;
+}
+
+#ifdef USE_SDL
+void FramePostProcessor::RunWorker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true)
+    {
+        _wake.wait(lock, [this] { return _framePending || _stopWorker; });
+        if (_stopWorker)
+        {
+            break;
+        }
+
+        std::swap(_pendingFrame, _workFrame);
+        Settings settings = _pendingSettings;
+        _framePending = false;
+
+        lock.unlock();
+        PostFrame frame = Process(_workFrame, settings, _outputBack);
+        lock.lock();
+
+        // publish the output, an older one that wasn't acquired yet gets overwritten
+        std::swap(_outputBack, _outputReady);
+        _readyFrame = frame;
+        _readyFrame.pixels = _outputReady;
+        _outputAvailable = true;
+    }
+}
+#endif
+
+PostFrame FramePostProcessor::Process(const u32 *pixelBuffer, const Settings &settings, u32 *output)
+{
+    const u32 *frame = pixelBuffer;
+
+    if (settings.ghosting)
+    {
+        if (_ghostValid)
+        {
+            BlendGhost(pixelBuffer, _ghostFrame, FrameSize);
+        }
+        else
+        {
+            memcpy(_ghostFrame, pixelBuffer, FrameSize * sizeof(u32));
+            _ghostValid = true;
+        }
+        frame = _ghostFrame;
+    }
+    else
+    {
+        _ghostValid = false;
+    }
+
+    switch (settings.filter)
+    {
+        case PostFilter::Scale2x:
+            if (settings.scale == 2)
+            {
+                Scale2x(frame, FrameWidth, FrameHeight, output);
+            }
+            else
+            {
+                Scale2x(frame, FrameWidth, FrameHeight, _scale2xFrame);
+                ScaleNearest(_scale2xFrame, FrameWidth * 2, FrameHeight * 2, settings.scale / 2, output);
+            }
+            break;
+
+        case PostFilter::Nearest:
+            ScaleNearest(frame, FrameWidth, FrameHeight, settings.scale, output);
+            break;
+
+        default:
+            memcpy(output, frame, FrameSize * sizeof(u32));
+            break;
+    }
+
+    return { output, FrameWidth * settings.scale, FrameHeight * settings.scale };
+}
+
+void FramePostProcessor::BlendGhost(const u32 *src, u32 *ghost, u32 count)
+{
+    u32 i = 0;
+
+    // average each channel with the previous blended frame (rounding up), so changes fade in
+    // over a few frames like on the DMG's slow LCD
+#if defined(__SSE2__)
+    for (; (i + 4) <= count; i += 4)
+    {
+        __m128i current = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i previous = _mm_loadu_si128((const __m128i *)(ghost + i));
+        _mm_storeu_si128((__m128i *)(ghost + i), _mm_avg_epu8(current, previous));
+    }
+#elif defined(__ARM_NEON)
+    for (; (i + 4) <= count; i += 4)
+    {
+        uint8x16_t current = vld1q_u8((const u8 *)(src + i));
+        uint8x16_t previous = vld1q_u8((const u8 *)(ghost + i));
+        vst1q_u8((u8 *)(ghost + i), vrhaddq_u8(current, previous));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        u32 a = src[i];
+        u32 b = ghost[i];
+        ghost[i] = (a | b) - (((a ^ b) >> 1) & 0x7F7F7F7F);
+    }
+}
+
+void FramePostProcessor::ScaleNearest(const u32 *src, u32 width, u32 height, u32 scale, u32 *dest)
+{
+    u32 destWidth = width * scale;
+
+    for (u32 y = 0; y < height; y++)
+    {
+        const u32 *srcRow = src + y * width;
+        u32 *destRow = dest + y * scale * destWidth;
+        u32 x = 0;
+
+#if defined(__SSE2__)
+        if (scale == 2)
+        {
+            for (; (x + 4) <= width; x += 4)
+            {
+                __m128i pixels = _mm_loadu_si128((const __m128i *)(srcRow + x));
+                _mm_storeu_si128((__m128i *)(destRow + x * 2), _mm_unpacklo_epi32(pixels, pixels));
+                _mm_storeu_si128((__m128i *)(destRow + x * 2 + 4), _mm_unpackhi_epi32(pixels, pixels));
+            }
+        }
+        else if (scale == 4)
+        {
+            for (; (x + 4) <= width; x += 4)
+            {
+                __m128i pixels = _mm_loadu_si128((const __m128i *)(srcRow + x));
+                _mm_storeu_si128((__m128i *)(destRow + x * 4), _mm_shuffle_epi32(pixels, 0x00));
+                _mm_storeu_si128((__m128i *)(destRow + x * 4 + 4), _mm_shuffle_epi32(pixels, 0x55));
+                _mm_storeu_si128((__m128i *)(destRow + x * 4 + 8), _mm_shuffle_epi32(pixels, 0xAA));
+                _mm_storeu_si128((__m128i *)(destRow + x * 4 + 12), _mm_shuffle_epi32(pixels, 0xFF));
+            }
+        }
+#elif defined(__ARM_NEON)
+        if (scale == 2)
+        {
+            for (; (x + 4) <= width; x += 4)
+            {
+                uint32x4_t pixels = vld1q_u32(srcRow + x);
+                uint32x4x2_t doubled = vzipq_u32(pixels, pixels);
+                vst1q_u32(destRow + x * 2, doubled.val[0]);
+                vst1q_u32(destRow + x * 2 + 4, doubled.val[1]);
+            }
+        }
+        else if (scale == 4)
+        {
+            for (; (x + 4) <= width; x += 4)
+            {
+                uint32x4_t pixels = vld1q_u32(srcRow + x);
+                uint32x4x2_t doubled = vzipq_u32(pixels, pixels);
+                uint32x4x2_t low = vzipq_u32(doubled.val[0], doubled.val[0]);
+                uint32x4x2_t high = vzipq_u32(doubled.val[1], doubled.val[1]);
+                vst1q_u32(destRow + x * 4, low.val[0]);
+                vst1q_u32(destRow + x * 4 + 4, low.val[1]);
+                vst1q_u32(destRow + x * 4 + 8, high.val[0]);
+                vst1q_u32(destRow + x * 4 + 12, high.val[1]);
+            }
+        }
+#endif
+
+        for (; x < width; x++)
+        {
+            for (u32 i = 0; i < scale; i++)
+            {
+                destRow[x * scale + i] = srcRow[x];
+            }
+        }
+
+        // remaining rows are copies of the first one
+        for (u32 i = 1; i < scale; i++)
+        {
+            memcpy(destRow + i * destWidth, destRow, destWidth * sizeof(u32));
+        }
+    }
+}
+
+// Scale2x/EPX for a single pixel, edges are clamped
+static inline void Scale2xPixel(const u32 *above, const u32 *row, const u32 *below, u32 x, u32 width, u32 *out0, u32 *out1)
+{
+    u32 b = above[x];
+    u32 d = row[(x > 0) ? x - 1 : x];
+    u32 e = row[x];
+    u32 f = row[(x < width - 1) ? x + 1 : x];
+    u32 h = below[x];
+
+    if ((b != h) && (d != f))
+    {
+        out0[x * 2] = (d == b) ? d : e;
+        out0[x * 2 + 1] = (b == f) ? f : e;
+        out1[x * 2] = (d == h) ? d : e;
+        out1[x * 2 + 1] = (h == f) ? f : e;
+    }
+    else
+    {
+        out0[x * 2] = e;
+        out0[x * 2 + 1] = e;
+        out1[x * 2] = e;
+        out1[x * 2 + 1] = e;
+    }
+}
+
+void FramePostProcessor::Scale2x(const u32 *src, u32 width, u32 height, u32 *dest)
+{
+    u32 destWidth = width * 2;
+
+    for (u32 y = 0; y < height; y++)
+    {
+        const u32 *above = src + ((y > 0) ? y - 1 : y) * width;
+        const u32 *row = src + y * width;
+        const u32 *below = src + ((y < height - 1) ? y + 1 : y) * width;
+        u32 *out0 = dest + y * 2 * destWidth;
+        u32 *out1 = out0 + destWidth;
+
+        // first pixel has no left neighbour, the vector loop stops before the last one for the same reason
+        Scale2xPixel(above, row, below, 0, width, out0, out1);
+        u32 x = 1;
+
+#if defined(__SSE2__)
+        for (; (x + 5) <= width; x += 4)
+        {
+            __m128i b = _mm_loadu_si128((const __m128i *)(above + x));
+            __m128i d = _mm_loadu_si128((const __m128i *)(row + x - 1));
+            __m128i e = _mm_loadu_si128((const __m128i *)(row + x));
+            __m128i f = _mm_loadu_si128((const __m128i *)(row + x + 1));
+            __m128i h = _mm_loadu_si128((const __m128i *)(below + x));
+
+            __m128i noEdge = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+            __m128i useD0 = _mm_andnot_si128(noEdge, _mm_cmpeq_epi32(d, b));
+            __m128i useF1 = _mm_andnot_si128(noEdge, _mm_cmpeq_epi32(b, f));
+            __m128i useD2 = _mm_andnot_si128(noEdge, _mm_cmpeq_epi32(d, h));
+            __m128i useF3 = _mm_andnot_si128(noEdge, _mm_cmpeq_epi32(h, f));
+
+            __m128i e0 = _mm_or_si128(_mm_and_si128(useD0, d), _mm_andnot_si128(useD0, e));
+            __m128i e1 = _mm_or_si128(_mm_and_si128(useF1, f), _mm_andnot_si128(useF1, e));
+            __m128i e2 = _mm_or_si128(_mm_and_si128(useD2, d), _mm_andnot_si128(useD2, e));
+            __m128i e3 = _mm_or_si128(_mm_and_si128(useF3, f), _mm_andnot_si128(useF3, e));
+
+            _mm_storeu_si128((__m128i *)(out0 + x * 2), _mm_unpacklo_epi32(e0, e1));
+            _mm_storeu_si128((__m128i *)(out0 + x * 2 + 4), _mm_unpackhi_epi32(e0, e1));
+            _mm_storeu_si128((__m128i *)(out1 + x * 2), _mm_unpacklo_epi32(e2, e3));
+            _mm_storeu_si128((__m128i *)(out1 + x * 2 + 4), _mm_unpackhi_epi32(e2, e3));
+        }
+#elif defined(__ARM_NEON)
+        for (; (x + 5) <= width; x += 4)
+        {
+            uint32x4_t b = vld1q_u32(above + x);
+            uint32x4_t d = vld1q_u32(row + x - 1);
+            uint32x4_t e = vld1q_u32(row + x);
+            uint32x4_t f = vld1q_u32(row + x + 1);
+            uint32x4_t h = vld1q_u32(below + x);
+
+            uint32x4_t noEdge = vorrq_u32(vceqq_u32(b, h), vceqq_u32(d, f));
+            uint32x4_t e0 = vbslq_u32(vbicq_u32(vceqq_u32(d, b), noEdge), d, e);
+            uint32x4_t e1 = vbslq_u32(vbicq_u32(vceqq_u32(b, f), noEdge), f, e);
+            uint32x4_t e2 = vbslq_u32(vbicq_u32(vceqq_u32(d, h), noEdge), d, e);
+            uint32x4_t e3 = vbslq_u32(vbicq_u32(vceqq_u32(h, f), noEdge), f, e);
+
+            uint32x4x2_t top = vzipq_u32(e0, e1);
+            uint32x4x2_t bottom = vzipq_u32(e2, e3);
+            vst1q_u32(out0 + x * 2, top.val[0]);
+            vst1q_u32(out0 + x * 2 + 4, top.val[1]);
+            vst1q_u32(out1 + x * 2, bottom.val[0]);
+            vst1q_u32(out1 + x * 2 + 4, bottom.val[1]);
+        }
+#endif
+
+        for (; x < width; x++)
+        {
+            Scale2xPixel(above, row, below, x, width, out0, out1);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "shared.h"
+
+#ifdef USE_SDL
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+enum class PostFilter : u8
+{
+    None, // no post-processing, frames are used as-is
+    Nearest, // integer scale
+    Scale2x, // smooth edges with Scale2x/EPX, then integer scale
+};
+
+struct PostFrame
+{
+    const u32 *pixels;
+    u32 width;
+    u32 height;
+};
+
+// Scales and filters completed 160x144 frames. With SDL the work is done on a worker thread:
+// frames are handed over without waiting, if the worker is busy then the pending frame is replaced
+// and the older one is dropped. Without threads (Circle) frames are processed synchronously.
+class FramePostProcessor
+{
+private:
+    static constexpr u32 MaxScale = 4;
+    static constexpr u32 MaxOutputSize = (160 * MaxScale) * (144 * MaxScale);
+
+    struct Settings
+    {
+        PostFilter filter;
+        u8 scale;
+        bool ghosting;
+    };
+
+    Settings _settings;
+
+    // previous blended frame for ghosting
+    u32 *_ghostFrame;
+    bool _ghostValid;
+
+    // intermediate Scale2x result
+    u32 *_scale2xFrame;
+
+    // last completed output
+    u32 *_outputReady;
+    PostFrame _readyFrame;
+    bool _outputAvailable;
+
+    u32 _droppedFrames;
+
+#ifdef USE_SDL
+    // output being written by the worker and the one handed to the host by AcquireOutput
+    // (stays valid until the next call)
+    u32 *_outputBack;
+    u32 *_outputFront;
+
+    std::thread _worker;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopWorker;
+
+    // frame waiting for the worker and the frame the worker is processing
+    u32 *_pendingFrame;
+    u32 *_workFrame;
+    Settings _pendingSettings;
+    bool _framePending;
+
+    void RunWorker();
+#endif
+
+    PostFrame Process(const u32 *pixelBuffer, const Settings &settings, u32 *output);
+
+    static void BlendGhost(const u32 *src, u32 *ghost, u32 count);
+    static void ScaleNearest(const u32 *src, u32 width, u32 height, u32 scale, u32 *dest);
+    static void Scale2x(const u32 *src, u32 width, u32 height, u32 *dest);
+public:
+    FramePostProcessor();
+    ~FramePostProcessor();
+
+    PostFilter GetFilter() { return _settings.filter; }
+    u8 GetScale() { return _settings.scale; }
+    bool IsGhostingEnabled() { return _settings.ghosting; }
+    bool IsEnabled() { return (_settings.filter != PostFilter::None) || _settings.ghosting; }
+    u32 GetDroppedFrames() { return _droppedFrames; }
+
+    void SetFilter(PostFilter filter, u8 scale);
+    void SetGhosting(bool enable);
+
+    // queues a 160x144 frame for post-processing (processes it right away without threads),
+    // returns false if the frame was dropped because the worker was busy
+    bool Submit(const u32 *pixelBuffer);
+
+    // gets the latest completed output, returns false if nothing new was completed since the last call
+    bool AcquireOutput(PostFrame &frame);
+};
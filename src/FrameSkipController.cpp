@@ -0,0 +1,48 @@
+#include "FrameSkipController.h"
+
+FrameSkipController::FrameSkipController()
+{
+    Reset();
+}
+
+void FrameSkipController::Reset()
+{
+    _frameSkip = 0;
+    _behindFrames = 0;
+    _aheadFrames = 0;
+}
+
+u8 FrameSkipController::Update(u32 queueDepth, u32 targetDepth)
+{
+    if (queueDepth < (targetDepth / 2))
+    {
+        // audio queue is draining, emulation is behind real time
+        _aheadFrames = 0;
+        _behindFrames++;
+
+        if ((_behindFrames >= AdjustFrames) && (_frameSkip < MaxFrameSkip))
+        {
+            _frameSkip++;
+            _behindFrames = 0;
+        }
+    }
+    else if (queueDepth >= targetDepth)
+    {
+        // queue is full so the host will wait, there is time to spare
+        _behindFrames = 0;
+        _aheadFrames++;
+
+        if ((_aheadFrames >= AdjustFrames) && (_frameSkip > 0))
+        {
+            _frameSkip--;
+            _aheadFrames = 0;
+        }
+    }
+    else
+    {
+        _behindFrames = 0;
+        _aheadFrames = 0;
+    }
+
+    return _frameSkip;
+}
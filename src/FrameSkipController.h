@@ -0,0 +1,26 @@
+#pragma once
+
+#include "shared.h"
+
+// Adjusts the PPU frame skip ratio based on how far emulation is lagging behind real time.
+// The audio queue depth is used as the clock: if it keeps draining, frames are produced
+// too slowly and more frames get skipped; if the host has to wait on it, skip fewer.
+class FrameSkipController
+{
+private:
+    static constexpr u8 MaxFrameSkip = 4;
+
+    // consecutive frames required before changing the skip ratio (hysteresis)
+    static constexpr u32 AdjustFrames = 30;
+
+    u8 _frameSkip;
+    u32 _behindFrames;
+    u32 _aheadFrames;
+public:
+    FrameSkipController();
+
+    u8 GetFrameSkip() { return _frameSkip; }
+
+    void Reset();
+    u8 Update(u32 queueDepth, u32 targetDepth);
+};
@@ -1,5 +1,11 @@
 #include "GameBoy.h"
 #include "DmgBios.h"
+#ifdef USE_SDL
+#include "DeferredPpu.h"
+#include "DeferredApu.h"
+#include "PpuPredictor.h"
+#include <chrono>
+#endif
 #include <algorithm>
 #include <filesystem>
 #include <iostream>
@@ -48,6 +54,11 @@ GameBoy::GameBoy(GameBoyModel model, const char *romFile, IHostSystem *host)
 
 GameBoy::~GameBoy()
 {
+#ifdef USE_SDL
+    _deferredPpu.reset();
+    _deferredApu.reset();
+#endif
+
     delete[] _workRam;
     delete[] _highRam;
     delete[] _videoRam;
@@ -59,11 +70,11 @@ void GameBoy::ExecuteTwoCycles()
     _state.cycleCount++;
     _apu->AddCycles(_state.cgbHighSpeed ? 1 : 2);
     ExecuteTimer();
-    _ppu->ExecuteCycle(); // Adjust for CGB
+    ExecutePpuCycle(); // Adjust for CGB
     _state.cycleCount++;
     if (!_state.cgbHighSpeed)
     {
-        _ppu->ExecuteCycle();
+        ExecutePpuCycle();
     }
     if ((_state.cycleCount & 0x3) == 0) // run DMA on 4 cycle intervals
     {
@@ -83,6 +94,440 @@ void GameBoy::ExecuteTwoCycles()
     }
 }
 
+void GameBoy::ExecutePpuCycle()
+{
+#ifdef USE_SDL
+    if (_speculating)
+    {
+        // the replica runs the real PPU, the CPU goes by the predicted timing
+        u8 irqs = _ppuPredictor->Step();
+        if (irqs != 0)
+        {
+            RaisePredictedIrqs(irqs);
+        }
+        return;
+    }
+#endif
+
+    if (_ppuSleepCycles > 0)
+    {
+        // PPU has nothing to do until it wakes up
+        _ppuSleepCycles--;
+    }
+    else
+    {
+        _ppu->ExecuteCycle();
+        _ppuSleepCycles += _ppu->TakeSleepCycles();
+    }
+}
+
+void GameBoy::SyncPpu()
+{
+    // PPU state needs to be exact before it is accessed, it might also be woken up
+    if (_ppuSleepCycles > 0)
+    {
+        _ppu->ReturnSleepCycles(_ppuSleepCycles);
+        _ppuSleepCycles = 0;
+    }
+}
+
+u32 *GameBoy::GetPixelBuffer()
+{
+#ifdef USE_SDL
+    if (_deferredPpu != nullptr)
+    {
+        return _deferredPpu->GetPixelBuffer();
+    }
+#endif
+    return _ppu->GetPixelBuffer();
+}
+
+void GameBoy::SetFrameSkip(u8 frameSkip)
+{
+    _ppu->SetFrameSkip(frameSkip);
+    LogPpuWrite(PpuWriteType::FrameSkip, 0, frameSkip);
+}
+
+void GameBoy::SetAudioRateAdjustment(double ratio)
+{
+    _apu->SetRateAdjustment(ratio);
+    LogApuWrite(ApuLogType::RateAdjustment, 0, _apu->GetAdjustedClockRate());
+}
+
+void GameBoy::SetAudioResampler(ResamplerQuality quality)
+{
+    _apu->SetResamplerQuality(quality);
+    LogApuWrite(ApuLogType::Resampler, 0, (u32)quality);
+}
+
+#ifdef USE_STEP_SYNTH
+void GameBoy::SetAudioSynthQuality(StepSynthQuality quality)
+{
+    _apu->SetSynthQuality(quality);
+    LogApuWrite(ApuLogType::SynthQuality, 0, (u32)quality);
+}
+#endif
+
+void GameBoy::SetAudioSynthesis(bool enable)
+{
+#ifdef USE_SDL
+    if (_deferredApu != nullptr)
+    {
+        // the emulated APU stays without synthesis, the replica does it
+        LogApuWrite(ApuLogType::Synthesis, 0, enable);
+        return;
+    }
+#endif
+    _apu->SetSynthesisEnabled(enable);
+}
+
+void GameBoy::SetDeferredAudio(bool enable)
+{
+#ifdef USE_SDL
+    if (enable == (_deferredApu != nullptr))
+    {
+        return;
+    }
+
+    if (enable)
+    {
+        _deferredApu.reset(new DeferredApu(this, _host, _apu.get()));
+    }
+    else
+    {
+        SetSpeculativePpu(false);
+        _deferredApu->HandBack();
+        _deferredApu.reset();
+    }
+#endif
+}
+
+bool GameBoy::IsDeferredAudio()
+{
+#ifdef USE_SDL
+    return _deferredApu != nullptr;
+#else
+    return false;
+#endif
+}
+
+void GameBoy::SetHeadless(bool headless)
+{
+    _ppu->SetHeadless(headless);
+    LogPpuWrite(PpuWriteType::Headless, 0, headless);
+}
+
+void GameBoy::RequestFrame()
+{
+    _ppu->RequestFrame();
+    LogPpuWrite(PpuWriteType::RequestFrame, 0, 0);
+}
+
+void GameBoy::SetDeferredRendering(bool enable)
+{
+#ifdef USE_SDL
+    if (enable == (_deferredPpu != nullptr))
+    {
+        return;
+    }
+
+    if (enable && (_ppu->GetOutputFormat() != PpuOutputFormat::Rgba))
+    {
+        // the replica only draws RGBA frames for the host
+        return;
+    }
+
+    SyncPpu();
+    if (enable)
+    {
+        _deferredPpu.reset(new DeferredPpu(this, _host, _ppu.get(), _videoRam, _videoRamSize, _oamRam));
+    }
+    else
+    {
+        SetSpeculativePpu(false);
+        _deferredPpu->HandBack();
+        _deferredPpu.reset();
+    }
+#endif
+}
+
+void GameBoy::SetObserver(FrameObserver *observer)
+{
+    SetDeferredRendering(false);
+    SyncPpu();
+    _ppu->SetObserver(observer);
+}
+
+void GameBoy::GetObservation(PpuObservation &observation)
+{
+    SyncPpu();
+    _ppu->GetObservation(observation);
+}
+
+void GameBoy::SetSpeculativePpu(bool enable)
+{
+#ifdef USE_SDL
+    if (enable == (_ppuPredictor != nullptr))
+    {
+        return;
+    }
+
+    if (!enable)
+    {
+        _deferredPpu->SetKeepDrawingEnds(false);
+        _ppuPredictor.reset();
+        return;
+    }
+
+    // the replica is the real PPU and keeps the drawing ends the predictor goes by, and audio is held back
+    // until a run checked out
+    SetDeferredRendering(true);
+    SetDeferredAudio(true);
+    if (_deferredPpu == nullptr)
+    {
+        return;
+    }
+
+    SyncPpu();
+    _deferredPpu->SetKeepDrawingEnds(true);
+    _ppuPredictor.reset(new PpuPredictor(_ppu.get(), _cart->GetTitle(), _ppu->GetCycleCount()));
+    _lockstepUntil = 0;
+    _undoLog.reserve(UndoLogSize);
+#endif
+}
+
+bool GameBoy::IsSpeculativePpu()
+{
+#ifdef USE_SDL
+    return _ppuPredictor != nullptr;
+#else
+    return false;
+#endif
+}
+
+u64 GameBoy::GetPpuRollBacks()
+{
+#ifdef USE_SDL
+    return (_ppuPredictor != nullptr) ? _ppuPredictor->GetRollBacks() : 0;
+#else
+    return 0;
+#endif
+}
+
+void GameBoy::SetPpuPredictionStats(bool enable)
+{
+#ifdef USE_SDL
+    if (enable == _ppuPredictionStats)
+    {
+        return;
+    }
+
+    _ppuPredictionStats = enable;
+    if (_ppuPredictor != nullptr)
+    {
+        // counters and lockstep frames start over
+        _ppuPredictor.reset(new PpuPredictor(_ppu.get(), _cart->GetTitle(), _ppu->GetCycleCount() - _ppuSleepCycles));
+    }
+#endif
+}
+
+bool GameBoy::IsDeferredRendering()
+{
+#ifdef USE_SDL
+    return _deferredPpu != nullptr;
+#else
+    return false;
+#endif
+}
+
+void GameBoy::LogPpuWrite(u8 type, u16 addr, u8 val)
+{
+#ifdef USE_SDL
+    if (_speculating)
+    {
+        LogPredictedAccess(type, addr, val);
+    }
+    else if (_deferredPpu != nullptr)
+    {
+        // cycle the emulated PPU is at, cycles it hasn't slept through yet don't count
+        _deferredPpu->LogWrite(type, addr, val, _ppu->GetCycleCount() - _ppuSleepCycles);
+    }
+#endif
+}
+
+void GameBoy::LogApuWrite(u8 type, u16 addr, u32 val)
+{
+#ifdef USE_SDL
+    if (_deferredApu != nullptr)
+    {
+        _deferredApu->LogWrite(type, addr, val, _apu->GetCycleCount());
+        if (_speculating && _deferredApu->IsHoldFull())
+        {
+            // held writes can't be handed over until the run checks out
+            _endSpeculation = true;
+        }
+    }
+#endif
+}
+
+#ifdef USE_SDL
+void GameBoy::LogPredictedAccess(u8 type, u16 addr, u8 val)
+{
+    // VRAM/OAM and CGB palette data are blocked in some modes, the replica checks the mode that was predicted
+    u8 mode = PpuNoPrediction;
+    if ((type == PpuWriteType::VideoRam) || (type == PpuWriteType::OamRam) || (type == PpuWriteType::PredictedRead) ||
+        ((type == PpuWriteType::Register) && ((addr == 0xFF69) || (addr == 0xFF6B))))
+    {
+        mode = _ppu->GetState().lcdMode;
+        _ppuPredictor->CountAccess();
+    }
+    _deferredPpu->LogWrite(type, addr, val, _ppuPredictor->GetCycle(), mode);
+}
+
+void GameBoy::UpdateSpeculation()
+{
+    bool caughtUp = false;
+    if (_speculating)
+    {
+        if (!_endSpeculation && !_mispredicted && !_deferredPpu->IsMispredicted())
+        {
+            return;
+        }
+        EndSpeculation();
+        caughtUp = true;
+    }
+
+    // drawing is the one mode whose length isn't known ahead, so runs start outside of it and have a whole
+    // line's OAM search to learn its end from the replica
+    const PpuState &ppu = _ppu->GetState();
+    if (ppu.lcdPower && (ppu.lcdMode != LcdModeFlag::Drawing) && !_state.cgbHdmaMode &&
+        !_ppuPredictor->IsLockstepFrame() && ((_ppu->GetCycleCount() - _ppuSleepCycles) >= _lockstepUntil))
+    {
+        StartSpeculation(caughtUp);
+    }
+}
+
+void GameBoy::StartSpeculation(bool caughtUp)
+{
+    SyncPpu();
+    if (!caughtUp)
+    {
+        _deferredPpu->WaitForReplica(_ppu->GetCycleCount());
+    }
+
+    // the replica is the real PPU from here, everything else it takes to go back here is kept aside
+    _deferredPpu->SaveReplicaCheckpoint(_checkpoint.ppu);
+    _deferredPpu->StartChecking();
+    _checkpoint.state = _state;
+    _checkpoint.cpu = _cpu->GetState();
+    _checkpoint.cart.seekp(0);
+    _cart->SaveRegisters(_checkpoint.cart);
+    _checkpoint.apu.seekp(0);
+    _apu->SaveCheckpoint(_checkpoint.apu);
+    _deferredApu->Hold();
+
+    _ppuPredictor->Start(_checkpoint.ppu, _deferredPpu->GetLineDrawingEnds());
+    _speculating = true;
+}
+
+void GameBoy::EndSpeculation()
+{
+    _speculating = false;
+    _endSpeculation = false;
+    _mispredicted = false;
+
+    if (_deferredPpu->FinishChecking(_ppuPredictor->GetCycle()))
+    {
+        CommitSpeculation();
+    }
+    else
+    {
+        RollBackSpeculation();
+    }
+}
+
+void GameBoy::StopSpeculation()
+{
+    // a write in the middle of an instruction needs the real PPU, so the run ends here if it checked out
+    if (_mispredicted)
+    {
+        return;
+    }
+
+    if (!_deferredPpu->FinishChecking(_ppuPredictor->GetCycle()))
+    {
+        // can't be rolled back in the middle of an instruction
+        _mispredicted = true;
+        return;
+    }
+
+    _speculating = false;
+    _endSpeculation = false;
+    CommitSpeculation();
+}
+
+void GameBoy::CommitSpeculation()
+{
+    _undoLog.clear();
+    _deferredApu->Commit();
+    _ppuPredictor->Commit();
+
+    // the emulated PPU carries on from the replica's timing
+    _deferredPpu->SaveReplicaCheckpoint(_checkpoint.ppu);
+    _ppu->LoadCheckpoint(_checkpoint.ppu, true /*timingOnly*/);
+
+    if (_ppuPredictor->IsFrameEnded())
+    {
+        // what the emulated PPU does at the start of V-Blank
+        _host->SyncAudio();
+        _deferredPpu->PresentFrame();
+    }
+}
+
+void GameBoy::RollBackSpeculation()
+{
+    _ppuPredictor->RollBack(_deferredPpu->GetMispredictedType(), _deferredPpu->GetMispredictedAddr());
+    u64 mispredictedCycle = _deferredPpu->GetMispredictedCycle();
+
+    // in reverse so each byte ends up with what it was before the run
+    for (auto entry = _undoLog.rbegin(); entry != _undoLog.rend(); entry++)
+    {
+        *entry->data = entry->value;
+    }
+    _undoLog.clear();
+
+    _state = _checkpoint.state;
+    _cpu->SetState(_checkpoint.cpu);
+    _checkpoint.cart.seekg(0);
+    _cart->LoadRegisters(_checkpoint.cart);
+    _checkpoint.apu.seekg(0);
+    _apu->LoadCheckpoint(_checkpoint.apu);
+    RefreshMemoryMap();
+    _deferredApu->Discard();
+
+    _deferredPpu->RollBack(_checkpoint.ppu);
+    _ppu->LoadCheckpoint(_checkpoint.ppu, true /*timingOnly*/);
+
+    // the same instructions run again in lockstep, past the dot the prediction was wrong at
+    _lockstepUntil = mispredictedCycle + 1;
+}
+
+void GameBoy::RaisePredictedIrqs(u8 irqs)
+{
+    // the replica checks they're raised on the same dot
+    _deferredPpu->LogWrite(PpuWriteType::PredictedIrq, 0, irqs, _ppuPredictor->GetCycle());
+    SetInterruptFlags(irqs);
+
+    if (irqs & IrqFlag::VBlank)
+    {
+        CheckJoyPadChange();
+
+        // the frame is presented once the run checked out
+        _endSpeculation = true;
+    }
+}
+#endif
+
 void GameBoy::Reset()
 {
     MapMemory(_workRam, 0xC000, 0xDFFF, false /*readOnly*/);
@@ -103,7 +548,14 @@ void GameBoy::Reset()
     _state.serialBitCounter = 0;
 
     _cpu->Reset();
+    _ppuSleepCycles = 0;
     _ppu->Reset();
+#ifdef USE_SDL
+    if (_deferredPpu != nullptr)
+    {
+        _deferredPpu->Reset();
+    }
+#endif
 
     if (!_state.biosEnabled)
     {
@@ -147,18 +599,55 @@ void GameBoy::RunCycles(u32 cycles)
 {
     u64 targetCycleCount = _state.cycleCount + cycles;
 
-    while (targetCycleCount >= _state.cycleCount)
+    do
     {
-        _cpu->RunOneInstruction();
-    }
+        while (targetCycleCount >= _state.cycleCount)
+        {
+#ifdef USE_SDL
+            if (_ppuPredictor != nullptr)
+            {
+                // runs start and end between instructions
+                UpdateSpeculation();
+            }
+#endif
+            _cpu->RunOneInstruction();
+        }
+
+#ifdef USE_SDL
+        if (_speculating)
+        {
+            // nothing outside of this sees a run, a rollback goes back to before the target
+            EndSpeculation();
+        }
+#endif
+    } while (targetCycleCount >= _state.cycleCount);
 }
 
 void GameBoy::RunOneFrame()
 {
+#ifdef USE_SDL
+    // only timed for the predictor's report, taking the time every frame isn't free
+    std::chrono::steady_clock::time_point start;
+    bool timed = (_ppuPredictor != nullptr) && _ppuPredictionStats;
+    if (timed)
+    {
+        start = std::chrono::steady_clock::now();
+    }
+#endif
+
     // 154 scanlines per frame, 456 clocks per scanline
     RunCycles(154 * 456);
 
+    LogApuWrite(ApuLogType::Execute, 0, 0);
     _apu->Execute();
+
+#ifdef USE_SDL
+    if (timed)
+    {
+        _ppuPredictor->EndFrame(_ppu->GetCycleCount() - _ppuSleepCycles,
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+#endif
 }
 
 void GameBoy::SaveState(const char *fileName)
@@ -172,6 +661,8 @@ void GameBoy::SaveState(const char *fileName)
 
 void GameBoy::SaveState(std::ofstream &outState)
 {
+    SyncPpu();
+
     outState.write((char *)_workRam, _workRamSize);
     outState.write((char *)_highRam, GameBoy::HighRamSize);
     outState.write((char *)_videoRam, _videoRamSize);
@@ -180,6 +671,14 @@ void GameBoy::SaveState(std::ofstream &outState)
 
     _cart->SaveState(outState);
     _cpu->SaveState(outState);
+#ifdef USE_SDL
+    if (_deferredPpu != nullptr)
+    {
+        // the emulated PPU doesn't have the drawing state
+        _deferredPpu->SaveState(outState);
+    }
+    else
+#endif
     _ppu->SaveState(outState);
     _apu->SaveState(outState);
 }
@@ -195,6 +694,14 @@ void GameBoy::LoadState(const char *fileName)
 
 void GameBoy::LoadState(std::ifstream &inState)
 {
+#ifdef USE_SDL
+    if (_deferredPpu != nullptr)
+    {
+        // replica must not be running while the state is replaced
+        _deferredPpu->WaitForReplica();
+    }
+#endif
+
     inState.read((char *)_workRam, _workRamSize);
     inState.read((char *)_highRam, GameBoy::HighRamSize);
     inState.read((char *)_videoRam, _videoRamSize);
@@ -203,10 +710,22 @@ void GameBoy::LoadState(std::ifstream &inState)
 
     _cart->LoadState(inState);
     _cpu->LoadState(inState);
+    _ppuSleepCycles = 0;
     _ppu->LoadState(inState);
     _apu->LoadState(inState);
 
     RefreshMemoryMap();
+
+#ifdef USE_SDL
+    if (_deferredPpu != nullptr)
+    {
+        _deferredPpu->Resync();
+    }
+    if (_deferredApu != nullptr)
+    {
+        _deferredApu->Resync();
+    }
+#endif
 }
 
 void GameBoy::SwitchSpeed()
@@ -276,6 +795,16 @@ u8 GameBoy::ReadRegister(u16 addr)
             case 0xFF49: case 0xFF4A: case 0xFF4B:
             case 0xFF4F: // CGB Bank
             case 0xFF68: case 0xFF69: case 0xFF6A: case 0xFF6B: // CGB Palette
+#ifdef USE_SDL
+                if (_speculating && ((addr == 0xFF41) || (addr == 0xFF44)))
+                {
+                    // predicted, the replica checks it against the real value
+                    u8 value = _ppu->ReadRegister(addr);
+                    _deferredPpu->LogWrite(PpuWriteType::PredictedRead, addr, value, _ppuPredictor->GetCycle());
+                    _ppuPredictor->CountRead();
+                    return value;
+                }
+#endif
                 return _ppu->ReadRegister(addr);
             case 0xFF46: // DMA - OAM DMA Transfer
                 return _state.oamDmaSrcAddr;
@@ -290,10 +819,22 @@ u8 GameBoy::ReadRegister(u16 addr)
     }
     else if (addr >= 0xFE00)
     {
+#ifdef USE_SDL
+        if (_speculating)
+        {
+            LogPredictedAccess(PpuWriteType::PredictedRead, addr, 0);
+        }
+#endif
         return _ppu->ReadOamRam(addr);
     }
     else if (addr >= 0x8000 && addr <= 0x9FFF)
     {
+#ifdef USE_SDL
+        if (_speculating)
+        {
+            LogPredictedAccess(PpuWriteType::PredictedRead, addr, 0);
+        }
+#endif
         return _ppu->ReadVideoRam(addr);
     }
     else
@@ -316,6 +857,7 @@ void GameBoy::Write(u16 addr, u8 val)
     }
     else if (_writeMap[block])
     {
+        SaveUndo(&_writeMap[block][addr & 0xFF]);
         _writeMap[block][addr & 0xFF] = val;
     }
     else
@@ -335,6 +877,7 @@ void GameBoy::WriteRegister(u16 addr, u8 val)
     }
     else if (addr >= 0xFF80)
     {
+        SaveUndo(&_highRam[addr & 0x7F]);
         _highRam[addr & 0x7F] = val;
         return;
     }
@@ -437,6 +980,7 @@ void GameBoy::WriteRegister(u16 addr, u8 val)
             case 0xFF37: case 0xFF38: case 0xFF39: case 0xFF3A:
             case 0xFF3B: case 0xFF3C: case 0xFF3D: case 0xFF3E:
             case 0xFF3F:
+                LogApuWrite(ApuLogType::Register, addr, val);
                 _apu->WriteRegister(addr, val);
                 return;
             case 0xFF40: case 0xFF41: case 0xFF42: case 0xFF43:
@@ -444,7 +988,29 @@ void GameBoy::WriteRegister(u16 addr, u8 val)
             case 0xFF4A: case 0xFF4B:
             case 0xFF4F: // CGB Bank
             case 0xFF68: case 0xFF69: case 0xFF6A: case 0xFF6B: // CGB Palette
+#ifdef USE_SDL
+                if (_speculating)
+                {
+                    if ((addr == 0xFF40) || (addr == 0xFF41) || (addr == 0xFF45))
+                    {
+                        // LCD power changes the timing and STAT/LYC writes can raise the interrupt themselves
+                        StopSpeculation();
+                        if (_speculating)
+                        {
+                            // rolled back at the next instruction anyway
+                            return;
+                        }
+                    }
+                    else if (addr == 0xFF43)
+                    {
+                        // fine scroll makes drawing take longer
+                        _ppuPredictor->SetScrollX(val);
+                    }
+                }
+#endif
+                SyncPpu();
                 _ppu->WriteRegister(addr, val);
+                LogPpuWrite(PpuWriteType::Register, addr, val);
                 return;
             case 0xFF46: // OAM DMA Transfer and Start Address
                 _state.oamDmaSrcAddr = val;
@@ -480,6 +1046,17 @@ void GameBoy::WriteRegister(u16 addr, u8 val)
 
                 if ((val & 0x80) != 0) // HDMA mode
                 {
+#ifdef USE_SDL
+                    if (_speculating)
+                    {
+                        // HDMA runs in the real PPU's H-Blanks
+                        StopSpeculation();
+                        if (_speculating)
+                        {
+                            return;
+                        }
+                    }
+#endif
                     //std::cout << "HDMA: $" << std::hex << _state.cgbDmaSrcAddr << "->" << (0x8000 | _state.cgbDmaDestAddr) << " Length=" << int(_state.cgbDmaLength) << std::endl;
                     _state.cgbHdmaMode = true;
                     _state.cgbDmaComplete = false;
@@ -524,16 +1101,35 @@ void GameBoy::WriteRegister(u16 addr, u8 val)
     }
     else if (addr >= 0xFE00)
     {
+        if ((addr & 0xFF) < OamRamSize)
+        {
+            SaveUndo(&_oamRam[addr & 0xFF]);
+        }
+        SyncPpu();
         _ppu->WriteOamRam(addr, val, false /*dmaBypass*/);
+        LogPpuWrite(PpuWriteType::OamRam, addr, val);
         return;
     }
     else if (addr >= 0x8000 && addr <= 0x9FFF)
     {
+        SaveUndo(&_videoRam[(_ppu->GetState().vramBank << 13) | (addr & 0x1FFF)]);
         _ppu->WriteVideoRam(addr, val);
+        LogPpuWrite(PpuWriteType::VideoRam, addr, val);
         return;
     }
     else
     {
+#ifdef USE_SDL
+        if (_speculating && (addr >= 0xA000))
+        {
+            // cart RAM behind the mapper (MBC2) isn't in the undo log
+            StopSpeculation();
+            if (_speculating)
+            {
+                return;
+            }
+        }
+#endif
         _cart->WriteRegister(addr, val);
         return;
     }
@@ -760,6 +1356,7 @@ void GameBoy::ExecuteTimer()
     u16 mask = _state.cgbHighSpeed ? 0x2000 : 0x1000;
 	if (((newDivider & mask) == 0) &&
         ((_state.divider & mask) != 0)) {
+		LogApuWrite(ApuLogType::TimerTick, 0, 0);
 		_apu->TimerTick();
 	}
 
@@ -775,7 +1372,10 @@ void GameBoy::ExecuteOamDma()
             // first DMA cycle does not write since nothing has been fetched yet
             if (_state.oamDmaCounter < 161)
             {
+                SaveUndo(&_oamRam[160 - _state.oamDmaCounter]);
+                SyncPpu();
                 _ppu->WriteOamRam(160 - _state.oamDmaCounter, _state.oamDmaBuffer, true /*dmaBypass*/);
+                LogPpuWrite(PpuWriteType::OamDma, 160 - _state.oamDmaCounter, _state.oamDmaBuffer);
 
                 //std::cout << "DMA write $" << int(160 - _state.oamDmaCounter) << "=" << int(_state.oamDmaBuffer) << std::endl;
             }
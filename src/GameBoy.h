@@ -3,6 +3,8 @@
 #include <memory>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <vector>
 #include "shared.h"
 #include "IHostSystem.h"
 #include "GameBoyCart.h"
@@ -10,6 +12,13 @@
 #include "GameBoyPpu.h"
 #include "GameBoyApu.h"
 
+#ifdef USE_SDL
+class DeferredPpu;
+class DeferredApu;
+class PpuPredictor;
+class FrameObserver;
+#endif
+
 enum class GameBoyModel
 {
     Auto,
@@ -142,6 +151,25 @@ struct GameBoyState
     bool biosEnabled;
 };
 
+#ifdef USE_SDL
+// what a speculative run is rolled back to (see GameBoy::SetSpeculativePpu), memory is put back from the undo log
+struct GameBoyCheckpoint
+{
+    GameBoyState state;
+    CpuState cpu;
+    PpuCheckpoint ppu;
+    std::stringstream cart; // mapper registers
+    std::stringstream apu;
+};
+
+// byte written during a speculative run and what it was before
+struct GameBoyUndoEntry
+{
+    u8 *data;
+    u8 value;
+};
+#endif
+
 class GameBoy
 {
 private:
@@ -151,6 +179,7 @@ private:
     static constexpr u32 VideoRamSizeCgb = 0x4000; // 16 KB
 	static constexpr u32 OamRamSize = 0xA0;
 	static constexpr u32 HighRamSize = 0x7F;
+    static constexpr u32 UndoLogSize = 1 << 16; // writes a speculative run ends early at
 
     IHostSystem *_host;
     GameBoyModel _model;
@@ -161,6 +190,27 @@ private:
     std::unique_ptr<GameBoyPpu> _ppu;
     std::unique_ptr<GameBoyApu> _apu;
 
+#ifdef USE_SDL
+    // draws frames on a render thread when enabled, _ppu only runs timing then
+    std::unique_ptr<DeferredPpu> _deferredPpu;
+
+    // synthesizes audio on an audio thread when enabled, _apu only keeps the state software can read then
+    std::unique_ptr<DeferredApu> _deferredApu;
+
+    // runs the CPU ahead of the PPU when enabled, see SetSpeculativePpu
+    std::unique_ptr<PpuPredictor> _ppuPredictor;
+    bool _ppuPredictionStats = false;
+    bool _speculating = false; // in a run, _ppu isn't stepped and only has the predicted timing
+    bool _endSpeculation = false; // run ends at the next instruction, its frame ended or it got too long
+    bool _mispredicted = false; // found out in the middle of an instruction, rolled back at the next one
+    u64 _lockstepUntil = 0; // PPU cycle past a wrong prediction, no run starts before it
+    GameBoyCheckpoint _checkpoint;
+    std::vector<GameBoyUndoEntry> _undoLog;
+#endif
+
+    // PPU cycles left where the PPU is sleeping and doesn't need to be called
+    u32 _ppuSleepCycles = 0;
+
     // internal RAM
     u8 *_workRam = nullptr;
     u8 *_videoRam = nullptr;
@@ -177,17 +227,99 @@ private:
     u8 *_writeMap[0x100] = {};
     u8 _readableRegMap[0x100] = {};
     u8 _writeableRegMap[0x100] = {};
+
+    // passes a write that affects what the PPU draws on to the deferred renderer
+    inline void LogPpuWrite(u8 type, u16 addr, u8 val);
+
+    // passes what the APU does to the deferred synthesizer
+    inline void LogApuWrite(u8 type, u16 addr, u32 val);
+
+#ifdef USE_SDL
+    // speculative runs, see SetSpeculativePpu
+    void UpdateSpeculation();
+    void StartSpeculation(bool caughtUp);
+    void EndSpeculation();
+    void StopSpeculation();
+    void CommitSpeculation();
+    void RollBackSpeculation();
+    void RaisePredictedIrqs(u8 irqs);
+    void LogPredictedAccess(u8 type, u16 addr, u8 val);
+#endif
+
+    // memory written during a speculative run is put back from the undo log when it's rolled back
+    void SaveUndo(u8 *data)
+    {
+#ifdef USE_SDL
+        if (_speculating)
+        {
+            _undoLog.push_back({ data, *data });
+            if (_undoLog.size() >= UndoLogSize)
+            {
+                _endSpeculation = true;
+            }
+        }
+#endif
+    }
 public:
     GameBoy(GameBoyModel type, const char *romFile, IHostSystem *host);
     ~GameBoy();
 
     u64 GetCycleCount() { return _state.cycleCount; }
-    u32 *GetPixelBuffer() { return _ppu->GetPixelBuffer(); }
+    u32 *GetPixelBuffer();
+    void SetFrameSkip(u8 frameSkip);
+
+    // dynamic rate control, scales the audio clock so slightly more or fewer samples are produced per frame
+    void SetAudioRateAdjustment(double ratio);
+
+    // converts the audio to the host's rate with a windowed-sinc resampler (see AudioResampler)
+    void SetAudioResampler(ResamplerQuality quality);
+
+#ifdef USE_STEP_SYNTH
+    // kernel width of the band-limited steps (see StepSynth)
+    void SetAudioSynthQuality(StepSynthQuality quality);
+#endif
+
+    // skips audio synthesis for runs that throw the audio away, registers and wave RAM behave the same
+    void SetAudioSynthesis(bool enable);
+
+    // audio is synthesized on another thread from a log of APU writes, the output is identical
+    void SetDeferredAudio(bool enable);
+    bool IsDeferredAudio();
+
+    void SetHeadless(bool headless);
+    void RequestFrame();
+
+    // frames are drawn on another thread from a log of PPU writes, the output is identical
+    void SetDeferredRendering(bool enable);
+    bool IsDeferredRendering();
+
+    // frames go to the observer as shades, palette indices or luma instead of to the host (see FrameObserver),
+    // they're drawn by the emulated PPU so this doesn't combine with deferred rendering
+    void SetObserver(FrameObserver *observer);
+
+    // tiles, sprites and palettes on screen without drawing anything, works with headless and skipped frames too
+    void GetObservation(PpuObservation &observation);
+
+    // the CPU runs ahead on predicted STAT/LY and PPU interrupts while the deferred renderer's replica runs
+    // the real PPU on its own thread and checks each prediction. a wrong one rolls the CPU, timers, memory
+    // and APU back to where the run started, and it runs again in lockstep. needs deferred rendering and
+    // audio, both are turned on with it
+    void SetSpeculativePpu(bool enable);
+    bool IsSpeculativePpu();
+
+    // prints how often the predictions were wrong and the speedup against lockstep frames, for each title
+    void SetPpuPredictionStats(bool enable);
+
+    // runs rolled back since speculation was turned on, counted from the last report when stats are printed
+    u64 GetPpuRollBacks();
+
     GameBoyModel GetModel() { return _model; }
     inline bool IsCgb() { return _state.isCgb; }
     bool IsBiosEnabled() { return _state.biosEnabled; }
 
     void ExecuteTwoCycles();
+    inline void ExecutePpuCycle();
+    void SyncPpu();
     void Reset();
     void RunCycles(u32 cycles);
     void RunOneFrame();
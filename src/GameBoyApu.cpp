@@ -21,30 +21,32 @@ GameBoyApu::GameBoyApu(GameBoy *gameBoy, IHostSystem *host)
 
     _cycleCount = 0;
     _pendingCycles = 0;
+    _executedCycles = 0;
 
-    _sampleBuffer = new blip_sample_t[OutputBufferSampleSize * 2];
-    memset(_sampleBuffer, 0, sizeof(blip_sample_t) * OutputBufferSampleSize * 2);
+    _sampleBuffer = new s16[OutputBufferSampleSize * 2];
+    memset(_sampleBuffer, 0, sizeof(s16) * OutputBufferSampleSize * 2);
 
     _lastLeftSample = 0;
     _lastRightSample = 0;
 
-    u32 sampleRate = 44100;  // TODO: Get from host
-    u32 clockRate = 4194304;
+    _resamplerQuality = ResamplerQuality::Off;
+    _resample = false;
+    _synthesisEnabled = true;
 
-    // setup Blip Buffers
-    _bufLeft.clear();
-    _bufRight.clear();
+    u32 sampleRate = _host->GetAudioSampleRate();
+    _clockRate = ClockRate;
 
-    _bufLeft.sample_rate(sampleRate);
-    _bufLeft.clock_rate(clockRate);
-    _bufRight.sample_rate(sampleRate);
-    _bufRight.clock_rate(clockRate);
+    ClearSynths();
+    SetSynthSampleRate(sampleRate);
+    SetSynthClockRate(_clockRate);
 
+#ifndef USE_STEP_SYNTH
     // setup Blip synths
     _synthLeft.output(&_bufLeft);
     _synthLeft.volume(0.5);
     _synthRight.output(&_bufRight);
     _synthRight.volume(0.5);
+#endif
 }
 
 GameBoyApu::~GameBoyApu()
@@ -52,82 +54,296 @@ GameBoyApu::~GameBoyApu()
     delete[] _sampleBuffer;
 }
 
+#ifdef USE_STEP_SYNTH
+void GameBoyApu::SetSynthSampleRate(u32 sampleRate)
+{
+    if (_synth.GetSampleRate() != sampleRate)
+    {
+        _synth.SetSampleRate(sampleRate);
+    }
+}
+
+void GameBoyApu::SetSynthClockRate(u32 clockRate)
+{
+    if (_synth.GetClockRate() != clockRate)
+    {
+        _synth.SetClockRate(clockRate);
+    }
+}
+
+void GameBoyApu::ClearSynths()
+{
+    _synth.Clear();
+}
+
+void GameBoyApu::EndSynthFrame(u32 cycles)
+{
+    _synth.EndFrame(cycles);
+}
+
+u32 GameBoyApu::GetSynthSamples()
+{
+    return _synth.GetSamplesAvailable();
+}
+
+u32 GameBoyApu::ReadSynthSamples(s16 *output, u32 frames)
+{
+    return _synth.ReadSamples(output, frames);
+}
+
+void GameBoyApu::RemoveSynthSamples(u32 frames)
+{
+    _synth.RemoveSamples(frames);
+}
+#else
+void GameBoyApu::SetSynthSampleRate(u32 sampleRate)
+{
+    if (_bufLeft.sample_rate() != (long)sampleRate)
+    {
+        _bufLeft.set_sample_rate(sampleRate);
+        _bufRight.set_sample_rate(sampleRate);
+    }
+}
+
+void GameBoyApu::SetSynthClockRate(u32 clockRate)
+{
+    if (_bufLeft.clock_rate() != (long)clockRate)
+    {
+        _bufLeft.clock_rate(clockRate);
+        _bufRight.clock_rate(clockRate);
+    }
+}
+
+void GameBoyApu::ClearSynths()
+{
+    _bufLeft.clear();
+    _bufRight.clear();
+}
+
+void GameBoyApu::EndSynthFrame(u32 cycles)
+{
+    _bufLeft.end_frame(cycles);
+    _bufRight.end_frame(cycles);
+}
+
+u32 GameBoyApu::GetSynthSamples()
+{
+    return _bufLeft.samples_avail();
+}
+
+u32 GameBoyApu::ReadSynthSamples(s16 *output, u32 frames)
+{
+    u32 samplesRead = _bufLeft.read_samples(output, frames, 1);
+    _bufRight.read_samples(output + 1, frames, 1);
+    return samplesRead;
+}
+
+void GameBoyApu::RemoveSynthSamples(u32 frames)
+{
+    _bufLeft.remove_samples(frames);
+    _bufRight.remove_samples(frames);
+}
+#endif
+
 s16 maxSample = 0;
 
-void GameBoyApu::Execute()
+void GameBoyApu::ExecutePending()
 {
+    _executedCycles += _pendingCycles;
+
     if (!_state.masterEnable)
     {
         // apu is disabled, just eat cycles
         _cycleCount += _pendingCycles;
         _pendingCycles = 0;
     }
-    else
+    else if (!_synthesisEnabled && (_pendingCycles > 0))
+    {
+        ExecuteSilent(_pendingCycles);
+        _cycleCount += _pendingCycles;
+        _pendingCycles = 0;
+    }
+    else if (_pendingCycles > 0)
     {
-        while (_pendingCycles > 0)
+        // registers and envelopes only change between calls, pick up what changed since the last one
+        MixOutputs();
+
+        // the rest of the span only has the channels' own edges, which they send to the synths directly
+        s32 leftVolume = (((_state.masterVolume >> 4) & 0x07) + 1) * 40;
+        s32 rightVolume = ((_state.masterVolume & 0x07) + 1) * 40;
+        u32 cycles = _pendingCycles;
+
+        if (_square0->IsAudible() && (_state.outputEnable & 0x11))
         {
-            u32 step = std::min({
-                _pendingCycles,
-                (s32)_square0->GetTimer(),
-                (s32)_square1->GetTimer(),
-                (s32)_wave->GetTimer(),
-                (s32)_noise->GetTimer()
-            });
-
-            if (step == 0)
-            {
-                step = 1;
-            }
+            _square0->Synthesize(_cycleCount, cycles,
+                (_state.outputEnable & 0x10) ? leftVolume : 0,
+                (_state.outputEnable & 0x01) ? rightVolume : 0);
+        }
+        else
+        {
+            _square0->Execute(cycles);
+        }
 
-            _pendingCycles -= step;
+        if (_square1->IsAudible() && (_state.outputEnable & 0x22))
+        {
+            _square1->Synthesize(_cycleCount, cycles,
+                (_state.outputEnable & 0x20) ? leftVolume : 0,
+                (_state.outputEnable & 0x02) ? rightVolume : 0);
+        }
+        else
+        {
+            _square1->Execute(cycles);
+        }
 
-            _square0->Execute(step);
-            _square1->Execute(step);
-            _wave->Execute(step);
-            _noise->Execute(step);
+        if (_wave->IsAudible() && (_state.outputEnable & 0x44))
+        {
+            _wave->Synthesize(_cycleCount, cycles,
+                (_state.outputEnable & 0x40) ? leftVolume : 0,
+                (_state.outputEnable & 0x04) ? rightVolume : 0);
+        }
+        else
+        {
+            _wave->Execute(cycles);
+        }
 
-            s16 leftSample = 0, rightSample = 0;
+        if (_noise->IsAudible() && (_state.outputEnable & 0x88))
+        {
+            _noise->Synthesize(_cycleCount, cycles,
+                (_state.outputEnable & 0x80) ? leftVolume : 0,
+                (_state.outputEnable & 0x08) ? rightVolume : 0);
+        }
+        else
+        {
+            _noise->Execute(cycles);
+        }
 
-            leftSample += (_state.outputEnable & 0x10) ? _square0->GetOutput() : 0;
-            leftSample += (_state.outputEnable & 0x20) ? _square1->GetOutput() : 0;
-            leftSample += (_state.outputEnable & 0x40) ? _wave->GetOutput() : 0;
-            leftSample += (_state.outputEnable & 0x80) ? _noise->GetOutput() : 0;
-            leftSample *= (((_state.masterVolume >> 4) & 0x07) + 1) * 40;
+        _cycleCount += cycles;
+        _pendingCycles = 0;
+    }
+}
 
-            rightSample += (_state.outputEnable & 0x01) ? _square0->GetOutput() : 0;
-            rightSample += (_state.outputEnable & 0x02) ? _square1->GetOutput() : 0;
-            rightSample += (_state.outputEnable & 0x04) ? _wave->GetOutput() : 0;
-            rightSample += (_state.outputEnable & 0x08) ? _noise->GetOutput() : 0;
-            rightSample *= ((_state.masterVolume & 0x07) + 1) * 40;
+void GameBoyApu::Execute()
+{
+    ExecutePending();
 
-            // send any delta samples to Blip synth
-            if (_lastLeftSample != leftSample)
-            {
-                _synthLeft.offset_inline(_cycleCount, leftSample - _lastLeftSample);
-                _lastLeftSample = leftSample;
-            }
-            if (_lastRightSample != rightSample)
+    if ((_cycleCount >= 20000) && !_synthesisEnabled)
+    {
+        // nothing was sent to the buffers, there's no audio frame to end
+        _cycleCount = 0;
+    }
+    else if (_cycleCount >= 20000)
+    {
+        EndSynthFrame(_cycleCount);
+
+        if (_resample)
+        {
+            u32 samplesRead = ReadSynthSamples(_sampleBuffer, OutputBufferSampleSize);
+
+            u32 frames = _resampler.GetMaxOutputFrames(samplesRead);
+            s16 *output = _host->BeginAudioWrite(frames);
+            _host->EndAudioWrite(_resampler.Process(_sampleBuffer, samplesRead, output, frames));
+        }
+        else
+        {
+            // read straight into the host's queue, if it's full the rest of the frame is dropped
+            u32 samplesAvailable = GetSynthSamples();
+            u32 frames = samplesAvailable;
+            s16 *output = _host->BeginAudioWrite(frames);
+
+            ReadSynthSamples(output, frames);
+            _host->EndAudioWrite(frames);
+
+            if (frames < samplesAvailable)
             {
-                _synthRight.offset_inline(_cycleCount, rightSample - _lastRightSample);
-                _lastRightSample = rightSample;
+                RemoveSynthSamples(samplesAvailable - frames);
             }
-
-           _cycleCount += step;
         }
+
+        _cycleCount = 0;
+        SetSynthClockRate(_clockRate);
     }
+}
 
-    if (_cycleCount >= 20000)
-    {
-        _bufLeft.end_frame(_cycleCount);
-        _bufRight.end_frame(_cycleCount);
+void GameBoyApu::SetResamplerQuality(ResamplerQuality quality)
+{
+    u32 hostRate = _host->GetAudioSampleRate();
+    _resamplerQuality = quality;
+    _resample = (quality != ResamplerQuality::Off) && (hostRate != ResamplerInputRate);
 
-        u32 samplesRead = _bufLeft.read_samples(_sampleBuffer, OutputBufferSampleSize, 1);
-        _bufRight.read_samples(_sampleBuffer + 1, OutputBufferSampleSize, 1);
+    SetSynthSampleRate(_resample ? ResamplerInputRate : hostRate);
 
-        _host->QueueAudio(_sampleBuffer, samplesRead);
+    if (_resample)
+    {
+        _resampler.Configure(ResamplerInputRate, hostRate, quality, OutputBufferSampleSize);
+    }
+}
 
-        _cycleCount = 0;
+void GameBoyApu::SetSynthesisEnabled(bool enabled)
+{
+    if (enabled && !_synthesisEnabled)
+    {
+        // the buffers start over from silence, the first mix sends the whole current output
+        ClearSynths();
+        _lastLeftSample = 0;
+        _lastRightSample = 0;
     }
+    _synthesisEnabled = enabled;
+}
+
+void GameBoyApu::ExecuteSilent(u32 cycles)
+{
+    _square0->UpdateOutput();
+    _square1->UpdateOutput();
+    _wave->UpdateOutput();
+    _noise->UpdateOutput();
+
+    _square0->Execute(cycles);
+    _square1->Execute(cycles);
+    _wave->Execute(cycles);
+    _noise->Execute(cycles);
+
+    // synthesis leaves the output of a channel that's heard at its last edge, keep the saved state the same
+    if (_square0->IsAudible() && (_state.outputEnable & 0x11))
+    {
+        _square0->UpdateOutput();
+    }
+    if (_square1->IsAudible() && (_state.outputEnable & 0x22))
+    {
+        _square1->UpdateOutput();
+    }
+    if (_wave->IsAudible() && (_state.outputEnable & 0x44))
+    {
+        _wave->UpdateOutput();
+    }
+    if (_noise->IsAudible() && (_state.outputEnable & 0x88))
+    {
+        _noise->UpdateOutput();
+    }
+}
+
+void GameBoyApu::MixOutputs()
+{
+    _square0->UpdateOutput();
+    _square1->UpdateOutput();
+    _wave->UpdateOutput();
+    _noise->UpdateOutput();
+
+    s16 leftSample = 0, rightSample = 0;
+
+    leftSample += (_state.outputEnable & 0x10) ? _square0->GetOutput() : 0;
+    leftSample += (_state.outputEnable & 0x20) ? _square1->GetOutput() : 0;
+    leftSample += (_state.outputEnable & 0x40) ? _wave->GetOutput() : 0;
+    leftSample += (_state.outputEnable & 0x80) ? _noise->GetOutput() : 0;
+    leftSample *= (((_state.masterVolume >> 4) & 0x07) + 1) * 40;
+
+    rightSample += (_state.outputEnable & 0x01) ? _square0->GetOutput() : 0;
+    rightSample += (_state.outputEnable & 0x02) ? _square1->GetOutput() : 0;
+    rightSample += (_state.outputEnable & 0x04) ? _wave->GetOutput() : 0;
+    rightSample += (_state.outputEnable & 0x08) ? _noise->GetOutput() : 0;
+    rightSample *= ((_state.masterVolume & 0x07) + 1) * 40;
+
+    // send any delta samples to the synths
+    AddOutputDelta(_cycleCount, leftSample - _lastLeftSample, rightSample - _lastRightSample);
 }
 
 void GameBoyApu::TimerTick()
@@ -170,7 +386,7 @@ u8 GameBoyApu::ReadRegister(u16 addr)
     std::cout << "read_apu: " << std::hex << int(addr) << std::endl;
 #endif
 
-    Execute();
+    ExecutePending();
 
     switch (addr)
     {
@@ -329,7 +545,7 @@ void GameBoyApu::WriteRegister(u16 addr, u8 val)
     }
 }
 
-void GameBoyApu::LoadState(std::ifstream &inState)
+void GameBoyApu::LoadState(std::istream &inState)
 {
     inState.read((char *)&_state, sizeof(ApuState));
     inState.read((char *)&_pendingCycles, sizeof(_pendingCycles));
@@ -341,7 +557,7 @@ void GameBoyApu::LoadState(std::ifstream &inState)
     _noise->LoadState(inState);
 }
 
-void GameBoyApu::SaveState(std::ofstream &outState)
+void GameBoyApu::SaveState(std::ostream &outState)
 {
     outState.write((char *)&_state, sizeof(ApuState));
     outState.write((char *)&_pendingCycles, sizeof(_pendingCycles));
@@ -351,4 +567,16 @@ void GameBoyApu::SaveState(std::ofstream &outState)
     _square1->SaveState(outState);
     _wave->SaveState(outState);
     _noise->SaveState(outState);
-}
\ No newline at end of file
+}
+
+void GameBoyApu::LoadCheckpoint(std::istream &inState)
+{
+    LoadState(inState);
+    inState.read((char *)&_executedCycles, sizeof(_executedCycles));
+}
+
+void GameBoyApu::SaveCheckpoint(std::ostream &outState)
+{
+    SaveState(outState);
+    outState.write((char *)&_executedCycles, sizeof(_executedCycles));
+}
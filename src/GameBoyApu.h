@@ -5,7 +5,12 @@
 #include "GameBoyNoiseChannel.h"
 #include "GameBoySquareChannel.h"
 #include "GameBoyWaveChannel.h"
+#include "AudioResampler.h"
+#ifdef USE_STEP_SYNTH
+#include "StepSynth.h"
+#else
 #include "Blip_Buffer.h"
+#endif
 #include <memory>
 #include <iostream>
 #include <fstream>
@@ -13,6 +18,22 @@
 
 class GameBoy;
 
+// what the APU was doing when it reaches the audio thread's log (see DeferredApu)
+namespace ApuLogType
+{
+    enum ApuLogType : u8
+    {
+        Register,
+        TimerTick,
+        Execute, // end of an emulated frame
+        RateAdjustment, // value holds the adjusted clock rate
+        Resampler,
+        Synthesis,
+        SynthQuality, // StepSynth builds only
+        Sync, // catch up and report back
+    };
+}
+
 struct ApuState
 {
     // Bit 0-2: Right Channel Volume
@@ -41,6 +62,10 @@ class GameBoyApu
 {
 private:
     static constexpr u32 OutputBufferSampleSize = 4096;
+    static constexpr u32 ClockRate = 4194304;
+
+    // rate the synths run at when the resampler converts to the host's rate
+    static constexpr u32 ResamplerInputRate = 44100;
 
     GameBoy *_gameBoy;
     IHostSystem *_host;
@@ -54,33 +79,119 @@ private:
 
     s32 _pendingCycles;
     u32 _cycleCount;
+    u64 _executedCycles; // cycles executed since this instance was created, not part of the saved state
 
-    blip_sample_t *_sampleBuffer;
+    // clock rate the buffers switch to at the end of the current frame (see SetRateAdjustment)
+    u32 _clockRate;
+
+    s16 *_sampleBuffer; // what the resampler converts, otherwise samples go straight to the host
 
     // used for delta calculations
     u16 _lastLeftSample;
     u16 _lastRightSample;
 
+#ifdef USE_STEP_SYNTH
+    StepSynth _synth;
+#else
     Blip_Buffer _bufLeft;
     Blip_Buffer _bufRight;
 
     // band-limited synths
     Blip_Synth<blip_good_quality,32767> _synthLeft;
     Blip_Synth<blip_good_quality,32767> _synthRight;
+#endif
+
+    AudioResampler _resampler;
+    ResamplerQuality _resamplerQuality;
+    bool _resample;
+
+    bool _synthesisEnabled;
+
+    // mixes the channel outputs at the current cycle and sends the change to the synths
+    void MixOutputs();
+
+    // steps the channels without synthesizing anything
+    void ExecuteSilent(u32 cycles);
+
+    // runs the pending cycles and leaves the audio frame open, reads use it so frames only end where
+    // the audio thread's replica also executes (writes, timer ticks and the end of emulated frames)
+    void ExecutePending();
+
+    // the buffers both synths are read from, stereo interleaved
+    void SetSynthSampleRate(u32 sampleRate);
+    void SetSynthClockRate(u32 clockRate);
+    void ClearSynths();
+    void EndSynthFrame(u32 cycles);
+    u32 GetSynthSamples();
+    u32 ReadSynthSamples(s16 *output, u32 frames);
+    void RemoveSynthSamples(u32 frames);
 public:
     GameBoyApu(GameBoy *gameBoy, IHostSystem *host);
     ~GameBoyApu();
 
     void AddCycles(s32 cycles) { _pendingCycles += cycles; }
+    u64 GetCycleCount() { return _executedCycles + _pendingCycles; }
+
+    // scales the clock rate the output is resampled from, from the host's dynamic rate control.
+    // takes effect at the end of the current audio frame so the cycles already in the buffers keep their timing
+    void SetRateAdjustment(double ratio) { _clockRate = (u32)(ClockRate * ratio + 0.5); }
+
+    // the clock rate the adjustment ended up at, the audio thread's replica takes it as is (see DeferredApu)
+    u32 GetAdjustedClockRate() { return _clockRate; }
+    void SetAdjustedClockRate(u32 clockRate) { _clockRate = clockRate; }
+
+    // with a resampler the synths run at a fixed rate and it converts their output to the host's rate,
+    // otherwise they synthesize at the host's rate directly. changing it drops the audio not queued yet
+    ResamplerQuality GetResamplerQuality() { return _resamplerQuality; }
+    void SetResamplerQuality(ResamplerQuality quality);
+
+    // without synthesis only what software can see is kept up: the channels' timers, lengths, sweep and
+    // wave position still run (in closed form), nothing is mixed, resampled or queued to the host
+    bool IsSynthesisEnabled() { return _synthesisEnabled; }
+    void SetSynthesisEnabled(bool enabled);
+
+#ifdef USE_STEP_SYNTH
+    // width of the band-limited steps, takes effect with the next change in output
+    StepSynthQuality GetSynthQuality() { return _synth.GetQuality(); }
+    void SetSynthQuality(StepSynthQuality quality) { _synth.SetQuality(quality); }
+#endif
 
     bool IsEnabled() { return _state.masterEnable; }
 
     void Execute();
     void TimerTick();
 
+    // a channel's output changed by delta at this cycle, scaled by the channel's stereo routing and master volume
+    inline void AddOutputDelta(u32 cycle, s32 left, s32 right)
+    {
+#ifdef USE_STEP_SYNTH
+        if ((left | right) != 0)
+        {
+            _synth.AddDelta(cycle, left, right);
+            _lastLeftSample += left;
+            _lastRightSample += right;
+        }
+#else
+        if (left != 0)
+        {
+            _synthLeft.offset_inline(cycle, left);
+            _lastLeftSample += left;
+        }
+        if (right != 0)
+        {
+            _synthRight.offset_inline(cycle, right);
+            _lastRightSample += right;
+        }
+#endif
+    }
+
     u8 ReadRegister(u16 addr);
     void WriteRegister(u16 addr, u8 val);
 
-    void LoadState(std::ifstream &inState);
-    void SaveState(std::ofstream &outState);
+    void LoadState(std::istream &inState);
+    void SaveState(std::ostream &outState);
+
+    // saved state with the executed cycles, which the log to the audio thread is timed by (see DeferredApu)
+    void LoadCheckpoint(std::istream &inState);
+    void SaveCheckpoint(std::ostream &outState);
 };
\ No newline at end of file
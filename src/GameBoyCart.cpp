@@ -165,6 +165,7 @@ void GameBoyCart::LoadState(std::ifstream &inState)
     {
         inState.read((char *)_cartRam, _header.GetRamSize());
     }
+    LoadRegisters(inState);
 }
 
 void GameBoyCart::SaveState(std::ofstream &outState)
@@ -173,6 +174,7 @@ void GameBoyCart::SaveState(std::ofstream &outState)
     {
         outState.write((char *)_cartRam, _header.GetRamSize());
     }
+    SaveRegisters(outState);
 }
 
 void GameBoyCartMbc1::Reset()
@@ -250,18 +252,16 @@ void GameBoyCartMbc1::WriteRegister(u16 addr, u8 val)
     RefreshMemoryMap();
 }
 
-void GameBoyCartMbc1::LoadState(std::ifstream &inState)
+void GameBoyCartMbc1::LoadRegisters(std::istream &inState)
 {
-    GameBoyCart::LoadState(inState);
     inState.read((char*)&_ramGate, sizeof(bool));
     inState.read((char*)&_bank1, sizeof(u8));
     inState.read((char*)&_bank2, sizeof(u8));
     inState.read((char*)&_mode, sizeof(u8));
 }
 
-void GameBoyCartMbc1::SaveState(std::ofstream &outState)
+void GameBoyCartMbc1::SaveRegisters(std::ostream &outState)
 {
-    GameBoyCart::SaveState(outState);
     outState.write((char*)&_ramGate, sizeof(bool));
     outState.write((char*)&_bank1, sizeof(u8));
     outState.write((char*)&_bank2, sizeof(u8));
@@ -346,16 +346,14 @@ void GameBoyCartMbc2::WriteRegister(u16 addr, u8 val)
     RefreshMemoryMap();
 }
 
-void GameBoyCartMbc2::LoadState(std::ifstream &inState)
+void GameBoyCartMbc2::LoadRegisters(std::istream &inState)
 {
-    GameBoyCart::LoadState(inState);
     inState.read((char*)&_ramGate, sizeof(bool));
     inState.read((char*)&_romBank, sizeof(u8));
 }
 
-void GameBoyCartMbc2::SaveState(std::ofstream &outState)
+void GameBoyCartMbc2::SaveRegisters(std::ostream &outState)
 {
-    GameBoyCart::SaveState(outState);
     outState.write((char*)&_ramGate, sizeof(bool));
     outState.write((char*)&_romBank, sizeof(u8));
 }
@@ -435,17 +433,15 @@ void GameBoyCartMbc3::WriteRegister(u16 addr, u8 val)
     RefreshMemoryMap();
 }
 
-void GameBoyCartMbc3::LoadState(std::ifstream &inState)
+void GameBoyCartMbc3::LoadRegisters(std::istream &inState)
 {
-    GameBoyCart::LoadState(inState);
     inState.read((char*)&_ramGate, sizeof(bool));
     inState.read((char*)&_romBank, sizeof(u8));
     inState.read((char*)&_ramBank, sizeof(u8));
 }
 
-void GameBoyCartMbc3::SaveState(std::ofstream &outState)
+void GameBoyCartMbc3::SaveRegisters(std::ostream &outState)
 {
-    GameBoyCart::SaveState(outState);
     outState.write((char*)&_ramGate, sizeof(bool));
     outState.write((char*)&_romBank, sizeof(u8));
     outState.write((char*)&_ramBank, sizeof(u8));
@@ -523,17 +519,15 @@ void GameBoyCartMbc5::WriteRegister(u16 addr, u8 val)
     RefreshMemoryMap();
 }
 
-void GameBoyCartMbc5::LoadState(std::ifstream &inState)
+void GameBoyCartMbc5::LoadRegisters(std::istream &inState)
 {
-    GameBoyCart::LoadState(inState);
     inState.read((char*)&_ramGate, sizeof(bool));
     inState.read((char*)&_romBank, sizeof(u16));
     inState.read((char*)&_ramBank, sizeof(u8));
 }
 
-void GameBoyCartMbc5::SaveState(std::ofstream &outState)
+void GameBoyCartMbc5::SaveRegisters(std::ostream &outState)
 {
-    GameBoyCart::SaveState(outState);
     outState.write((char*)&_ramGate, sizeof(bool));
     outState.write((char*)&_romBank, sizeof(u16));
     outState.write((char*)&_ramBank, sizeof(u8));
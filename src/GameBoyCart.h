@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstring>
 #include <fstream>
 #include <string>
 #include "shared.h"
@@ -178,8 +179,14 @@ public:
     void LoadSaveRam();
     void WriteSaveRam();
 
-    virtual void LoadState(std::ifstream &inState);
-    virtual void SaveState(std::ofstream &outState);
+    void LoadState(std::ifstream &inState);
+    void SaveState(std::ofstream &outState);
+
+    // mapper registers without the RAM, also kept in a speculative run's checkpoint (see GameBoy::SetSpeculativePpu)
+    virtual void LoadRegisters(std::istream &) {}
+    virtual void SaveRegisters(std::ostream &) {}
+
+    std::string GetTitle() { return std::string((const char *)_header.title, strnlen((const char *)_header.title, sizeof(_header.title))); }
 
     ModelSupport GetColorGameBoySupport()
     {
@@ -223,8 +230,8 @@ public:
     u8 ReadRegister(u16 addr) override;
     void WriteRegister(u16 addr, u8 val) override;
 
-    void LoadState(std::ifstream &inState) override;
-    void SaveState(std::ofstream &outState) override;
+    void LoadRegisters(std::istream &inState) override;
+    void SaveRegisters(std::ostream &outState) override;
 };
 
 class GameBoyCartMbc2 : public GameBoyCart
@@ -250,8 +257,8 @@ public:
     u8 ReadRegister(u16 addr) override;
     void WriteRegister(u16 addr, u8 val) override;
 
-    void LoadState(std::ifstream &inState) override;
-    void SaveState(std::ofstream &outState) override;
+    void LoadRegisters(std::istream &inState) override;
+    void SaveRegisters(std::ostream &outState) override;
 };
 
 class GameBoyCartMbc3 : public GameBoyCart
@@ -279,8 +286,8 @@ public:
     u8 ReadRegister(u16 addr) override;
     void WriteRegister(u16 addr, u8 val) override;
 
-    void LoadState(std::ifstream &inState) override;
-    void SaveState(std::ofstream &outState) override;
+    void LoadRegisters(std::istream &inState) override;
+    void SaveRegisters(std::ostream &outState) override;
 };
 
 class GameBoyCartMbc5 : public GameBoyCart
@@ -308,6 +315,6 @@ public:
     u8 ReadRegister(u16 addr) override;
     void WriteRegister(u16 addr, u8 val) override;
 
-    void LoadState(std::ifstream &inState) override;
-    void SaveState(std::ofstream &outState) override;
+    void LoadRegisters(std::istream &inState) override;
+    void SaveRegisters(std::ostream &outState) override;
 };
\ No newline at end of file
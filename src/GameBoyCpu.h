@@ -111,6 +111,9 @@ public:
     void LoadState(std::ifstream &inState);
     void SaveState(std::ofstream &outState);
 
+    const CpuState &GetState() { return _state; }
+    void SetState(const CpuState &state) { _state = state; }
+
     inline u8 Read(u16 addr);
     inline u8 ReadImm();
     inline u16 ReadImmWord();
@@ -1,10 +1,25 @@
 #include "GameBoyNoiseChannel.h"
+#include "GameBoyApu.h"
 #include <iostream>
 
+bool GameBoyNoiseChannel::_tablesBuilt = false;
+u16 GameBoyNoiseChannel::_longStates[LongLength];
+u16 GameBoyNoiseChannel::_longPositions[0x8000];
+u8 GameBoyNoiseChannel::_longRuns[LongLength];
+u16 GameBoyNoiseChannel::_shortStates[ShortLength];
+u8 GameBoyNoiseChannel::_shortPositions[0x80];
+u8 GameBoyNoiseChannel::_shortRuns[ShortLength];
+
 GameBoyNoiseChannel::GameBoyNoiseChannel(GameBoyApu *apu)
 {
     _apu = apu;
     _state = {};
+
+    if (!_tablesBuilt)
+    {
+        BuildTables();
+        _tablesBuilt = true;
+    }
 }
 
 GameBoyNoiseChannel::~GameBoyNoiseChannel()
@@ -24,44 +39,186 @@ void GameBoyNoiseChannel::SetEnabled(bool val)
     _state.enabled = val;
 }
 
-void GameBoyNoiseChannel::Execute(u32 cycles)
+void GameBoyNoiseChannel::UpdateOutput()
 {
     // https://gbdev.gg8.se/wiki/articles/Gameboy_sound_hardware
     // "Using a noise channel clock shift of 14 or 15 results in the LFSR receiving no clocks.""
-	if (_state.shiftFrequency >= 14) {
-		return;
-	}
-
-	if (_state.enabled)
+    if (_state.shiftFrequency >= 14)
     {
-		_state.output = ((_state.shiftRegister & 0x01) ^ 0x01) * _state.volume;
+        return;
+    }
 
-        //std::cout << std::dec << "output=" << int(_state.output) << std::endl;
-        //std::cout << std::dec << "shiftRegister=" << int(_state.shiftRegister) << std::endl;
-	}
+    if (_state.enabled)
+    {
+        _state.output = ((_state.shiftRegister & 0x01) ^ 0x01) * _state.volume;
+    }
     else
     {
-		_state.output = 0;
-	}
+        _state.output = 0;
+    }
+}
+
+void GameBoyNoiseChannel::Execute(u32 cycles)
+{
+    if (_state.shiftFrequency >= 14)
+    {
+        return;
+    }
+
+    u32 remaining = GetRemainingCycles();
+    if (cycles < remaining)
+    {
+        _state.timer = remaining - cycles;
+        return;
+    }
+
+    // the reload value is 16 bits, so periods of 64K cycles and up wrap around
+    cycles -= remaining;
+    ResetTimer();
+    u32 period = GetRemainingCycles();
+    u32 steps = 1 + (cycles / period);
+
+    _state.timer = period - (cycles % period);
+    Shift(steps);
+}
+
+void GameBoyNoiseChannel::Synthesize(u32 cycle, u32 cycles, s32 leftVolume, s32 rightVolume)
+{
+    u32 remaining = GetRemainingCycles();
+    if (cycles < remaining)
+    {
+        _state.timer = remaining - cycles;
+        return;
+    }
+
+    ResetTimer();
+    u32 period = GetRemainingCycles();
+    u32 steps = 1 + ((cycles - remaining) / period);
+
+    // bit 0 only depends on the position in the sequence, jump from one change of it to the next
+    const u16 *states = _state.useShortStep ? _shortStates : _longStates;
+    const u8 *runs = _state.useShortStep ? _shortRuns : _longRuns;
+    u32 length = _state.useShortStep ? ShortLength : LongLength;
+    u16 value = _state.useShortStep ? (_state.shiftRegister & 0x7F) : _state.shiftRegister;
+
+    if (value != 0) // stuck at 0 otherwise
+    {
+        u32 position = _state.useShortStep ? _shortPositions[value] : _longPositions[value];
+        u32 stepsDone = 0;
+
+        while (true)
+        {
+            u32 distance = runs[position];
+            if ((stepsDone + distance) > steps)
+            {
+                break;
+            }
 
-    _state.timer -= cycles;
-    if (_state.timer == 0)
+            stepsDone += distance;
+            position += distance;
+            position = (position >= length) ? (position - length) : position;
+
+            // the LFSR shifts at cycle + remaining and every period after that
+            s8 output = ((states[position] & 0x01) ^ 0x01) * _state.volume;
+            s32 delta = output - _state.output;
+            _apu->AddOutputDelta(cycle + remaining + (stepsDone - 1) * period, delta * leftVolume, delta * rightVolume);
+            _state.output = output;
+        }
+    }
+
+    _state.timer = period - ((cycles - remaining) % period);
+    Shift(steps);
+}
+
+void GameBoyNoiseChannel::Shift(u32 count)
+{
+    _state.shiftRegister = Advance(_state.shiftRegister, _state.useShortStep, count);
+}
+
+u16 GameBoyNoiseChannel::Advance(u16 shiftRegister, bool useShortStep, u32 count)
+{
+    if (!useShortStep)
     {
-        ResetTimer();
+        return (shiftRegister != 0) ?
+            _longStates[(_longPositions[shiftRegister] + (count % LongLength)) % LongLength] :
+            0;
+    }
+    else if (count >= 8)
+    {
+        // the bits above the low 7 were all shifted in since short mode was selected
+        u8 low = shiftRegister & 0x7F;
+        return (low != 0) ?
+            _shortStates[(_shortPositions[low] + (count % ShortLength)) % ShortLength] :
+            0;
+    }
 
-        // When clocked by the frequency timer, the low two bits (0 and 1) are XORed,
-        // all bits are shifted right by one, and the result of the XOR is put into
-        // the now-empty high bit.
-        u16 allShiftedRight = _state.shiftRegister >> 1;
-	    u8 lowXorBits = (_state.shiftRegister & 0x01) ^ (allShiftedRight & 0x01);
-		_state.shiftRegister = (lowXorBits << 14) | allShiftedRight;
+    while (count-- > 0)
+    {
+        shiftRegister = ShiftOnce(shiftRegister, true);
+    }
+    return shiftRegister;
+}
+
+u16 GameBoyNoiseChannel::ShiftOnce(u16 shiftRegister, bool useShortStep)
+{
+    // When clocked by the frequency timer, the low two bits (0 and 1) are XORed,
+    // all bits are shifted right by one, and the result of the XOR is put into
+    // the now-empty high bit.
+    u16 allShiftedRight = shiftRegister >> 1;
+    u8 lowXorBits = (shiftRegister & 0x01) ^ (allShiftedRight & 0x01);
+    shiftRegister = (lowXorBits << 14) | allShiftedRight;
 
-        if (_state.useShortStep)
+    if (useShortStep)
+    {
+        // If width mode is 1 (NR43), the XOR result is ALSO put into bit 6 AFTER the shift, resulting in a 7-bit LFSR.
+        shiftRegister &= ~0x40;
+        shiftRegister |= (lowXorBits << 6);
+    }
+
+    return shiftRegister;
+}
+
+void GameBoyNoiseChannel::BuildTables()
+{
+    u16 shiftRegister = 0x7FFF;
+    for (u32 i = 0; i < LongLength; i++)
+    {
+        _longStates[i] = shiftRegister;
+        _longPositions[shiftRegister] = i;
+        shiftRegister = ShiftOnce(shiftRegister, false);
+    }
+
+    // after 8 shifts the whole register follows from the low 7 bits
+    shiftRegister = 0x7F;
+    for (u32 i = 0; i < 8; i++)
+    {
+        shiftRegister = ShiftOnce(shiftRegister, true);
+    }
+    for (u32 i = 0; i < ShortLength; i++)
+    {
+        _shortStates[i] = shiftRegister;
+        _shortPositions[shiftRegister & 0x7F] = i;
+        shiftRegister = ShiftOnce(shiftRegister, true);
+    }
+
+    // sequences are cyclic, so runs can wrap around the end
+    for (u32 i = 0; i < LongLength; i++)
+    {
+        u32 run = 1;
+        while (((_longStates[(i + run) % LongLength] ^ _longStates[i]) & 0x01) == 0)
+        {
+            run++;
+        }
+        _longRuns[i] = run;
+    }
+    for (u32 i = 0; i < ShortLength; i++)
+    {
+        u32 run = 1;
+        while (((_shortStates[(i + run) % ShortLength] ^ _shortStates[i]) & 0x01) == 0)
         {
-			// If width mode is 1 (NR43), the XOR result is ALSO put into bit 6 AFTER the shift, resulting in a 7-bit LFSR.
-			_state.shiftRegister &= ~0x40;
-			_state.shiftRegister |= (lowXorBits << 6);
+            run++;
         }
+        _shortRuns[i] = run;
     }
 }
 
@@ -190,12 +347,12 @@ void GameBoyNoiseChannel::WriteRegister(u16 addr, u8 val)
     }
 }
 
-void GameBoyNoiseChannel::LoadState(std::ifstream &inState)
+void GameBoyNoiseChannel::LoadState(std::istream &inState)
 {
     inState.read((char *)&_state, sizeof(NoiseChannelState));
 }
 
-void GameBoyNoiseChannel::SaveState(std::ofstream &outState)
+void GameBoyNoiseChannel::SaveState(std::ostream &outState)
 {
     outState.write((char *)&_state, sizeof(NoiseChannelState));
 }
\ No newline at end of file
@@ -53,24 +53,55 @@ private:
     NoiseChannelState _state;
     GameBoyApu *_apu;
 
+    // LFSR sequences, shared by all instances and built by the first one. Long mode starts at 0x7FFF and
+    // goes through all 32767 non-zero states. Short mode only feeds back into the low 7 bits, which go
+    // through all 127 non-zero values, and after 8 shifts the whole register follows from them.
+    static constexpr u32 LongLength = 32767;
+    static constexpr u32 ShortLength = 127;
+    static bool _tablesBuilt;
+    static u16 _longStates[LongLength];
+    static u16 _longPositions[0x8000];
+    static u8 _longRuns[LongLength]; // shifts until bit 0 changes
+    static u16 _shortStates[ShortLength];
+    static u8 _shortPositions[0x80];
+    static u8 _shortRuns[ShortLength];
+
+    static void BuildTables();
+
     void ResetTimer();
+    void Shift(u32 count);
 public:
     GameBoyNoiseChannel(GameBoyApu *apu);
     ~GameBoyNoiseChannel();
 
+    // the LFSR after count shifts, through the tables the first instance builds. ShiftOnce is a single
+    // shift the way the hardware does it
+    static u16 Advance(u16 shiftRegister, bool useShortStep, u32 count);
+    static u16 ShiftOnce(u16 shiftRegister, bool useShortStep);
+
     inline s8 GetOutput() { return _state.output; }
-    inline u8 GetTimer() { return _state.timer; }
+
+    // cycles until the LFSR shifts, a timer of 0 wraps around first
+    inline u32 GetRemainingCycles() { return _state.timer ? _state.timer : 0x10000; }
+
+    // output can only change when the LFSR shifts while this is true, otherwise it stays where it is
+    inline bool IsAudible() { return _state.enabled && (_state.volume > 0) && (_state.shiftFrequency < 14); }
+    void UpdateOutput();
 
     bool IsEnabled() { return _state.enabled; }
     void SetEnabled(bool val);
 
     void Execute(u32 cycles);
+
+    // same as Execute, but also sends each change in the output to the APU at the cycle it happens,
+    // the output has to be up to date and the channel audible
+    void Synthesize(u32 cycle, u32 cycles, s32 leftVolume, s32 rightVolume);
     void TickCounter();
     void TickVolumeEnvelope();
 
     u8 ReadRegister(u16 addr);
     void WriteRegister(u16 addr, u8 val);
 
-    void LoadState(std::ifstream &inState);
-    void SaveState(std::ofstream &outState);
+    void LoadState(std::istream &inState);
+    void SaveState(std::ostream &outState);
 };
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "GameBoyPpu.h"
 #include "GameBoy.h"
+#include "LineCompositor.h"
+#include "FrameObserver.h"
 
 #include <memory.h>
 #include <iostream>
@@ -15,29 +17,37 @@ GameBoyPpu::GameBoyPpu(GameBoy *gameBoy, IHostSystem *host, u8 *videoRam, u8 *oa
 
     _pixelBuffer = new u32[160 * 144];
     memset(_pixelBuffer, 0, 160 * 144 * sizeof(u32));
+    _byteBuffer = new u8[160 * 144];
+    memset(_byteBuffer, 0, 160 * 144);
+
+    _layerPixels[0] = new u8[256 * 256];
+    _layerPixels[1] = new u8[256 * 256];
+    InvalidateLayers();
 
     _state.scanline = 0;
     _pixelsRendered = 0;
 
-    // build CGB color lookup
-    // Found at https://byuu.net/video/color-emulation/
-    // Original author is unknown
-    for (u32 r = 0; r < 32; r++)
-    for (u32 g = 0; g < 32; g++)
-    for (u32 b = 0; b < 32; b++)
+    // drawing without sprites or window until a line was seen
+    for (u32 i = 0; i < 144; i++)
     {
-        u8 r2 = std::min<u32>((r * 26 + g *  4 + b *  2), 960) >> 2;
-        u8 g2 = std::min<u32>((         g * 24 + b *  8), 960) >> 2;
-        u8 b2 = std::min<u32>((r *  6 + g *  4 + b * 22), 960) >> 2;
-
-        _cgbPal[r][g][b] = (r2 << 24) | (g2 << 16) | (b2 << 8);
+        _lineDrawingEnd[i] = 256;
     }
-    
+
+    memset(_palColors, 0, sizeof(_palColors));
+    ResolvePaletteBytes();
+
+    // saved with the state, but only filled in once an OAM search finds a sprite
+    memset(_spriteX, 0, sizeof(_spriteX));
+    memset(_spriteAddr, 0, sizeof(_spriteAddr));
+    _fetchOamAddr = 0;
 }
 
 GameBoyPpu::~GameBoyPpu()
 {
     delete[] _pixelBuffer;
+    delete[] _byteBuffer;
+    delete[] _layerPixels[0];
+    delete[] _layerPixels[1];
 }
 
 void GameBoyPpu::ExecuteCycle()
@@ -45,14 +55,29 @@ void GameBoyPpu::ExecuteCycle()
     // Timing reference: https://github.com/AntonioND/giibiiadvance/blob/master/docs/TCAGBD.pdf
 
     u8 preserveMode = _state.lcdMode;
+    _cycleCount++;
 
     if (!_state.lcdPower)
     {
-        if ((_gameBoy->GetCycleCount() % (154 * 456)) == 0)
+        // keep the host in sync by pushing a frame every time a frame's worth of cycles has passed, counted
+        // in lines like with the LCD on so the tick and the sleep stay within a line
+        _state.tick++;
+        if (_state.sleepCycles > 0)
+        {
+            _state.sleepCycles--;
+            return;
+        }
+
+        _state.tick = 0;
+        _state.sleepCycles = 456 - 1;
+        if (++_state.scanline < 154)
         {
-            _host->SyncAudio();
-            _host->PushVideoFrame(_pixelBuffer);
+            return;
         }
+
+        _state.scanline = 0;
+        _host->SyncAudio();
+        PushVideoFrame(false);
         return;
     }
 
@@ -85,8 +110,11 @@ void GameBoyPpu::ExecuteCycle()
             case 4:
                 _state.lcdMode = LcdModeFlag::OamSearch;
                 _spritesFound = 0;
+                _oamSearchLive = false;
+                _state.sleepCycles = 79; // sleep through OAM search, results are taken from the line's bucket
                 break;
             case 84:
+                FinishOamSearch();
                 _state.lcdMode = LcdModeFlag::Drawing;
                 StartRender();
                 _renderPaused = true;
@@ -95,13 +123,17 @@ void GameBoyPpu::ExecuteCycle()
                 _renderPaused = false;
                 break;
             case 456: // end of scanline
-                _state.sleepCycles = 0;
                 _state.tick = 0;
                 _state.scanline++;
                 if (_state.scanline == 144)
                 {
                     // entering v-blank, LY is updated immediately
                     _state.ly = _state.scanline;
+                    _state.sleepCycles = 3; // sleep until v-blank starts
+                }
+                else
+                {
+                    _state.sleepCycles = 2; // sleep until LY is updated
                 }
                 break;
         }
@@ -116,10 +148,36 @@ void GameBoyPpu::ExecuteCycle()
                 {
                     _state.lcdMode = LcdModeFlag::VBlank;
                     _windowOffset = 0;
-                    _gameBoy->SetInterruptFlags(IrqFlag::VBlank);
+                    if (!_replica)
+                    {
+                        _gameBoy->SetInterruptFlags(IrqFlag::VBlank);
+                    }
+                    else
+                    {
+                        _replicaIrqs |= IrqFlag::VBlank;
+                    }
                     _host->SyncAudio();
-                    _host->PushVideoFrame(_pixelBuffer);
-                    _gameBoy->CheckJoyPadChange();
+                    if (!_skipFrame)
+                    {
+                        // buffer is a complete picture of VRAM/registers if nothing changed while it was drawn
+                        _bufferValid = (_generation == _frameGeneration);
+                        _bufferGeneration = _generation;
+                        PushVideoFrame(_repeatFrame);
+                    }
+                    else if (_deferred && _replicaDrawsFrame)
+                    {
+                        // frame is drawn by the replica, the host presents it at the same point
+                        PushVideoFrame(false);
+                    }
+                    else if (_observer == nullptr)
+                    {
+                        // when deferred the replica skips it too, nothing to wait for
+                        _host->SkipVideoFrame();
+                    }
+                    if (!_replica)
+                    {
+                        _gameBoy->CheckJoyPadChange();
+                    }
                 }
                 break;
             case 12:
@@ -138,10 +196,12 @@ void GameBoyPpu::ExecuteCycle()
                     // exiting v-blank, starting new frame
                     _state.scanline = 0;
                     _state.ly = 0;
+                    StartFrame();
                 }
                 else
                 {
                     _state.ly = _state.scanline;
+                    _state.sleepCycles = 11; // nothing happens until cycle 12 of a v-blank line
                 }
                 break;
         }
@@ -159,14 +219,19 @@ void GameBoyPpu::ExecuteCycle()
         {
             // enter h-blank
             _state.lcdMode = LcdModeFlag::HBlank;
+            if (_keepDrawingEnds)
+            {
+                _lineDrawingEnd[_state.scanline] = _state.tick - (_lineStart.scrollX & 0x07);
+            }
+            FinishRender();
 
-            if (_state.scanline < 143)
+            if ((_state.scanline < 143) && !_replica)
             {
                 _gameBoy->ExecuteCgbHdma();
             }
         }
     }
-    else if (_state.lcdMode == LcdModeFlag::OamSearch)
+    else if ((_state.lcdMode == LcdModeFlag::OamSearch) && _oamSearchLive)
     {
         TickOamSearch();
     }
@@ -188,6 +253,12 @@ void GameBoyPpu::TickBgFetcher()
     switch (_fetcherBg.tick++)
     {
         case 1: // fetch tile
+            if (_timingOnly)
+            {
+                // timing-only frame, fetched data would never be displayed (or is already in the pixel buffer)
+                break;
+            }
+
             if (_insideWindow)
             {
                 tileMapAddr = (_state.lcdControl & 0x40) ? 0x1C00 : 0x1800;
@@ -219,18 +290,24 @@ void GameBoyPpu::TickBgFetcher()
             break;
 
         case 3: // fetch first tile data byte
-            _fetcherBg.tileData0 = _videoRam[_fetcherBg.tileSetAddr];
+            if (!_timingOnly)
+            {
+                _fetcherBg.tileData0 = _videoRam[_fetcherBg.tileSetAddr];
+            }
             break;
 
         case 5: // fetch second tile data byte
-            _fetcherBg.tileData1 = _videoRam[_fetcherBg.tileSetAddr + 1];
+            if (!_timingOnly)
+            {
+                _fetcherBg.tileData1 = _videoRam[_fetcherBg.tileSetAddr + 1];
+            }
             // fall through
 
         case 6:
         case 7:
             if (_fifoBg.length == 0) // is FIFO ready for new data?
             {
-                for (int i = 0; i < 8; i++)
+                for (int i = 0; !_timingOnly && (i < 8); i++)
                 {
                     u8 x = (_fetcherBg.attributes & 0x20) ? i : (7 - i);
                     _fifoBg.data[i].color =
@@ -254,6 +331,8 @@ void GameBoyPpu::TickBgFetcher()
 
 void GameBoyPpu::TickDrawing()
 {
+    _drawTicks++;
+
     // did drawing transition over the BG/window boundary?
     if (_windowEnable &&
         !_insideWindow &&
@@ -290,46 +369,20 @@ void GameBoyPpu::TickDrawing()
 
     if (_fifoBg.length > 0 && _fetchNextSprite)
     {
-        // have entered visible area?
-        if (_pixelsRendered >= 0)
+        // have entered visible area? (skipped and repeated frames leave the pixel buffer alone)
+        if ((_pixelsRendered >= 0) && !_timingOnly)
         {
-            u16 bufferOffset = _state.scanline * 160 + _pixelsRendered;
-            u8 bgColorIndex = _fifoBg.data[_fifoBg.position].color;
-            u8 bgAttributes = _fifoBg.data[_fifoBg.position].attributes;
-            u8 spriteColorIndex = _fifoOam.data[_fifoOam.position].color;
-            u8 spriteAttributes = _fifoOam.data[_fifoOam.position].attributes;
-
-            // check if sprite or BG pixel has priority
-            if ((spriteColorIndex != 0) && // sprite pixel is opaque,
-                ((bgColorIndex == 0) || // BG pixel is transparent
-                ((spriteAttributes & 0x80) == 0x0 && (bgAttributes & 0x80) == 0))) // sprite has priority and BG doesn't have priority
+            // mixer was picked for the line instead of testing the model, sprites and format for each pixel
+            switch (_drawMixer)
             {
-                // Sprite pixel has priority
-
-                if (_gameBoy->IsCgb())
-                {
-                    CgbPalEntry color = _state.cgbObjPal[spriteColorIndex | ((spriteAttributes & 0x07) << 2)];
-                    _pixelBuffer[bufferOffset] = _cgbPal[color.r][color.g][color.b];
-                }
-                else
-                {
-                    u8 palette = (spriteAttributes & 0x10) != 0 ? _state.objPal1 : _state.objPal0;
-                    u8 color = (palette >> (spriteColorIndex * 2)) & 0x03;
-                    _pixelBuffer[bufferOffset] = _dmgPal[color];
-                }
-            }
-            else
-            {
-                if (_gameBoy->IsCgb())
-                {
-                    CgbPalEntry color = _state.cgbBgPal[bgColorIndex | ((bgAttributes & 0x07) << 2)];
-                    _pixelBuffer[bufferOffset] = _cgbPal[color.r][color.g][color.b];
-                }
-                else
-                {
-                    u8 color = (_state.bgPal >> (bgColorIndex * 2)) & 0x03;
-                    _pixelBuffer[bufferOffset] = _dmgPal[color];
-                }
+                case 0: MixPixel<false, false, false>(); break;
+                case PpuMixerFlag::Cgb: MixPixel<true, false, false>(); break;
+                case PpuMixerFlag::Sprites: MixPixel<false, true, false>(); break;
+                case PpuMixerFlag::Cgb | PpuMixerFlag::Sprites: MixPixel<true, true, false>(); break;
+                case PpuMixerFlag::Rgba: MixPixel<false, false, true>(); break;
+                case PpuMixerFlag::Cgb | PpuMixerFlag::Rgba: MixPixel<true, false, true>(); break;
+                case PpuMixerFlag::Sprites | PpuMixerFlag::Rgba: MixPixel<false, true, true>(); break;
+                case PpuMixerFlag::Cgb | PpuMixerFlag::Sprites | PpuMixerFlag::Rgba: MixPixel<true, true, true>(); break;
             }
         }
 
@@ -344,68 +397,154 @@ void GameBoyPpu::TickDrawing()
     TickBgFetcher();
 }
 
-void GameBoyPpu::TickOamFetcher()
+template <bool cgb, bool sprites, bool rgba>
+void GameBoyPpu::MixPixel()
 {
-    s16 spriteY;
-    u8 spriteTileIndex;
-    u8 spriteAttribute;
+    u16 bufferOffset = _state.scanline * 160 + _pixelsRendered;
+    u8 bgColorIndex = _fifoBg.data[_fifoBg.position].color;
+    u8 bgAttributes = _fifoBg.data[_fifoBg.position].attributes;
+    u8 spriteColorIndex = sprites ? _fifoOam.data[_fifoOam.position].color : 0;
+    u8 spriteAttributes = _fifoOam.data[_fifoOam.position].attributes;
+
+    u8 palIndex;
+
+    // check if sprite or BG pixel has priority
+    if (sprites &&
+        (spriteColorIndex != 0) && // sprite pixel is opaque,
+        ((bgColorIndex == 0) || // BG pixel is transparent
+        ((spriteAttributes & 0x80) == 0x0 && (bgAttributes & 0x80) == 0))) // sprite has priority and BG doesn't have priority
+    {
+        // Sprite pixel has priority
+
+        if (cgb)
+        {
+            palIndex = 0x20 | ((spriteAttributes & 0x07) << 2) | spriteColorIndex;
+        }
+        else
+        {
+            palIndex = 0x20 | ((spriteAttributes & 0x10) >> 2) | spriteColorIndex;
+        }
+    }
+    else
+    {
+        if (cgb)
+        {
+            palIndex = ((bgAttributes & 0x07) << 2) | bgColorIndex;
+        }
+        else
+        {
+            palIndex = bgColorIndex;
+        }
+    }
+
+    // buffer still holds the previous frame, track if this line differs from it
+    if (rgba)
+    {
+        u32 pixel = _palColors[palIndex];
+        _lineChanges |= _pixelBuffer[bufferOffset] ^ pixel;
+        _pixelBuffer[bufferOffset] = pixel;
+    }
+    else
+    {
+        u8 value = _palBytes[palIndex];
+        _lineChanges |= _byteBuffer[bufferOffset] ^ value;
+        _byteBuffer[bufferOffset] = value;
+    }
+}
+
+void GameBoyPpu::SelectDrawMixer()
+{
+    // sprite pixels only reach the FIFO after a sprite was fetched while sprites were enabled,
+    // so the sprite-less variant is only picked again at the start of the next line
+    _lineSprites = _lineSprites || ((_state.lcdControl & 0x02) && (_spritesFound > 0) && (_spriteX[0] < 168));
+
+    _drawMixer =
+        (_gameBoy->IsCgb() ? PpuMixerFlag::Cgb : 0) |
+        (_lineSprites ? PpuMixerFlag::Sprites : 0) |
+        ((_outputFormat == PpuOutputFormat::Rgba) ? PpuMixerFlag::Rgba : 0);
+}
+
+u16 GameBoyPpu::GetSpriteTileAddr(u8 oamAddr)
+{
+    // address of the sprite's tile data for the current scanline
+    s16 spriteY = (s16)_oamRam[oamAddr] - 16;
+    u8 spriteTileIndex = _oamRam[oamAddr + 2];
+    u8 spriteAttribute = _oamRam[oamAddr + 3];
     u8 spriteRow;
 
-    switch (_fetcherOam.tick++)
+    if (_state.lcdControl & 0x04)
     {
-        case 1: // fetch sprite tile
-            spriteY = (s16)_oamRam[_fetchOamAddr] - 16;
-            spriteTileIndex = _oamRam[_fetchOamAddr + 2];
-            spriteAttribute = _oamRam[_fetchOamAddr + 3];
+        // large sprites enabled (8x16)
 
-            if (_state.lcdControl & 0x04)
-            {
-                // large sprites enabled (8x16)
+        spriteTileIndex &= 0xFE; // second half of sprite will use index+1
 
-                spriteTileIndex &= 0xFE; // second half of sprite will use index+1
+        if ((spriteAttribute & 0x40) != 0)
+        {
+            // Y mirroring
+            spriteRow = 15 - (_state.scanline - spriteY);
+        }
+        else
+        {
+            spriteRow = _state.scanline - spriteY;
+        }
+    }
+    else
+    {
+        // use normal sized sprites
 
-                if ((spriteAttribute & 0x40) != 0)
-                {
-                    // Y mirroring
-                    spriteRow = 15 - (_state.scanline - spriteY);
-                }
-                else
-                {
-                    spriteRow = _state.scanline - spriteY;
-                }
-            }
-            else
-            {
-                // use normal sized sprites
+        if ((spriteAttribute & 0x40) != 0)
+        {
+            // Y mirroring
+            spriteRow = 7 - (_state.scanline - spriteY);
+        }
+        else
+        {
+            spriteRow = _state.scanline - spriteY;
+        }
+    }
 
-                if ((spriteAttribute & 0x40) != 0)
-                {
-                    // Y mirroring
-                    spriteRow = 7 - (_state.scanline - spriteY);
-                }
-                else
-                {
-                    spriteRow = _state.scanline - spriteY;
-                }
-            }
+    u16 tileSetAddr = (spriteTileIndex * 16) + (spriteRow * 2);
+    if (_gameBoy->IsCgb())
+    {
+        tileSetAddr += (spriteAttribute & 0x08) ? 0x2000 : 0x0000;
+    }
 
-            _fetcherOam.tileSetAddr = (spriteTileIndex * 16) + (spriteRow * 2);
-            if (_gameBoy->IsCgb())
+    return tileSetAddr;
+}
+
+void GameBoyPpu::TickOamFetcher()
+{
+    switch (_fetcherOam.tick++)
+    {
+        case 1: // fetch sprite tile
+            if (_timingOnly)
             {
-                _fetcherOam.tileSetAddr += (spriteAttribute & 0x08) ? 0x2000 : 0x0000;
+                // timing-only frame, fetched data would never be displayed (or is already in the pixel buffer)
+                break;
             }
-            _fetcherOam.attributes = spriteAttribute;
+
+            _fetcherOam.tileSetAddr = GetSpriteTileAddr(_fetchOamAddr);
+            _fetcherOam.attributes = _oamRam[_fetchOamAddr + 3];
             break;
 
         case 3: // fetch first tile data byte
-            _fetcherOam.tileData0 = _videoRam[_fetcherOam.tileSetAddr];
+            if (!_timingOnly)
+            {
+                _fetcherOam.tileData0 = _videoRam[_fetcherOam.tileSetAddr];
+            }
             break;
 
         case 5: // fetch second tile data byte
-            _fetcherOam.tileData1 = _videoRam[_fetcherOam.tileSetAddr+1];
             _fetchNextSprite = true;
             _fetcherOam.tick = 0;
 
+            if (_timingOnly)
+            {
+                break;
+            }
+
+            _fetcherOam.tileData1 = _videoRam[_fetcherOam.tileSetAddr+1];
+
             if ((_state.lcdControl & 0x02) != 0) // sprite render enable?
             {
                 for (int i = 0, j = _fifoOam.position; i < 8; i++, j = (j + 1) & 7) // fill pixel FIFO queue
@@ -455,22 +594,115 @@ void GameBoyPpu::TickOamSearch()
     }
 }
 
+void GameBoyPpu::BuildLineSprites()
+{
+    // same search as TickOamSearch, but done for every line at once
+    s16 height = (_state.lcdControl & 0x04) ? 16 : 8;
+
+    memset(_lineSpriteCount, 0, sizeof(_lineSpriteCount));
+
+    for (u8 oamAddr = 0; oamAddr < 160; oamAddr += 4)
+    {
+        s16 oamY = (s16)_oamRam[oamAddr] - 16;
+        s16 first = std::max<s16>(oamY, 0);
+        s16 last = std::min<s16>(oamY + height, 144);
+
+        for (s16 line = first; line < last; line++)
+        {
+            if (_lineSpriteCount[line] < 10) // only first 10 sprites in OAM order are found
+            {
+                _lineSpriteAddr[line][_lineSpriteCount[line]++] = oamAddr;
+            }
+        }
+    }
+
+    _lineSpritesDirty = false;
+}
+
+void GameBoyPpu::StartLiveOamSearch()
+{
+    // called right before OAM or the sprite size changes during OAM search,
+    // entries that were already searched keep the results from the bucket
+    if (_lineSpritesDirty)
+    {
+        BuildLineSprites();
+    }
+
+    u8 searched = (_state.tick - 3) / 2;
+
+    _spritesFound = 0;
+    for (int i = 0; i < _lineSpriteCount[_state.scanline]; i++)
+    {
+        u8 oamAddr = _lineSpriteAddr[_state.scanline][i];
+        if ((oamAddr / 4) >= searched)
+        {
+            break;
+        }
+
+        _spriteX[_spritesFound] = _oamRam[oamAddr + 1];
+        _spriteAddr[_spritesFound] = oamAddr;
+        _spritesFound++;
+    }
+
+    _oamSearchLive = true;
+    _state.sleepCycles = 0; // wake up to search remaining entries
+}
+
+void GameBoyPpu::FinishOamSearch()
+{
+    if (!_oamSearchLive)
+    {
+        // OAM didn't change during search, so bucket has the same results
+        if (_lineSpritesDirty)
+        {
+            BuildLineSprites();
+        }
+
+        _spritesFound = _lineSpriteCount[_state.scanline];
+        for (int i = 0; i < _spritesFound; i++)
+        {
+            u8 oamAddr = _lineSpriteAddr[_state.scanline][i];
+            _spriteX[i] = _oamRam[oamAddr + 1];
+            _spriteAddr[i] = oamAddr;
+        }
+    }
+
+    // sort results by X, sprites with the same X stay in OAM order
+    for (int i = 1; i < _spritesFound; i++)
+    {
+        u8 x = _spriteX[i];
+        u8 addr = _spriteAddr[i];
+        int j = i - 1;
+        while ((j >= 0) && (_spriteX[j] > x))
+        {
+            _spriteX[j + 1] = _spriteX[j];
+            _spriteAddr[j + 1] = _spriteAddr[j];
+            j--;
+        }
+        _spriteX[j + 1] = x;
+        _spriteAddr[j + 1] = addr;
+    }
+
+    _spriteHead = 0;
+}
+
 void GameBoyPpu::MoveToNextSprite()
 {
     // move to next search result from OAM search phase
     if (_fetchNextSprite && ((_state.lcdControl & 0x02) || _gameBoy->IsCgb()))
     {
-        for (int i = 0; i < _spritesFound; i++)
+        // skip sprites that were passed over (off the left edge or while sprites were disabled)
+        while ((_spriteHead < _spritesFound) && (((s16)_spriteX[_spriteHead] - 8) < _pixelsRendered))
         {
-            if (_pixelsRendered == ((s16)_spriteX[i] - 8))
-            {
-                _fetchNextSprite = false;
-                _fetchOamAddr = _spriteAddr[i];
-                _spriteX[i] = 255; // remove from result
-                _fetcherOam.tick = 0; // start fetcher
+            _spriteHead++;
+        }
 
-                break;
-            }
+        if ((_spriteHead < _spritesFound) && (((s16)_spriteX[_spriteHead] - 8) == _pixelsRendered))
+        {
+            _fetchNextSprite = false;
+            _fetchOamAddr = _spriteAddr[_spriteHead];
+            _spriteHead++; // remove from result
+            _fetcherOam.tick = 0; // start fetcher
         }
     }
 }
@@ -487,11 +719,219 @@ void GameBoyPpu::CheckLcdStatusIrq()
 
     if (triggerStat && !_state.raisedStatIrq)
     {
-        _gameBoy->SetInterruptFlags(IrqFlag::LcdStat);
+        if (!_replica)
+        {
+            _gameBoy->SetInterruptFlags(IrqFlag::LcdStat);
+        }
+        else
+        {
+            _replicaIrqs |= IrqFlag::LcdStat;
+        }
     }
     _state.raisedStatIrq = triggerStat;
 }
 
+u32 GameBoyPpu::CorrectCgbColor(CgbPalEntry color)
+{
+    // adjust 5-bit CGB color to look closer to the real LCD
+    // Found at https://byuu.net/video/color-emulation/
+    // Original author is unknown
+    u32 r = color.r;
+    u32 g = color.g;
+    u32 b = color.b;
+
+    u8 r2 = std::min<u32>((r * 26 + g *  4 + b *  2), 960) >> 2;
+    u8 g2 = std::min<u32>((         g * 24 + b *  8), 960) >> 2;
+    u8 b2 = std::min<u32>((r *  6 + g *  4 + b * 22), 960) >> 2;
+
+    return (r2 << 24) | (g2 << 16) | (b2 << 8);
+}
+
+void GameBoyPpu::ResolveDmgPalette(u8 offset, u8 palette)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        _palColors[offset + i] = _dmgPal[(palette >> (i * 2)) & 0x03];
+        _palBytes[offset + i] = GetPaletteByte(offset + i);
+    }
+}
+
+void GameBoyPpu::SetPaletteColor(u8 index, u32 color)
+{
+    if (_palColors[index] != color)
+    {
+        MarkChanged();
+        _palColors[index] = color;
+        _palBytes[index] = GetPaletteByte(index);
+    }
+}
+
+u8 GameBoyPpu::GetPaletteByte(u8 index)
+{
+    return (_outputFormat == PpuOutputFormat::PaletteIndex) ? index : GetColorByte(_palColors[index]);
+}
+
+u8 GameBoyPpu::GetColorByte(u32 color)
+{
+    u32 luma = (77 * (color >> 24) + 150 * ((color >> 16) & 0xFF) + 29 * ((color >> 8) & 0xFF) + 128) >> 8;
+
+    switch (_outputFormat)
+    {
+        case PpuOutputFormat::Shade:
+            // 0 is the lightest like DMG shades, CGB colors are bucketed by brightness
+            return 3 - (luma >> 6);
+        case PpuOutputFormat::Luma:
+            return luma;
+        default:
+            return 0;
+    }
+}
+
+void GameBoyPpu::ResolvePaletteBytes()
+{
+    for (int i = 0; i < 64; i++)
+    {
+        _palBytes[i] = GetPaletteByte(i);
+    }
+}
+
+void GameBoyPpu::SetObserver(FrameObserver *observer)
+{
+    _observer = observer;
+    SetOutputFormat((observer != nullptr) ? observer->GetFormat() : PpuOutputFormat::Rgba);
+}
+
+void GameBoyPpu::SetOutputFormat(PpuOutputFormat format)
+{
+    if (_outputFormat == format)
+    {
+        return;
+    }
+
+    PpuOutputFormat previous = _outputFormat;
+    _outputFormat = format;
+    ResolvePaletteBytes();
+    SelectDrawMixer();
+
+    if ((previous == PpuOutputFormat::Rgba) && (format != PpuOutputFormat::PaletteIndex))
+    {
+        // start out with what the host was shown, matters while the LCD is off and nothing is drawn
+        for (u32 i = 0; i < 160 * 144; i++)
+        {
+            _byteBuffer[i] = GetColorByte(_pixelBuffer[i]);
+        }
+    }
+
+    // buffer doesn't hold the last frame in this format, draw the next one completely
+    _bufferValid = false;
+    for (u32 i = 0; i < DirtyLineWords; i++)
+    {
+        _dirtyLines[i] = 0xFFFFFFFF;
+    }
+}
+
+void GameBoyPpu::GetObservation(PpuObservation &observation)
+{
+    observation.lcdControl = _state.lcdControl;
+    observation.scrollX = _state.scrollX;
+    observation.scrollY = _state.scrollY;
+    observation.windowX = _state.windowX;
+    observation.windowY = _state.windowY;
+    observation.windowVisible = (_state.lcdControl & 0x20) && (_state.windowX < 167) && (_state.windowY < 144);
+    observation.spriteHeight = (_state.lcdControl & 0x04) ? 16 : 8;
+
+    // sprites the OAM search finds on any line, which already applies the limit of 10 per line
+    observation.spriteCount = 0;
+    if (_state.lcdControl & 0x02)
+    {
+        if (_lineSpritesDirty)
+        {
+            BuildLineSprites();
+        }
+
+        u64 found = 0;
+        for (int line = 0; line < 144; line++)
+        {
+            for (int i = 0; i < _lineSpriteCount[line]; i++)
+            {
+                found |= 1ull << (_lineSpriteAddr[line][i] >> 2);
+            }
+        }
+
+        for (u8 index = 0; index < 40; index++)
+        {
+            const u8 *entry = _oamRam + index * 4;
+            if (!(found & (1ull << index)) || (entry[1] == 0) || (entry[1] >= 168))
+            {
+                // not found or off screen horizontally, though it still counted towards the limit
+                continue;
+            }
+
+            PpuObservedSprite &sprite = observation.sprites[observation.spriteCount++];
+            sprite.oamIndex = index;
+            sprite.x = (s16)entry[1] - 8;
+            sprite.y = (s16)entry[0] - 16;
+            sprite.tile = entry[2];
+            sprite.attributes = entry[3];
+        }
+    }
+
+    // same addressing as the BG fetcher
+    u16 bgMap = (_state.lcdControl & 0x08) ? 0x1C00 : 0x1800;
+    u16 windowMap = (_state.lcdControl & 0x40) ? 0x1C00 : 0x1800;
+    bool signedTiles = !(_state.lcdControl & 0x10);
+
+    for (int row = 0; row < 18; row++)
+    {
+        for (int column = 0; column < 20; column++)
+        {
+            u8 screenX = column * 8;
+            u8 screenY = row * 8;
+            PpuObservedTile &tile = observation.tiles[row][column];
+
+            u16 mapAddr;
+            tile.window = observation.windowVisible &&
+                (screenY >= _state.windowY) &&
+                (screenX + 7 >= _state.windowX);
+            if (tile.window)
+            {
+                mapAddr = windowMap + (((screenY - _state.windowY) >> 3) * 32) + ((screenX + 7 - _state.windowX) >> 3);
+            }
+            else
+            {
+                u8 x = _state.scrollX + screenX;
+                u8 y = _state.scrollY + screenY;
+                mapAddr = bgMap + ((y >> 3) * 32) + (x >> 3);
+            }
+
+            u8 tileIndex = _videoRam[mapAddr];
+            tile.tile = signedTiles ? (256 + (s8)tileIndex) : tileIndex;
+            tile.attributes = _gameBoy->IsCgb() ? _videoRam[0x2000 | mapAddr] : 0;
+        }
+    }
+
+    memcpy(observation.colors, _palColors, sizeof(observation.colors));
+}
+
+void GameBoyPpu::ResolvePalettes()
+{
+    if (_gameBoy->IsCgb())
+    {
+        for (int i = 0; i < 32; i++)
+        {
+            _palColors[i] = CorrectCgbColor(_state.cgbBgPal[i]);
+            _palColors[0x20 | i] = CorrectCgbColor(_state.cgbObjPal[i]);
+        }
+    }
+    else
+    {
+        ResolveDmgPalette(0x00, _state.bgPal);
+        ResolveDmgPalette(0x20, _state.objPal0);
+        ResolveDmgPalette(0x24, _state.objPal1);
+    }
+    ResolvePaletteBytes();
+}
+
 u8 GameBoyPpu::ReadRegister(u16 addr)
 {
     switch (addr)
@@ -573,6 +1013,10 @@ void GameBoyPpu::Reset()
     _state = {};
     _state.lcdPower = (!_gameBoy->IsBiosEnabled());
     _state.lcdMode = LcdModeFlag::HBlank;
+    if (!_state.lcdPower)
+    {
+        _state.sleepCycles = 456 - 1; // next line of the frame push
+    }
 
     // CGB palette is all white
     for (int i = 0; i < 32; i++)
@@ -583,6 +1027,100 @@ void GameBoyPpu::Reset()
     }
 
     _state.vramBank = 0;
+
+    ResolvePalettes();
+    _lineSpritesDirty = true;
+    _oamSearchLive = false;
+
+    _bufferValid = false;
+    _repeatFrame = false;
+    _lineCached = false;
+    _timingOnly = _skipFrame;
+    InvalidateLayers();
+}
+
+void GameBoyPpu::StartFrame()
+{
+    // decide if this frame is drawn or skipped, timing and IRQs run either way
+    _skipFrame = (_frameSkipCounter != 0) || _headless;
+
+    _frameSkipCounter++;
+    if (_frameSkipCounter > _frameSkip)
+    {
+        _frameSkipCounter = 0;
+    }
+
+    if (_frameRequested)
+    {
+        // frame was asked for on demand, always draw it
+        _skipFrame = false;
+        _frameRequested = false;
+    }
+
+    if (_deferred)
+    {
+        // frames are drawn by the replica, only timing runs here
+        _replicaDrawsFrame = !_skipFrame;
+        _skipFrame = true;
+    }
+
+    // nothing was written since the pixel buffer was drawn, so this frame would be identical
+    _repeatFrame = !_skipFrame && _bufferValid && (_generation == _bufferGeneration);
+    _timingOnly = _skipFrame || _repeatFrame;
+    _frameGeneration = _generation;
+}
+
+void GameBoyPpu::MarkChanged(bool latchedByLine)
+{
+    // must be called before the write is applied
+    _generation++;
+    if (_repeatFrame)
+    {
+        StopRepeatFrame();
+    }
+    else if (_lineCached && !latchedByLine && (_state.lcdMode == LcdModeFlag::Drawing))
+    {
+        // raster effect, line can't be drawn from the layers anymore
+        _lineCached = false;
+        _timingOnly = _skipFrame;
+        RedrawLine();
+    }
+}
+
+void GameBoyPpu::StopRepeatFrame()
+{
+    _repeatFrame = false;
+    _timingOnly = _skipFrame;
+
+    if (!_timingOnly && (_state.lcdMode == LcdModeFlag::Drawing))
+    {
+        RedrawLine();
+    }
+}
+
+void GameBoyPpu::RedrawLine()
+{
+    // line was only timed so far, redraw it up to the current cycle so the rest can be drawn
+    // nothing changed during the line, so this gives the same result as drawing it all along
+    u16 drawTicks = _drawTicks;
+
+    _fifoBg = _lineStart.fifoBg;
+    _fifoOam = _lineStart.fifoOam;
+    _fetcherBg = _lineStart.fetcherBg;
+    _fetcherOam = _lineStart.fetcherOam;
+    _insideWindow = _lineStart.insideWindow;
+    _windowOffset = _lineStart.windowOffset;
+    _fetchNextSprite = _lineStart.fetchNextSprite;
+    _fetchOamAddr = _lineStart.fetchOamAddr;
+    _spriteHead = _lineStart.spriteHead;
+    _pixelsRendered = _lineStart.pixelsRendered;
+    _bgColumn = _lineStart.bgColumn;
+    _drawTicks = 0;
+
+    while (_drawTicks < drawTicks)
+    {
+        TickDrawing();
+    }
 }
 
 void GameBoyPpu::StartRender()
@@ -605,6 +1143,287 @@ void GameBoyPpu::StartRender()
     // rendering starts off screen from -8 to -16 pixels
     _pixelsRendered = -8 - (_state.scrollX & 0x07);
     _bgColumn = _state.scrollX / 8;
+
+    _lineChanges = 0;
+    _drawTicks = 0;
+
+    // line is drawn from the layers when it's done, unless something changes while drawing
+    _lineCached = !_skipFrame && !_repeatFrame;
+    _timingOnly = true;
+
+    // remember where the line started in case a repeated frame has to be drawn after all
+    _lineStart.fifoBg = _fifoBg;
+    _lineStart.fifoOam = _fifoOam;
+    _lineStart.fetcherBg = _fetcherBg;
+    _lineStart.fetcherOam = _fetcherOam;
+    _lineStart.insideWindow = _insideWindow;
+    _lineStart.windowOffset = _windowOffset;
+    _lineStart.fetchNextSprite = _fetchNextSprite;
+    _lineStart.fetchOamAddr = _fetchOamAddr;
+    _lineStart.spriteHead = _spriteHead;
+    _lineStart.pixelsRendered = _pixelsRendered;
+    _lineStart.bgColumn = _bgColumn;
+    _lineStart.scrollX = _state.scrollX;
+
+    _lineSprites = false;
+    SelectDrawMixer();
+}
+
+void GameBoyPpu::FinishRender()
+{
+    if (_lineCached)
+    {
+        DrawCachedLine();
+        _lineCached = false;
+        _timingOnly = _skipFrame || _repeatFrame;
+    }
+
+    if (_lineChanges != 0)
+    {
+        _dirtyLines[_state.scanline >> 5] |= (u32)1 << (_state.scanline & 0x1F);
+    }
+}
+
+void GameBoyPpu::UpdateLayerTile(u8 map, u16 entry)
+{
+    u16 mapAddr = (map ? 0x1C00 : 0x1800) + entry;
+    u8 tileIndex = _videoRam[mapAddr];
+    u8 tileAttributes = _gameBoy->IsCgb() ? _videoRam[0x2000 | mapAddr] : 0;
+
+    // same addressing as BG fetcher
+    u16 tileSetAddr = (_state.lcdControl & 0x10) ? 0x0000 : 0x1000;
+    tileSetAddr += tileSetAddr ?
+        (s8)tileIndex * 16 :
+        tileIndex * 16;
+    tileSetAddr |= (tileAttributes & 0x08) ? 0x2000 : 0x0000;
+
+    u32 key = (tileSetAddr << 8) | tileAttributes;
+    u32 generation = _tileGeneration[tileSetAddr >> 13][(tileSetAddr & 0x1FFF) >> 4];
+    if ((_layerTileKey[map][entry] == key) && (_layerTileGeneration[map][entry] == generation))
+    {
+        // layer already has this tile
+        return;
+    }
+
+    _layerTileKey[map][entry] = key;
+    _layerTileGeneration[map][entry] = generation;
+
+    u8 *dest = _layerPixels[map] + ((entry >> 5) * 8 * 256) + ((entry & 0x1F) * 8);
+    u8 attributes = ((tileAttributes & 0x07) << 2) | (tileAttributes & 0x80);
+    for (int y = 0; y < 8; y++, dest += 256)
+    {
+        u8 tileY = (tileAttributes & 0x40) ? (7 - y) : y; // flip vertically
+        u8 tileData0 = _videoRam[tileSetAddr + tileY * 2];
+        u8 tileData1 = _videoRam[tileSetAddr + tileY * 2 + 1];
+
+        for (int i = 0; i < 8; i++)
+        {
+            u8 x = (tileAttributes & 0x20) ? i : (7 - i);
+            dest[i] = attributes |
+                ((tileData0 >> x) & 0x01) |
+                (((tileData1 >> x) & 0x01) << 1);
+        }
+    }
+}
+
+void GameBoyPpu::InvalidateLayers()
+{
+    memset(_layerTileKey, 0xFF, sizeof(_layerTileKey));
+}
+
+void GameBoyPpu::DrawCachedLine()
+{
+    // pick the mixer for this line once instead of testing for each pixel
+    bool sprites = (_state.lcdControl & 0x02) && (_spritesFound > 0) && (_spriteX[0] < 168);
+
+    if (_insideWindow)
+    {
+        if (!sprites)
+        {
+            MixCachedLine<true, false, false>();
+        }
+        else if (_gameBoy->IsCgb())
+        {
+            MixCachedLine<true, true, true>();
+        }
+        else
+        {
+            MixCachedLine<true, true, false>();
+        }
+    }
+    else
+    {
+        if (!sprites)
+        {
+            MixCachedLine<false, false, false>();
+        }
+        else if (_gameBoy->IsCgb())
+        {
+            MixCachedLine<false, true, true>();
+        }
+        else
+        {
+            MixCachedLine<false, true, false>();
+        }
+    }
+}
+
+template <bool window, bool sprites, bool cgb>
+void GameBoyPpu::MixCachedLine()
+{
+    // Layer pixels are color (bits 0-1), CGB palette (bits 2-4) and CGB priority (bit 7),
+    // so the lower 5 bits are an index into the BG palette colors
+    u8 bgLine[160];
+    u8 spriteLine[160];
+
+    // window starts where the pixel counter reached WX - 7
+    s16 windowStart = window ? (s16)_windowStartX - 7 : 160;
+    s16 bgEnd = window ? std::max<s16>(windowStart, 0) : 160;
+
+    if (bgEnd > 0)
+    {
+        u8 map = (_state.lcdControl & 0x08) ? 1 : 0;
+        u8 y = _state.scrollY + _state.scanline;
+        u8 x = _lineStart.scrollX;
+
+        for (int column = x >> 3; column <= ((x + bgEnd - 1) >> 3); column++)
+        {
+            UpdateLayerTile(map, ((y >> 3) * 32) + (column & 0x1F));
+        }
+
+        const u8 *src = _layerPixels[map] + (y * 256);
+        if (x <= (256 - bgEnd))
+        {
+            memcpy(bgLine, src + x, bgEnd);
+        }
+        else
+        {
+            // wraps around
+            memcpy(bgLine, src + x, 256 - x);
+            memcpy(bgLine + (256 - x), src, bgEnd - (256 - x));
+        }
+    }
+
+    if (window)
+    {
+        u8 map = (_state.lcdControl & 0x40) ? 1 : 0;
+        u8 y = (u8)_windowOffset - 1;
+        u8 x = bgEnd - windowStart;
+
+        for (int column = x >> 3; column <= ((x + 159 - bgEnd) >> 3); column++)
+        {
+            UpdateLayerTile(map, ((y >> 3) * 32) + column);
+        }
+
+        memcpy(bgLine + bgEnd, _layerPixels[map] + (y * 256) + x, 160 - bgEnd);
+    }
+
+    if (sprites)
+    {
+        // sprite pixels are color (bits 0-1), index into OBJ palette colors (bits 0-5) and priority (bit 7)
+        // sprites were fetched in X order, first opaque pixel wins like in the sprite FIFO
+        memset(spriteLine, 0, sizeof(spriteLine));
+
+        for (int i = 0; (i < _spritesFound) && (_spriteX[i] < 168); i++)
+        {
+            u8 oamAddr = _spriteAddr[i];
+            u16 tileSetAddr = GetSpriteTileAddr(oamAddr);
+            u8 tileData0 = _videoRam[tileSetAddr];
+            u8 tileData1 = _videoRam[tileSetAddr + 1];
+            u8 spriteAttributes = _oamRam[oamAddr + 3];
+            u8 attributes = 0x20 | (spriteAttributes & 0x80) | (cgb ?
+                ((spriteAttributes & 0x07) << 2) :
+                ((spriteAttributes & 0x10) >> 2));
+
+            for (int j = 0; j < 8; j++)
+            {
+                s16 screenX = (s16)_spriteX[i] - 8 + j;
+                if ((screenX < 0) || (screenX >= 160) || (spriteLine[screenX] != 0))
+                {
+                    continue;
+                }
+
+                u8 x = (spriteAttributes & 0x20) ? j : (7 - j); // horizontal mirror
+                u8 color =
+                    ((tileData0 >> x) & 0x01) |
+                    (((tileData1 >> x) & 0x01) << 1);
+                if (color)
+                {
+                    spriteLine[screenX] = attributes | color;
+                }
+            }
+        }
+    }
+
+    u8 indexLine[160];
+    if (sprites)
+    {
+        // same priority rules as TickDrawing
+        LineCompositor::ResolvePriority(bgLine, spriteLine, indexLine, 160);
+    }
+    else
+    {
+        for (int i = 0; i < 160; i++)
+        {
+            indexLine[i] = bgLine[i] & 0x1F;
+        }
+    }
+
+    if (_outputFormat == PpuOutputFormat::Rgba)
+    {
+        u32 *dest = _pixelBuffer + (_state.scanline * 160);
+        for (int i = 0; i < 160; i++)
+        {
+            u32 pixel = _palColors[indexLine[i]];
+            _lineChanges |= dest[i] ^ pixel;
+            dest[i] = pixel;
+        }
+    }
+    else
+    {
+        u8 *dest = _byteBuffer + (_state.scanline * 160);
+        for (int i = 0; i < 160; i++)
+        {
+            u8 value = _palBytes[indexLine[i]];
+            _lineChanges |= dest[i] ^ value;
+            dest[i] = value;
+        }
+    }
+}
+
+void GameBoyPpu::PushVideoFrame(bool repeat)
+{
+    if (_observer != nullptr)
+    {
+        _observer->PushFrame(_byteBuffer, repeat);
+    }
+    else
+    {
+        _host->PushVideoFrame(_pixelBuffer, _dirtyLines, repeat);
+    }
+
+    for (u32 i = 0; i < DirtyLineWords; i++)
+    {
+        _dirtyLines[i] = 0;
+    }
+}
+
+void GameBoyPpu::CopyFrameSkip(const GameBoyPpu &other)
+{
+    _frameSkip = other._frameSkip;
+    _frameSkipCounter = other._frameSkipCounter;
+    _headless = other._headless;
+    _frameRequested = other._frameRequested;
+}
+
+void GameBoyPpu::SetDeferred(bool deferred)
+{
+    _deferred = deferred;
+    _replicaDrawsFrame = true;
+    _skipFrame = deferred;
+    _repeatFrame = false;
+    _lineCached = false;
+    _timingOnly = deferred;
 }
 
 void GameBoyPpu::SetLcdPower(bool enable)
@@ -614,6 +1433,8 @@ void GameBoyPpu::SetLcdPower(bool enable)
     if (_state.lcdPower) // powering on
     {
         _state.tick = 0;
+        _state.scanline = 0; // counted lines of the frame pushes while off
+        StartFrame();
         StartRender();
         _state.lyCoincident = (_state.ly == _state.lyCompare);
         CheckLcdStatusIrq();
@@ -625,6 +1446,7 @@ void GameBoyPpu::SetLcdPower(bool enable)
         _state.scanline = 0;
         _state.ly = 0;
         _state.lcdStatus &= 0xFC; // clear mode
+        _state.sleepCycles = 456 - 1; // next line of the frame push
     }
 }
 
@@ -633,12 +1455,30 @@ void GameBoyPpu::WriteRegister(u16 addr, u8 val)
     switch (addr)
     {
         case 0xFF40:
+            if (_state.lcdControl != val)
+            {
+                MarkChanged();
+            }
+            if ((_state.lcdControl ^ val) & 0x04)
+            {
+                // sprite size changed, OAM search results are different
+                if ((_state.lcdMode == LcdModeFlag::OamSearch) && !_oamSearchLive)
+                {
+                    StartLiveOamSearch();
+                }
+                _lineSpritesDirty = true;
+            }
             _state.lcdControl = val;
             if (_state.lcdPower != ((_state.lcdControl & 0x80) != 0))
             {
                 // LCD power has been toggled
                 SetLcdPower((_state.lcdControl & 0x80) != 0);
             }
+            else if (_state.lcdMode == LcdModeFlag::Drawing)
+            {
+                // sprites may have been enabled for the rest of the line
+                SelectDrawMixer();
+            }
             return;
         case 0xFF41: // STAT - LCD Status
             if (!_gameBoy->IsCgb())
@@ -651,9 +1491,17 @@ void GameBoyPpu::WriteRegister(u16 addr, u8 val)
             CheckLcdStatusIrq();
             return;
         case 0xFF42: // SCY - BG Scroll Y
+            if (_state.scrollY != val)
+            {
+                MarkChanged();
+            }
             _state.scrollY = val;
             return;
         case 0xFF43: // SCX - BG Scroll X
+            if (_state.scrollX != val)
+            {
+                MarkChanged(true /*latchedByLine*/);
+            }
             _state.scrollX = val;
             return;
         case 0xFF45: // LY (LCDC Y-Coordinate)
@@ -666,18 +1514,41 @@ void GameBoyPpu::WriteRegister(u16 addr, u8 val)
             }
             return;
         case 0xFF47: // BGP
+            if (!_gameBoy->IsCgb() && (_state.bgPal != val))
+            {
+                MarkChanged();
+                ResolveDmgPalette(0x00, val);
+            }
             _state.bgPal = val;
             return;
         case 0xFF48: // OBP0
+            if (!_gameBoy->IsCgb() && (_state.objPal0 != val))
+            {
+                MarkChanged();
+                ResolveDmgPalette(0x20, val);
+            }
             _state.objPal0 = val;
             return;
         case 0xFF49: // OBP1
+            if (!_gameBoy->IsCgb() && (_state.objPal1 != val))
+            {
+                MarkChanged();
+                ResolveDmgPalette(0x24, val);
+            }
             _state.objPal1 = val;
             return;
         case 0xFF4A: // WY
+            if (_state.windowY != val)
+            {
+                MarkChanged(true /*latchedByLine*/);
+            }
             _state.windowY = val;
             return;
         case 0xFF4B: // WX
+            if (_state.windowX != val)
+            {
+                MarkChanged(true /*latchedByLine*/);
+            }
             _state.windowX = val;
             return;
     }
@@ -711,6 +1582,7 @@ void GameBoyPpu::WriteRegister(u16 addr, u8 val)
                             (_state.cgbBgPal[_state.cgbBgPalAddr >> 1].g & 0x18) |
                             (val >> 5);
                     }
+                    SetPaletteColor(_state.cgbBgPalAddr >> 1, CorrectCgbColor(_state.cgbBgPal[_state.cgbBgPalAddr >> 1]));
                     _state.cgbBgPalAddr += _state.cgbIncBgPalAddr ? 1 : 0;
                     _state.cgbBgPalAddr &= 0x3F; // wrap
                 }
@@ -737,6 +1609,7 @@ void GameBoyPpu::WriteRegister(u16 addr, u8 val)
                             (_state.cgbObjPal[_state.cgbObjPalAddr >> 1].g & 0x18) |
                             (val >> 5);
                     }
+                    SetPaletteColor(0x20 | (_state.cgbObjPalAddr >> 1), CorrectCgbColor(_state.cgbObjPal[_state.cgbObjPalAddr >> 1]));
                     _state.cgbObjPalAddr += (_state.cgbIncObjPalAddr) ? 1 : 0;
                     _state.cgbObjPalAddr &= 0x3F; // wrap
                 }
@@ -776,7 +1649,18 @@ void GameBoyPpu::WriteVideoRam(u16 addr, u8 val)
     }
     else
     {
-        _videoRam[(_state.vramBank << 13) | (addr & 0x1FFF)] = val;
+        u8 &data = _videoRam[(_state.vramBank << 13) | (addr & 0x1FFF)];
+        if (data != val)
+        {
+            MarkChanged();
+            data = val;
+
+            if ((addr & 0x1FFF) < 0x1800)
+            {
+                // tile data changed, layer tiles using it are out of date
+                _tileGeneration[_state.vramBank][(addr & 0x1FFF) >> 4]++;
+            }
+        }
     }
 }
 
@@ -799,7 +1683,20 @@ void GameBoyPpu::WriteOamRam(u8 addr, u8 val, bool dmaBypass)
 {
     if ((addr < 160) && (dmaBypass || (_state.lcdMode <= LcdModeFlag::VBlank))) // if in DMA or V-Blank or H-Blank, writes are allowed
     {
-        _oamRam[addr] = val;
+        if (_oamRam[addr] != val)
+        {
+            MarkChanged();
+            if ((_state.lcdMode == LcdModeFlag::OamSearch) && !_oamSearchLive)
+            {
+                StartLiveOamSearch();
+            }
+            if ((addr & 0x03) == 0)
+            {
+                // Y position changed, OAM search results are different
+                _lineSpritesDirty = true;
+            }
+            _oamRam[addr] = val;
+        }
     }
     else
     {
@@ -809,9 +1706,10 @@ void GameBoyPpu::WriteOamRam(u8 addr, u8 val, bool dmaBypass)
     }
 }
 
-void GameBoyPpu::LoadState(std::ifstream &inState)
+void GameBoyPpu::LoadState(std::istream &inState)
 {
     inState.read((char *)&_state, sizeof(PpuState));
+    ResolvePalettes();
 
     inState.read((char *)&_fifoBg, sizeof(PixelFifo));
     inState.read((char *)&_fifoOam, sizeof(PixelFifo));
@@ -829,15 +1727,161 @@ void GameBoyPpu::LoadState(std::ifstream &inState)
     inState.read((char *)_spriteX, sizeof(_spriteX));
     inState.read((char *)_spriteAddr, sizeof(_spriteAddr));
     inState.read((char *)&_spritesFound, sizeof(_spritesFound));
+    inState.read((char *)&_spriteHead, sizeof(_spriteHead));
+    inState.read((char *)&_oamSearchLive, sizeof(_oamSearchLive));
 
     inState.read((char *)&_renderPaused, sizeof(_renderPaused));
     inState.read((char *)&_pixelsRendered, sizeof(_pixelsRendered));
     inState.read((char *)&_bgColumn, sizeof(_bgColumn));
     inState.read((char *)_pixelBuffer, 160 * 144 * sizeof(u32));
+
+    // OAM was replaced
+    _lineSpritesDirty = true;
+
+    // sprite pixels may already be in the FIFO, whatever LCDC says now
+    _lineSprites = (_spritesFound > 0);
+    SelectDrawMixer();
+
+    // pixel buffer and VRAM came from somewhere else
+    _bufferValid = false;
+    _repeatFrame = false;
+    _lineCached = false;
+    _timingOnly = _skipFrame;
+    _replicaDrawsFrame = true;
+    InvalidateLayers();
+
+    // whole frame was replaced
+    for (u32 i = 0; i < DirtyLineWords; i++)
+    {
+        _dirtyLines[i] = 0xFFFFFFFF;
+    }
+}
+
+void GameBoyPpu::SaveCheckpoint(PpuCheckpoint &checkpoint)
+{
+    checkpoint.state = _state;
+    checkpoint.cycleCount = _cycleCount;
+
+    checkpoint.draw.fifoBg = _fifoBg;
+    checkpoint.draw.fifoOam = _fifoOam;
+    checkpoint.draw.fetcherBg = _fetcherBg;
+    checkpoint.draw.fetcherOam = _fetcherOam;
+    checkpoint.draw.insideWindow = _insideWindow;
+    checkpoint.draw.windowOffset = _windowOffset;
+    checkpoint.draw.fetchNextSprite = _fetchNextSprite;
+    checkpoint.draw.fetchOamAddr = _fetchOamAddr;
+    checkpoint.draw.spriteHead = _spriteHead;
+    checkpoint.draw.pixelsRendered = _pixelsRendered;
+    checkpoint.draw.bgColumn = _bgColumn;
+    checkpoint.lineStart = _lineStart;
+    checkpoint.drawTicks = _drawTicks;
+    checkpoint.windowEnable = _windowEnable;
+    checkpoint.windowStartX = _windowStartX;
+    checkpoint.windowStartY = _windowStartY;
+    checkpoint.renderPaused = _renderPaused;
+    checkpoint.lineSprites = _lineSprites;
+
+    memcpy(checkpoint.spriteX, _spriteX, sizeof(_spriteX));
+    memcpy(checkpoint.spriteAddr, _spriteAddr, sizeof(_spriteAddr));
+    checkpoint.spritesFound = _spritesFound;
+    checkpoint.oamSearchLive = _oamSearchLive;
+
+    checkpoint.frameSkipCounter = _frameSkipCounter;
+    checkpoint.skipFrame = _skipFrame;
+    checkpoint.frameRequested = _frameRequested;
+    checkpoint.generation = _generation;
+    checkpoint.frameGeneration = _frameGeneration;
+    checkpoint.bufferGeneration = _bufferGeneration;
+    checkpoint.repeatFrame = _repeatFrame;
+    checkpoint.timingOnly = _timingOnly;
+    checkpoint.lineCached = _lineCached;
+    checkpoint.lineChanges = _lineChanges;
+}
+
+void GameBoyPpu::LoadCheckpoint(const PpuCheckpoint &checkpoint, bool timingOnly)
+{
+    _state = checkpoint.state;
+    _cycleCount = checkpoint.cycleCount;
+    ResolvePalettes();
+
+    _fifoBg = checkpoint.draw.fifoBg;
+    _fifoOam = checkpoint.draw.fifoOam;
+    _fetcherBg = checkpoint.draw.fetcherBg;
+    _fetcherOam = checkpoint.draw.fetcherOam;
+    _insideWindow = checkpoint.draw.insideWindow;
+    _windowOffset = checkpoint.draw.windowOffset;
+    _fetchNextSprite = checkpoint.draw.fetchNextSprite;
+    _fetchOamAddr = checkpoint.draw.fetchOamAddr;
+    _spriteHead = checkpoint.draw.spriteHead;
+    _pixelsRendered = checkpoint.draw.pixelsRendered;
+    _bgColumn = checkpoint.draw.bgColumn;
+    _lineStart = checkpoint.lineStart;
+    _drawTicks = checkpoint.drawTicks;
+    _windowEnable = checkpoint.windowEnable;
+    _windowStartX = checkpoint.windowStartX;
+    _windowStartY = checkpoint.windowStartY;
+    _renderPaused = checkpoint.renderPaused;
+
+    memcpy(_spriteX, checkpoint.spriteX, sizeof(_spriteX));
+    memcpy(_spriteAddr, checkpoint.spriteAddr, sizeof(_spriteAddr));
+    _spritesFound = checkpoint.spritesFound;
+    _oamSearchLive = checkpoint.oamSearchLive;
+
+    // OAM may have been written since
+    _lineSpritesDirty = true;
+    _lineSprites = checkpoint.lineSprites;
+    SelectDrawMixer();
+
+    if (timingOnly)
+    {
+        // the replica this came from draws the frames, carry on expecting the ones it draws
+        _frameSkipCounter = checkpoint.frameSkipCounter;
+        _frameRequested = checkpoint.frameRequested;
+        _replicaDrawsFrame = !checkpoint.skipFrame;
+        return;
+    }
+
+    _frameSkipCounter = checkpoint.frameSkipCounter;
+    _skipFrame = checkpoint.skipFrame;
+    _frameRequested = checkpoint.frameRequested;
+    _generation = checkpoint.generation;
+    _frameGeneration = checkpoint.frameGeneration;
+    _bufferGeneration = checkpoint.bufferGeneration;
+    _repeatFrame = checkpoint.repeatFrame;
+    _timingOnly = checkpoint.timingOnly;
+    _lineCached = checkpoint.lineCached;
+    _lineChanges = checkpoint.lineChanges;
+
+    // VRAM was put back and lines past this one may have been drawn from what it was overwritten with,
+    // so the layers are drawn again and no frame can be repeated from the pixel buffer
+    InvalidateLayers();
+    _bufferValid = false;
+    if (_repeatFrame)
+    {
+        StopRepeatFrame();
+    }
+
+    for (u32 i = 0; i < DirtyLineWords; i++)
+    {
+        _dirtyLines[i] = 0xFFFFFFFF;
+    }
 }
 
-void GameBoyPpu::SaveState(std::ofstream &outState)
+void GameBoyPpu::SaveState(std::ostream &outState)
 {
+    if (_repeatFrame)
+    {
+        // saved fetch state has to be real, draw the rest of the frame instead
+        StopRepeatFrame();
+    }
+    else if (_lineCached && (_state.lcdMode == LcdModeFlag::Drawing))
+    {
+        // same for a line that's drawn from the layers
+        _lineCached = false;
+        _timingOnly = _skipFrame;
+        RedrawLine();
+    }
+
     outState.write((char *)&_state, sizeof(PpuState));
 
     outState.write((char *)&_fifoBg, sizeof(PixelFifo));
@@ -856,6 +1900,8 @@ void GameBoyPpu::SaveState(std::ofstream &outState)
     outState.write((char *)_spriteX, sizeof(_spriteX));
     outState.write((char *)_spriteAddr, sizeof(_spriteAddr));
     outState.write((char *)&_spritesFound, sizeof(_spritesFound));
+    outState.write((char *)&_spriteHead, sizeof(_spriteHead));
+    outState.write((char *)&_oamSearchLive, sizeof(_oamSearchLive));
 
     outState.write((char *)&_renderPaused, sizeof(_renderPaused));
     outState.write((char *)&_pixelsRendered, sizeof(_pixelsRendered));
@@ -5,6 +5,7 @@
 #include "IHostSystem.h"
 
 class GameBoy;
+class FrameObserver;
 
 struct CgbPalEntry // 5 bits per component
 {
@@ -81,6 +82,7 @@ struct PpuState
     u8 windowY;
 
     // track cycles where no activity is happening (VBlank/HBlank) so can bail out early
+    // also sleeps through the lines of the frames pushed while the LCD is off
     u16 sleepCycles;
 
     // VRAM bank select (CGB)
@@ -119,6 +121,44 @@ namespace LcdModeFlag
     };
 }
 
+// variants of the pixel mixer in TickDrawing
+namespace PpuMixerFlag
+{
+    enum PpuMixerFlag : u8
+    {
+        Cgb = 0x01,
+        Sprites = 0x02,
+        Rgba = 0x04,
+    };
+}
+
+// what the PPU draws frames as
+enum class PpuOutputFormat : u8
+{
+    Rgba, // host colors in the pixel buffer
+    Shade, // 2-bit shade per pixel (0 lightest, 3 darkest), CGB colors are bucketed by brightness
+    PaletteIndex, // palette entry per pixel (0-31 BG, 32-63 OBJ)
+    Luma, // 8-bit grayscale per pixel
+};
+
+// PPU accesses that are logged for the deferred renderer to replay (see DeferredPpu)
+namespace PpuWriteType
+{
+    enum PpuWriteType : u8
+    {
+        Register,
+        VideoRam,
+        OamRam,
+        OamDma,
+        FrameSkip,
+        Headless,
+        RequestFrame,
+        Sync, // catch up to this cycle and report back
+        PredictedRead, // STAT/LY value or VRAM/OAM access the CPU went by on predicted timing
+        PredictedIrq, // interrupts raised on predicted timing
+    };
+}
+
 struct PixelFifoEntry
 {
     u8 color;
@@ -159,6 +199,99 @@ struct PpuFetcher
     u16 tileSetAddr;
 };
 
+// drawing state at the start of mode 3, so a line can be drawn again up to the current cycle
+struct PpuLineStart
+{
+    PixelFifo fifoBg;
+    PixelFifo fifoOam;
+    PpuFetcher fetcherBg;
+    PpuFetcher fetcherOam;
+    bool insideWindow;
+    u8 windowOffset;
+    bool fetchNextSprite;
+    u8 fetchOamAddr;
+    u8 spriteHead;
+    s16 pixelsRendered;
+    u8 bgColumn;
+    u8 scrollX; // only used by cached lines, fetcher latches SCX through bgColumn/pixelsRendered
+};
+
+// everything ExecuteCycle carries from one dot to the next apart from VRAM, OAM and the pixels, so the
+// PPU can be put back to an earlier dot or take over another PPU's timing (see GameBoy::SetSpeculativePpu)
+struct PpuCheckpoint
+{
+    PpuState state;
+    u64 cycleCount;
+
+    // fetch state of the current line, same fields as at its start
+    PpuLineStart draw;
+    PpuLineStart lineStart;
+    u16 drawTicks;
+    bool windowEnable;
+    u8 windowStartX;
+    u8 windowStartY;
+    bool renderPaused;
+    bool lineSprites;
+
+    u8 spriteX[10];
+    u8 spriteAddr[10];
+    u8 spritesFound;
+    bool oamSearchLive;
+
+    // frame skipping, repeated frames and cached lines
+    u8 frameSkipCounter;
+    bool skipFrame;
+    bool frameRequested;
+    u32 generation;
+    u32 frameGeneration;
+    u32 bufferGeneration;
+    bool repeatFrame;
+    bool timingOnly;
+    bool lineCached;
+    u32 lineChanges;
+};
+
+// sprite that's drawn on at least one line (see PpuObservation)
+struct PpuObservedSprite
+{
+    u8 oamIndex; // 0-39
+    s16 x; // screen position of the top left corner
+    s16 y;
+    u8 tile;
+    u8 attributes;
+};
+
+// BG or window tile covering one 8x8 cell of the screen (see PpuObservation)
+struct PpuObservedTile
+{
+    u16 tile; // tile in its VRAM bank (0-383), the signed 8800 addressing is already resolved
+    u8 attributes; // CGB map attributes (palette, bank, flips, priority), 0 on DMG
+    bool window;
+};
+
+// what's on screen as tiles, sprites and palettes instead of pixels, filled in from the registers,
+// OAM and VRAM so it doesn't depend on frames being drawn
+struct PpuObservation
+{
+    u8 lcdControl;
+    u8 scrollX;
+    u8 scrollY;
+    u8 windowX;
+    u8 windowY;
+    bool windowVisible;
+    u8 spriteHeight;
+
+    // sprites that made it past the 10 sprites per line limit somewhere on screen, in OAM order
+    u8 spriteCount;
+    PpuObservedSprite sprites[40];
+
+    // one tile per 8x8 cell of the screen, taken at the cell's top left pixel
+    PpuObservedTile tiles[18][20];
+
+    // host colors with the same layout as PpuOutputFormat::PaletteIndex (0-31 BG, 32-63 OBJ)
+    u32 colors[64];
+};
+
 class GameBoyPpu
 {
 private:
@@ -171,8 +304,8 @@ private:
 
     PixelFifo _fifoBg;
     PixelFifo _fifoOam;
-    PpuFetcher _fetcherBg;
-    PpuFetcher _fetcherOam;
+    PpuFetcher _fetcherBg = {};
+    PpuFetcher _fetcherOam = {};
 
     bool _windowEnable;
     bool _insideWindow;
@@ -185,11 +318,92 @@ private:
     u8 _spriteX[10];
     u8 _spriteAddr[10];
     u8 _spritesFound;
+    u8 _spriteHead; // next search result to be fetched, results are sorted by X while drawing
+
+    // OAM search results for every visible line, only rebuilt when OAM or the sprite size changes
+    u8 _lineSpriteAddr[144][10];
+    u8 _lineSpriteCount[144];
+    bool _lineSpritesDirty = true;
+
+    // OAM changed in the middle of a search, so finish this line's search one entry at a time
+    bool _oamSearchLive;
 
     bool _renderPaused;
     s16 _pixelsRendered;
+
+    // accumulates bits that differ from the previous frame's pixels on the current line
+    u32 _lineChanges;
+
+    // scanlines that changed since the last frame pushed to the host
+    u32 _dirtyLines[DirtyLineWords] = {};
+
+    // render one frame out of every (frameSkip + 1), skipped frames only run timing
+    u8 _frameSkip = 0;
+    u8 _frameSkipCounter = 0;
+    bool _skipFrame = false;
+
+    // deferred: the replica draws this frame, so it's waited for at V-Blank. it decides the same way, only
+    // a frame that started before the two were synced is waited for either way
+    bool _replicaDrawsFrame = true;
+
+    // headless mode only renders frames that were explicitly requested
+    bool _headless = false;
+    bool _frameRequested = false;
+
+    // bumped by every write that changes something frames are drawn from (VRAM, OAM, palettes, LCDC, scroll, window)
+    u32 _generation = 0;
+    u32 _frameGeneration = 0; // generation at the start of the current frame
+    u32 _bufferGeneration = 0; // generation the pixel buffer was drawn from
+    bool _bufferValid = false; // pixel buffer was drawn without changes in the middle of the frame
+
+    // frame would be identical to the pixel buffer, so only timing is run until something changes
+    bool _repeatFrame = false;
+
+    // frames are drawn by a replica of this PPU on another thread (DeferredPpu), this one only runs timing
+    bool _deferred = false;
+
+    // this is the replica, it only draws and leaves interrupts, HDMA and the joypad to the emulated PPU
+    bool _replica = false;
+
+    // dots run since the PPU was created, including the ones that were slept through
+    u64 _cycleCount = 0;
+
+    // interrupts the replica would have raised since they were last taken
+    u8 _replicaIrqs = 0;
+
+    // tick drawing ended at on each visible line, less SCX's fine scroll, only kept for a PpuPredictor
+    bool _keepDrawingEnds = false;
+    u16 _lineDrawingEnd[144];
+
+    // fetched data isn't needed (skipped or repeated frame, or line drawn from the layers)
+    bool _timingOnly = false;
+
+    // TickDrawing's pixel mixer for the model, output format and whether sprite pixels can show up on
+    // the current line, picked at the start of the line and whenever one of them changes
+    u8 _drawMixer = PpuMixerFlag::Sprites | PpuMixerFlag::Rgba;
+    bool _lineSprites = true;
+
+    // BG and window layers for both tile maps (256x256, 1 byte per pixel), drawn tile by tile when
+    // the map entry, CGB attributes, tile data address or tile data changed since the tile was drawn
+    u8 *_layerPixels[2];
+    u32 _layerTileKey[2][32 * 32];
+    u32 _layerTileGeneration[2][32 * 32];
+    u32 _tileGeneration[2][384] = {}; // bumped on each tile data write, per VRAM bank
+
+    // current line only runs timing and is drawn from the layers at H-Blank
+    bool _lineCached = false;
+
+    // number of TickDrawing calls on the current line and the state when it started
+    u16 _drawTicks;
+    PpuLineStart _lineStart;
+
     u8 _bgColumn;
     u32 *_pixelBuffer;
+
+    // one byte per pixel, drawn to instead of the pixel buffer for the formats other than RGBA
+    PpuOutputFormat _outputFormat = PpuOutputFormat::Rgba;
+    u8 *_byteBuffer;
+    FrameObserver *_observer = nullptr;
     u32 _dmgPal[4] =
     {
         0xFFFFFF00,
@@ -197,21 +411,72 @@ private:
         0x55555500,
         0x00000000,
     };
-    u32 _cgbPal[32][32][32]; 
 
+    // palettes resolved to host colors whenever they are written (entries 0-31 BG, 32-63 OBJ)
+    // DMG only uses BGP at 0-3, OBP0 at 32-35 and OBP1 at 36-39
+    u32 _palColors[64];
+
+    // same palette entries as the bytes written for the output format
+    u8 _palBytes[64];
+
+    inline void StartFrame();
     inline void StartRender();
+    inline void FinishRender();
+    inline void PushVideoFrame(bool repeat);
+    inline void MarkChanged(bool latchedByLine = false);
+    void StopRepeatFrame();
+    void RedrawLine();
+    void UpdateLayerTile(u8 map, u16 entry);
+    void InvalidateLayers();
+    void DrawCachedLine();
+    template <bool window, bool sprites, bool cgb> void MixCachedLine();
+    inline u16 GetSpriteTileAddr(u8 oamAddr);
     void SetLcdPower(bool enable);
     inline void TickDrawing();
+    template <bool cgb, bool sprites, bool rgba> inline void MixPixel();
+    void SelectDrawMixer();
     inline void TickBgFetcher();
     inline void TickOamSearch();
+    void BuildLineSprites();
+    void StartLiveOamSearch();
+    inline void FinishOamSearch();
     inline void TickOamFetcher();
     inline void MoveToNextSprite();
     inline void CheckLcdStatusIrq();
+
+    static u32 CorrectCgbColor(CgbPalEntry color);
+    void ResolveDmgPalette(u8 offset, u8 palette);
+    void ResolvePalettes();
+    void SetPaletteColor(u8 index, u32 color);
+    u8 GetPaletteByte(u8 index);
+    u8 GetColorByte(u32 color);
+    void ResolvePaletteBytes();
 public:
     GameBoyPpu(GameBoy *gameBoy, IHostSystem *host, u8 *videoRam, u8 *oamRam);
     ~GameBoyPpu();
 
     void ExecuteCycle();
+
+    // hand the sleeping cycles to the caller, which can skip calling ExecuteCycle until they are used up
+    u16 TakeSleepCycles()
+    {
+        u16 cycles = _state.sleepCycles;
+        _state.tick += cycles;
+        _state.sleepCycles = 0;
+        _cycleCount += cycles;
+        return cycles;
+    }
+
+    // give back any sleeping cycles that weren't used yet (before the PPU is accessed)
+    void ReturnSleepCycles(u16 cycles)
+    {
+        _state.tick -= cycles;
+        _state.sleepCycles = cycles;
+        _cycleCount -= cycles;
+    }
+
+    // includes sleeping cycles that were taken but not used yet
+    u64 GetCycleCount() { return _cycleCount; }
     u8 ReadRegister(u16 addr);
     void Reset();
     void WriteRegister(u16 addr, u8 val);
@@ -224,6 +489,58 @@ public:
 
     u32 *GetPixelBuffer() { return _pixelBuffer; }
 
-    void LoadState(std::ifstream &inState);
-    void SaveState(std::ofstream &outState);
+    // the pixel buffer isn't drawn to for the byte formats, frames are in the byte buffer (160x144) instead
+    void SetOutputFormat(PpuOutputFormat format);
+    PpuOutputFormat GetOutputFormat() { return _outputFormat; }
+    const u8 *GetByteBuffer() { return _byteBuffer; }
+
+    // frames are pushed to the observer in its format instead of to the host, nullptr goes back to RGBA
+    void SetObserver(FrameObserver *observer);
+
+    // fills in the tiles and sprites on screen as of now, normally called once a frame has finished
+    void GetObservation(PpuObservation &observation);
+    const PpuState &GetState() { return _state; }
+
+    u8 GetFrameSkip() { return _frameSkip; }
+    void SetFrameSkip(u8 frameSkip) { _frameSkip = frameSkip; }
+
+    bool IsHeadless() { return _headless; }
+    bool IsFrameRequested() { return _frameRequested; }
+    void SetHeadless(bool headless) { _headless = headless; }
+    void RequestFrame() { _frameRequested = true; }
+
+    // frame skip, headless and the frames counted towards them as the other PPU has them
+    void CopyFrameSkip(const GameBoyPpu &other);
+
+    void SetHost(IHostSystem *host) { _host = host; }
+    void SetDeferred(bool deferred);
+    void SetReplica(bool replica) { _replica = replica; }
+
+    u8 TakeReplicaIrqs()
+    {
+        u8 irqs = _replicaIrqs;
+        _replicaIrqs = 0;
+        return irqs;
+    }
+
+    void SetKeepDrawingEnds(bool keep) { _keepDrawingEnds = keep; }
+    const u16 *GetLineDrawingEnds() { return _lineDrawingEnd; }
+
+    // while the CPU runs ahead on predicted timing this PPU isn't stepped, LY and the mode are set
+    // from the prediction instead so STAT/LY reads and the VRAM/OAM access checks go by it
+    void SetPredictedTiming(u16 tick, u8 scanline, u8 ly, u8 mode)
+    {
+        _state.tick = tick;
+        _state.scanline = scanline;
+        _state.ly = ly;
+        _state.lcdMode = mode;
+        _state.lyCoincident = (ly == _state.lyCompare);
+    }
+
+    // timingOnly leaves the frame state alone, for a PPU that doesn't draw its frames itself
+    void SaveCheckpoint(PpuCheckpoint &checkpoint);
+    void LoadCheckpoint(const PpuCheckpoint &checkpoint, bool timingOnly);
+
+    void LoadState(std::istream &inState);
+    void SaveState(std::ostream &outState);
 };
\ No newline at end of file
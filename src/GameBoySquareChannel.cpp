@@ -3,6 +3,7 @@
 #include <iostream>
 
 constexpr s8 GameBoySquareChannel::DutyTable[4][8];
+constexpr u8 GameBoySquareChannel::DutyEdgeTable[4][8];
 
 GameBoySquareChannel::GameBoySquareChannel(GameBoyApu *apu)
 {
@@ -27,10 +28,8 @@ void GameBoySquareChannel::SetEnabled(bool val)
     _state.enabled = val;
 }
 
-void GameBoySquareChannel::Execute(u32 cycles)
+void GameBoySquareChannel::UpdateOutput()
 {
-    _state.timer -= cycles;
-
     if (_state.enabled)
     {
         _state.output = GameBoySquareChannel::DutyTable[_state.dutyCycleSelect][_state.dutyCyclePosition] * _state.volume;
@@ -39,18 +38,60 @@ void GameBoySquareChannel::Execute(u32 cycles)
     {
         _state.output = 0;
     }
+}
+
+void GameBoySquareChannel::Execute(u32 cycles)
+{
+    // catch up all timer reloads in the span at once, the frequency can't change in the middle of it
+    u32 remaining = GetRemainingCycles();
+    if (cycles < remaining)
+    {
+        _state.timer = remaining - cycles;
+        return;
+    }
+
+    cycles -= remaining;
+    u32 period = (2048 - _state.frequency) * 4;
+    u32 steps = 1 + (cycles / period);
+
+    _state.timer = period - (cycles % period);
+    _state.dutyCyclePosition = (_state.dutyCyclePosition + steps) & 0x07;
+}
+
+void GameBoySquareChannel::Synthesize(u32 cycle, u32 cycles, s32 leftVolume, s32 rightVolume)
+{
+    u32 remaining = GetRemainingCycles();
+    if (cycles < remaining)
+    {
+        _state.timer = remaining - cycles;
+        return;
+    }
 
-    //std::cout << int(_state.frequency) << std::endl;
+    // duty steps happen at cycle + remaining and every period after that, jump from edge to edge
+    u32 period = (2048 - _state.frequency) * 4;
+    u32 steps = 1 + ((cycles - remaining) / period);
+    u32 stepsDone = 0;
+    u8 position = _state.dutyCyclePosition;
 
-    // check if frequency timer is triggered
-    if (_state.timer == 0)
+    while (true)
     {
-        // reload timer
-        _state.timer = (2048 - _state.frequency) * 4;
+        u32 distance = DutyEdgeTable[_state.dutyCycleSelect][position];
+        if ((stepsDone + distance) > steps)
+        {
+            break;
+        }
 
-        // advance to next position in duty cycle
-        _state.dutyCyclePosition = (_state.dutyCyclePosition + 1) & 0x07;
+        stepsDone += distance;
+        position = (position + distance) & 0x07;
+
+        s8 output = GameBoySquareChannel::DutyTable[_state.dutyCycleSelect][position] * _state.volume;
+        s32 delta = output - _state.output;
+        _apu->AddOutputDelta(cycle + remaining + (stepsDone - 1) * period, delta * leftVolume, delta * rightVolume);
+        _state.output = output;
     }
+
+    _state.timer = period - ((cycles - remaining) % period);
+    _state.dutyCyclePosition = (_state.dutyCyclePosition + steps) & 0x07;
 }
 
 void GameBoySquareChannel::TickCounter()
@@ -253,12 +294,12 @@ void GameBoySquareChannel::WriteRegister(u16 addr, u8 val)
     }
 }
 
-void GameBoySquareChannel::LoadState(std::ifstream &inState)
+void GameBoySquareChannel::LoadState(std::istream &inState)
 {
     inState.read((char *)&_state, sizeof(SquareChannelState));
 }
 
-void GameBoySquareChannel::SaveState(std::ofstream &outState)
+void GameBoySquareChannel::SaveState(std::ostream &outState)
 {
     outState.write((char *)&_state, sizeof(SquareChannelState));
 }
\ No newline at end of file
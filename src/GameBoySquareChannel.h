@@ -78,6 +78,14 @@ private:
         { 0, 0, 0, 0, 0, 0, 1, 1 }  // 75%
     };
 
+    // duty steps from each position until the output flips
+    static constexpr u8 DutyEdgeTable[4][8] = {
+        { 1, 7, 6, 5, 4, 3, 2, 1 },
+        { 2, 1, 6, 5, 4, 3, 2, 1 },
+        { 4, 3, 2, 1, 4, 3, 2, 1 },
+        { 6, 5, 4, 3, 2, 1, 2, 1 }
+    };
+
     GameBoyApu *_apu;
 
     SquareChannelState _state;
@@ -88,12 +96,22 @@ public:
     ~GameBoySquareChannel();
 
     inline s8 GetOutput() { return _state.output; }
-    inline u16 GetTimer() { return _state.timer; }
+
+    // cycles until the duty position steps, a timer of 0 wraps around first
+    inline u32 GetRemainingCycles() { return _state.timer ? _state.timer : 0x10000; }
+
+    // output can only change at a duty step while this is true, otherwise it stays at 0
+    inline bool IsAudible() { return _state.enabled && (_state.volume > 0); }
+    void UpdateOutput();
 
     bool IsEnabled() { return _state.enabled; }
     void SetEnabled(bool val);
 
     void Execute(u32 cycles);
+
+    // same as Execute, but also sends each edge of the waveform to the APU at the cycle it happens,
+    // the output has to be up to date and the channel audible
+    void Synthesize(u32 cycle, u32 cycles, s32 leftVolume, s32 rightVolume);
     void TickCounter();
     void TickFrequencyEnvelope();
     void TickVolumeEnvelope();
@@ -101,6 +119,6 @@ public:
     u8 ReadRegister(u16 addr);
     void WriteRegister(u16 addr, u8 val);
 
-    void LoadState(std::ifstream &inState);
-    void SaveState(std::ofstream &outState);
+    void LoadState(std::istream &inState);
+    void SaveState(std::ostream &outState);
 };
\ No newline at end of file
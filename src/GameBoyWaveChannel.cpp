@@ -1,4 +1,5 @@
 #include "GameBoyWaveChannel.h"
+#include "GameBoyApu.h"
 
 GameBoyWaveChannel::GameBoyWaveChannel(GameBoyApu *apu)
 {
@@ -29,7 +30,7 @@ void GameBoyWaveChannel::SetEnabled(bool val)
     _state.enabled = val;
 }
 
-void GameBoyWaveChannel::Execute(u32 cycles)
+void GameBoyWaveChannel::UpdateOutput()
 {
     if (_state.enabled && _state.volume)
     {
@@ -39,26 +40,71 @@ void GameBoyWaveChannel::Execute(u32 cycles)
     {
         _state.output = 0;
     }
+}
 
-    _state.timer -= cycles;
-    if (_state.timer == 0)
+void GameBoyWaveChannel::Execute(u32 cycles)
+{
+    u32 remaining = GetRemainingCycles();
+    if (cycles < remaining)
     {
-        // "The wave channel's frequency timer period is set to (2048-frequency)*2"
-        _state.timer = (2048 - _state.frequency) * 2;
+        _state.timer = remaining - cycles;
+        return;
+    }
 
-        _state.position++;
-        _state.position &= 0x1F; // loops
+    // "The wave channel's frequency timer period is set to (2048-frequency)*2"
+    cycles -= remaining;
+    u32 period = (2048 - _state.frequency) * 2;
+    u32 steps = 1 + (cycles / period);
 
-        // alternate between upper and lower nibbles (4-bit samples)
-        if (_state.position & 0x01)
-        {
-            _state.waveBuffer = _state.waveRam[_state.position >> 1] & 0x0F;
-        }
-        else
+    _state.timer = period - (cycles % period);
+    _state.position = (_state.position + steps) & 0x1F; // loops
+
+    // only the last sample read is still in the buffer
+    ReadSample();
+}
+
+void GameBoyWaveChannel::Synthesize(u32 cycle, u32 cycles, s32 leftVolume, s32 rightVolume)
+{
+    u32 remaining = GetRemainingCycles();
+    if (cycles < remaining)
+    {
+        _state.timer = remaining - cycles;
+        return;
+    }
+
+    u32 period = (2048 - _state.frequency) * 2;
+    u8 shift = _state.volume - 1;
+
+    // a sample is read at cycle + remaining and every period after that
+    u32 offset = remaining;
+    for (; offset <= cycles; offset += period)
+    {
+        _state.position = (_state.position + 1) & 0x1F;
+        ReadSample();
+
+        s8 output = _state.waveBuffer >> shift;
+        if (output != _state.output)
         {
-            _state.waveBuffer = _state.waveRam[_state.position >> 1] >> 4;
+            s32 delta = output - _state.output;
+            _apu->AddOutputDelta(cycle + offset, delta * leftVolume, delta * rightVolume);
+            _state.output = output;
         }
     }
+
+    _state.timer = offset - cycles;
+}
+
+void GameBoyWaveChannel::ReadSample()
+{
+    // alternate between upper and lower nibbles (4-bit samples)
+    if (_state.position & 0x01)
+    {
+        _state.waveBuffer = _state.waveRam[_state.position >> 1] & 0x0F;
+    }
+    else
+    {
+        _state.waveBuffer = _state.waveRam[_state.position >> 1] >> 4;
+    }
 }
 
 void GameBoyWaveChannel::TickCounter()
@@ -145,12 +191,12 @@ void GameBoyWaveChannel::WriteWaveRam(u8 addr, u8 val)
     _state.waveRam[addr & 0x0F] = val;
 }
 
-void GameBoyWaveChannel::LoadState(std::ifstream &inState)
+void GameBoyWaveChannel::LoadState(std::istream &inState)
 {
     inState.read((char *)&_state, sizeof(WaveChannelState));
 }
 
-void GameBoyWaveChannel::SaveState(std::ofstream &outState)
+void GameBoyWaveChannel::SaveState(std::ostream &outState)
 {
     outState.write((char *)&_state, sizeof(WaveChannelState));
 }
\ No newline at end of file
@@ -43,17 +43,29 @@ class GameBoyWaveChannel
 private:
     WaveChannelState _state;
     GameBoyApu *_apu;
+
+    inline void ReadSample();
 public:
     GameBoyWaveChannel(GameBoyApu *apu);
     ~GameBoyWaveChannel();
 
     inline s8 GetOutput() { return _state.output; }
-    inline u8 GetTimer() { return _state.timer; }
+
+    // cycles until the next sample is read, a timer of 0 wraps around first
+    inline u32 GetRemainingCycles() { return _state.timer ? _state.timer : 0x10000; }
+
+    // output can only change when a sample is read while this is true, otherwise it stays at 0
+    inline bool IsAudible() { return _state.enabled && (_state.volume > 0); }
+    void UpdateOutput();
 
     bool IsEnabled() { return _state.enabled; }
     void SetEnabled(bool val);
 
     void Execute(u32 cycles);
+
+    // same as Execute, but also sends each change in the output to the APU at the cycle it happens,
+    // the output has to be up to date and the channel audible
+    void Synthesize(u32 cycle, u32 cycles, s32 leftVolume, s32 rightVolume);
     void TickCounter();
     void TickVolumeEnvelope();
 
@@ -63,6 +75,6 @@ public:
     u8 ReadWaveRam(u8 addr);
     void WriteWaveRam(u8 addr, u8 val);
 
-    void LoadState(std::ifstream &inState);
-    void SaveState(std::ofstream &outState);
+    void LoadState(std::istream &inState);
+    void SaveState(std::ostream &outState);
 };
\ No newline at end of file
@@ -23,6 +23,9 @@ enum HostButton : u16
     Menu   = 0x100,
 };
 
+// size of the dirty scanline bitmap passed with each video frame (1 bit per scanline)
+constexpr u32 DirtyLineWords = (144 + 31) / 32;
+
 class IHostSystem
 {
 public:
@@ -30,8 +33,20 @@ public:
     virtual bool IsButtonPressed(HostButton button) = 0;
     virtual void LoadRomFile(const char *romFile) = 0;
     virtual HostExitCode RunApp(int argc, const char *argv[]) = 0;
-    virtual void QueueAudio(s16 *buffer, u32 sampleCount) = 0;
+    // rate the audio device was opened with, the APU writes stereo frames at this rate
+    virtual u32 GetAudioSampleRate() = 0;
+
+    // lends the APU room in the host's audio queue for up to frames stereo frames, which it synthesizes
+    // straight into. frames is lowered to what fits, EndAudioWrite queues the ones that were written
+    virtual s16 *BeginAudioWrite(u32 &frames) = 0;
+    virtual void EndAudioWrite(u32 frames) = 0;
     virtual void SyncAudio() = 0;
 
-    virtual void PushVideoFrame(u32 *pixelBuffer) = 0;
+    // dirtyLines marks the scanlines that changed since the previously pushed frame,
+    // bit (y & 31) of word (y >> 5) is set for line y. nullptr means all lines changed.
+    // repeat is set when nothing the frame is drawn from changed, the pixel buffer wasn't touched since the last push
+    virtual void PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat) = 0;
+
+    // in place of PushVideoFrame for a frame that wasn't drawn (frame skip or headless), the time still passed
+    virtual void SkipVideoFrame() = 0;
 };
\ No newline at end of file
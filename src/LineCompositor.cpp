@@ -0,0 +1,80 @@
+#include "LineCompositor.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void LineCompositor::ResolvePriority(const u8 *bgLine, const u8 *spriteLine, u8 *indexLine, u32 count)
+{
+    u32 i = 0;
+
+    // sprite wins if it's opaque and either the BG pixel is color 0 or neither has the priority bit set
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i colorMask = _mm_set1_epi8(0x03);
+    const __m128i priorityMask = _mm_set1_epi8((char)0x80);
+    const __m128i bgIndexMask = _mm_set1_epi8(0x1F);
+    const __m128i spriteIndexMask = _mm_set1_epi8(0x3F);
+
+    for (; (i + 16) <= count; i += 16)
+    {
+        __m128i bg = _mm_loadu_si128((const __m128i *)(bgLine + i));
+        __m128i sprite = _mm_loadu_si128((const __m128i *)(spriteLine + i));
+
+        __m128i spriteTransparent = _mm_cmpeq_epi8(sprite, zero);
+        __m128i bgTransparent = _mm_cmpeq_epi8(_mm_and_si128(bg, colorMask), zero);
+        __m128i noPriority = _mm_cmpeq_epi8(_mm_and_si128(_mm_or_si128(sprite, bg), priorityMask), zero);
+        __m128i spriteWins = _mm_andnot_si128(spriteTransparent, _mm_or_si128(bgTransparent, noPriority));
+
+        __m128i index = _mm_or_si128(
+            _mm_and_si128(spriteWins, _mm_and_si128(sprite, spriteIndexMask)),
+            _mm_andnot_si128(spriteWins, _mm_and_si128(bg, bgIndexMask)));
+        _mm_storeu_si128((__m128i *)(indexLine + i), index);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t colorMask = vdupq_n_u8(0x03);
+    const uint8x16_t priorityMask = vdupq_n_u8(0x80);
+    const uint8x16_t bgIndexMask = vdupq_n_u8(0x1F);
+    const uint8x16_t spriteIndexMask = vdupq_n_u8(0x3F);
+
+    for (; (i + 16) <= count; i += 16)
+    {
+        uint8x16_t bg = vld1q_u8(bgLine + i);
+        uint8x16_t sprite = vld1q_u8(spriteLine + i);
+
+        uint8x16_t spriteOpaque = vtstq_u8(sprite, sprite);
+        uint8x16_t bgTransparent = vceqq_u8(vandq_u8(bg, colorMask), vdupq_n_u8(0));
+        uint8x16_t noPriority = vceqq_u8(vandq_u8(vorrq_u8(sprite, bg), priorityMask), vdupq_n_u8(0));
+        uint8x16_t spriteWins = vandq_u8(spriteOpaque, vorrq_u8(bgTransparent, noPriority));
+
+        uint8x16_t index = vbslq_u8(spriteWins,
+            vandq_u8(sprite, spriteIndexMask),
+            vandq_u8(bg, bgIndexMask));
+        vst1q_u8(indexLine + i, index);
+    }
+#endif
+
+    // remaining pixels (or everything without SIMD support)
+    ResolvePriorityScalar(bgLine + i, spriteLine + i, indexLine + i, count - i);
+}
+
+void LineCompositor::ResolvePriorityScalar(const u8 *bgLine, const u8 *spriteLine, u8 *indexLine, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+        u8 bg = bgLine[i];
+        u8 sprite = spriteLine[i];
+
+        if ((sprite != 0) &&
+            (((bg & 0x03) == 0) || (((sprite | bg) & 0x80) == 0)))
+        {
+            indexLine[i] = sprite & 0x3F;
+        }
+        else
+        {
+            indexLine[i] = bg & 0x1F;
+        }
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "shared.h"
+
+// Resolves sprite vs BG priority for a run of line pixels.
+// BG pixels are color (bits 0-1), CGB palette (bits 2-4) and CGB priority (bit 7).
+// Sprite pixels are 0 when transparent, otherwise color (bits 0-1), index into the
+// OBJ half of the palette colors (bits 0-5) and priority (bit 7).
+// Output is an index into the 64 palette colors for each pixel.
+class LineCompositor
+{
+public:
+    static void ResolvePriority(const u8 *bgLine, const u8 *spriteLine, u8 *indexLine, u32 count);
+    static void ResolvePriorityScalar(const u8 *bgLine, const u8 *spriteLine, u8 *indexLine, u32 count);
+};
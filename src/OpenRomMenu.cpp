@@ -230,7 +230,7 @@ void OpenRomMenu::RunFrame()
 
     DrawFileList();
 
-    _host->PushVideoFrame(_pixelBuffer);
+    _host->PushVideoFrame(_pixelBuffer, nullptr, false);
 }
 
 void OpenRomMenu::ScrollIntoView(std::vector<RomMenuItem>::iterator item)
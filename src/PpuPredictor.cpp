@@ -0,0 +1,255 @@
+#include "PpuPredictor.h"
+#include "GameBoy.h"
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+constexpr u64 ReportFrames = 600;
+constexpr u64 LockstepInterval = 10; // one in this many frames is timed without speculation
+
+PpuPredictor::PpuPredictor(GameBoyPpu *ppu, const std::string &title, u64 cycle)
+{
+    _ppu = ppu;
+    _title = title;
+    _lcdStatus = 0;
+    _lyCompare = 0;
+    _scrollX = 0;
+    memcpy(_lineDrawingEnd, ppu->GetLineDrawingEnds(), sizeof(_lineDrawingEnd));
+    _cycle = cycle;
+    _nextEvent = cycle;
+    _tickCycle = cycle;
+    _predicted = {};
+    _frameEnded = false;
+
+    _startCycle = cycle;
+    _reportCycle = cycle;
+    _reads = 0;
+    _accesses = 0;
+    _irqs = 0;
+    _readMisses = 0;
+    _accessMisses = 0;
+    _irqMisses = 0;
+    _runs = 0;
+    _speculatedDots = 0;
+    _rolledBackDots = 0;
+    _frames = 0;
+    _lockstepFrames = 0;
+    _seconds = 0;
+    _lockstepSeconds = 0;
+    _lockstepFrame = false;
+}
+
+void PpuPredictor::Start(const PpuCheckpoint &checkpoint, const u16 *lineDrawingEnds)
+{
+    const PpuState &state = checkpoint.state;
+    _lcdStatus = state.lcdStatus;
+    _lyCompare = state.lyCompare;
+    _scrollX = state.scrollX;
+    memcpy(_lineDrawingEnd, lineDrawingEnds, sizeof(_lineDrawingEnd));
+
+    // runs only start outside of drawing, so the drawing end isn't needed until the next line's
+    _predicted.tick = state.tick;
+    _predicted.scanline = state.scanline;
+    _predicted.ly = state.ly;
+    _predicted.mode = state.lcdMode;
+    _predicted.statLine = state.raisedStatIrq;
+    _predicted.drawingEnd = 0;
+
+    _cycle = checkpoint.cycleCount;
+    _tickCycle = _cycle;
+    _nextEvent = _cycle + (GetNextEventTick() - _predicted.tick);
+    _frameEnded = false;
+
+    _startCycle = _cycle;
+    _runs++;
+}
+
+u16 PpuPredictor::GetNextEventTick()
+{
+    const PredictedPpu &ppu = _predicted;
+    if (ppu.scanline < 144)
+    {
+        if (ppu.tick < 3)
+        {
+            return 3;
+        }
+        if (ppu.tick < 4)
+        {
+            return 4;
+        }
+        if (ppu.tick < 84)
+        {
+            return 84;
+        }
+        return (ppu.mode == LcdModeFlag::Drawing) ? ppu.drawingEnd : 456;
+    }
+
+    if ((ppu.scanline == 144) && (ppu.tick < 4))
+    {
+        return 4;
+    }
+    if ((ppu.scanline == 153) && (ppu.tick < 12))
+    {
+        return 12;
+    }
+    return 456;
+}
+
+u8 PpuPredictor::RunEvent()
+{
+    PredictedPpu &ppu = _predicted;
+    ppu.tick += (u16)(_cycle - _tickCycle);
+    _tickCycle = _cycle;
+    u8 irqs = 0;
+
+    // same events as GameBoyPpu::ExecuteCycle
+    if (ppu.scanline < 144)
+    {
+        switch (ppu.tick)
+        {
+            case 3:
+                ppu.ly = ppu.scanline;
+                break;
+            case 4:
+                ppu.mode = LcdModeFlag::OamSearch;
+                break;
+            case 84:
+                ppu.mode = LcdModeFlag::Drawing;
+                ppu.drawingEnd = _lineDrawingEnd[ppu.scanline] + (_scrollX & 0x07);
+                break;
+            case 456:
+                ppu.tick = 0;
+                ppu.scanline++;
+                if (ppu.scanline == 144)
+                {
+                    ppu.ly = ppu.scanline;
+                }
+                break;
+        }
+
+        if ((ppu.mode == LcdModeFlag::Drawing) && (ppu.tick >= ppu.drawingEnd))
+        {
+            ppu.mode = LcdModeFlag::HBlank;
+        }
+    }
+    else
+    {
+        if ((ppu.tick == 4) && (ppu.scanline == 144))
+        {
+            ppu.mode = LcdModeFlag::VBlank;
+            irqs |= IrqFlag::VBlank;
+            _frameEnded = true;
+        }
+        else if ((ppu.tick == 12) && (ppu.scanline == 153))
+        {
+            ppu.ly = 0;
+        }
+        else if (ppu.tick == 456)
+        {
+            ppu.tick = 0;
+            ppu.scanline++;
+            if (ppu.scanline == 154)
+            {
+                ppu.scanline = 0;
+            }
+            ppu.ly = ppu.scanline;
+        }
+    }
+
+    bool statLine =
+        ((_lcdStatus & LcdStatusFlags::CoincidentScanline) && (ppu.ly == _lyCompare)) ||
+        ((_lcdStatus & LcdStatusFlags::OamSearch) && (ppu.mode == LcdModeFlag::OamSearch)) ||
+        ((_lcdStatus & LcdStatusFlags::VBlank) && (ppu.mode == LcdModeFlag::VBlank)) ||
+        ((_lcdStatus & LcdStatusFlags::HBlank) && (ppu.mode == LcdModeFlag::HBlank));
+
+    if (statLine && !ppu.statLine)
+    {
+        irqs |= IrqFlag::LcdStat;
+    }
+    ppu.statLine = statLine;
+
+    if (irqs != 0)
+    {
+        _irqs++;
+    }
+
+    _ppu->SetPredictedTiming(ppu.tick, ppu.scanline, ppu.ly, ppu.mode);
+    _nextEvent = _cycle + (GetNextEventTick() - ppu.tick);
+    return irqs;
+}
+
+void PpuPredictor::Commit()
+{
+    _speculatedDots += _cycle - _startCycle;
+}
+
+void PpuPredictor::RollBack(u8 type, u16 addr)
+{
+    // everything the CPU did since the start is run again
+    _rolledBackDots += _cycle - _startCycle;
+
+    if (type == PpuWriteType::PredictedIrq)
+    {
+        _irqMisses++;
+    }
+    else if ((type == PpuWriteType::PredictedRead) && ((addr == 0xFF41) || (addr == 0xFF44)))
+    {
+        _readMisses++;
+    }
+    else
+    {
+        _accessMisses++;
+    }
+}
+
+void PpuPredictor::EndFrame(u64 cycle, double seconds)
+{
+    if (_lockstepFrame)
+    {
+        _lockstepSeconds += seconds;
+        _lockstepFrames++;
+    }
+    else
+    {
+        _seconds += seconds;
+    }
+
+    _frames++;
+    _lockstepFrame = ((_frames % LockstepInterval) == 0);
+    if (_frames < ReportFrames)
+    {
+        return;
+    }
+
+    u64 dots = cycle - _reportCycle;
+    u64 rollbacks = _readMisses + _accessMisses + _irqMisses;
+    u64 splitFrames = _frames - _lockstepFrames;
+    double splitFrame = (splitFrames > 0) ? (_seconds / splitFrames) : 0;
+    double lockstepFrame = (_lockstepFrames > 0) ? (_lockstepSeconds / _lockstepFrames) : 0;
+
+    std::cout << std::fixed << std::setprecision(2)
+        << "PPU split [" << _title << "] " << _frames << " frames:"
+        << " STAT/LY reads " << _reads << " (" << ((_reads > 0) ? (100.0 * _readMisses / _reads) : 0) << "% mispredicted),"
+        << " VRAM/OAM accesses " << _accesses << " (" << ((_accesses > 0) ? (100.0 * _accessMisses / _accesses) : 0) << "%),"
+        << " interrupts " << _irqs << " (" << ((_irqs > 0) ? (100.0 * _irqMisses / _irqs) : 0) << "%),"
+        << " runs " << _runs << " (" << ((_runs > 0) ? (100.0 * rollbacks / _runs) : 0) << "% rolled back),"
+        << " ran ahead " << ((dots > 0) ? (100.0 * _speculatedDots / dots) : 0) << "% of dots,"
+        << " ran again " << ((dots > 0) ? (100.0 * _rolledBackDots / dots) : 0) << "%,"
+        << " frame " << (splitFrame * 1e6) << " us split against " << (lockstepFrame * 1e6) << " us lockstep,"
+        << " net speedup " << ((splitFrame > 0) ? (lockstepFrame / splitFrame) : 0) << "x" << std::endl;
+
+    _reportCycle = cycle;
+    _reads = 0;
+    _accesses = 0;
+    _irqs = 0;
+    _readMisses = 0;
+    _accessMisses = 0;
+    _irqMisses = 0;
+    _runs = 0;
+    _speculatedDots = 0;
+    _rolledBackDots = 0;
+    _frames = 0;
+    _lockstepFrames = 0;
+    _seconds = 0;
+    _lockstepSeconds = 0;
+}
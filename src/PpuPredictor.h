@@ -0,0 +1,102 @@
+#pragma once
+
+#include "shared.h"
+#include "GameBoyPpu.h"
+#include <string>
+
+// PPU timing as the CPU sees it while the real PPU runs on another thread (see GameBoy::SetSpeculativePpu).
+// Starting from a checkpoint of the real PPU it goes through the same events as GameBoyPpu::ExecuteCycle,
+// so LY, the LCD mode and the VBlank/STAT interrupts are known without fetching or drawing anything. Only
+// where drawing ends isn't, that's taken from the last frame the real PPU drew. The other thread checks
+// each prediction the CPU went by, this also counts how often they were wrong and times frames with and
+// without the split for each title.
+class PpuPredictor
+{
+private:
+    struct PredictedPpu
+    {
+        u16 tick;
+        u8 scanline;
+        u8 ly;
+        u8 mode;
+        bool statLine;
+        u16 drawingEnd; // tick where drawing is predicted to end on this line
+    };
+
+    GameBoyPpu *_ppu; // gets the predicted timing, which reads and access checks go by
+    std::string _title;
+
+    // registers the prediction depends on, LCDC/STAT/LYC writes end the run so only SCX changes during it
+    u8 _lcdStatus;
+    u8 _lyCompare;
+    u8 _scrollX;
+
+    // drawing ends the real PPU saw on each line, less SCX's fine scroll
+    u16 _lineDrawingEnd[144];
+
+    u64 _cycle; // dots run, counted like GameBoyPpu::GetCycleCount
+    u64 _nextEvent; // dot where the timing can change next, nothing happens in between
+    u64 _tickCycle; // dot _predicted.tick is at
+    PredictedPpu _predicted;
+    bool _frameEnded;
+
+    // counters since the last report
+    u64 _startCycle; // dot the current run started at
+    u64 _reportCycle;
+    u64 _reads;
+    u64 _accesses;
+    u64 _irqs;
+    u64 _readMisses;
+    u64 _accessMisses;
+    u64 _irqMisses;
+    u64 _runs;
+    u64 _speculatedDots; // run ahead and checked out
+    u64 _rolledBackDots; // run ahead and run again after a rollback
+    u64 _frames;
+    u64 _lockstepFrames;
+    double _seconds;
+    double _lockstepSeconds;
+
+    // frame runs without speculation, timed to compare against
+    bool _lockstepFrame;
+
+    u8 RunEvent();
+    u16 GetNextEventTick();
+public:
+    PpuPredictor(GameBoyPpu *ppu, const std::string &title, u64 cycle);
+
+    // a run starts from a checkpoint of the real PPU and the drawing ends it saw
+    void Start(const PpuCheckpoint &checkpoint, const u16 *lineDrawingEnds);
+
+    // one dot on predicted timing, returns the interrupts raised on it
+    u8 Step()
+    {
+        if (++_cycle < _nextEvent)
+        {
+            return 0;
+        }
+        return RunEvent();
+    }
+
+    u64 GetCycle() { return _cycle; }
+    void SetScrollX(u8 scrollX) { _scrollX = scrollX; }
+
+    // predictions the CPU went by, interrupts are counted by Step
+    void CountRead() { _reads++; }
+    void CountAccess() { _accesses++; }
+
+    // the run ends, either everything checked out or the first wrong prediction was this access
+    void Commit();
+    void RollBack(u8 type, u16 addr);
+
+    // VBlank started during the run, its frame is presented once the run checked out
+    bool IsFrameEnded() { return _frameEnded; }
+
+    bool IsLockstepFrame() { return _lockstepFrame; }
+
+    // since the last report, or since it was created while nothing is reported
+    u64 GetRollBacks() { return _readMisses + _accessMisses + _irqMisses; }
+
+    // a frame took this long, the counters are printed every few hundred frames
+    void EndFrame(u64 cycle, double seconds);
+};
@@ -1,6 +1,9 @@
 #include "SdlApp.h"
 #include "OpenRomMenu.h"
+#include "VideoCaptureReader.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 
@@ -8,13 +11,35 @@
 const int SCREEN_WIDTH = 320*3;
 const int SCREEN_HEIGHT = 240*3;
 
+// milliseconds of audio the rate control keeps queued, emulation waits if the queue gets past the maximum
+const u32 AUDIO_TARGET_LATENCY = 40;
+const u32 AUDIO_MAX_LATENCY = 100;
+
+// most frames the APU writes to the audio ring at once
+const u32 AUDIO_WRITE_FRAMES = 4096;
+
 SdlApp::SdlApp()
 {
     _window = nullptr;
     _renderer = nullptr;
     _frameTexture = nullptr;
+    _frameTextureWidth = 0;
+    _frameTextureHeight = 0;
+    _lastPixelBuffer = nullptr;
+    _lastSubmittedBuffer = nullptr;
     _audioDevice = 0;
+    _audioTargetFrames = 0;
+    _audioMaxFrames = 0;
+    _audioStarted = false;
     _menuEnable = false;
+    _deferredRendering = false;
+    _deferredAudio = false;
+    _speculativePpu = false;
+    _ppuPredictionStats = false;
+    _resamplerQuality = ResamplerQuality::Off;
+#ifdef USE_STEP_SYNTH
+    _synthQuality = StepSynthQuality::Good;
+#endif
 }
 
 SdlApp::~SdlApp()
@@ -67,7 +92,7 @@ bool SdlApp::Initialize()
     SDL_RenderClear(_renderer);
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
 
-    _frameTexture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, 160, 144);
+    SetFrameTextureSize(160, 144);
 
     SDL_AudioSpec requestedAudioSpec;
     memset(&requestedAudioSpec, 0, sizeof(requestedAudioSpec));
@@ -75,13 +100,22 @@ bool SdlApp::Initialize()
     requestedAudioSpec.format = AUDIO_S16SYS;
     requestedAudioSpec.channels = 2;
     requestedAudioSpec.silence = 0;
-    requestedAudioSpec.samples = 4096;
-    requestedAudioSpec.callback = nullptr;
+    requestedAudioSpec.samples = 1024;
+    requestedAudioSpec.callback = AudioCallback;
+    requestedAudioSpec.userdata = this;
 
-    _audioDevice = SDL_OpenAudioDevice(nullptr, 0, &requestedAudioSpec, &_audioSpec, 0);
+    // the device's own rate saves SDL from resampling again, the APU resamples to whatever it is
+    _audioDevice = SDL_OpenAudioDevice(nullptr, 0, &requestedAudioSpec, &_audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
     if (_audioDevice > 0)
     {
-        SDL_PauseAudioDevice(_audioDevice, 0); // start playing
+        // the device pulls whole buffers, the queue has to stay deeper than that
+        _audioTargetFrames = std::max<u32>(_audioSpec.freq * AUDIO_TARGET_LATENCY / 1000, _audioSpec.samples * 2);
+        _audioMaxFrames = std::max<u32>(_audioSpec.freq * AUDIO_MAX_LATENCY / 1000, _audioTargetFrames * 2);
+
+        // room for the maximum queue plus what the APU writes before the next SyncAudio
+        _audioRing.reset(new AudioRing(_audioMaxFrames * 2, AUDIO_WRITE_FRAMES));
+
+        // the device stays paused until SyncAudio has queued the target (see SyncAudio)
         //std::cout << "Started playing: " << SDL_GetAudioDeviceName(2,0) << std::endl;
         //std::cout << "frequency " << _audioSpec.freq << std::endl;
     }
@@ -130,13 +164,102 @@ bool SdlApp::IsButtonPressed(HostButton button)
 void SdlApp::LoadRomFile(const char *romFile)
 {
     _gameBoy.reset(new GameBoy(GameBoyModel::Auto, romFile, this));
+    _gameBoy->SetDeferredRendering(_deferredRendering);
+    _gameBoy->SetPpuPredictionStats(_ppuPredictionStats);
+    _gameBoy->SetAudioResampler(_resamplerQuality);
+#ifdef USE_STEP_SYNTH
+    _gameBoy->SetAudioSynthQuality(_synthQuality);
+#endif
+    _gameBoy->SetDeferredAudio(_deferredAudio);
+    _gameBoy->SetSpeculativePpu(_speculativePpu);
     _menuEnable = false;
 }
 
 HostExitCode SdlApp::RunApp(int argc, const char *argv[])
 {
-    const char *romFile = (argc > 1) ? argv[1] : "tetris.gb";
+    const char *romFile = "tetris.gb";
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--capture") == 0) && ((i + 1) < argc))
+        {
+            if (!_capture.Open(argv[++i]))
+            {
+                std::cerr << "Failed to open capture file " << argv[i] << std::endl;
+            }
+        }
+        else if (strcmp(argv[i], "--deferred-ppu") == 0)
+        {
+            _deferredRendering = true;
+        }
+        else if (strcmp(argv[i], "--deferred-apu") == 0)
+        {
+            _deferredAudio = true;
+        }
+        else if (strcmp(argv[i], "--speculative-ppu") == 0)
+        {
+            _speculativePpu = true;
+        }
+        else if (strcmp(argv[i], "--ppu-stats") == 0)
+        {
+            _ppuPredictionStats = true;
+        }
+        else if ((strcmp(argv[i], "--resampler") == 0) && ((i + 1) < argc))
+        {
+            const char *quality = argv[++i];
+            if (strcmp(quality, "low") == 0)
+            {
+                _resamplerQuality = ResamplerQuality::Low;
+            }
+            else if (strcmp(quality, "medium") == 0)
+            {
+                _resamplerQuality = ResamplerQuality::Medium;
+            }
+            else if (strcmp(quality, "high") == 0)
+            {
+                _resamplerQuality = ResamplerQuality::High;
+            }
+            else
+            {
+                std::cerr << "Unknown resampler quality " << quality << std::endl;
+            }
+        }
+#ifdef USE_STEP_SYNTH
+        else if ((strcmp(argv[i], "--synth") == 0) && ((i + 1) < argc))
+        {
+            const char *quality = argv[++i];
+            if (strcmp(quality, "cheap") == 0)
+            {
+                _synthQuality = StepSynthQuality::Cheap;
+            }
+            else if (strcmp(quality, "good") == 0)
+            {
+                _synthQuality = StepSynthQuality::Good;
+            }
+            else if (strcmp(quality, "best") == 0)
+            {
+                _synthQuality = StepSynthQuality::Best;
+            }
+            else
+            {
+                std::cerr << "Unknown synth quality " << quality << std::endl;
+            }
+        }
+#endif
+        else
+        {
+            romFile = argv[i];
+        }
+    }
+
     _gameBoy.reset(new GameBoy(GameBoyModel::Auto, romFile, this));
+    _gameBoy->SetDeferredRendering(_deferredRendering);
+    _gameBoy->SetPpuPredictionStats(_ppuPredictionStats);
+    _gameBoy->SetAudioResampler(_resamplerQuality);
+#ifdef USE_STEP_SYNTH
+    _gameBoy->SetAudioSynthQuality(_synthQuality);
+#endif
+    _gameBoy->SetDeferredAudio(_deferredAudio);
+    _gameBoy->SetSpeculativePpu(_speculativePpu);
 
     SDL_Event event;
     bool running = true;
@@ -162,6 +285,21 @@ HostExitCode SdlApp::RunApp(int argc, const char *argv[])
                 case SDL_QUIT:
                     running = false;
                     break;
+
+                case SDL_KEYDOWN:
+                    if (event.key.repeat)
+                    {
+                        break;
+                    }
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F1)
+                    {
+                        CyclePostFilter();
+                    }
+                    else if (event.key.keysym.scancode == SDL_SCANCODE_F2)
+                    {
+                        _postProcessor.SetGhosting(!_postProcessor.IsGhostingEnabled());
+                    }
+                    break;
             }
         }
 
@@ -174,32 +312,202 @@ HostExitCode SdlApp::RunApp(int argc, const char *argv[])
         menuPressed = IsButtonPressed(HostButton::Menu);
     }
 
+    if ((_audioRing != nullptr) && ((_audioRing->GetUnderruns() > 0) || (_audioRing->GetOverruns() > 0)))
+    {
+        std::cout << "Audio underruns: " << _audioRing->GetUnderruns() << " frames, overruns: "
+            << _audioRing->GetOverruns() << " frames" << std::endl;
+    }
+
     return HostExitCode::Success;
 }
 
-void SdlApp::QueueAudio(s16 *buffer, u32 sampleCount)
+u32 SdlApp::GetAudioSampleRate()
+{
+    return (_audioDevice > 0) ? _audioSpec.freq : 44100;
+}
+
+void SDLCALL SdlApp::AudioCallback(void *userdata, Uint8 *stream, int len)
+{
+    SdlApp *app = (SdlApp *)userdata;
+    app->_audioRing->Read((s16 *)stream, len / (2 * sizeof(s16)));
+}
+
+s16 *SdlApp::BeginAudioWrite(u32 &frames)
 {
-    SDL_QueueAudio(_audioDevice, buffer, sampleCount * 2 * sizeof(s16));
+    if (_audioRing == nullptr)
+    {
+        frames = 0;
+        return nullptr;
+    }
+    return _audioRing->BeginWrite(frames);
+}
+
+void SdlApp::EndAudioWrite(u32 frames)
+{
+    if (_audioRing != nullptr)
+    {
+        _audioRing->EndWrite(frames);
+    }
 }
 
 void SdlApp::SyncAudio()
 {
-    u32 maxBytes = 2940 * 8;
+    if (_audioRing == nullptr)
+    {
+        return;
+    }
+
+    u32 queuedFrames = _audioRing->GetQueuedFrames();
+    if (!_audioStarted && (queuedFrames >= _audioTargetFrames))
+    {
+        // starting with the queue at the target, underruns from here on mean emulation fell behind
+        SDL_PauseAudioDevice(_audioDevice, 0);
+        _audioStarted = true;
+    }
+
+    // start skipping frames if the queue shows that emulation can't keep up
+    _gameBoy->SetFrameSkip(_frameSkip.Update(queuedFrames, _audioTargetFrames));
+
+    // vsync paces emulation at the display's rate, which drifts from the audio device's. produce a
+    // little more or less audio to keep the queue at the target instead of waiting on it every frame
+    _gameBoy->SetAudioRateAdjustment(_audioRate.Update(queuedFrames, _audioTargetFrames));
+
+    // without vsync (or on a faster display) the audio device is the clock. sleep until the queue is
+    // back under the maximum rather than spinning on it
+    u32 framesPerMs = _audioSpec.freq / 1000;
+    while (queuedFrames > _audioMaxFrames)
+    {
+        SDL_Delay(std::max<u32>((queuedFrames - _audioMaxFrames) / framesPerMs, 1));
+        queuedFrames = _audioRing->GetQueuedFrames();
+    }
+}
+
+void SdlApp::SetFrameTextureSize(u32 width, u32 height)
+{
+    if ((_frameTexture != nullptr) && (width == _frameTextureWidth) && (height == _frameTextureHeight))
+    {
+        return;
+    }
 
-    while (SDL_GetQueuedAudioSize(_audioDevice) > maxBytes)
+    if (_frameTexture != nullptr)
     {
+        SDL_DestroyTexture(_frameTexture);
     }
+
+    _frameTexture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    _frameTextureWidth = width;
+    _frameTextureHeight = height;
+
+    // new texture doesn't hold any frame yet
+    _lastPixelBuffer = nullptr;
 }
 
-void SdlApp::PushVideoFrame(u32 *pixelBuffer)
+void SdlApp::CyclePostFilter()
 {
-    SDL_UpdateTexture(_frameTexture, nullptr, pixelBuffer, 160 * sizeof(u32));
+    // off -> 3x nearest -> 2x Scale2x -> 4x Scale2x -> off
+    switch (_postProcessor.GetFilter())
+    {
+        case PostFilter::None:
+            _postProcessor.SetFilter(PostFilter::Nearest, 3);
+            break;
+        case PostFilter::Nearest:
+            _postProcessor.SetFilter(PostFilter::Scale2x, 2);
+            break;
+        case PostFilter::Scale2x:
+            if (_postProcessor.GetScale() < 4)
+            {
+                _postProcessor.SetFilter(PostFilter::Scale2x, 4);
+            }
+            else
+            {
+                _postProcessor.SetFilter(PostFilter::None, 1);
+            }
+            break;
+    }
+}
+
+void SdlApp::PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat)
+{
+    _capture.PushFrame(pixelBuffer, repeat);
+
+    if (_postProcessor.IsEnabled())
+    {
+        // ghosting keeps fading towards a repeated frame, otherwise there's nothing new to process
+        if (!repeat || (pixelBuffer != _lastSubmittedBuffer) || _postProcessor.IsGhostingEnabled())
+        {
+            _lastSubmittedBuffer = _postProcessor.Submit(pixelBuffer) ? pixelBuffer : nullptr;
+        }
+
+        // show whatever the worker finished last, never wait for the frame that was just submitted
+        PostFrame frame;
+        if (_postProcessor.AcquireOutput(frame))
+        {
+            SetFrameTextureSize(frame.width, frame.height);
+            SDL_UpdateTexture(_frameTexture, nullptr, frame.pixels, frame.width * sizeof(u32));
+        }
+
+        // texture doesn't hold an unprocessed frame
+        _lastPixelBuffer = nullptr;
+    }
+    else
+    {
+        _lastSubmittedBuffer = nullptr;
+        SetFrameTextureSize(160, 144);
+
+        if (repeat && (pixelBuffer == _lastPixelBuffer))
+        {
+            // texture already has this frame
+        }
+        else if ((dirtyLines == nullptr) || (pixelBuffer != _lastPixelBuffer))
+        {
+            // texture holds something else (i.e. the menu), upload everything
+            SDL_UpdateTexture(_frameTexture, nullptr, pixelBuffer, 160 * sizeof(u32));
+            _lastPixelBuffer = pixelBuffer;
+        }
+        else
+        {
+            // only upload runs of scanlines that changed
+            int y = 0;
+            while (y < 144)
+            {
+                if ((dirtyLines[y >> 5] & ((u32)1 << (y & 0x1F))) == 0)
+                {
+                    y++;
+                    continue;
+                }
+
+                SDL_Rect rect = { 0, y, 160, 0 };
+                while ((y < 144) && (dirtyLines[y >> 5] & ((u32)1 << (y & 0x1F))))
+                {
+                    y++;
+                }
+                rect.h = y - rect.y;
+
+                SDL_UpdateTexture(_frameTexture, &rect, pixelBuffer + rect.y * 160, 160 * sizeof(u32));
+            }
+        }
+    }
+
     SDL_RenderCopy(_renderer, _frameTexture, nullptr, nullptr);
     SDL_RenderPresent(_renderer);
 }
 
+void SdlApp::SkipVideoFrame()
+{
+    // the window keeps the last frame, the capture still has to account for the time
+    _capture.SkipFrame();
+}
+
 int main(int argc, char *argv[])
 {
+    // beargb_sdl --convert-capture <capture> <output.y4m | ppm prefix/pattern> [first frame] [frame count]
+    if ((argc > 3) && (strcmp(argv[1], "--convert-capture") == 0))
+    {
+        u32 firstFrame = (argc > 4) ? strtoul(argv[4], nullptr, 10) : 0;
+        u32 frameCount = (argc > 5) ? strtoul(argv[5], nullptr, 10) : 0;
+        return VideoCaptureReader::Convert(argv[2], argv[3], firstFrame, frameCount) ? 0 : 1;
+    }
+
     SdlApp app;
 
     if (!app.Initialize())
@@ -1,6 +1,11 @@
 #pragma once
 
 #include "GameBoy.h"
+#include "FrameSkipController.h"
+#include "AudioRateController.h"
+#include "AudioRing.h"
+#include "FramePostProcessor.h"
+#include "VideoCapture.h"
 #include "IHostSystem.h"
 #include <SDL.h>
 #include <memory>
@@ -14,12 +19,38 @@ private:
     SDL_Window *_window;
     SDL_Renderer *_renderer;
     SDL_Texture *_frameTexture;
+    u32 _frameTextureWidth;
+    u32 _frameTextureHeight;
+    u32 *_lastPixelBuffer;
+    u32 *_lastSubmittedBuffer; // last frame handed to the post-processor
     const u8 *_keyboardState;
 
     SDL_AudioSpec _audioSpec;
     SDL_AudioDeviceID _audioDevice;
+    std::unique_ptr<AudioRing> _audioRing; // drained by AudioCallback on SDL's audio thread
+    u32 _audioTargetFrames; // queue depth the rate control aims for
+    u32 _audioMaxFrames; // emulation waits while more than this is queued
+    bool _audioStarted;
+
+    FrameSkipController _frameSkip;
+    AudioRateController _audioRate;
+    FramePostProcessor _postProcessor;
+    VideoCapture _capture;
 
     bool _menuEnable;
+    bool _deferredRendering; // --deferred-ppu, draw frames on a render thread
+    bool _deferredAudio; // --deferred-apu, synthesize audio on an audio thread
+    bool _speculativePpu; // --speculative-ppu, run the CPU ahead of the PPU thread on predicted timing
+    bool _ppuPredictionStats; // --ppu-stats, print the misprediction rates and speedup of --speculative-ppu
+    ResamplerQuality _resamplerQuality; // --resampler low|medium|high, otherwise the APU synthesizes at the device's rate
+#ifdef USE_STEP_SYNTH
+    StepSynthQuality _synthQuality; // --synth cheap|good|best
+#endif
+
+    static void SDLCALL AudioCallback(void *userdata, Uint8 *stream, int len);
+
+    void SetFrameTextureSize(u32 width, u32 height);
+    void CyclePostFilter();
 public:
     SdlApp();
     ~SdlApp();
@@ -28,7 +59,10 @@ public:
     bool IsButtonPressed(HostButton button) override;
     void LoadRomFile(const char *romFile) override;
     HostExitCode RunApp(int argc, const char *argv[]) override;
-    void QueueAudio(s16 *buffer, u32 sampleCount) override;
+    u32 GetAudioSampleRate() override;
+    s16 *BeginAudioWrite(u32 &frames) override;
+    void EndAudioWrite(u32 frames) override;
     void SyncAudio() override;
-    void PushVideoFrame(u32 *pixelBuffer) override;
+    void PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat) override;
+    void SkipVideoFrame() override;
 };
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include "StepSynth.h"
+#include "WindowedSinc.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+StepSynth::StepSynth()
+{
+    _width = 0;
+    _quality = StepSynthQuality::Good;
+    _capacity = 0;
+    _sampleRate = 0;
+    _clockRate = 0;
+    _offset = 0;
+    _factor = 0;
+    _accLeft = 0;
+    _accRight = 0;
+    _bassShift = 31;
+
+    SetQuality(StepSynthQuality::Good);
+}
+
+void StepSynth::SetQuality(StepSynthQuality quality)
+{
+    // the buffer is sized for the widest kernel, what's already in it stays valid
+    _quality = quality;
+    _width = (u32)quality;
+    GenerateKernel();
+}
+
+void StepSynth::GenerateKernel()
+{
+    // cut off further below nyquist with fewer taps since the transition band gets wider
+    double cutoff = (_width >= 16) ? 0.9 : ((_width >= 12) ? 0.86 : 0.8);
+    double half = _width / 2;
+
+    _kernel.resize(Phases * _width * 2);
+    std::vector<double> row(_width);
+
+    for (u32 phase = 0; phase < Phases; phase++)
+    {
+        double sum = 0;
+        for (u32 tap = 0; tap < _width; tap++)
+        {
+            // distance of the tap from the step, which is in the middle of its phase after tap (half - 1)
+            double x = tap - (half - 1) - ((phase + 0.5) / Phases);
+            row[tap] = WindowedSinc(x, cutoff, half);
+            sum += row[tap];
+        }
+
+        // every row has to add up to exactly one step or the integrated output drifts
+        s32 total = 0;
+        u32 largest = 0;
+        s16 *dest = &_kernel[phase * _width * 2];
+        for (u32 tap = 0; tap < _width; tap++)
+        {
+            s16 coefficient = (s16)floor(row[tap] / sum * (1 << KernelBits) + 0.5);
+            dest[tap * 2] = coefficient;
+            total += coefficient;
+            largest = (coefficient > dest[largest * 2]) ? tap : largest;
+        }
+        dest[largest * 2] += (s16)((1 << KernelBits) - total);
+
+        for (u32 tap = 0; tap < _width; tap++)
+        {
+            dest[tap * 2 + 1] = dest[tap * 2];
+        }
+    }
+}
+
+void StepSynth::SetSampleRate(u32 sampleRate)
+{
+    _sampleRate = sampleRate;
+    _capacity = sampleRate / 4;
+    _buffer.assign((_capacity + MaxWidth + 1) * 2, 0);
+
+    // same high-pass as Blip_Buffer's default bass_freq(16)
+    u32 shift = 13;
+    u32 f = (16 << 16) / sampleRate;
+    while ((f >>= 1) && --shift)
+    {
+    }
+    _bassShift = shift;
+
+    if (_clockRate != 0)
+    {
+        SetClockRate(_clockRate);
+    }
+    Clear();
+}
+
+void StepSynth::SetClockRate(u32 clockRate)
+{
+    _clockRate = clockRate;
+    _factor = (u64)floor((double)_sampleRate / clockRate * 4294967296.0 + 0.5);
+}
+
+void StepSynth::Clear()
+{
+    std::fill(_buffer.begin(), _buffer.end(), 0);
+    _offset = 0;
+    _accLeft = 0;
+    _accRight = 0;
+}
+
+void StepSynth::EndFrame(u32 cycles)
+{
+    _offset += cycles * _factor;
+}
+
+void StepSynth::Integrate(s16 *output, u32 frames)
+{
+    const s32 *input = &_buffer[0];
+    u32 i = 0;
+
+#if defined(__SSE2__)
+    // left and right integrate side by side in the low two lanes, packing clamps them to 16 bits
+    __m128i acc = _mm_set_epi32(0, 0, _accRight, _accLeft);
+    __m128i bass = _mm_cvtsi32_si128(_bassShift);
+    for (; i < frames; i++)
+    {
+        __m128i sample = _mm_srai_epi32(acc, KernelBits);
+        acc = _mm_sub_epi32(acc, _mm_sra_epi32(acc, bass));
+        acc = _mm_add_epi32(acc, _mm_loadl_epi64((const __m128i *)(input + i * 2)));
+        s32 packed = _mm_cvtsi128_si32(_mm_packs_epi32(sample, sample));
+        memcpy(output + i * 2, &packed, sizeof(packed));
+    }
+    _accLeft = _mm_cvtsi128_si32(acc);
+    _accRight = _mm_cvtsi128_si32(_mm_srli_si128(acc, 4));
+#elif defined(__ARM_NEON)
+    int32x2_t acc = vset_lane_s32(_accRight, vdup_n_s32(_accLeft), 1);
+    int32x2_t bass = vdup_n_s32(-_bassShift);
+    for (; i < frames; i++)
+    {
+        int32x2_t sample = vshr_n_s32(acc, KernelBits);
+        acc = vsub_s32(acc, vshl_s32(acc, bass));
+        acc = vadd_s32(acc, vld1_s32(input + i * 2));
+        int16x4_t packed = vqmovn_s32(vcombine_s32(sample, sample));
+        vst1_lane_s16(output + i * 2, packed, 0);
+        vst1_lane_s16(output + i * 2 + 1, packed, 1);
+    }
+    _accLeft = vget_lane_s32(acc, 0);
+    _accRight = vget_lane_s32(acc, 1);
+#else
+    s32 accLeft = _accLeft;
+    s32 accRight = _accRight;
+    for (; i < frames; i++)
+    {
+        s32 left = accLeft >> KernelBits;
+        s32 right = accRight >> KernelBits;
+        accLeft += input[i * 2] - (accLeft >> _bassShift);
+        accRight += input[i * 2 + 1] - (accRight >> _bassShift);
+        output[i * 2] = (s16)std::min(std::max(left, -32768), 32767);
+        output[i * 2 + 1] = (s16)std::min(std::max(right, -32768), 32767);
+    }
+    _accLeft = accLeft;
+    _accRight = accRight;
+#endif
+}
+
+u32 StepSynth::ReadSamples(s16 *output, u32 maxFrames)
+{
+    u32 frames = std::min(GetSamplesAvailable(), maxFrames);
+    if (frames == 0)
+    {
+        return 0;
+    }
+
+    Integrate(output, frames);
+
+    // the integrator already moved past them
+    u32 remaining = GetSamplesAvailable() - frames + MaxWidth + 1;
+    memmove(&_buffer[0], &_buffer[frames * 2], remaining * 2 * sizeof(s32));
+    memset(&_buffer[remaining * 2], 0, frames * 2 * sizeof(s32));
+    _offset -= (u64)frames << 32;
+    return frames;
+}
+
+void StepSynth::RemoveSamples(u32 frames)
+{
+    // rare (the host's queue is full), read them somewhere they're thrown away
+    s16 discard[256 * 2];
+    while ((frames > 0) && (GetSamplesAvailable() > 0))
+    {
+        frames -= ReadSamples(discard, std::min(frames, 256u));
+    }
+}
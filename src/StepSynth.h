@@ -0,0 +1,135 @@
+#pragma once
+
+#include "shared.h"
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// kernel width in taps, same widths as Blip_Buffer's med/good/high qualities
+enum class StepSynthQuality
+{
+    Cheap = 8,
+    Good = 12,
+    Best = 16,
+};
+
+// Band-limited step synthesis for the APU, in place of two Blip_Buffers on builds where every cycle
+// counts. Only what the APU needs: both channels share one buffer and one kernel lookup per change
+// in output, amplitudes are the mixer's (deltas within 16 bits, levels never above 16 bits either)
+// and everything is fixed point. A change adds the band-limited impulse of the step to a buffer of
+// differences, reading integrates them back into samples through the same high-pass Blip_Buffer has.
+class StepSynth
+{
+private:
+    static constexpr u32 PhaseBits = 7;
+    static constexpr u32 Phases = 1 << PhaseBits;
+
+    // a kernel row sums to this, an integrated step of delta is delta << KernelBits. shifting it back down
+    // gives samples at the mixer's amplitude, same as Blip_Synth::volume(0.5) with a range of 32767
+    static constexpr u32 KernelBits = 15;
+
+    static constexpr u32 MaxWidth = 16;
+
+    u32 _width;
+    StepSynthQuality _quality;
+
+    // Phases rows of _width coefficients, each one twice in a row (left, right) so a row lines up with
+    // the interleaved buffer and is multiplied with both deltas at once
+    std::vector<s16> _kernel;
+
+    // interleaved left/right differences, one frame per output sample plus room for the last kernel
+    std::vector<s32> _buffer;
+    u32 _capacity; // frames that can be made available before they're read
+
+    u32 _sampleRate;
+    u32 _clockRate;
+
+    // position of the frame's start in the buffer and output samples per cycle, 32.32 fixed point
+    u64 _offset;
+    u64 _factor;
+
+    s32 _accLeft;
+    s32 _accRight;
+    s32 _bassShift;
+
+    void GenerateKernel();
+    void Integrate(s16 *output, u32 frames);
+public:
+    StepSynth();
+
+    StepSynthQuality GetQuality() { return _quality; }
+    void SetQuality(StepSynthQuality quality);
+
+    // the buffer holds a quarter second, changing the sample rate clears it
+    u32 GetSampleRate() { return _sampleRate; }
+    void SetSampleRate(u32 sampleRate);
+
+    u32 GetClockRate() { return _clockRate; }
+    void SetClockRate(u32 clockRate);
+
+    // output latency in samples
+    u32 GetLatency() { return _width / 2; }
+
+    void Clear();
+
+    // the output steps by left/right at this cycle of the current frame
+    inline void AddDelta(u32 cycle, s32 left, s32 right)
+    {
+        if (((u32)(left + 32768) | (u32)(right + 32768)) > 0xFFFF)
+        {
+            // beyond what the mixer produces, the multiplies are 16-bit
+            AddDelta(cycle, left / 2, right / 2);
+            AddDelta(cycle, left - (left / 2), right - (right / 2));
+            return;
+        }
+
+        u64 time = _offset + (cycle * _factor);
+        u32 phase = (u32)(time >> (32 - PhaseBits)) & (Phases - 1);
+        const s16 *kernel = &_kernel[phase * _width * 2];
+        s32 *buffer = &_buffer[(time >> 32) * 2];
+
+#if defined(__SSE2__)
+        // 16-bit multiplies give the low and high halves of the products, unpacking them makes the 32-bit products
+        __m128i delta = _mm_set_epi16(right, left, right, left, right, left, right, left);
+        for (u32 i = 0; i < _width * 2; i += 8)
+        {
+            __m128i k = _mm_loadu_si128((const __m128i *)(kernel + i));
+            __m128i low = _mm_mullo_epi16(k, delta);
+            __m128i high = _mm_mulhi_epi16(k, delta);
+            __m128i *dest = (__m128i *)(buffer + i);
+            _mm_storeu_si128(dest, _mm_add_epi32(_mm_loadu_si128(dest), _mm_unpacklo_epi16(low, high)));
+            _mm_storeu_si128(dest + 1, _mm_add_epi32(_mm_loadu_si128(dest + 1), _mm_unpackhi_epi16(low, high)));
+        }
+#elif defined(__ARM_NEON)
+        int16x4_t delta = vreinterpret_s16_s32(vdup_n_s32((s32)((u16)left | ((u32)(u16)right << 16))));
+        for (u32 i = 0; i < _width * 2; i += 8)
+        {
+            int16x8_t k = vld1q_s16(kernel + i);
+            vst1q_s32(buffer + i, vmlal_s16(vld1q_s32(buffer + i), vget_low_s16(k), delta));
+            vst1q_s32(buffer + i + 4, vmlal_s16(vld1q_s32(buffer + i + 4), vget_high_s16(k), delta));
+        }
+#else
+        for (u32 i = 0; i < _width * 2; i += 2)
+        {
+            s32 k = kernel[i];
+            buffer[i] += k * left;
+            buffer[i + 1] += k * right;
+        }
+#endif
+    }
+
+    // the frame ends after this many cycles, its samples can be read and the next frame starts there
+    void EndFrame(u32 cycles);
+
+    u32 GetSamplesAvailable() { return (u32)(_offset >> 32); }
+
+    // reads up to maxFrames interleaved stereo frames, returns the number read
+    u32 ReadSamples(s16 *output, u32 maxFrames);
+
+    // drops samples without reading them, the level they end at carries over
+    void RemoveSamples(u32 frames);
+};
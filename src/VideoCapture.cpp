@@ -0,0 +1,406 @@
+#include "VideoCapture.h"
+#include <cstring>
+#include <utility>
+
+// frame rate of the LCD: 4194304 Hz / 70224 dots per frame
+constexpr u32 CaptureRateNumerator = 4194304;
+constexpr u32 CaptureRateDenominator = 70224;
+
+VideoCapture::VideoCapture()
+{
+    _slots = new CaptureSlot[SlotCount];
+    _head = 0;
+    _tail = 0;
+    _lastPixelBuffer = nullptr;
+    _pendingDrops = 0;
+    _droppedFrames = 0;
+    _stopWorker = false;
+
+    _keyframeInterval = DefaultKeyframeInterval;
+    _framesSinceKeyframe = 0;
+    _needKeyframe = true;
+    _paletteSize = 0;
+    _indices[0] = new u8[CaptureFrameSize];
+    _indices[1] = new u8[CaptureFrameSize];
+    _delta = new u8[CaptureFrameSize];
+    _pendingRepeats = 0;
+}
+
+VideoCapture::~VideoCapture()
+{
+    Close();
+
+    delete[] _slots;
+    delete[] _indices[0];
+    delete[] _indices[1];
+    delete[] _delta;
+}
+
+bool VideoCapture::Open(const char *fileName, u32 keyframeInterval)
+{
+    Close();
+
+    _file.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!_file.good())
+    {
+        return false;
+    }
+
+    _file.write(CaptureMagic, sizeof(CaptureMagic));
+    WriteValue<u8>(CaptureVersion);
+    WriteValue<u16>(CaptureWidth);
+    WriteValue<u16>(CaptureHeight);
+    WriteValue<u32>(CaptureRateNumerator);
+    WriteValue<u32>(CaptureRateDenominator);
+
+    _head = 0;
+    _tail = 0;
+    _lastPixelBuffer = nullptr;
+    _pendingDrops = 0;
+    _droppedFrames = 0;
+    _stopWorker = false;
+
+    _keyframeInterval = (keyframeInterval > 0) ? keyframeInterval : 1;
+    _framesSinceKeyframe = 0;
+    _needKeyframe = true;
+    _pendingRepeats = 0;
+
+    _worker = std::thread(&VideoCapture::RunWorker, this);
+    return true;
+}
+
+void VideoCapture::Close()
+{
+    if (!_worker.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopWorker = true;
+    }
+    _wake.notify_one();
+    _worker.join();
+
+    _file.close();
+}
+
+void VideoCapture::PushFrame(const u32 *pixelBuffer, bool repeat)
+{
+    if (!IsOpen())
+    {
+        return;
+    }
+
+    // a repeat only matches the encoder's previous frame if the pixel buffer's last push was captured
+    repeat = repeat && (pixelBuffer == _lastPixelBuffer) && (_pendingDrops == 0);
+    _lastPixelBuffer = pixelBuffer;
+
+    u32 head = _head.load(std::memory_order_relaxed);
+    if ((head - _tail.load(std::memory_order_acquire)) >= SlotCount)
+    {
+        // encoder is behind, drop the frame rather than waiting for a free slot
+        _pendingDrops++;
+        _droppedFrames++;
+        return;
+    }
+
+    CaptureSlot &slot = _slots[head % SlotCount];
+    slot.droppedBefore = _pendingDrops;
+    slot.repeat = repeat;
+    if (!repeat)
+    {
+        memcpy(slot.pixels, pixelBuffer, sizeof(slot.pixels));
+    }
+    _pendingDrops = 0;
+
+    _head.store(head + 1, std::memory_order_release);
+
+    // the worker holds the lock until it's waiting, so the wakeup can't get lost
+    std::lock_guard<std::mutex> lock(_mutex);
+    _wake.notify_one();
+}
+
+void VideoCapture::SkipFrame()
+{
+    if (!IsOpen())
+    {
+        return;
+    }
+
+    // written as dropped before the next frame that's captured
+    _pendingDrops++;
+}
+
+void VideoCapture::RunWorker()
+{
+    while (true)
+    {
+        u32 tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this, tail]
+            {
+                return _stopWorker || (tail != _head.load(std::memory_order_acquire));
+            });
+
+            if (_stopWorker && (tail == _head.load(std::memory_order_acquire)))
+            {
+                break;
+            }
+            continue;
+        }
+
+        EncodeSlot(_slots[tail % SlotCount]);
+        _tail.store(tail + 1, std::memory_order_release);
+    }
+
+    if (_pendingDrops > 0)
+    {
+        // frames dropped right before the capture was closed
+        FlushRepeats();
+        WriteCountRecord(CaptureRecord::Dropped, _pendingDrops);
+    }
+    FlushRepeats();
+    _file.flush();
+}
+
+void VideoCapture::EncodeSlot(const CaptureSlot &slot)
+{
+    if (slot.droppedBefore > 0)
+    {
+        FlushRepeats();
+        WriteCountRecord(CaptureRecord::Dropped, slot.droppedBefore);
+        _framesSinceKeyframe += slot.droppedBefore;
+    }
+
+    if (slot.repeat)
+    {
+        _pendingRepeats++;
+        _framesSinceKeyframe++;
+        return;
+    }
+
+    EncodeFrame(slot.pixels);
+}
+
+void VideoCapture::EncodeFrame(const u32 *pixels)
+{
+    bool keyframe = _needKeyframe || (_framesSinceKeyframe >= _keyframeInterval);
+    u8 *indices = _indices[0];
+    u8 *prevIndices = _indices[1];
+
+    u16 paletteStart = _paletteSize;
+    if (keyframe)
+    {
+        _paletteSize = 0;
+        _paletteLookup.clear();
+        paletteStart = 0;
+    }
+
+    bool indexed = IndexFrame(pixels, indices);
+    if (!indexed && !keyframe)
+    {
+        // palette is full, start over with only this frame's colors
+        keyframe = true;
+        _paletteSize = 0;
+        _paletteLookup.clear();
+        paletteStart = 0;
+        indexed = IndexFrame(pixels, indices);
+    }
+
+    if (!indexed)
+    {
+        // too many colors for a palette
+        FlushRepeats();
+        WriteRawKeyframe(pixels);
+        _paletteSize = 0;
+        _paletteLookup.clear();
+        _needKeyframe = true;
+        _framesSinceKeyframe = 1;
+        return;
+    }
+
+    const u8 *payloadSource = indices;
+    if (!keyframe)
+    {
+        bool changed = (_paletteSize != paletteStart);
+        for (u32 i = 0; i < CaptureFrameSize; i++)
+        {
+            _delta[i] = indices[i] ^ prevIndices[i];
+            changed |= (_delta[i] != 0);
+        }
+
+        if (!changed)
+        {
+            // rendered again, but nothing changed
+            _pendingRepeats++;
+            _framesSinceKeyframe++;
+            return;
+        }
+        payloadSource = _delta;
+    }
+
+    _payload.clear();
+    CompressRle(payloadSource, CaptureFrameSize, _payload);
+
+    FlushRepeats();
+    WriteValue<u8>(keyframe ? CaptureRecord::Keyframe : CaptureRecord::Delta);
+    WriteValue<u16>(_paletteSize - paletteStart);
+    _file.write((const char *)(_palette + paletteStart), (_paletteSize - paletteStart) * sizeof(u32));
+    WriteValue<u32>(_payload.size());
+    _file.write((const char *)_payload.data(), _payload.size());
+
+    std::swap(_indices[0], _indices[1]);
+    _needKeyframe = false;
+    _framesSinceKeyframe = keyframe ? 1 : (_framesSinceKeyframe + 1);
+}
+
+bool VideoCapture::IndexFrame(const u32 *pixels, u8 *indices)
+{
+    u32 lastColor = 0;
+    u8 lastIndex = 0;
+    bool haveLast = false;
+
+    for (u32 i = 0; i < CaptureFrameSize; i++)
+    {
+        u32 color = pixels[i];
+
+        // neighbouring pixels are usually the same color
+        if (!haveLast || (color != lastColor))
+        {
+            auto entry = _paletteLookup.find(color);
+            if (entry != _paletteLookup.end())
+            {
+                lastIndex = entry->second;
+            }
+            else if (_paletteSize < 256)
+            {
+                lastIndex = (u8)_paletteSize;
+                _palette[_paletteSize++] = color;
+                _paletteLookup[color] = lastIndex;
+            }
+            else
+            {
+                return false;
+            }
+
+            lastColor = color;
+            haveLast = true;
+        }
+
+        indices[i] = lastIndex;
+    }
+
+    return true;
+}
+
+void VideoCapture::WriteRawKeyframe(const u32 *pixels)
+{
+    std::vector<u8> rgb(CaptureFrameSize * 3);
+    for (u32 i = 0; i < CaptureFrameSize; i++)
+    {
+        rgb[i * 3] = pixels[i] >> 24;
+        rgb[i * 3 + 1] = pixels[i] >> 16;
+        rgb[i * 3 + 2] = pixels[i] >> 8;
+    }
+
+    _payload.clear();
+    CompressRle(rgb.data(), rgb.size(), _payload);
+
+    WriteValue<u8>(CaptureRecord::RawKeyframe);
+    WriteValue<u32>(_payload.size());
+    _file.write((const char *)_payload.data(), _payload.size());
+}
+
+void VideoCapture::WriteCountRecord(u8 type, u32 count)
+{
+    while (count > 0)
+    {
+        u16 records = (count > 0xFFFF) ? 0xFFFF : count;
+        WriteValue<u8>(type);
+        WriteValue<u16>(records);
+        count -= records;
+    }
+}
+
+void VideoCapture::FlushRepeats()
+{
+    if (_pendingRepeats > 0)
+    {
+        WriteCountRecord(CaptureRecord::Repeat, _pendingRepeats);
+        _pendingRepeats = 0;
+    }
+}
+
+void VideoCapture::CompressRle(const u8 *src, u32 size, std::vector<u8> &out)
+{
+    u32 i = 0;
+    while (i < size)
+    {
+        // length of the run starting here
+        u32 run = 1;
+        while (((i + run) < size) && (run < 130) && (src[i + run] == src[i]))
+        {
+            run++;
+        }
+
+        if (run >= 3)
+        {
+            out.push_back(0x80 | (run - 3));
+            out.push_back(src[i]);
+            i += run;
+            continue;
+        }
+
+        // literals until the next run of 3 or more
+        u32 start = i;
+        while ((i < size) && ((i - start) < 128))
+        {
+            if (((i + 2) < size) && (src[i] == src[i + 1]) && (src[i] == src[i + 2]))
+            {
+                break;
+            }
+            i++;
+        }
+
+        out.push_back(i - start - 1);
+        out.insert(out.end(), src + start, src + i);
+    }
+}
+
+bool VideoCapture::DecompressRle(const u8 *src, u32 size, u8 *dest, u32 destSize)
+{
+    u32 in = 0;
+    u32 out = 0;
+
+    while (in < size)
+    {
+        u8 control = src[in++];
+        if (control < 0x80)
+        {
+            u32 count = control + 1;
+            if (((in + count) > size) || ((out + count) > destSize))
+            {
+                return false;
+            }
+            memcpy(dest + out, src + in, count);
+            in += count;
+            out += count;
+        }
+        else
+        {
+            u32 count = (control & 0x7F) + 3;
+            if ((in >= size) || ((out + count) > destSize))
+            {
+                return false;
+            }
+            memset(dest + out, src[in++], count);
+            out += count;
+        }
+    }
+
+    return out == destSize;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "shared.h"
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Capture file layout (host byte order):
+//  Header: "BGBV", u8 version, u16 width, u16 height, u32 frame rate numerator, u32 frame rate denominator
+//  Records: u8 type, followed by
+//   Keyframe/Delta: u16 number of colors appended to the palette, u32 colors, u32 payload size, payload
+//    (RLE of the palette index for each pixel, XORed with the previous frame's indices for deltas)
+//   RawKeyframe: u32 payload size, payload (RLE of RGB bytes, used when a frame has more than 256 colors)
+//   Repeat/Dropped: u16 number of frames that are the same as the previous one (dropped frames weren't captured,
+//    either the encoder was behind or the emulator skipped drawing them)
+// Keyframes reset the palette and don't depend on earlier frames, so decoding can start at any of them.
+namespace CaptureRecord
+{
+    enum CaptureRecord : u8
+    {
+        Keyframe = 0,
+        Delta = 1,
+        Repeat = 2,
+        Dropped = 3,
+        RawKeyframe = 4,
+    };
+}
+
+constexpr char CaptureMagic[4] = { 'B', 'G', 'B', 'V' };
+constexpr u8 CaptureVersion = 1;
+constexpr u32 CaptureWidth = 160;
+constexpr u32 CaptureHeight = 144;
+constexpr u32 CaptureFrameSize = CaptureWidth * CaptureHeight;
+
+// Writes pushed video frames to a compact capture file. The emulation thread only copies frames into
+// a fixed ring of slots, a background thread indexes, delta encodes, compresses and writes them.
+// When the ring is full the frame is dropped (and recorded as such) instead of waiting, frames the
+// emulator skipped are recorded as dropped too so the capture keeps to emulated time.
+class VideoCapture
+{
+private:
+    static constexpr u32 SlotCount = 16;
+    static constexpr u32 DefaultKeyframeInterval = 300;
+
+    struct CaptureSlot
+    {
+        u32 pixels[CaptureFrameSize];
+        u32 droppedBefore; // frames dropped right before this one
+        bool repeat; // pixels weren't copied, same as the previous frame
+    };
+
+    CaptureSlot *_slots;
+    std::atomic<u32> _head; // next slot written by the emulation thread
+    std::atomic<u32> _tail; // next slot encoded by the worker
+
+    // emulation thread
+    const u32 *_lastPixelBuffer;
+    u32 _pendingDrops;
+    u32 _droppedFrames; // only the ones the encoder was too far behind for
+
+    std::thread _worker;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::atomic<bool> _stopWorker;
+
+    // worker thread (encoder state)
+    std::ofstream _file;
+    u32 _keyframeInterval;
+    u32 _framesSinceKeyframe;
+    bool _needKeyframe;
+    u32 _palette[256];
+    u16 _paletteSize;
+    std::unordered_map<u32, u8> _paletteLookup;
+    u8 *_indices[2]; // current and previous frame
+    u8 *_delta;
+    std::vector<u8> _payload;
+    u32 _pendingRepeats;
+
+    void RunWorker();
+    void EncodeSlot(const CaptureSlot &slot);
+    void EncodeFrame(const u32 *pixels);
+    bool IndexFrame(const u32 *pixels, u8 *indices);
+    void WriteRawKeyframe(const u32 *pixels);
+    void WriteCountRecord(u8 type, u32 count);
+    void FlushRepeats();
+
+    template <typename T> void WriteValue(T value) { _file.write((const char *)&value, sizeof(T)); }
+public:
+    VideoCapture();
+    ~VideoCapture();
+
+    bool Open(const char *fileName, u32 keyframeInterval = DefaultKeyframeInterval);
+
+    // encodes the frames that are still queued and closes the file
+    void Close();
+
+    bool IsOpen() { return _worker.joinable(); }
+    u32 GetDroppedFrames() { return _droppedFrames; }
+
+    // repeat means the pixel buffer wasn't touched since it was last pushed
+    void PushFrame(const u32 *pixelBuffer, bool repeat);
+
+    // a frame the emulator didn't draw
+    void SkipFrame();
+
+    // PackBits style: control byte below 0x80 is followed by (n + 1) literal bytes,
+    // otherwise the next byte is repeated ((n & 0x7F) + 3) times
+    static void CompressRle(const u8 *src, u32 size, std::vector<u8> &out);
+    static bool DecompressRle(const u8 *src, u32 size, u8 *dest, u32 destSize);
+};
@@ -0,0 +1,419 @@
+#include "VideoCaptureReader.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+
+VideoCaptureReader::VideoCaptureReader()
+{
+    _rateNumerator = 0;
+    _rateDenominator = 1;
+    _paletteSize = 0;
+    _indices = new u8[CaptureFrameSize];
+    _delta = new u8[CaptureFrameSize];
+    _pixels = new u32[CaptureFrameSize];
+    _repeatsLeft = 0;
+    _frameNumber = 0;
+    _haveKeyframe = false;
+}
+
+VideoCaptureReader::~VideoCaptureReader()
+{
+    delete[] _indices;
+    delete[] _delta;
+    delete[] _pixels;
+}
+
+bool VideoCaptureReader::Open(const char *fileName)
+{
+    _file.open(fileName, std::ios::in | std::ios::binary);
+    if (!_file.good())
+    {
+        return false;
+    }
+
+    char magic[sizeof(CaptureMagic)];
+    u8 version;
+    u16 width;
+    u16 height;
+    _file.read(magic, sizeof(magic));
+    if (!_file.good() || (memcmp(magic, CaptureMagic, sizeof(magic)) != 0) ||
+        !ReadValue(version) || (version != CaptureVersion) ||
+        !ReadValue(width) || !ReadValue(height) || (width != CaptureWidth) || (height != CaptureHeight) ||
+        !ReadValue(_rateNumerator) || !ReadValue(_rateDenominator))
+    {
+        return false;
+    }
+
+    _firstRecord = _file.tellg();
+    _repeatsLeft = 0;
+    _frameNumber = 0;
+    _haveKeyframe = false;
+    return true;
+}
+
+bool VideoCaptureReader::ReadPayload()
+{
+    u32 size;
+    if (!ReadValue(size) || (size > CaptureFrameSize * 4))
+    {
+        return false;
+    }
+
+    _payload.resize(size);
+    return (bool)_file.read((char *)_payload.data(), size);
+}
+
+bool VideoCaptureReader::ReadIndexedFrame(bool keyframe)
+{
+    u16 newColors;
+    if (!ReadValue(newColors))
+    {
+        return false;
+    }
+
+    if (keyframe)
+    {
+        _paletteSize = 0;
+    }
+    if ((_paletteSize + newColors) > 256)
+    {
+        return false;
+    }
+
+    _file.read((char *)(_palette + _paletteSize), newColors * sizeof(u32));
+    _paletteSize += newColors;
+
+    if (!ReadPayload())
+    {
+        return false;
+    }
+
+    if (keyframe)
+    {
+        if (!VideoCapture::DecompressRle(_payload.data(), _payload.size(), _indices, CaptureFrameSize))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (!VideoCapture::DecompressRle(_payload.data(), _payload.size(), _delta, CaptureFrameSize))
+        {
+            return false;
+        }
+        for (u32 i = 0; i < CaptureFrameSize; i++)
+        {
+            _indices[i] ^= _delta[i];
+        }
+    }
+
+    for (u32 i = 0; i < CaptureFrameSize; i++)
+    {
+        if (_indices[i] >= _paletteSize)
+        {
+            return false;
+        }
+        _pixels[i] = _palette[_indices[i]];
+    }
+
+    return true;
+}
+
+bool VideoCaptureReader::ReadRawFrame()
+{
+    std::vector<u8> rgb(CaptureFrameSize * 3);
+    if (!ReadPayload() || !VideoCapture::DecompressRle(_payload.data(), _payload.size(), rgb.data(), rgb.size()))
+    {
+        return false;
+    }
+
+    for (u32 i = 0; i < CaptureFrameSize; i++)
+    {
+        _pixels[i] = (rgb[i * 3] << 24) | (rgb[i * 3 + 1] << 16) | (rgb[i * 3 + 2] << 8);
+    }
+
+    // a delta can't follow this frame
+    _paletteSize = 0;
+    return true;
+}
+
+bool VideoCaptureReader::ReadFrame(const u32 *&pixels)
+{
+    pixels = _pixels;
+
+    while (_repeatsLeft == 0)
+    {
+        u8 type;
+        if (!ReadValue(type))
+        {
+            return false;
+        }
+
+        bool decoded = false;
+        switch (type)
+        {
+            case CaptureRecord::Keyframe:
+                decoded = ReadIndexedFrame(true);
+                _haveKeyframe = decoded;
+                break;
+
+            case CaptureRecord::Delta:
+                decoded = _haveKeyframe && ReadIndexedFrame(false);
+                break;
+
+            case CaptureRecord::RawKeyframe:
+                decoded = ReadRawFrame();
+                _haveKeyframe = decoded;
+                break;
+
+            case CaptureRecord::Repeat:
+            case CaptureRecord::Dropped:
+            {
+                u16 count;
+                if (!ReadValue(count) || !_haveKeyframe)
+                {
+                    return false;
+                }
+                _repeatsLeft = count;
+                continue;
+            }
+
+            default:
+                return false;
+        }
+
+        if (!decoded)
+        {
+            return false;
+        }
+
+        _frameNumber++;
+        return true;
+    }
+
+    _repeatsLeft--;
+    _frameNumber++;
+    return true;
+}
+
+bool VideoCaptureReader::SkipRecord(u8 type, u32 &frames)
+{
+    frames = 1;
+
+    switch (type)
+    {
+        case CaptureRecord::Keyframe:
+        case CaptureRecord::Delta:
+        {
+            u16 newColors;
+            u32 size;
+            if (!ReadValue(newColors))
+            {
+                return false;
+            }
+            _file.seekg(newColors * sizeof(u32), std::ios::cur);
+            if (!ReadValue(size))
+            {
+                return false;
+            }
+            return (bool)_file.seekg(size, std::ios::cur);
+        }
+
+        case CaptureRecord::RawKeyframe:
+        {
+            u32 size;
+            if (!ReadValue(size))
+            {
+                return false;
+            }
+            return (bool)_file.seekg(size, std::ios::cur);
+        }
+
+        case CaptureRecord::Repeat:
+        case CaptureRecord::Dropped:
+        {
+            u16 count;
+            if (!ReadValue(count))
+            {
+                return false;
+            }
+            frames = count;
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+bool VideoCaptureReader::Seek(u32 frameNumber)
+{
+    // find the last keyframe at or before the frame, only reading record headers
+    _file.clear();
+    _file.seekg(_firstRecord);
+
+    std::streampos keyframePos = _firstRecord;
+    u32 keyframeNumber = 0;
+    u32 recordFrame = 0;
+
+    while (recordFrame <= frameNumber)
+    {
+        std::streampos recordPos = _file.tellg();
+        u8 type;
+        u32 frames;
+        if (!ReadValue(type) || !SkipRecord(type, frames))
+        {
+            break;
+        }
+
+        if ((type == CaptureRecord::Keyframe) || (type == CaptureRecord::RawKeyframe))
+        {
+            keyframePos = recordPos;
+            keyframeNumber = recordFrame;
+        }
+        recordFrame += frames;
+    }
+
+    // decode from there up to the frame
+    _file.clear();
+    _file.seekg(keyframePos);
+    _repeatsLeft = 0;
+    _haveKeyframe = false;
+    _frameNumber = keyframeNumber;
+
+    const u32 *pixels;
+    while (_frameNumber < frameNumber)
+    {
+        if (!ReadFrame(pixels))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool VideoCaptureReader::ParseFramePattern(const std::string &pattern, std::string &prefix, u32 &digits, std::string &suffix)
+{
+    size_t start = pattern.find('%');
+    if (start == std::string::npos)
+    {
+        return false;
+    }
+
+    // the name is put together without printf, so anything but the frame number is rejected
+    size_t end = start + 1;
+    digits = 0;
+    if ((end < pattern.size()) && (pattern[end] == '0'))
+    {
+        while ((++end < pattern.size()) && (pattern[end] >= '0') && (pattern[end] <= '9'))
+        {
+            digits = digits * 10 + (pattern[end] - '0');
+            if (digits > 10)
+            {
+                return false;
+            }
+        }
+    }
+
+    if ((end >= pattern.size()) || (pattern[end] != 'u') || (pattern.find('%', end) != std::string::npos))
+    {
+        return false;
+    }
+
+    prefix = pattern.substr(0, start);
+    suffix = pattern.substr(end + 1);
+    return true;
+}
+
+bool VideoCaptureReader::Convert(const char *captureFile, const char *output, u32 firstFrame, u32 frameCount)
+{
+    VideoCaptureReader reader;
+    if (!reader.Open(captureFile) || !reader.Seek(firstFrame))
+    {
+        return false;
+    }
+
+    std::string outputName(output);
+    bool y4m = (outputName.size() > 4) && (outputName.compare(outputName.size() - 4, 4, ".y4m") == 0);
+    if (!y4m && (outputName.find('%') == std::string::npos))
+    {
+        outputName += "%05u.ppm";
+    }
+
+    std::string namePrefix;
+    std::string nameSuffix;
+    u32 nameDigits = 0;
+    if (!y4m && !ParseFramePattern(outputName, namePrefix, nameDigits, nameSuffix))
+    {
+        std::cout << "Output pattern needs exactly one %u or %0Nu: " << output << std::endl;
+        return false;
+    }
+
+    std::ofstream outFile;
+    if (y4m)
+    {
+        outFile.open(output, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!outFile.good())
+        {
+            return false;
+        }
+        outFile << "YUV4MPEG2 W" << CaptureWidth << " H" << CaptureHeight
+            << " F" << reader.GetRateNumerator() << ":" << reader.GetRateDenominator()
+            << " Ip A1:1 C444 XCOLORRANGE=FULL\n";
+    }
+
+    std::vector<u8> planes(CaptureFrameSize * 3);
+    const u32 *pixels;
+    u32 written = 0;
+
+    while (((frameCount == 0) || (written < frameCount)) && reader.ReadFrame(pixels))
+    {
+        if (y4m)
+        {
+            // full range BT.601
+            for (u32 i = 0; i < CaptureFrameSize; i++)
+            {
+                s32 r = (pixels[i] >> 24) & 0xFF;
+                s32 g = (pixels[i] >> 16) & 0xFF;
+                s32 b = (pixels[i] >> 8) & 0xFF;
+
+                planes[i] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+                planes[CaptureFrameSize + i] = ((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128;
+                planes[CaptureFrameSize * 2 + i] = ((128 * r - 107 * g - 21 * b + 128) >> 8) + 128;
+            }
+
+            outFile << "FRAME\n";
+            outFile.write((const char *)planes.data(), planes.size());
+        }
+        else
+        {
+            std::string number = std::to_string(firstFrame + written);
+            if (number.size() < nameDigits)
+            {
+                number.insert(0, nameDigits - number.size(), '0');
+            }
+            std::string fileName = namePrefix + number + nameSuffix;
+
+            std::ofstream ppmFile(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!ppmFile.good())
+            {
+                return false;
+            }
+
+            for (u32 i = 0; i < CaptureFrameSize; i++)
+            {
+                planes[i * 3] = pixels[i] >> 24;
+                planes[i * 3 + 1] = pixels[i] >> 16;
+                planes[i * 3 + 2] = pixels[i] >> 8;
+            }
+
+            ppmFile << "P6\n" << CaptureWidth << " " << CaptureHeight << "\n255\n";
+            ppmFile.write((const char *)planes.data(), planes.size());
+        }
+
+        written++;
+    }
+
+    return written > 0;
+}
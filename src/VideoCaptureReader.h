@@ -0,0 +1,59 @@
+#pragma once
+
+#include "VideoCapture.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Decodes capture files written by VideoCapture
+class VideoCaptureReader
+{
+private:
+    std::ifstream _file;
+    std::streampos _firstRecord;
+    u32 _rateNumerator;
+    u32 _rateDenominator;
+
+    u32 _palette[256];
+    u16 _paletteSize;
+    u8 *_indices;
+    u8 *_delta;
+    u32 *_pixels;
+    std::vector<u8> _payload;
+
+    // frames left from the last repeat/dropped record
+    u32 _repeatsLeft;
+    u32 _frameNumber;
+    bool _haveKeyframe;
+
+    bool ReadPayload();
+    bool ReadIndexedFrame(bool keyframe);
+    bool ReadRawFrame();
+    bool SkipRecord(u8 type, u32 &frames);
+
+    // splits an output pattern around its only %u or %0Nu, false if it has any other %
+    static bool ParseFramePattern(const std::string &pattern, std::string &prefix, u32 &digits, std::string &suffix);
+
+    template <typename T> bool ReadValue(T &value) { return (bool)_file.read((char *)&value, sizeof(T)); }
+public:
+    VideoCaptureReader();
+    ~VideoCaptureReader();
+
+    bool Open(const char *fileName);
+
+    u32 GetRateNumerator() { return _rateNumerator; }
+    u32 GetRateDenominator() { return _rateDenominator; }
+
+    // number of the frame returned by the next ReadFrame call
+    u32 GetFrameNumber() { return _frameNumber; }
+
+    // decodes the next frame (RGBA, 160x144), returns false at the end of the capture
+    bool ReadFrame(const u32 *&pixels);
+
+    // continue decoding from the frame with the given number, starting at the closest keyframe before it
+    bool Seek(u32 frameNumber);
+
+    // writes frames to a Y4M file (if the output ends with .y4m) or to numbered PPM files,
+    // a pattern with one %u or %0Nu like "frame%05u.ppm" can be given, otherwise the number is appended
+    static bool Convert(const char *captureFile, const char *output, u32 firstFrame, u32 frameCount);
+};
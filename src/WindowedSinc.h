@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cmath>
+
+// one tap of a Blackman-windowed sinc low-pass, the band-limited kernels of AudioResampler and StepSynth
+// are built from it. x is the tap's distance from the kernel's center in samples, cutoff is relative to
+// nyquist and the window reaches zero at a distance of half
+inline double WindowedSinc(double x, double cutoff, double half)
+{
+    double sinc = (x == 0) ? 1.0 : (sin(M_PI * cutoff * x) / (M_PI * cutoff * x));
+    double window = 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half); // blackman
+    return sinc * window;
+}
@@ -0,0 +1,355 @@
+// The APU's channels caught up in closed form against the same APU stepped one cycle at a time. One APU
+// runs everything between two register writes or timer ticks as a single span. In the other, each cycle
+// is its own span and starts with a mix, which takes every output straight from the channels' state
+// instead of from the edges they send. The audio, NR52 after every span, wave RAM read back, and the
+// saved state at checkpoints have to be the same. Before that, the noise channel's LFSR tables against
+// shifting it one step at a time.
+
+#include "TestRom.h"
+#include "GameBoyApu.h"
+#include "GameBoyNoiseChannel.h"
+#include <random>
+#include <sstream>
+
+static constexpr u32 TimerTickCycles = 8192;
+
+// a span takes the APU up to the cycle, reading NR52 runs it
+class ApuPair
+{
+private:
+    TestHost _spanHost;
+    TestHost _cycleHost;
+    GameBoyApu _spans;
+    GameBoyApu _cycles;
+    bool _ticking;
+    u64 _cycle = 0;
+    u64 _nextTick = TimerTickCycles;
+public:
+    u64 failedCycle = 0;
+    u32 enabledSpans = 0;
+
+    ApuPair(bool ticking) : _spans(nullptr, &_spanHost), _cycles(nullptr, &_cycleHost), _ticking(ticking)
+    {
+        Write(0xFF26, 0x80);
+        Write(0xFF24, 0x77);
+        Write(0xFF25, 0xFF);
+    }
+
+    u64 GetCycle() { return _cycle; }
+
+    // the frame sequencer ticks in between when ticking, otherwise spans can be as long as the caller's
+    void Run(u32 cycles, u8 channelBit)
+    {
+        while ((cycles > 0) && !failedCycle)
+        {
+            u32 step = cycles;
+            if (_ticking && (step > (_nextTick - _cycle)))
+            {
+                step = (u32)(_nextTick - _cycle);
+            }
+
+            _spans.AddCycles(step);
+            u8 status = _spans.ReadRegister(0xFF26);
+            u8 cycleStatus = 0;
+            for (u32 i = 0; i < step; i++)
+            {
+                _cycles.AddCycles(1);
+                cycleStatus = _cycles.ReadRegister(0xFF26);
+            }
+
+            _cycle += step;
+            cycles -= step;
+            if (status != cycleStatus)
+            {
+                failedCycle = _cycle;
+            }
+            if (status & channelBit)
+            {
+                enabledSpans++;
+            }
+
+            if (_ticking && (_cycle == _nextTick))
+            {
+                _spans.TimerTick();
+                _cycles.TimerTick();
+                _nextTick += TimerTickCycles;
+            }
+        }
+    }
+
+    void Write(u16 addr, u8 val)
+    {
+        _spans.WriteRegister(addr, val);
+        _cycles.WriteRegister(addr, val);
+    }
+
+    void Read(u16 addr)
+    {
+        if (_spans.ReadRegister(addr) != _cycles.ReadRegister(addr))
+        {
+            failedCycle = _cycle;
+        }
+    }
+
+    // one more cycle in both, so every channel's output is mixed from where it is now, then the state
+    bool Check()
+    {
+        Run(1, 0);
+
+        std::stringstream spanState;
+        std::stringstream cycleState;
+        _spans.SaveState(spanState);
+        _cycles.SaveState(cycleState);
+
+        if ((spanState.str() != cycleState.str()) ||
+            (_spanHost.audioFrames != _cycleHost.audioFrames) ||
+            (_spanHost.audioHash != _cycleHost.audioHash))
+        {
+            failedCycle = _cycle;
+        }
+        return !failedCycle;
+    }
+
+    u64 GetAudioFrames() { return _spanHost.audioFrames; }
+};
+
+// the square channels: every duty, frequencies from the longest period to the shortest, lengths that run
+// out, sweeps that overflow, and powering the APU off and on, which leaves the timers at 0
+static void WriteSquare(ApuPair &apus, std::mt19937 &random)
+{
+    u16 base = (random() % 2) ? 0xFF10 : 0xFF15;
+    switch (random() % 9)
+    {
+        case 0:
+            apus.Write(0xFF10, (u8)random());
+            break;
+        case 1:
+            apus.Write(base + 1, (u8)((random() % 4) ? random() : (random() | 0x3C)));
+            break;
+        case 2:
+            apus.Write(base + 2, (u8)((random() % 8) ? (random() | 0x10) : random()));
+            break;
+        case 3:
+            apus.Write(base + 3, (u8)random());
+            break;
+        case 4: case 5: case 6:
+            apus.Write(base + 4, (u8)(((random() % 4) ? 0x07 : (random() & 0x07)) | (random() & 0xC0)));
+            break;
+        case 7:
+            apus.Write(0xFF25, (u8)((random() % 2) ? 0xFF : random()));
+            apus.Write(0xFF24, (u8)random());
+            break;
+        case 8:
+            if ((random() % 8) == 0)
+            {
+                apus.Write(0xFF26, 0x00);
+                apus.Write(0xFF26, 0x80);
+                apus.Write(0xFF24, 0x77);
+                apus.Write(0xFF25, 0xFF);
+            }
+            break;
+    }
+}
+
+// the noise channel: both widths, switched without a trigger while it plays, clock shifts from every
+// period up to the ones that never clock the LFSR, lengths that run out and envelopes
+static void WriteNoise(ApuPair &apus, std::mt19937 &random)
+{
+    switch (random() % 8)
+    {
+        case 0:
+            apus.Write(0xFF20, (u8)((random() % 4) ? random() : (random() | 0x3C)));
+            break;
+        case 1:
+            apus.Write(0xFF21, (u8)((random() % 8) ? (random() | 0x10) : random()));
+            break;
+        case 2: case 3:
+            apus.Write(0xFF22, (u8)(((random() % 8) ? (random() % 7) << 4 : random() & 0xF0) | (random() & 0x0F)));
+            break;
+        case 4: case 5:
+            apus.Write(0xFF23, (u8)(random() & 0xC0));
+            break;
+        case 6:
+            apus.Write(0xFF25, (u8)((random() % 2) ? 0xFF : random()));
+            apus.Write(0xFF24, (u8)random());
+            break;
+        case 7:
+            if ((random() % 8) == 0)
+            {
+                apus.Write(0xFF26, 0x00);
+                apus.Write(0xFF26, 0x80);
+                apus.Write(0xFF24, 0x77);
+                apus.Write(0xFF25, 0xFF);
+            }
+            break;
+    }
+}
+
+// the wave channel: wave RAM written and read back while it plays, a byte at a time or all of it, every
+// output level, the DAC switched off and on, frequencies from every other cycle to 4096, lengths that run out
+static void WriteWave(ApuPair &apus, std::mt19937 &random)
+{
+    switch (random() % 10)
+    {
+        case 0:
+            apus.Write(0xFF1A, (u8)((random() % 8) ? 0x80 : 0x00));
+            break;
+        case 1:
+            apus.Write(0xFF1B, (u8)((random() % 4) ? random() : (random() | 0xF0)));
+            break;
+        case 2:
+            apus.Write(0xFF1C, (u8)random());
+            break;
+        case 3:
+            apus.Write(0xFF1D, (u8)random());
+            break;
+        case 4: case 5:
+            apus.Write(0xFF1E, (u8)(((random() % 4) ? 0x07 : (random() & 0x07)) | (random() & 0xC0)));
+            break;
+        case 6:
+            apus.Write(0xFF30 + (random() % 16), (u8)random());
+            apus.Read(0xFF30 + (random() % 16));
+            break;
+        case 7:
+            for (u16 addr = 0xFF30; addr < 0xFF40; addr++)
+            {
+                apus.Write(addr, (u8)random());
+            }
+            break;
+        case 8:
+            apus.Write(0xFF25, (u8)((random() % 2) ? 0xFF : random()));
+            apus.Write(0xFF24, (u8)random());
+            break;
+        case 9:
+            if ((random() % 8) == 0)
+            {
+                apus.Write(0xFF26, 0x00);
+                apus.Write(0xFF26, 0x80);
+                apus.Write(0xFF24, 0x77);
+                apus.Write(0xFF25, 0xFF);
+            }
+            break;
+    }
+}
+
+struct Scenario
+{
+    const char *name;
+    void (*write)(ApuPair &apus, std::mt19937 &random);
+    u8 channelBit; // in NR52
+    bool ticking;
+    u32 maxSpan;
+};
+
+static const Scenario Scenarios[] =
+{
+    { "square", WriteSquare, 0x03, true, 20000 },
+    { "square, no frame sequencer", WriteSquare, 0x03, false, 70000 },
+    { "noise", WriteNoise, 0x08, true, 20000 },
+    { "noise, no frame sequencer", WriteNoise, 0x08, false, 140000 },
+    { "wave", WriteWave, 0x04, true, 20000 },
+    { "wave, no frame sequencer", WriteWave, 0x04, false, 70000 },
+};
+
+// GameBoyNoiseChannel::Advance against ShiftOnce, on runs of either width from wherever the last one left
+// the register. Runs in short mode right after long mode start with bits above the low 7 it didn't shift
+// in, so the ones shorter than 8 shifts are the ones that matter
+static u32 TestLfsr(std::mt19937 &random)
+{
+    static constexpr u32 Runs = 20000;
+
+    GameBoyNoiseChannel noise(nullptr);
+    u16 shiftRegister = 0x7FFF;
+    u32 switches = 0;
+    u32 stuck = 0;
+    bool useShortStep = false;
+
+    for (u32 run = 0; run < Runs; run++)
+    {
+        bool lastShortStep = useShortStep;
+        useShortStep = (random() % 2) != 0;
+        switches += (useShortStep != lastShortStep);
+
+        u32 count;
+        switch (random() % 4)
+        {
+            case 0: count = random() % 10; break;
+            case 1: count = random() % 300; break;
+            case 2: count = random() % 3000; break;
+            default: count = random() % 70000; break;
+        }
+
+        u16 expected = shiftRegister;
+        for (u32 i = 0; i < count; i++)
+        {
+            expected = GameBoyNoiseChannel::ShiftOnce(expected, useShortStep);
+        }
+
+        u16 advanced = GameBoyNoiseChannel::Advance(shiftRegister, useShortStep, count);
+        if (advanced != expected)
+        {
+            printf("Lfsr: %04x shifted %u times in %s mode is %04x, not %04x\n", shiftRegister, count,
+                useShortStep ? "short" : "long", advanced, expected);
+            return 1;
+        }
+
+        // short mode sometimes shifts all of the low 7 bits out from a register with none of them set, and
+        // with nothing set the register stays at 0
+        shiftRegister = expected;
+        if (shiftRegister == 0)
+        {
+            stuck++;
+            shiftRegister = (u16)(random() & 0x7FFF);
+        }
+    }
+
+    printf("Lfsr: %u runs, %u width switches, stuck at 0 %u times, matches\n", Runs, switches, stuck);
+    return 0;
+}
+
+static constexpr u32 Writes = 1500;
+
+int main()
+{
+    std::mt19937 random(1);
+    u32 failures = TestLfsr(random);
+
+    for (const Scenario &scenario : Scenarios)
+    {
+        ApuPair apus(scenario.ticking);
+        u32 writes = 0;
+        for (; (writes < Writes) && !apus.failedCycle; writes++)
+        {
+            // mostly short spans, some long enough to run many periods
+            u32 span = (random() % 4) ? (u32)(random() % 600) : (u32)(random() % scenario.maxSpan);
+            apus.Run(span, scenario.channelBit);
+            scenario.write(apus, random);
+
+            if ((writes % 50) == 49)
+            {
+                apus.Check();
+            }
+        }
+        apus.Check();
+
+        printf("ApuChannel %s: %u writes, %llu cycles, channel on in %u spans, %llu audio frames, ", scenario.name,
+            writes, (unsigned long long)apus.GetCycle(), apus.enabledSpans, (unsigned long long)apus.GetAudioFrames());
+        if (apus.failedCycle)
+        {
+            printf("differs by cycle %llu\n", (unsigned long long)apus.failedCycle);
+            failures++;
+        }
+        else
+        {
+            printf("matches\n");
+        }
+
+        // without the channel on this wouldn't test anything
+        if (apus.enabledSpans < (Writes / 4))
+        {
+            failures++;
+        }
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+// The two ways GameBoyApu gets audio to the host at 48000 Hz: Blip_Buffer synthesizing at 48000 Hz and
+// read straight out, or synthesizing at 44100 Hz and going through AudioResampler. Both on the same
+// square waves on 4 channels, in frames the length the APU ends them at, in ns per output frame
+
+#include "AudioResampler.h"
+#include "Blip_Buffer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+struct Edge
+{
+    u32 cycle;
+    s32 left;
+    s32 right;
+};
+
+static constexpr u32 ClockRate = 4194304;
+static constexpr u32 FrameCycles = 20000;
+static constexpr u32 Frames = 3000;
+static constexpr u32 OutputRate = 48000;
+
+// square waves with 4-bit levels at the mixer's volume, the odd channels only on the left
+static std::vector<std::vector<Edge>> MakeEdges()
+{
+    static const double frequencies[] = { 523.3, 659.3, 1046.5, 3520.0 };
+    static const s32 volumes[] = { 15, 12, 9, 6 };
+    double next[4] = {};
+    s32 levels[4] = {};
+
+    std::vector<std::vector<Edge>> edges(Frames);
+    for (u32 frame = 0; frame < Frames; frame++)
+    {
+        double frameStart = (double)frame * FrameCycles;
+        for (u32 channel = 0; channel < 4; channel++)
+        {
+            double period = floor(ClockRate / frequencies[channel] / 2);
+            for (; next[channel] < frameStart + FrameCycles; next[channel] += period)
+            {
+                s32 level = levels[channel] ? 0 : volumes[channel];
+                s32 delta = (level - levels[channel]) * 320;
+                edges[frame].push_back({ (u32)(next[channel] - frameStart), delta, (channel & 1) ? 0 : delta });
+                levels[channel] = level;
+            }
+        }
+        std::sort(edges[frame].begin(), edges[frame].end(), [](const Edge &a, const Edge &b) { return a.cycle < b.cycle; });
+    }
+    return edges;
+}
+
+// seconds it took and output frames, synthesized at sampleRate and resampled to OutputRate if there's a resampler
+static double Run(const std::vector<std::vector<Edge>> &edges, u32 sampleRate, AudioResampler *resampler, u64 &outputFrames)
+{
+    // set up the same way GameBoyApu does
+    Blip_Buffer bufLeft, bufRight;
+    Blip_Synth<blip_good_quality, 32767> synthLeft, synthRight;
+    bufLeft.set_sample_rate(sampleRate);
+    bufRight.set_sample_rate(sampleRate);
+    bufLeft.clock_rate(ClockRate);
+    bufRight.clock_rate(ClockRate);
+    synthLeft.output(&bufLeft);
+    synthLeft.volume(0.5);
+    synthRight.output(&bufRight);
+    synthRight.volume(0.5);
+    if (resampler != nullptr)
+    {
+        resampler->Reset();
+    }
+
+    s16 samples[4096 * 2];
+    s16 output[4096 * 2];
+    outputFrames = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::vector<Edge> &frame : edges)
+    {
+        for (const Edge &edge : frame)
+        {
+            synthLeft.offset_inline(edge.cycle, edge.left);
+            synthRight.offset_inline(edge.cycle, edge.right);
+        }
+        bufLeft.end_frame(FrameCycles);
+        bufRight.end_frame(FrameCycles);
+
+        u32 count = bufLeft.read_samples(samples, 4096, 1);
+        bufRight.read_samples(samples + 1, 4096, 1);
+        if (resampler != nullptr)
+        {
+            count = resampler->Process(samples, count, output, resampler->GetMaxOutputFrames(count));
+        }
+        outputFrames += count;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ns per output frame, the fastest of 5 runs
+static double Fastest(const std::vector<std::vector<Edge>> &edges, u32 sampleRate, AudioResampler *resampler)
+{
+    double fastest = 1e30;
+    u64 outputFrames = 0;
+    for (int i = 0; i < 5; i++)
+    {
+        fastest = std::min(fastest, Run(edges, sampleRate, resampler, outputFrames));
+    }
+    return fastest * 1e9 / outputFrames;
+}
+
+int main()
+{
+    std::vector<std::vector<Edge>> edges = MakeEdges();
+
+    printf("ns per output frame at %u Hz, lower is better\n", OutputRate);
+    printf("  blip at %u Hz  %5.1f\n", OutputRate, Fastest(edges, OutputRate, nullptr));
+
+    // what synthesizing at 44100 Hz costs for each output frame, the rest is the resampler
+    double blip = Fastest(edges, 44100, nullptr) * 44100 / OutputRate;
+    for (ResamplerQuality quality : { ResamplerQuality::Low, ResamplerQuality::Medium, ResamplerQuality::High })
+    {
+        AudioResampler resampler;
+        resampler.Configure(44100, OutputRate, quality, 4096);
+        double resampled = Fastest(edges, 44100, &resampler);
+        printf("  blip at 44100 Hz, %2u taps  %5.1f (resampler %.1f)\n", AudioResampler::GetTaps(quality), resampled,
+            resampled - blip);
+    }
+    return 0;
+}
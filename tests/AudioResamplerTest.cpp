@@ -0,0 +1,132 @@
+// AudioResampler::Filter (SSE2 or NEON, whichever the build has) against FilterScalar on random taps and
+// samples, and the whole resampler on a sine against the sine at the output rate. The paths add the taps
+// up in another order, so they're allowed to differ by float rounding of the sums
+
+#include "AudioResampler.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static constexpr u32 Runs = 100000;
+
+static u32 TestFilter()
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coefficient(-0.5f, 0.5f);
+    std::uniform_real_distribution<float> sample(-32768.0f, 32767.0f);
+    u32 failures = 0;
+    double worst = 0;
+
+    for (u32 run = 0; run < Runs; run++)
+    {
+        u32 taps = 8 << (run % 3);
+        float filter[64];
+        float left[32];
+        float right[32];
+        for (u32 i = 0; i < taps * 2; i++)
+        {
+            filter[i] = coefficient(random);
+        }
+        for (u32 i = 0; i < taps; i++)
+        {
+            left[i] = sample(random);
+            right[i] = ((random() % 4) == 0) ? 0.0f : sample(random);
+        }
+        float phaseFrac = (random() % 65536) / 65536.0f;
+
+        float simdLeft, simdRight, scalarLeft, scalarRight;
+        AudioResampler::Filter(filter, filter + taps, phaseFrac, left, right, taps, simdLeft, simdRight);
+        AudioResampler::FilterScalar(filter, filter + taps, phaseFrac, left, right, taps, scalarLeft, scalarRight);
+
+        // the rounding of a sum is within a few float epsilons of the largest partial sum, which is at
+        // most the sum of the terms' magnitudes
+        double boundLeft = 0;
+        double boundRight = 0;
+        for (u32 i = 0; i < taps; i++)
+        {
+            double coeff = fabs(filter[i] + (filter[taps + i] - filter[i]) * phaseFrac);
+            boundLeft += coeff * fabs(left[i]);
+            boundRight += coeff * fabs(right[i]);
+        }
+        double errorLeft = fabs(simdLeft - scalarLeft) / (boundLeft + 1);
+        double errorRight = fabs(simdRight - scalarRight) / (boundRight + 1);
+        worst = std::max(worst, std::max(errorLeft, errorRight));
+
+        if ((errorLeft > taps * 1.2e-7) || (errorRight > taps * 1.2e-7))
+        {
+            if (failures++ < 10)
+            {
+                printf("mismatch: run %u, %u taps, %f/%f against %f/%f\n", run, taps, simdLeft, simdRight,
+                    scalarLeft, scalarRight);
+            }
+        }
+    }
+
+    printf("AudioResampler filter: %u runs, %u mismatches, worst %.2g of the sum of magnitudes\n", Runs, failures, worst);
+    return failures;
+}
+
+// a 1 kHz sine from 44100 Hz to 48000 Hz in pieces the size the APU reads, against the sine at the time
+// each output frame is from. That's n * step - 1 input frames for output frame n, the history starts on
+// half the taps of silence and the output sits after tap half - 1
+static u32 TestSine(ResamplerQuality quality, double minimumSnr)
+{
+    const u32 inputRate = 44100;
+    const u32 outputRate = 48000;
+    const double amplitude = 16000;
+    const double frequency = 1000;
+
+    AudioResampler resampler;
+    resampler.Configure(inputRate, outputRate, quality, 1024);
+    u64 step = ((u64)inputRate << 32) / outputRate;
+
+    std::vector<s16> input(1024 * 2);
+    std::vector<s16> output(resampler.GetMaxOutputFrames(1024) * 2);
+    u64 inputFrame = 0;
+    u64 outputFrame = 0;
+    double signal = 0;
+    double noise = 0;
+
+    for (u32 piece = 0; piece < 200; piece++)
+    {
+        u32 count = 600 + (piece * 37) % 400;
+        for (u32 i = 0; i < count; i++)
+        {
+            s16 value = (s16)lrint(amplitude * sin(2 * M_PI * frequency * (inputFrame + i) / inputRate));
+            input[i * 2] = value;
+            input[i * 2 + 1] = -value;
+        }
+        inputFrame += count;
+
+        u32 produced = resampler.Process(input.data(), count, output.data(), resampler.GetMaxOutputFrames(count));
+        for (u32 i = 0; i < produced; i++, outputFrame++)
+        {
+            // past the silence the history starts on
+            if (outputFrame < 64)
+            {
+                continue;
+            }
+            double time = (double)(outputFrame * step) / 4294967296.0 - 1;
+            double expected = amplitude * sin(2 * M_PI * frequency * time / inputRate);
+            signal += expected * expected * 2;
+            noise += (output[i * 2] - expected) * (output[i * 2] - expected);
+            noise += (output[i * 2 + 1] + expected) * (output[i * 2 + 1] + expected);
+        }
+    }
+
+    double snr = 10 * log10(signal / noise);
+    bool passed = snr >= minimumSnr;
+    printf("AudioResampler %u taps, 1 kHz 44100 -> 48000 Hz: %llu frames, SNR %.1f dB (at least %.0f)\n",
+        AudioResampler::GetTaps(quality), (unsigned long long)outputFrame, snr, minimumSnr);
+    return passed ? 0 : 1;
+}
+
+int main()
+{
+    u32 failures = TestFilter();
+    failures += TestSine(ResamplerQuality::Low, 80);
+    failures += TestSine(ResamplerQuality::Medium, 83);
+    failures += TestSine(ResamplerQuality::High, 87);
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// AudioRing with a producer and a consumer thread. Every frame the producer asks for room for is numbered,
+// the low half on the left and the high half on the right, and the ones it isn't given are dropped. The
+// consumer has to get the rest in order with nothing repeated, followed only by silence when a read finds
+// too few queued. The gaps have to add up to the ring's overruns and the silence to its underruns. Each side
+// takes turns being the slow one, so the ring runs both full and empty while it wraps around many times.
+
+#include "AudioRing.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+static constexpr u32 Capacity = 1024;
+static constexpr u32 MaxWriteFrames = 300;
+static constexpr u32 Frames = 4000000;
+static constexpr u32 PhaseFrames = 50000; // the slow side switches every this many frames
+
+// phases where the producer is the slow side, the consumer is in the others
+static bool ProducerSlow(u32 frame) { return ((frame / PhaseFrames) % 2) == 0; }
+
+// lets the other side run, on one core too. the slow side lets it run a few times as long
+static void Pause(bool slow)
+{
+    std::this_thread::yield();
+    if (slow)
+    {
+        std::this_thread::yield();
+        std::this_thread::yield();
+        auto start = std::chrono::steady_clock::now();
+        while ((std::chrono::steady_clock::now() - start) < std::chrono::microseconds(5))
+        {
+        }
+    }
+}
+
+struct Counts
+{
+    u32 written = 0;
+    u32 dropped = 0;
+    u32 received = 0;
+    u32 gaps = 0;
+    u32 silent = 0;
+    u32 lastFrame = 0; // frames are numbered from 1, silence is 0 on both sides
+    bool ordered = true;
+};
+
+static void Produce(AudioRing &ring, Counts &counts, std::atomic<u32> &produced)
+{
+    std::mt19937 random(1);
+    u32 next = 1;
+
+    while (next <= Frames)
+    {
+        u32 frames = 1 + (random() % MaxWriteFrames);
+        if ((next + frames) > (Frames + 1))
+        {
+            frames = Frames + 1 - next;
+        }
+
+        u32 wanted = frames;
+        s16 *buffer = ring.BeginWrite(frames);
+        for (u32 i = 0; i < frames; i++)
+        {
+            buffer[i * 2] = (s16)(next + i);
+            buffer[i * 2 + 1] = (s16)((next + i) >> 16);
+        }
+        ring.EndWrite(frames);
+
+        counts.written += frames;
+        counts.dropped += wanted - frames;
+        next += wanted;
+        produced.store(next, std::memory_order_release);
+
+        // the ring was full, wait for it to drain the way the host does
+        while ((frames < wanted) && (ring.GetQueuedFrames() > (Capacity / 2)))
+        {
+            std::this_thread::yield();
+        }
+        Pause(ProducerSlow(next));
+    }
+}
+
+static void Consume(AudioRing &ring, Counts &counts, std::atomic<u32> &produced)
+{
+    std::mt19937 random(2);
+    std::vector<s16> output(MaxWriteFrames * 4);
+
+    // until the producer is done and everything it queued is read
+    while ((produced.load(std::memory_order_acquire) <= Frames) || (ring.GetQueuedFrames() > 0))
+    {
+        u32 frames = 1 + (random() % (MaxWriteFrames * 2));
+        ring.Read(output.data(), frames);
+
+        bool silence = false;
+        for (u32 i = 0; i < frames; i++)
+        {
+            u32 frame = (u16)output[i * 2] | ((u32)(u16)output[i * 2 + 1] << 16);
+            if (frame == 0)
+            {
+                silence = true;
+                counts.silent++;
+                continue;
+            }
+
+            // a frame after silence in the same read, or one that isn't newer than the last
+            if (silence || (frame <= counts.lastFrame))
+            {
+                counts.ordered = false;
+            }
+            counts.gaps += frame - counts.lastFrame - 1;
+            counts.lastFrame = frame;
+            counts.received++;
+        }
+
+        // ran dry, wait for more the way the audio device waits for its next callback
+        while (silence && (ring.GetQueuedFrames() == 0) && (produced.load(std::memory_order_acquire) <= Frames))
+        {
+            std::this_thread::yield();
+        }
+        Pause(!ProducerSlow(counts.lastFrame));
+    }
+}
+
+int main()
+{
+    AudioRing ring(Capacity, MaxWriteFrames);
+    Counts counts;
+    std::atomic<u32> produced(1);
+
+    std::thread consumer(Consume, std::ref(ring), std::ref(counts), std::ref(produced));
+    Produce(ring, counts, produced);
+    consumer.join();
+
+    // frames dropped at the end don't leave a gap before anything
+    u32 gaps = counts.gaps + (Frames - counts.lastFrame);
+    bool matches = counts.ordered && (counts.received == counts.written) && (gaps == counts.dropped) &&
+        (ring.GetOverruns() == counts.dropped) && (ring.GetUnderruns() == counts.silent);
+    printf("AudioRing: %u frames, %u written, %u read, %u overruns (%u dropped), %u underruns (%u silent), %s\n",
+        Frames, counts.written, counts.received, ring.GetOverruns(), counts.dropped, ring.GetUnderruns(),
+        counts.silent, matches ? "matches" : "differs");
+
+    // without both the ring running full and empty this wouldn't test anything
+    return (matches && (counts.dropped > 0) && (counts.silent > 0)) ? 0 : 1;
+}
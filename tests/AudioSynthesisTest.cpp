@@ -0,0 +1,181 @@
+// GameBoy::SetAudioSynthesis against synthesizing all the time. Every 8 frames the ROM starts a note on each
+// channel with a length that runs out, an envelope, sweep on channel 1 and the wave channel playing, writes
+// a wave RAM byte every frame, reads NR52 into WRAM all through the frame and every APU register and wave
+// RAM into WRAM at V-Blank. With synthesis off, toggled, and toggled through the audio thread's log, the
+// saved state every 5 frames after setup (those reads, and the channels' lengths, envelopes, timers, positions and
+// outputs) has to be the same as with it on, and with it off no audio is queued at all.
+
+#include "TestRom.h"
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+static constexpr u32 Frames = 220;
+static constexpr u32 SetupFrames = 100; // the DMG boot ROM takes about 60, clearing RAM about 25
+
+static void Assemble(TestRom &rom)
+{
+    rom.Emit({ 0xF3, 0x31, 0xFE, 0xFF });                   // di, ld sp,FFFE
+    rom.Label("waitVBlank");
+    rom.Emit({ 0xF0, 0x44, 0xFE, 144 });                    // ldh a,(LY), cp 144
+    rom.JumpRelative(0x20, "waitVBlank");
+    rom.Emit({ 0xAF, 0xE0, 0x40 });                         // LCD off
+    rom.ClearRam();
+
+    // APU on, everything to both sides
+    rom.Emit({ 0x3E, 0x80, 0xE0, 0x26, 0x3E, 0x77, 0xE0, 0x24, 0x3E, 0xFF, 0xE0, 0x25 });
+
+    // LCD on, V-Blank interrupt only
+    rom.Emit({ 0x3E, 0x91, 0xE0, 0x40, 0x3E, 0x01, 0xE0, 0xFF, 0xAF, 0xE0, 0x0F, 0xFB });
+
+    // NR52 into C800-CFFF, over and over
+    rom.Label("main");
+    rom.Emit({ 0x21, 0x00, 0xC8 });                         // ld hl,C800
+    rom.Label("poll");
+    rom.Emit({ 0xF0, 0x26, 0x22, 0x7C, 0xFE, 0xD0 });
+    rom.JumpRelative(0x20, "poll");
+    rom.JumpRelative(0x18, "main");
+
+    // V-Blank: count frames in D000, the frame count into a wave RAM byte, FF10-FF3F into C000 + (frame & 1F) * 40
+    rom.Org(0x40);
+    rom.Jump(0xC3, "vblank");
+    rom.Org(0x1000);
+    rom.Label("vblank");
+    rom.Emit({ 0xF5, 0xC5, 0xE5 });                         // push af, bc, hl
+    rom.Emit({ 0xFA, 0x00, 0xD0, 0x3C, 0xEA, 0x00, 0xD0, 0x47 });  // frame counter, ld b,a
+    rom.Emit({ 0x78, 0xE6, 0x0F, 0xF6, 0x30, 0x4F, 0x78, 0xE2 });  // ld (FF30 + (b & F)),b
+    rom.Emit({ 0x78, 0xE6, 0x1F, 0x26, 0x00, 0x6F });       // hl = b & 1F
+    rom.Emit({ 0x29, 0x29, 0x29, 0x29, 0x29, 0x29 });       // add hl,hl 6 times
+    rom.Emit({ 0x7C, 0xF6, 0xC0, 0x67, 0x0E, 0x10 });       // hl |= C000, ld c,10
+    rom.Label("registers");
+    rom.Emit({ 0xF2, 0x22, 0x0C, 0x79, 0xFE, 0x40 });       // ld a,(c), ld (hl+),a, until c is 40
+    rom.JumpRelative(0x20, "registers");
+
+    // every 8 frames a note on each channel, what changes with the frame count is in b
+    rom.Emit({ 0x78, 0xE6, 0x07 });
+    rom.JumpRelative(0x20, "noNote");
+    rom.Emit({ 0x3E, 0x15, 0xE0, 0x10 });                   // sweep up every tick, by 1/32
+    rom.Emit({ 0x78, 0xE6, 0xC0, 0xF6, 0x30, 0xE0, 0x11 }); // duty from b, length 16
+    rom.Emit({ 0x3E, 0xF3, 0xE0, 0x12, 0x78, 0xE0, 0x13, 0x3E, 0xC6, 0xE0, 0x14 });
+    rom.Emit({ 0x3E, 0x80, 0xE0, 0x16, 0x3E, 0x0F, 0xE0, 0x17 });  // 50%, envelope up from 0
+    rom.Emit({ 0x78, 0x2F, 0xE0, 0x18, 0x3E, 0x87, 0xE0, 0x19 });
+    rom.Emit({ 0x3E, 0x80, 0xE0, 0x1A, 0x3E, 0xE0, 0xE0, 0x1B, 0x3E, 0x20, 0xE0, 0x1C });  // length 32
+    rom.Emit({ 0x78, 0xE0, 0x1D, 0x3E, 0xC7, 0xE0, 0x1E });
+    rom.Emit({ 0x3E, 0x20, 0xE0, 0x20, 0x3E, 0xA1, 0xE0, 0x21 });  // length 32, envelope down
+    rom.Emit({ 0x78, 0xE0, 0x22, 0x3E, 0xC0, 0xE0, 0x23 });        // width and clock from b
+    rom.Label("noNote");
+    rom.Emit({ 0xE1, 0xC1, 0xF1, 0xD9 });                   // pop, reti
+}
+
+struct Mode
+{
+    const char *name;
+    bool synthesis;
+    u32 toggleFrames; // 0 leaves it as it is
+    bool deferred;
+};
+
+static const Mode Modes[] =
+{
+    { "on", true, 0, false },
+    { "off", false, 0, false },
+    { "toggled every 7 frames", false, 7, false },
+    { "toggled every 7 frames through the audio thread", false, 7, true },
+};
+
+static constexpr u32 StateFrames = 5;
+
+// the saved state every few frames once RAM is cleared
+static bool Run(const std::string &romFile, const Mode &mode, std::vector<std::string> &states, TestHost &host)
+{
+    GameBoy gameBoy(GameBoyModel::Auto, romFile.c_str(), &host);
+    gameBoy.SetDeferredAudio(mode.deferred);
+    gameBoy.SetAudioSynthesis(mode.synthesis);
+
+    std::string stateFile = romFile + "." + std::to_string(&mode - Modes) + ".state";
+    bool synthesis = mode.synthesis;
+    for (u32 i = 0; i < Frames; i++)
+    {
+        if (mode.toggleFrames && ((i % mode.toggleFrames) == 0))
+        {
+            synthesis = !synthesis;
+            gameBoy.SetAudioSynthesis(synthesis);
+        }
+        gameBoy.RunOneFrame();
+
+        if ((i >= SetupFrames) && ((i % StateFrames) == 0))
+        {
+            {
+                std::ofstream outState(stateFile, std::ios::out | std::ios::binary | std::ios::trunc);
+                gameBoy.SaveState(outState);
+            }
+            std::ifstream inState(stateFile, std::ios::in | std::ios::binary);
+            states.emplace_back(std::istreambuf_iterator<char>(inState), std::istreambuf_iterator<char>());
+            if (states.back().empty())
+            {
+                return false;
+            }
+        }
+    }
+
+    // hands the audio still queued for the audio thread over
+    gameBoy.SetDeferredAudio(false);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string outDir = (argc > 1) ? argv[1] : ".";
+    u32 failures = 0;
+
+    for (bool cgb : { false, true })
+    {
+        const char *model = cgb ? "CGB" : "DMG";
+        TestRom rom(cgb);
+        Assemble(rom);
+        std::string romFile = outDir + (cgb ? "/AudioSynthesisTest_cgb.gb" : "/AudioSynthesisTest_dmg.gb");
+        if (!rom.Write(romFile))
+        {
+            printf("can't write %s\n", romFile.c_str());
+            return 1;
+        }
+
+        std::vector<std::string> onStates;
+        TestHost onHost;
+        if (!Run(romFile, Modes[0], onStates, onHost))
+        {
+            printf("%s: can't run\n", model);
+            return 1;
+        }
+
+        for (const Mode &mode : Modes)
+        {
+            if (&mode == Modes)
+            {
+                continue;
+            }
+
+            std::vector<std::string> states;
+            TestHost host;
+            if (!Run(romFile, mode, states, host))
+            {
+                printf("%s: can't run\n", model);
+                return 1;
+            }
+
+            // the audio queued is only checked where there can't be any
+            bool stateMatches = (states == onStates);
+            bool silent = mode.synthesis || mode.toggleFrames || (host.audioFrames == 0);
+            printf("AudioSynthesis %s, %s: %u frames, %llu audio frames (%llu with it on), state %s%s\n", model,
+                mode.name, Frames, (unsigned long long)host.audioFrames, (unsigned long long)onHost.audioFrames,
+                stateMatches ? "matches" : "differs", silent ? "" : ", audio queued");
+
+            if ((onHost.audioFrames == 0) || !stateMatches || !silent)
+            {
+                failures++;
+            }
+        }
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// FrameObserver::Downscale2x and Downscale4x (SSE2 or NEON, whichever the build has) against the scalar
+// versions on random images of every width up to past a frame, so every length of scalar tail comes up,
+// with the values each byte format has. Then FrameObserver itself, on frames of each format at each
+// scale it takes, repeated frames included, against the scalar downscale of what was pushed.
+
+#include "FrameObserver.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static constexpr u32 MaxWidth = 200;
+static constexpr u32 Guard = 64;
+
+struct Format
+{
+    PpuOutputFormat format;
+    const char *name;
+    u32 values; // bytes are below this
+};
+
+static const Format Formats[] =
+{
+    { PpuOutputFormat::Shade, "shade", 4 },
+    { PpuOutputFormat::PaletteIndex, "palette index", 64 },
+    { PpuOutputFormat::Luma, "luma", 256 },
+};
+
+static u32 TestDownscale(std::mt19937 &random, const Format &format, u32 scale)
+{
+    u32 failures = 0;
+    u32 runs = 0;
+    std::vector<u8> src(MaxWidth * 8);
+    std::vector<u8> simd(MaxWidth * 2 + Guard);
+    std::vector<u8> scalar(MaxWidth * 2 + Guard);
+
+    for (u32 width = scale; width <= MaxWidth; width += scale)
+    {
+        for (u32 height = scale; height <= 8; height += scale)
+        {
+            for (u32 i = 0; i < width * height; i++)
+            {
+                // runs of the largest value too, the sums mustn't overflow
+                src[i] = ((random() % 8) == 0) ? (u8)(format.values - 1) : (u8)(random() % format.values);
+            }
+
+            memset(simd.data(), 0xEE, simd.size());
+            memset(scalar.data(), 0xEE, scalar.size());
+            if (scale == 2)
+            {
+                FrameObserver::Downscale2x(src.data(), simd.data(), width, height);
+                FrameObserver::Downscale2xScalar(src.data(), scalar.data(), width, height);
+            }
+            else
+            {
+                FrameObserver::Downscale4x(src.data(), simd.data(), width, height);
+                FrameObserver::Downscale4xScalar(src.data(), scalar.data(), width, height);
+            }
+            runs++;
+
+            // also catches writes past the image
+            if (memcmp(simd.data(), scalar.data(), simd.size()) != 0)
+            {
+                if (failures++ < 10)
+                {
+                    printf("mismatch: %ux downscale of %s, %ux%u\n", scale, format.name, width, height);
+                }
+            }
+        }
+    }
+
+    printf("FrameObserver %ux downscale of %s: %u images, %u mismatches\n", scale, format.name, runs, failures);
+    return failures;
+}
+
+static u32 TestObserver(std::mt19937 &random, const Format &format, u32 scale)
+{
+    const u32 stackSize = 3;
+    std::vector<u8> buffer(stackSize * 160 * 144);
+    FrameObserver observer;
+    bool configured = observer.Configure(format.format, scale, stackSize, buffer.data(), (u32)buffer.size());
+
+    // palette indices can't be averaged
+    if ((format.format == PpuOutputFormat::PaletteIndex) && (scale != 1))
+    {
+        bool passed = !configured;
+        printf("FrameObserver %s at 1/%u: %s\n", format.name, scale, passed ? "refused" : "accepted");
+        return passed ? 0 : 1;
+    }
+    if (!configured)
+    {
+        printf("FrameObserver %s at 1/%u: not configured\n", format.name, scale);
+        return 1;
+    }
+
+    u32 failures = 0;
+    std::vector<u8> frame(160 * 144);
+    std::vector<u8> expected(160 * 144);
+    for (u32 i = 0; i < 20; i++)
+    {
+        // a repeated frame is the one before, the observer copies the last observation instead
+        bool repeat = (i > 0) && ((random() % 3) == 0);
+        if (!repeat)
+        {
+            for (u8 &pixel : frame)
+            {
+                pixel = (u8)(random() % format.values);
+            }
+            if (scale == 2)
+            {
+                FrameObserver::Downscale2xScalar(frame.data(), expected.data(), 160, 144);
+            }
+            else if (scale == 4)
+            {
+                FrameObserver::Downscale4xScalar(frame.data(), expected.data(), 160, 144);
+            }
+            else
+            {
+                expected = frame;
+            }
+        }
+        observer.PushFrame(frame.data(), repeat);
+
+        u32 slot = observer.GetNewestSlot();
+        if ((observer.GetFrameCount() != i + 1) || (slot != (i % stackSize)) ||
+            (memcmp(observer.GetSlot(slot), expected.data(), observer.GetFrameSize()) != 0))
+        {
+            if (failures++ < 10)
+            {
+                printf("mismatch: %s at 1/%u, frame %u\n", format.name, scale, i);
+            }
+        }
+    }
+
+    printf("FrameObserver %s at 1/%u: %ux%u, %u mismatches\n", format.name, scale, observer.GetWidth(),
+        observer.GetHeight(), failures);
+    return failures;
+}
+
+int main()
+{
+    std::mt19937 random(1);
+    u32 failures = 0;
+
+    for (const Format &format : Formats)
+    {
+        failures += TestDownscale(random, format, 2);
+        failures += TestDownscale(random, format, 4);
+    }
+    for (const Format &format : Formats)
+    {
+        for (u32 scale : { 1, 2, 4 })
+        {
+            failures += TestObserver(random, format, scale);
+        }
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+// GameBoyPpu on its own, drawing DMG and CGB scenes with and without sprites, to RGBA and to luma. SCY is
+// written in every line's mode 3, so no line is drawn from the layer cache and everything goes through
+// TickDrawing and its pixel mixers. The same scenes without the writes are drawn from the cache.
+
+#include "TestRom.h"
+#include "GameBoyPpu.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+static constexpr u32 Frames = 20;
+static constexpr u32 Runs = 40;
+
+// tiles, maps, CGB map attributes and palettes that don't repeat for a while, and 40 8x16 sprites down and
+// across the screen with every attribute, up to 6 on a line
+static void Setup(GameBoyPpu &ppu, u8 *videoRam, u8 *oamRam, bool sprites)
+{
+    for (u32 addr = 0; addr < 0x1800; addr++)
+    {
+        u8 low = (u8)addr;
+        u8 value = low ^ (u8)((addr >> 8) | 0x80);
+        value = (u8)((value << 1) | (value >> 7)) ^ 0x5A;
+        videoRam[addr] = value + low;
+    }
+    for (u32 addr = 0x1800; addr < 0x2000; addr++)
+    {
+        u8 value = (u8)addr + (u8)((addr >> 8) | 0x80);
+        videoRam[addr] = (u8)((value << 1) | (value >> 7));
+        videoRam[0x2000 | addr] = ((u8)addr ^ (u8)((addr >> 8) | 0x80)) & 0xE7;
+    }
+    for (u32 i = 0; i < 40; i++)
+    {
+        oamRam[i * 4] = (u8)(16 + i * 3);
+        oamRam[i * 4 + 1] = (u8)(8 + i * 5);
+        oamRam[i * 4 + 2] = (u8)(40 - i);
+        oamRam[i * 4 + 3] = (u8)((40 - i) << 3);
+    }
+
+    ppu.Reset();
+    ppu.WriteRegister(0xFF68, 0x80);
+    ppu.WriteRegister(0xFF6A, 0x80);
+    for (u32 i = 0; i < 64; i++)
+    {
+        u8 value = (u8)(0x11 + (i + 1) * 37);
+        ppu.WriteRegister(0xFF69, value);
+        ppu.WriteRegister(0xFF6B, value ^ 0xFF);
+    }
+    ppu.WriteRegister(0xFF47, 0xE4);
+    ppu.WriteRegister(0xFF48, 0xD2);
+    ppu.WriteRegister(0xFF49, 0x1B);
+    ppu.WriteRegister(0xFF40, 0x00);
+    ppu.WriteRegister(0xFF40, sprites ? 0x97 : 0x95);
+}
+
+// a PPU drawing one of the scenes, with or without SCY written in mode 3
+struct Scene
+{
+    std::vector<u8> videoRam = std::vector<u8>(0x4000);
+    std::vector<u8> oamRam = std::vector<u8>(0xA0);
+    GameBoyPpu ppu;
+    bool raster;
+    u8 scrollY = 0;
+    u8 lastLine = 0xFF;
+    double fastest = 1e30;
+
+    Scene(GameBoy &gameBoy, IHostSystem &host, bool sprites, PpuOutputFormat format, bool raster)
+        : ppu(&gameBoy, &host, videoRam.data(), oamRam.data()), raster(raster)
+    {
+        ppu.SetOutputFormat(format);
+        Setup(ppu, videoRam.data(), oamRam.data(), sprites);
+    }
+
+    void Run()
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (u32 cycle = 0; cycle < Frames * 70224; cycle++)
+        {
+            ppu.ExecuteCycle();
+
+            const PpuState &state = ppu.GetState();
+            if (raster && (state.lcdMode == LcdModeFlag::Drawing) && (state.scanline != lastLine) && (state.tick > 100))
+            {
+                lastLine = state.scanline;
+                ppu.WriteRegister(0xFF42, scrollY++);
+            }
+        }
+        fastest = std::min(fastest, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    double Microseconds() { return fastest * 1e6 / Frames; }
+};
+
+int main(int argc, char *argv[])
+{
+    std::string outDir = (argc > 1) ? argv[1] : ".";
+
+    // the results are printed when everything has run, loading the ROMs prints their headers
+    std::vector<std::string> names;
+    std::vector<std::unique_ptr<Scene>> scenes;
+    TestHost host;
+    std::unique_ptr<GameBoy> gameBoys[2];
+    for (bool cgb : { false, true })
+    {
+        // the PPU only asks the GameBoy for the model
+        TestRom rom(cgb);
+        std::string romFile = outDir + (cgb ? "/PpuBench_cgb.gb" : "/PpuBench_dmg.gb");
+        if (!rom.Write(romFile))
+        {
+            printf("can't write %s\n", romFile.c_str());
+            return 1;
+        }
+        gameBoys[cgb].reset(new GameBoy(GameBoyModel::Auto, romFile.c_str(), &host));
+
+        for (bool sprites : { true, false })
+        {
+            for (PpuOutputFormat format : { PpuOutputFormat::Rgba, PpuOutputFormat::Luma })
+            {
+                names.push_back(std::string(cgb ? "CGB " : "DMG ") + (sprites ? "sprites    " : "no sprites ") +
+                    ((format == PpuOutputFormat::Luma) ? "luma" : "rgba"));
+                scenes.emplace_back(new Scene(*gameBoys[cgb], host, sprites, format, true));
+                scenes.emplace_back(new Scene(*gameBoys[cgb], host, sprites, format, false));
+            }
+        }
+    }
+
+    // short runs of every scene taking turns, so the fastest of each is one nothing else got in the way of
+    for (u32 run = 0; run < Runs; run++)
+    {
+        for (std::unique_ptr<Scene> &scene : scenes)
+        {
+            scene->Run();
+        }
+    }
+
+    printf("\nPPU us per frame, lower is better: every line drawn dot by dot, and drawn from the layer cache\n");
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        printf("  %s  dot by dot %6.1f  cached %6.1f\n", names[i].c_str(), scenes[i * 2]->Microseconds(),
+            scenes[i * 2 + 1]->Microseconds());
+    }
+    return 0;
+}
@@ -0,0 +1,429 @@
+// GameBoy::GetObservation against what the PPU draws, and with frames headless and skipped. The ROM fills
+// VRAM with tiles, maps and CGB attributes that follow from their addresses, and every 4 frames its V-Blank
+// handler switches to another of 8 settings of LCDC, scroll, window and OAM, with more than 10 sprites on
+// some lines and some off screen. Each frame's observation has to match the setting it was taken in, the
+// top left pixel of every cell no sprite covers has to be the observed tile's in the frame drawn with it,
+// and the observations have to be the same with frames headless, skipped and drawn on the render thread.
+// Every frame has to reach the host, as a frame or as one that was skipped.
+
+#include "TestRom.h"
+#include <vector>
+
+static constexpr u32 Frames = 180;
+static constexpr u32 SetupFrames = 100; // the DMG boot ROM takes about 60, clearing RAM about 25
+
+struct Step
+{
+    u8 lcdControl;
+    u8 scrollY;
+    u8 scrollX;
+    u8 windowY;
+    u8 windowX;
+};
+
+// both tile addressings, maps and sprite sizes, the window from the left edge, off below the screen and off
+static const Step Steps[8] =
+{
+    { 0xF3, 5, 3, 17, 40 },
+    { 0xE7, 58, 77, 0, 7 },
+    { 0xDB, 111, 151, 50, 8 },
+    { 0xB5, 164, 225, 9, 100 },
+    { 0xAF, 217, 43, 70, 159 },
+    { 0xFF, 14, 189, 150, 20 },
+    { 0xD3, 67, 6, 143, 83 },
+    { 0xA7, 120, 82, 3, 166 },
+};
+
+// 14 sprites on the same lines, one of them at X 0 and one past the right edge, which still count towards
+// the limit of 10, and the others anywhere
+static void MakeOam(u32 step, u8 *oam)
+{
+    for (u32 i = 0; i < 40; i++)
+    {
+        u8 *entry = oam + i * 4;
+        if (i < 14)
+        {
+            entry[0] = (u8)(56 + step * 3 + ((i == 12) ? 9 : 0));
+            entry[1] = (i == 2) ? 0 : (i == 5) ? 170 : (u8)(8 + i * 11);
+        }
+        else
+        {
+            entry[0] = (u8)((i * 37 + step * 13) % 170);
+            entry[1] = (u8)((i * 53 + step * 29) % 176);
+        }
+        entry[2] = (u8)(i * 7 + step);
+        entry[3] = (u8)(i * 0x1D + step * 0x40);
+    }
+}
+
+static u8 TileByte(u16 addr) { return (u8)addr ^ (u8)(addr >> 8); }
+static u8 MapByte(u16 addr) { return (addr < 0x9C00) ? (u8)addr : (u8)addr ^ 0x55; }
+static u8 AttributeByte(u16 addr) { return (u8)addr & 0x6F; }
+
+static void Assemble(TestRom &rom, bool cgb)
+{
+    rom.Emit({ 0xF3, 0x31, 0xFE, 0xFF });                   // di, ld sp,FFFE
+    rom.Label("waitVBlank");
+    rom.Emit({ 0xF0, 0x44, 0xFE, 144 });                    // ldh a,(LY), cp 144
+    rom.JumpRelative(0x20, "waitVBlank");
+    rom.Emit({ 0xAF, 0xE0, 0x40 });                         // LCD off
+    rom.ClearRam();
+
+    // tiles, maps and attributes as TileByte, MapByte and AttributeByte, bank 1 tiles stay 0
+    rom.Emit({ 0x21, 0x00, 0x80 });                         // ld hl,8000
+    rom.Label("tiles");
+    rom.Emit({ 0x7D, 0xAC, 0x22, 0x7C, 0xFE, 0x98 });       // ld a,l, xor h, ld (hl+),a, until 9800
+    rom.JumpRelative(0x20, "tiles");
+    rom.Label("bgMap");
+    rom.Emit({ 0x7D, 0x22, 0x7C, 0xFE, 0x9C });
+    rom.JumpRelative(0x20, "bgMap");
+    rom.Label("windowMap");
+    rom.Emit({ 0x7D, 0xEE, 0x55, 0x22, 0x7C, 0xFE, 0xA0 });
+    rom.JumpRelative(0x20, "windowMap");
+    if (cgb)
+    {
+        rom.Emit({ 0x3E, 0x01, 0xE0, 0x4F, 0x21, 0x00, 0x98 });
+        rom.Label("attributes");
+        rom.Emit({ 0x7D, 0xE6, 0x6F, 0x22, 0x7C, 0xFE, 0xA0 });
+        rom.JumpRelative(0x20, "attributes");
+        rom.Emit({ 0xAF, 0xE0, 0x4F });
+    }
+
+    // CGB palettes from 2800, DMG palettes
+    rom.Emit({ 0x3E, 0x80, 0xE0, 0x68, 0x3E, 0x80, 0xE0, 0x6A, 0x21, 0x00, 0x28, 0x0E, 0x40 });
+    rom.Label("bgPalettes");
+    rom.Emit({ 0x2A, 0xE0, 0x69, 0x0D });
+    rom.JumpRelative(0x20, "bgPalettes");
+    rom.Emit({ 0x0E, 0x40 });
+    rom.Label("objPalettes");
+    rom.Emit({ 0x2A, 0xE0, 0x6B, 0x0D });
+    rom.JumpRelative(0x20, "objPalettes");
+    rom.Emit({ 0x3E, 0xE4, 0xE0, 0x47, 0x3E, 0xD2, 0xE0, 0x48, 0x3E, 0x1B, 0xE0, 0x49 });
+
+    // LCD on, V-Blank interrupt only
+    rom.Emit({ 0x3E, Steps[0].lcdControl, 0xE0, 0x40, 0x3E, 0x01, 0xE0, 0xFF, 0xAF, 0xE0, 0x0F, 0xFB });
+    rom.Label("main");
+    rom.Emit({ 0x76 });                                     // halt
+    rom.JumpRelative(0x18, "main");
+
+    // V-Blank: count frames in D000, OAM then LCDC, SCY, SCX, WY and WX from 2000 + ((frame >> 2) & 7) * 100
+    rom.Org(0x40);
+    rom.Jump(0xC3, "vblank");
+    rom.Org(0x1000);
+    rom.Label("vblank");
+    rom.Emit({ 0xF5, 0xC5, 0xD5, 0xE5 });                   // push af, bc, de, hl
+    rom.Emit({ 0xFA, 0x00, 0xD0, 0x3C, 0xEA, 0x00, 0xD0 }); // frame counter
+    rom.Emit({ 0x1F, 0x1F, 0xE6, 0x07, 0xC6, 0x20, 0x67, 0x2E, 0x00, 0x11, 0x00, 0xFE });
+    for (u32 i = 0; i < 160; i++)
+    {
+        rom.Emit({ 0x2A, 0x12, 0x1C });                     // ld a,(hl+), ld (de),a, inc e, fits in V-Blank
+    }
+    rom.Emit({ 0x2A, 0xE0, 0x40, 0x2A, 0xE0, 0x42, 0x2A, 0xE0, 0x43, 0x2A, 0xE0, 0x4A, 0x2A, 0xE0, 0x4B });
+    rom.Emit({ 0xE1, 0xD1, 0xC1, 0xF1, 0xD9 });             // pop, reti
+
+    for (u32 step = 0; step < 8; step++)
+    {
+        u8 oam[160];
+        MakeOam(step, oam);
+        rom.Org((u16)(0x2000 + step * 0x100));
+        for (u8 byte : oam)
+        {
+            rom.Emit({ byte });
+        }
+        const Step &settings = Steps[step];
+        rom.Emit({ settings.lcdControl, settings.scrollY, settings.scrollX, settings.windowY, settings.windowX });
+    }
+
+    rom.Org(0x2800);
+    for (u32 i = 0; i < 64; i++)
+    {
+        rom.Emit({ (u8)(0x11 + (i + 1) * 37) });
+    }
+    for (u32 i = 0; i < 64; i++)
+    {
+        rom.Emit({ (u8)((0x11 + (i + 1) * 37) ^ 0xFF) });
+    }
+}
+
+// the step whose registers the observation has, or -1
+static int FindStep(const PpuObservation &observation)
+{
+    for (int step = 0; step < 8; step++)
+    {
+        const Step &settings = Steps[step];
+        if ((observation.lcdControl == settings.lcdControl) && (observation.scrollX == settings.scrollX) &&
+            (observation.scrollY == settings.scrollY) && (observation.windowX == settings.windowX) &&
+            (observation.windowY == settings.windowY))
+        {
+            return step;
+        }
+    }
+    return -1;
+}
+
+// the observation worked out from the step's settings: an OAM search on every line, and each cell's map entry
+static bool MatchesStep(const PpuObservation &observation, int step, bool cgb)
+{
+    const Step &settings = Steps[step];
+    u8 oam[160];
+    MakeOam(step, oam);
+
+    u8 height = (settings.lcdControl & 0x04) ? 16 : 8;
+    bool found[40] = {};
+    for (int line = 0; line < 144; line++)
+    {
+        u32 count = 0;
+        for (u32 i = 0; (i < 40) && (count < 10); i++)
+        {
+            if ((line + 16 >= oam[i * 4]) && (line + 16 < oam[i * 4] + height))
+            {
+                found[i] = true;
+                count++;
+            }
+        }
+    }
+
+    u32 spriteCount = 0;
+    for (u32 i = 0; (i < 40) && (settings.lcdControl & 0x02); i++)
+    {
+        const u8 *entry = oam + i * 4;
+        if (!found[i] || (entry[1] == 0) || (entry[1] >= 168))
+        {
+            continue;
+        }
+        if (spriteCount >= observation.spriteCount)
+        {
+            return false;
+        }
+        const PpuObservedSprite &sprite = observation.sprites[spriteCount++];
+        if ((sprite.oamIndex != i) || (sprite.x != entry[1] - 8) || (sprite.y != entry[0] - 16) ||
+            (sprite.tile != entry[2]) || (sprite.attributes != entry[3]))
+        {
+            return false;
+        }
+    }
+    if ((spriteCount != observation.spriteCount) || (observation.spriteHeight != height))
+    {
+        return false;
+    }
+
+    bool windowVisible = (settings.lcdControl & 0x20) && (settings.windowX < 167) && (settings.windowY < 144);
+    if (observation.windowVisible != windowVisible)
+    {
+        return false;
+    }
+    for (int row = 0; row < 18; row++)
+    {
+        for (int column = 0; column < 20; column++)
+        {
+            int x = column * 8;
+            int y = row * 8;
+            bool window = windowVisible && (y >= settings.windowY) && (x + 7 >= settings.windowX);
+            u16 addr;
+            if (window)
+            {
+                addr = ((settings.lcdControl & 0x40) ? 0x9C00 : 0x9800) +
+                    ((y - settings.windowY) / 8) * 32 + (x + 7 - settings.windowX) / 8;
+            }
+            else
+            {
+                addr = ((settings.lcdControl & 0x08) ? 0x9C00 : 0x9800) +
+                    (((settings.scrollY + y) & 0xFF) / 8) * 32 + ((settings.scrollX + x) & 0xFF) / 8;
+            }
+
+            u8 entry = MapByte(addr);
+            u16 tile = (settings.lcdControl & 0x10) ? entry : (u16)(256 + (s8)entry);
+            const PpuObservedTile &observed = observation.tiles[row][column];
+            if ((observed.window != window) || (observed.tile != tile) ||
+                (observed.attributes != (cgb ? AttributeByte(addr) : 0)))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// the top left pixel of every cell no sprite covers, from the observed tile and palette. counts the cells checked
+static bool MatchesFrame(const PpuObservation &observation, const u32 *frame, u32 &cells)
+{
+    for (int row = 0; row < 18; row++)
+    {
+        for (int column = 0; column < 20; column++)
+        {
+            int x = column * 8;
+            int y = row * 8;
+            bool covered = false;
+            for (u32 i = 0; i < observation.spriteCount; i++)
+            {
+                const PpuObservedSprite &sprite = observation.sprites[i];
+                covered |= (x >= sprite.x) && (x < sprite.x + 8) && (y >= sprite.y) && (y < sprite.y + observation.spriteHeight);
+            }
+            if (covered)
+            {
+                continue;
+            }
+
+            const PpuObservedTile &tile = observation.tiles[row][column];
+            u8 pixelX = tile.window ? (x + 7 - observation.windowX) : (observation.scrollX + x);
+            u8 pixelY = tile.window ? (y - observation.windowY) : (observation.scrollY + y);
+            pixelX = (tile.attributes & 0x20) ? (7 - (pixelX & 7)) : (pixelX & 7);
+            pixelY = (tile.attributes & 0x40) ? (7 - (pixelY & 7)) : (pixelY & 7);
+
+            u16 addr = (u16)(0x8000 + tile.tile * 16 + pixelY * 2);
+            u8 low = (tile.attributes & 0x08) ? 0 : TileByte(addr);
+            u8 high = (tile.attributes & 0x08) ? 0 : TileByte(addr + 1);
+            u8 color = ((low >> (7 - pixelX)) & 1) | (((high >> (7 - pixelX)) & 1) << 1);
+            if (frame[y * 160 + x] != observation.colors[(tile.attributes & 0x07) * 4 + color])
+            {
+                return false;
+            }
+            cells++;
+        }
+    }
+    return true;
+}
+
+// keeps the last frame
+class FrameHost : public TestHost
+{
+public:
+    u32 frame[160 * 144];
+
+    void PushVideoFrame(u32 *pixelBuffer, const u32 *dirtyLines, bool repeat) override
+    {
+        memcpy(frame, pixelBuffer, sizeof(frame));
+        TestHost::PushVideoFrame(pixelBuffer, dirtyLines, repeat);
+    }
+};
+
+struct Mode
+{
+    const char *name;
+    bool headless;
+    u8 frameSkip;
+    bool deferred;
+    bool speculative;
+};
+
+static const Mode Modes[] =
+{
+    { "drawn", false, 0, false, false },
+    { "headless", true, 0, false, false },
+    { "2 of 3 frames skipped", false, 2, false, false },
+    { "drawn on the render thread", false, 0, true, false },
+    { "2 of 3 frames skipped on the render thread", false, 2, true, false },
+    { "speculative", false, 0, true, true },
+};
+
+// every frame's observation once RAM is cleared, padding zeroed so they can be compared as bytes. a frame
+// the host gets is checked against the observation taken when the settings were the same for two frames,
+// which is all it was drawn in. the host has to be told about every frame, drawn or not
+static bool Run(const std::string &romFile, const Mode &mode, bool cgb, std::vector<PpuObservation> &observations,
+    u32 &checkedFrames, u32 &checkedCells)
+{
+    FrameHost host;
+    GameBoy gameBoy(GameBoyModel::Auto, romFile.c_str(), &host);
+    gameBoy.SetHeadless(mode.headless);
+    gameBoy.SetFrameSkip(mode.frameSkip);
+    gameBoy.SetDeferredRendering(mode.deferred);
+    gameBoy.SetSpeculativePpu(mode.speculative);
+
+    bool matches = true;
+    u32 setupFrames = 0;
+    for (u32 i = 0; i < Frames; i++)
+    {
+        u32 videoFrames = host.videoFrames;
+        gameBoy.RunOneFrame();
+        if (i < SetupFrames)
+        {
+            setupFrames = host.videoFrames + host.skippedFrames;
+            continue;
+        }
+
+        observations.emplace_back();
+        PpuObservation &observation = observations.back();
+        memset(&observation, 0, sizeof(observation));
+        gameBoy.GetObservation(observation);
+
+        size_t count = observations.size();
+        if ((count < 3) || memcmp(&observation, &observations[count - 3], sizeof(observation)))
+        {
+            continue;
+        }
+
+        // settled, so it's one of the steps
+        int step = FindStep(observation);
+        if ((step < 0) || !MatchesStep(observation, step, cgb))
+        {
+            printf("frame %u doesn't match the settings it was taken in\n", i);
+            matches = false;
+        }
+        if (host.videoFrames != videoFrames)
+        {
+            if (!MatchesFrame(observation, host.frame, checkedCells))
+            {
+                printf("frame %u doesn't match the observation\n", i);
+                matches = false;
+            }
+        }
+        checkedFrames++;
+    }
+
+    // hands the frames still queued for the render thread over
+    gameBoy.SetSpeculativePpu(false);
+    gameBoy.SetDeferredRendering(false);
+
+    if ((host.videoFrames + host.skippedFrames - setupFrames) != (Frames - SetupFrames))
+    {
+        printf("%u frames drawn and %u skipped\n", host.videoFrames, host.skippedFrames);
+        matches = false;
+    }
+    return matches;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string outDir = (argc > 1) ? argv[1] : ".";
+    u32 failures = 0;
+
+    for (bool cgb : { false, true })
+    {
+        const char *model = cgb ? "CGB" : "DMG";
+        TestRom rom(cgb);
+        Assemble(rom, cgb);
+        std::string romFile = outDir + (cgb ? "/PpuObservationTest_cgb.gb" : "/PpuObservationTest_dmg.gb");
+        if (!rom.Write(romFile))
+        {
+            printf("can't write %s\n", romFile.c_str());
+            return 1;
+        }
+
+        std::vector<PpuObservation> drawnObservations;
+        for (const Mode &mode : Modes)
+        {
+            std::vector<PpuObservation> observations;
+            u32 checkedFrames = 0;
+            u32 checkedCells = 0;
+            bool matches = Run(romFile, mode, cgb, observations, checkedFrames, checkedCells);
+            if (&mode == Modes)
+            {
+                drawnObservations = observations;
+            }
+
+            bool same = (observations.size() == drawnObservations.size()) &&
+                !memcmp(observations.data(), drawnObservations.data(), observations.size() * sizeof(PpuObservation));
+            printf("PpuObservation %s, %s: %u frames, %u settled, %u cells drawn, %s, %s\n", model, mode.name,
+                (u32)observations.size(), checkedFrames, checkedCells, matches ? "matches" : "differs",
+                same ? "same as drawn" : "not the same as drawn");
+
+            // settings that never settle, or sprites over every cell, wouldn't test anything
+            if (!matches || !same || (checkedFrames < observations.size() / 3) || (!mode.headless && (checkedCells == 0)))
+            {
+                failures++;
+            }
+        }
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
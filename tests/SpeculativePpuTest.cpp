@@ -0,0 +1,143 @@
+// GameBoy::SetSpeculativePpu against lockstep. The ROM turns 40 sprites on and off every other frame, so
+// the drawing ends the predictor takes from the last frame are always wrong on the lines they're on, and
+// it reads STAT into WRAM and the APU all through the frame. Every run that read a wrong mode is rolled
+// back, after which the saved state (memory, CPU, timers, PPU and APU), the frames and the audio have to
+// be the same as without speculation.
+
+#include "TestRom.h"
+#include <fstream>
+#include <iterator>
+
+static constexpr u32 Frames = 120;
+
+static void Assemble(TestRom &rom)
+{
+    rom.Emit({ 0xF3, 0x31, 0xFE, 0xFF });                   // di, ld sp,FFFE
+    rom.Label("waitVBlank");
+    rom.Emit({ 0xF0, 0x44, 0xFE, 144 });                    // ldh a,(LY), cp 144
+    rom.JumpRelative(0x20, "waitVBlank");
+    rom.Emit({ 0xAF, 0xE0, 0x40 });                         // LCD off
+    rom.ClearRam();
+
+    // sprite tiles, so the sprites are drawn too
+    rom.Emit({ 0x21, 0x00, 0x80 });                         // ld hl,8000
+    rom.Label("tiles");
+    rom.Emit({ 0x36, 0x5A, 0x23, 0x7C, 0xFE, 0x88 });       // ld (hl),5A, inc hl, until 8800
+    rom.JumpRelative(0x20, "tiles");
+    rom.Emit({ 0x21, 0x00, 0xFE, 0xAF, 0x0E, 0xA0 });       // hidden sprites to start with
+    rom.Label("clearOam");
+    rom.Emit({ 0x22, 0x0D });
+    rom.JumpRelative(0x20, "clearOam");
+
+    // channel 1 on, its frequency follows STAT below
+    rom.Emit({ 0x3E, 0x80, 0xE0, 0x26, 0x3E, 0x77, 0xE0, 0x24, 0x3E, 0xFF, 0xE0, 0x25 });
+    rom.Emit({ 0x3E, 0x80, 0xE0, 0x11, 0x3E, 0xF0, 0xE0, 0x12, 0x3E, 0x87, 0xE0, 0x14 });
+
+    // LCD on with 8x16 sprites, V-Blank interrupt only
+    rom.Emit({ 0x3E, 0x97, 0xE0, 0x40, 0x3E, 0x01, 0xE0, 0xFF, 0xAF, 0xE0, 0x0F, 0xFB });
+
+    // STAT into C000-C7FF and NR13, over and over
+    rom.Label("main");
+    rom.Emit({ 0x21, 0x00, 0xC0 });                         // ld hl,C000
+    rom.Label("poll");
+    rom.Emit({ 0xF0, 0x41, 0x22, 0xE0, 0x13, 0x7C, 0xFE, 0xC8 });
+    rom.JumpRelative(0x20, "poll");
+    rom.JumpRelative(0x18, "main");
+
+    // V-Blank: count frames in D000, sprites on in odd frames as 4 rows of 10, a note every 8 frames
+    rom.Org(0x40);
+    rom.Jump(0xC3, "vblank");
+    rom.Org(0x1000);
+    rom.Label("vblank");
+    rom.Emit({ 0xF5, 0xC5, 0xE5 });                         // push af, bc, hl
+    rom.Emit({ 0xFA, 0x00, 0xD0, 0x3C, 0xEA, 0x00, 0xD0 }); // frame counter
+    rom.Emit({ 0x1F, 0x9F, 0x47 });                         // rra, sbc a,a, ld b,a: FF on odd frames
+    rom.Emit({ 0x21, 0x00, 0xFE, 0x0E, 0x00 });             // ld hl,FE00, ld c,0
+    rom.Label("sprite");
+    rom.Emit({ 0x79, 0xE6, 0x03, 0xCB, 0x37, 0xC6, 16, 0xA0, 0x22 });  // Y = 16 + (i & 3) * 16, or 0
+    rom.Emit({ 0x79, 0x87, 0x87, 0xC6, 8, 0x22 });          // X = 8 + i * 4
+    rom.Emit({ 0xAF, 0x22, 0x22 });                         // tile and attributes
+    rom.Emit({ 0x0C, 0x79, 0xFE, 40 });
+    rom.JumpRelative(0x20, "sprite");
+    rom.Emit({ 0xFA, 0x00, 0xD0, 0xE6, 0x07 });
+    rom.JumpRelative(0x20, "noNote");
+    rom.Emit({ 0x3E, 0xB0, 0xE0, 0x11, 0x3E, 0xF3, 0xE0, 0x12, 0x3E, 0xC7, 0xE0, 0x14 });
+    rom.Label("noNote");
+    rom.Emit({ 0xE1, 0xC1, 0xF1, 0xD9 });                   // pop, reti
+}
+
+static bool Run(const std::string &romFile, bool speculative, std::string &state, TestHost &host, u64 &rollBacks)
+{
+    GameBoy gameBoy(GameBoyModel::Auto, romFile.c_str(), &host);
+    gameBoy.SetSpeculativePpu(speculative);
+    if (gameBoy.IsSpeculativePpu() != speculative)
+    {
+        return false;
+    }
+
+    for (u32 i = 0; i < Frames; i++)
+    {
+        gameBoy.RunOneFrame();
+    }
+    rollBacks = gameBoy.GetPpuRollBacks();
+
+    // hands the frames and audio still queued for the other threads over
+    gameBoy.SetSpeculativePpu(false);
+    gameBoy.SetDeferredRendering(false);
+    gameBoy.SetDeferredAudio(false);
+
+    std::string stateFile = romFile + (speculative ? ".speculative.state" : ".lockstep.state");
+    {
+        std::ofstream outState(stateFile, std::ios::out | std::ios::binary | std::ios::trunc);
+        gameBoy.SaveState(outState);
+    }
+    std::ifstream inState(stateFile, std::ios::in | std::ios::binary);
+    state.assign(std::istreambuf_iterator<char>(inState), std::istreambuf_iterator<char>());
+    return !state.empty();
+}
+
+int main(int argc, char *argv[])
+{
+    std::string outDir = (argc > 1) ? argv[1] : ".";
+    u32 failures = 0;
+
+    for (bool cgb : { false, true })
+    {
+        const char *model = cgb ? "CGB" : "DMG";
+        TestRom rom(cgb);
+        Assemble(rom);
+        std::string romFile = outDir + (cgb ? "/SpeculativePpuTest_cgb.gb" : "/SpeculativePpuTest_dmg.gb");
+        if (!rom.Write(romFile))
+        {
+            printf("can't write %s\n", romFile.c_str());
+            return 1;
+        }
+
+        std::string lockstepState;
+        std::string speculativeState;
+        TestHost lockstepHost;
+        TestHost speculativeHost;
+        u64 rollBacks = 0;
+        if (!Run(romFile, false, lockstepState, lockstepHost, rollBacks) ||
+            !Run(romFile, true, speculativeState, speculativeHost, rollBacks))
+        {
+            printf("%s: can't run\n", model);
+            return 1;
+        }
+
+        bool stateMatches = (speculativeState == lockstepState);
+        bool videoMatches = (speculativeHost.videoFrames == lockstepHost.videoFrames) && (speculativeHost.videoHash == lockstepHost.videoHash);
+        bool audioMatches = (speculativeHost.audioFrames == lockstepHost.audioFrames) && (speculativeHost.audioHash == lockstepHost.audioHash);
+        printf("SpeculativePpu %s: %u frames, %llu runs rolled back, state %s, video %s, audio %s\n", model, Frames,
+            (unsigned long long)rollBacks, stateMatches ? "matches" : "differs", videoMatches ? "matches" : "differs",
+            audioMatches ? "matches" : "differs");
+
+        // without any rollback this wouldn't test anything
+        if ((rollBacks == 0) || !stateMatches || !videoMatches || !audioMatches)
+        {
+            failures++;
+        }
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+// StepSynth against Blip_Buffer (what the SDL build synthesizes with) on APU-like streams of square
+// wave edges: how far the aliasing is below the wave and how long a change in output takes, including
+// reading the samples back out
+
+#include "StepSynth.h"
+#include "Blip_Buffer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <vector>
+
+struct Edge
+{
+    u32 cycle;
+    s32 left;
+    s32 right;
+};
+
+static constexpr u32 ClockRate = 4194304;
+static constexpr u32 FrameCycles = 20000; // about where the APU ends its frames
+
+// square waves at the given frequencies with 4-bit levels at the mixer's volume (320 per step at
+// full master volume), edges on whole cycles like the hardware's
+static std::vector<std::vector<Edge>> MakeEdges(const std::vector<double> &frequencies, u32 frames)
+{
+    struct Channel
+    {
+        double period;
+        double next;
+        s32 level;
+        s32 volume;
+    };
+
+    static const s32 volumes[] = { 15, 12, 9, 6 };
+    std::vector<Channel> channels;
+    for (size_t i = 0; i < frequencies.size(); i++)
+    {
+        channels.push_back({ floor(ClockRate / frequencies[i] / 2), 0.0, 0, volumes[i % 4] });
+    }
+
+    std::vector<std::vector<Edge>> edges(frames);
+    double frameStart = 0;
+    for (u32 frame = 0; frame < frames; frame++)
+    {
+        double frameEnd = frameStart + FrameCycles;
+        while (true)
+        {
+            Channel *next = nullptr;
+            for (Channel &channel : channels)
+            {
+                if ((channel.next < frameEnd) && ((next == nullptr) || (channel.next < next->next)))
+                {
+                    next = &channel;
+                }
+            }
+            if (next == nullptr)
+            {
+                break;
+            }
+
+            s32 level = next->level ? 0 : next->volume;
+            s32 delta = (level - next->level) * 320;
+            bool both = ((next - &channels[0]) & 1) != 0;
+            edges[frame].push_back({ (u32)(next->next - frameStart), delta, both ? delta : delta / 2 });
+            next->level = level;
+            next->next += next->period;
+        }
+        frameStart = frameEnd;
+    }
+    return edges;
+}
+
+template <int Quality>
+static double RunBlip(const std::vector<std::vector<Edge>> &edges, u32 sampleRate, std::vector<s16> &output)
+{
+    // set up the same way GameBoyApu does
+    Blip_Buffer bufLeft, bufRight;
+    Blip_Synth<Quality, 32767> synthLeft, synthRight;
+    bufLeft.set_sample_rate(sampleRate);
+    bufRight.set_sample_rate(sampleRate);
+    bufLeft.clock_rate(ClockRate);
+    bufRight.clock_rate(ClockRate);
+    synthLeft.output(&bufLeft);
+    synthLeft.volume(0.5);
+    synthRight.output(&bufRight);
+    synthRight.volume(0.5);
+
+    output.clear();
+    s16 samples[4096 * 2];
+    auto start = std::chrono::steady_clock::now();
+    for (const std::vector<Edge> &frame : edges)
+    {
+        for (const Edge &edge : frame)
+        {
+            synthLeft.offset_inline(edge.cycle, edge.left);
+            synthRight.offset_inline(edge.cycle, edge.right);
+        }
+        bufLeft.end_frame(FrameCycles);
+        bufRight.end_frame(FrameCycles);
+
+        long count = bufLeft.read_samples(samples, 4096, 1);
+        bufRight.read_samples(samples + 1, 4096, 1);
+        output.insert(output.end(), samples, samples + count * 2);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double RunStepSynth(StepSynthQuality quality, const std::vector<std::vector<Edge>> &edges, u32 sampleRate, std::vector<s16> &output)
+{
+    StepSynth synth;
+    synth.SetQuality(quality);
+    synth.SetSampleRate(sampleRate);
+    synth.SetClockRate(ClockRate);
+
+    output.clear();
+    s16 samples[4096 * 2];
+    auto start = std::chrono::steady_clock::now();
+    for (const std::vector<Edge> &frame : edges)
+    {
+        for (const Edge &edge : frame)
+        {
+            synth.AddDelta(edge.cycle, edge.left, edge.right);
+        }
+        synth.EndFrame(FrameCycles);
+
+        u32 count = synth.ReadSamples(samples, 4096);
+        output.insert(output.end(), samples, samples + count * 2);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void Fft(std::vector<std::complex<double>> &data)
+{
+    size_t size = data.size();
+    for (size_t i = 1, j = 0; i < size; i++)
+    {
+        size_t bit = size >> 1;
+        for (; j & bit; bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j)
+        {
+            std::swap(data[i], data[j]);
+        }
+    }
+
+    for (size_t length = 2; length <= size; length <<= 1)
+    {
+        std::complex<double> step(cos(-2 * M_PI / length), sin(-2 * M_PI / length));
+        for (size_t i = 0; i < size; i += length)
+        {
+            std::complex<double> w(1);
+            for (size_t j = 0; j < length / 2; j++)
+            {
+                std::complex<double> even = data[i + j];
+                std::complex<double> odd = data[i + j + length / 2] * w;
+                data[i + j] = even + odd;
+                data[i + j + length / 2] = even - odd;
+                w *= step;
+            }
+        }
+    }
+}
+
+// seconds the fastest of 5 runs took
+template <typename Run>
+static double Fastest(Run run)
+{
+    double fastest = 1e30;
+    for (int i = 0; i < 5; i++)
+    {
+        fastest = std::min(fastest, run());
+    }
+    return fastest;
+}
+
+// power at the square wave's harmonics against everything else below 15 kHz (left channel), in dB
+static double AliasRatio(const std::vector<s16> &output, u32 sampleRate, double frequency)
+{
+    const size_t size = 1 << 16;
+    const size_t start = 8192; // past the high-pass settling
+    std::vector<std::complex<double>> data(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        // blackman-harris
+        double window = 0.35875 - 0.48829 * cos(2 * M_PI * i / size) + 0.14128 * cos(4 * M_PI * i / size) - 0.01168 * cos(6 * M_PI * i / size);
+        data[i] = output[(start + i) * 2] * window;
+    }
+    Fft(data);
+
+    double signal = 0;
+    double alias = 0;
+    for (size_t bin = 3; bin < size / 2; bin++)
+    {
+        double binFrequency = (double)bin * sampleRate / size;
+        if (binFrequency > 15000)
+        {
+            break;
+        }
+
+        double harmonic = binFrequency / frequency;
+        bool onHarmonic = fabs(harmonic - floor(harmonic + 0.5)) * frequency < 5.0 * sampleRate / size;
+        (onHarmonic ? signal : alias) += std::norm(data[bin]);
+    }
+    return 10 * log10(signal / alias);
+}
+
+int main()
+{
+    std::vector<s16> output;
+
+    printf("alias ratio in dB, higher is better\n");
+    for (u32 sampleRate : { 44100, 48000 })
+    {
+        // the square channel at period registers 1750, 1900 and 2000
+        for (u32 period : { 1750, 1900, 2000 })
+        {
+            double frequency = 131072.0 / (2048 - period);
+            std::vector<std::vector<Edge>> edges = MakeEdges({ frequency }, 400);
+
+            // the edges are on whole cycles, which is the frequency the harmonics are at
+            double exact = ClockRate / (2 * floor(ClockRate / frequency / 2));
+
+            printf("%u Hz, %7.1f Hz square:", sampleRate, exact);
+            RunBlip<blip_med_quality>(edges, sampleRate, output);
+            printf("  blip8 %.1f", AliasRatio(output, sampleRate, exact));
+            RunBlip<blip_good_quality>(edges, sampleRate, output);
+            printf("  blip12 %.1f", AliasRatio(output, sampleRate, exact));
+            RunBlip<blip_high_quality>(edges, sampleRate, output);
+            printf("  blip16 %.1f", AliasRatio(output, sampleRate, exact));
+            RunStepSynth(StepSynthQuality::Cheap, edges, sampleRate, output);
+            printf("  cheap %.1f", AliasRatio(output, sampleRate, exact));
+            RunStepSynth(StepSynthQuality::Good, edges, sampleRate, output);
+            printf("  good %.1f", AliasRatio(output, sampleRate, exact));
+            RunStepSynth(StepSynthQuality::Best, edges, sampleRate, output);
+            printf("  best %.1f\n", AliasRatio(output, sampleRate, exact));
+        }
+    }
+
+    // busy music on all 4 channels
+    std::vector<std::vector<Edge>> edges = MakeEdges({ 523.3, 659.3, 1046.5, 3520.0 }, 3000);
+    size_t count = 0;
+    for (const std::vector<Edge> &frame : edges)
+    {
+        count += frame.size();
+    }
+
+    printf("\nns per change in output at 44100 Hz (%zu changes), lower is better\n", count);
+    printf("  blip8 %.1f", Fastest([&] { return RunBlip<blip_med_quality>(edges, 44100, output); }) * 1e9 / count);
+    printf("  blip12 %.1f", Fastest([&] { return RunBlip<blip_good_quality>(edges, 44100, output); }) * 1e9 / count);
+    printf("  blip16 %.1f", Fastest([&] { return RunBlip<blip_high_quality>(edges, 44100, output); }) * 1e9 / count);
+    printf("  cheap %.1f", Fastest([&] { return RunStepSynth(StepSynthQuality::Cheap, edges, 44100, output); }) * 1e9 / count);
+    printf("  good %.1f", Fastest([&] { return RunStepSynth(StepSynthQuality::Good, edges, 44100, output); }) * 1e9 / count);
+    printf("  best %.1f\n", Fastest([&] { return RunStepSynth(StepSynthQuality::Best, edges, 44100, output); }) * 1e9 / count);
+    return 0;
+}
@@ -0,0 +1,202 @@
+// StepSynth output for random streams of changes, as a hash per configuration. The Makefile runs the
+// native (SSE2 or NEON), scalar and emulated NEON builds and the hashes have to be identical, the
+// synthesis is all fixed point so every path gives the same samples. What they all give is checked
+// against a plain floating point synth that puts every step exactly where it is.
+
+#include "StepSynth.h"
+#include "WindowedSinc.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static constexpr u32 ClockRate = 4194304;
+
+static u64 Hash(u64 hash, const s16 *samples, u32 count)
+{
+    // FNV-1a
+    for (u32 i = 0; i < count; i++)
+    {
+        hash = (hash ^ (u16)samples[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// the same band-limited steps and high-pass as StepSynth in doubles, without its fixed point, kernel table or
+// splitting of large steps, and with the whole output kept so nothing is moved around. A step is still put
+// in the middle of one of 128 phases of a sample: with the exact times the difference is about 50 dB
+// down, which is the phases' error and would hide anything smaller
+class ReferenceSynth
+{
+private:
+    u32 _width;
+    double _cutoff;
+    double _bass;
+    u32 _sampleRate;
+    u64 _factor = 0;
+    u64 _offset = 0;
+    u64 _read = 0;
+    std::vector<double> _differences;
+    double _accLeft = 0;
+    double _accRight = 0;
+public:
+    ReferenceSynth(StepSynthQuality quality, u32 sampleRate)
+    {
+        _width = (u32)quality;
+        _cutoff = (_width >= 16) ? 0.9 : ((_width >= 12) ? 0.86 : 0.8);
+        _sampleRate = sampleRate;
+
+        // Blip_Buffer's bass_freq(16)
+        u32 shift = 13;
+        u32 f = (16 << 16) / sampleRate;
+        while ((f >>= 1) && --shift)
+        {
+        }
+        _bass = 1.0 / (1u << shift);
+    }
+
+    void SetClockRate(u32 clockRate)
+    {
+        _factor = (u64)floor((double)_sampleRate / clockRate * 4294967296.0 + 0.5);
+    }
+
+    void AddDelta(u32 cycle, s32 left, s32 right)
+    {
+        u64 time = _offset + (cycle * _factor);
+        u64 index = time >> 32;
+        double fraction = (floor((u32)time / 4294967296.0 * 128) + 0.5) / 128;
+        double half = _width / 2;
+        if (_differences.size() < (index + _width) * 2)
+        {
+            _differences.resize((index + _width) * 2 + 65536, 0.0);
+        }
+
+        double taps[16];
+        double sum = 0;
+        for (u32 tap = 0; tap < _width; tap++)
+        {
+            taps[tap] = WindowedSinc(tap - (half - 1) - fraction, _cutoff, half);
+            sum += taps[tap];
+        }
+        for (u32 tap = 0; tap < _width; tap++)
+        {
+            _differences[(index + tap) * 2] += left * taps[tap] / sum;
+            _differences[(index + tap) * 2 + 1] += right * taps[tap] / sum;
+        }
+    }
+
+    void EndFrame(u32 cycles) { _offset += cycles * _factor; }
+
+    // the next frames of output, each one is what was integrated before its differences are added
+    void Read(double *output, u32 frames)
+    {
+        for (u32 i = 0; i < frames; i++, _read++)
+        {
+            output[i * 2] = _accLeft;
+            output[i * 2 + 1] = _accRight;
+            _accLeft += ((_read * 2 < _differences.size()) ? _differences[_read * 2] : 0.0) - _accLeft * _bass;
+            _accRight += ((_read * 2 < _differences.size()) ? _differences[_read * 2 + 1] : 0.0) - _accRight * _bass;
+        }
+    }
+};
+
+// signal to error against the reference in dB, worse than this means StepSynth isn't synthesizing what it's given
+static constexpr double MinimumSnr = 70;
+
+static bool Run(StepSynthQuality quality, u32 sampleRate, u32 seed)
+{
+    std::mt19937 random(seed);
+    StepSynth synth;
+    synth.SetQuality(quality);
+    synth.SetSampleRate(sampleRate);
+    synth.SetClockRate(ClockRate);
+    ReferenceSynth reference(quality, sampleRate);
+    reference.SetClockRate(ClockRate);
+
+    s16 samples[4096 * 2];
+    double expected[4096 * 2];
+    double signal = 0;
+    double error = 0;
+    u64 hash = 14695981039346656037ull;
+    u64 total = 0;
+
+    // the mixer's output levels are within 4 channels * 15 * 320, steps across the whole range are
+    // beyond 16 bits and have to be split up
+    s32 left = 0;
+    s32 right = 0;
+
+    for (u32 frame = 0; frame < 600; frame++)
+    {
+        // frames around the length the APU ends them at, changes anywhere in them. In order, like the
+        // APU's, so the levels in between stay within the mixer's too
+        u32 cycles = 16000 + random() % 8192;
+        std::vector<u32> changes(random() % 400);
+        for (u32 &cycle : changes)
+        {
+            cycle = random() % cycles;
+        }
+        std::sort(changes.begin(), changes.end());
+        for (u32 cycle : changes)
+        {
+            s32 newLeft = (s32)(random() % 38401) - 19200;
+            s32 newRight = ((random() % 4) == 0) ? right : ((s32)(random() % 38401) - 19200);
+            synth.AddDelta(cycle, newLeft - left, newRight - right);
+            reference.AddDelta(cycle, newLeft - left, newRight - right);
+            left = newLeft;
+            right = newRight;
+        }
+        synth.EndFrame(cycles);
+        reference.EndFrame(cycles);
+
+        if ((frame % 60) == 59)
+        {
+            // host's rate control
+            u32 clockRate = ClockRate - 20000 + random() % 40000;
+            synth.SetClockRate(clockRate);
+            reference.SetClockRate(clockRate);
+        }
+
+        if ((random() % 20) == 0)
+        {
+            u32 frames = std::min(synth.GetSamplesAvailable(), (u32)(random() % 300));
+            synth.RemoveSamples(frames);
+            for (u32 removed = 0; removed < frames; removed += 256)
+            {
+                reference.Read(expected, std::min(frames - removed, 256u));
+            }
+        }
+
+        // reads in uneven pieces, sometimes leaving samples for the next frame
+        while (synth.GetSamplesAvailable() > 64)
+        {
+            u32 read = synth.ReadSamples(samples, 1 + random() % 1024);
+            hash = Hash(hash, samples, read * 2);
+            total += read;
+
+            reference.Read(expected, read);
+            for (u32 i = 0; i < read * 2; i++)
+            {
+                signal += expected[i] * expected[i];
+                error += (samples[i] - expected[i]) * (samples[i] - expected[i]);
+            }
+        }
+    }
+
+    double snr = 10 * log10(signal / error);
+    printf("StepSynth quality %u at %u Hz: %llu samples, hash %016llx, %.1f dB signal to error against the reference\n",
+        (u32)quality, sampleRate, (unsigned long long)total, (unsigned long long)hash, snr);
+    return snr >= MinimumSnr;
+}
+
+int main()
+{
+    bool passed = true;
+    for (StepSynthQuality quality : { StepSynthQuality::Cheap, StepSynthQuality::Good, StepSynthQuality::Best })
+    {
+        passed &= Run(quality, 44100, 1);
+        passed &= Run(quality, 48000, 2);
+        passed &= Run(quality, 22050, 3);
+    }
+    return passed ? 0 : 1;
+}
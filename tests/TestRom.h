@@ -0,0 +1,187 @@
+// what the tests that run the whole emulator share: a ROM assembled from opcode bytes, and a host that
+// hashes the video and audio it gets
+
+#pragma once
+
+#include "GameBoy.h"
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+
+// a 32 KiB cart without a mapper. the header jumps to 0x150, labels are resolved when the file is written
+class TestRom
+{
+private:
+    struct Fixup
+    {
+        u16 addr;
+        bool relative;
+        std::string label;
+    };
+
+    std::vector<u8> _rom;
+    std::map<std::string, u16> _labels;
+    std::vector<Fixup> _fixups;
+    u16 _pc;
+    u32 _fills = 0;
+public:
+    TestRom(bool cgb)
+    {
+        static const u8 logo[48] =
+        {
+            0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B, 0x03, 0x73, 0x00, 0x83, 0x00, 0x0C, 0x00, 0x0D,
+            0x00, 0x08, 0x11, 0x1F, 0x88, 0x89, 0x00, 0x0E, 0xDC, 0xCC, 0x6E, 0xE6, 0xDD, 0xDD, 0xD9, 0x99,
+            0xBB, 0xBB, 0x67, 0x63, 0x6E, 0x0E, 0xEC, 0xCC, 0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E
+        };
+
+        _rom.assign(0x8000, 0);
+        memcpy(&_rom[0x104], logo, sizeof(logo));
+        memcpy(&_rom[0x134], "TEST", 4);
+        _rom[0x143] = cgb ? 0x80 : 0x00;
+
+        _pc = 0x100;
+        Emit({ 0x00 });
+        Jump(0xC3, "start");
+        _pc = 0x150;
+        Label("start");
+    }
+
+    void Org(u16 addr) { _pc = addr; }
+    void Label(const char *name) { _labels[name] = _pc; }
+
+    void Emit(std::initializer_list<u8> bytes)
+    {
+        for (u8 byte : bytes)
+        {
+            _rom[_pc++] = byte;
+        }
+    }
+
+    // inline loop that sets count bytes from addr, with a, bc and hl
+    void Fill(u16 addr, u16 count, u8 value)
+    {
+        std::string label = "fill" + std::to_string(_fills++);
+        Emit({ 0x21, (u8)addr, (u8)(addr >> 8), 0x01, (u8)count, (u8)(count >> 8) });
+        Label(label.c_str());
+        Emit({ 0x3E, value, 0x22, 0x0B, 0x78, 0xB1 });    // ld (hl+),a, dec bc, until bc is 0
+        JumpRelative(0x20, label.c_str());
+    }
+
+    // RAM isn't cleared on power on, the tests compare runs so they clear what the state has of it: every
+    // WRAM and VRAM bank and HRAM below the stack. needs the LCD off
+    void ClearRam()
+    {
+        for (u8 bank = 1; bank < 8; bank++)
+        {
+            Emit({ 0x3E, bank, 0xE0, 0x70 });
+            Fill(0xD000, 0x1000, 0);
+        }
+        Emit({ 0x3E, 0x01, 0xE0, 0x70, 0xE0, 0x4F });
+        Fill(0x8000, 0x2000, 0);
+        Emit({ 0xAF, 0xE0, 0x4F });
+        Fill(0x8000, 0x2000, 0);
+        Fill(0xC000, 0x1000, 0);
+        Fill(0xFF80, 0x7E, 0);
+    }
+
+    // jr and jr cc
+    void JumpRelative(u8 opcode, const char *label)
+    {
+        Emit({ opcode, 0 });
+        _fixups.push_back({ (u16)(_pc - 1), true, label });
+    }
+
+    // jp, jp cc and call
+    void Jump(u8 opcode, const char *label)
+    {
+        Emit({ opcode, 0, 0 });
+        _fixups.push_back({ (u16)(_pc - 2), false, label });
+    }
+
+    bool Write(const std::string &fileName)
+    {
+        for (const Fixup &fixup : _fixups)
+        {
+            u16 target = _labels.at(fixup.label);
+            if (fixup.relative)
+            {
+                _rom[fixup.addr] = (u8)(target - (fixup.addr + 1));
+            }
+            else
+            {
+                _rom[fixup.addr] = (u8)target;
+                _rom[fixup.addr + 1] = (u8)(target >> 8);
+            }
+        }
+
+        u8 checksum = 0;
+        for (u32 i = 0x134; i < 0x14D; i++)
+        {
+            checksum = checksum - _rom[i] - 1;
+        }
+        _rom[0x14D] = checksum;
+
+        FILE *file = fopen(fileName.c_str(), "wb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        bool written = (fwrite(_rom.data(), 1, _rom.size(), file) == _rom.size());
+        fclose(file);
+        return written;
+    }
+};
+
+// FNV-1a of every frame and sample, frames may come from the render thread and samples from the audio thread.
+// frames that weren't drawn are only counted
+class TestHost : public IHostSystem
+{
+private:
+    s16 _audio[8192 * 2];
+public:
+    u64 videoHash = 14695981039346656037ull;
+    u64 audioHash = 14695981039346656037ull;
+    u32 videoFrames = 0;
+    u32 skippedFrames = 0;
+    u64 audioFrames = 0;
+
+    bool Initialize() override { return true; }
+    bool IsButtonPressed(HostButton) override { return false; }
+    void LoadRomFile(const char *) override {}
+    HostExitCode RunApp(int, const char *[]) override { return HostExitCode::Success; }
+    u32 GetAudioSampleRate() override { return 44100; }
+
+    s16 *BeginAudioWrite(u32 &frames) override
+    {
+        if (frames > 8192)
+        {
+            frames = 8192;
+        }
+        return _audio;
+    }
+
+    void EndAudioWrite(u32 frames) override
+    {
+        for (u32 i = 0; i < frames * 2; i++)
+        {
+            audioHash = (audioHash ^ (u16)_audio[i]) * 1099511628211ull;
+        }
+        audioFrames += frames;
+    }
+
+    void SyncAudio() override {}
+
+    void PushVideoFrame(u32 *pixelBuffer, const u32 *, bool) override
+    {
+        for (u32 i = 0; i < 160 * 144; i++)
+        {
+            videoHash = (videoHash ^ pixelBuffer[i]) * 1099511628211ull;
+        }
+        videoFrames++;
+    }
+
+    void SkipVideoFrame() override { skippedFrames++; }
+};
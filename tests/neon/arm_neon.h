@@ -0,0 +1,203 @@
+#pragma once
+
+// The NEON intrinsics used in src/, one lane at a time, so the NEON paths can be built and tested on
+// hosts without NEON. The Makefile puts this in front of the system headers with __ARM_NEON defined,
+// on ARM hosts the real arm_neon.h is used instead. Only as exact as the tests need: results match
+// the instructions, speed doesn't.
+
+#include <stdint.h>
+#include <string.h>
+
+struct int16x4_t { int16_t lane[4]; };
+struct int16x8_t { int16_t lane[8]; };
+struct int32x2_t { int32_t lane[2]; };
+struct int32x4_t { int32_t lane[4]; };
+struct uint8x8_t { uint8_t lane[8]; };
+struct uint8x16_t { uint8_t lane[16]; };
+struct uint16x4_t { uint16_t lane[4]; };
+struct uint16x8_t { uint16_t lane[8]; };
+struct uint32x4_t { uint32_t lane[4]; };
+struct uint32x4x2_t { uint32x4_t val[2]; };
+struct float32x2_t { float lane[2]; };
+struct float32x4_t { float lane[4]; };
+
+// loads and stores
+
+inline uint8x16_t vld1q_u8(const uint8_t *ptr) { uint8x16_t r; memcpy(r.lane, ptr, sizeof(r.lane)); return r; }
+inline uint32x4_t vld1q_u32(const uint32_t *ptr) { uint32x4_t r; memcpy(r.lane, ptr, sizeof(r.lane)); return r; }
+inline int16x8_t vld1q_s16(const int16_t *ptr) { int16x8_t r; memcpy(r.lane, ptr, sizeof(r.lane)); return r; }
+inline int32x2_t vld1_s32(const int32_t *ptr) { int32x2_t r; memcpy(r.lane, ptr, sizeof(r.lane)); return r; }
+inline int32x4_t vld1q_s32(const int32_t *ptr) { int32x4_t r; memcpy(r.lane, ptr, sizeof(r.lane)); return r; }
+inline float32x4_t vld1q_f32(const float *ptr) { float32x4_t r; memcpy(r.lane, ptr, sizeof(r.lane)); return r; }
+
+inline void vst1_u8(uint8_t *ptr, uint8x8_t a) { memcpy(ptr, a.lane, sizeof(a.lane)); }
+inline void vst1q_u8(uint8_t *ptr, uint8x16_t a) { memcpy(ptr, a.lane, sizeof(a.lane)); }
+inline void vst1q_u32(uint32_t *ptr, uint32x4_t a) { memcpy(ptr, a.lane, sizeof(a.lane)); }
+inline void vst1q_s32(int32_t *ptr, int32x4_t a) { memcpy(ptr, a.lane, sizeof(a.lane)); }
+inline void vst1_lane_s16(int16_t *ptr, int16x4_t a, int lane) { *ptr = a.lane[lane]; }
+
+// lanes
+
+inline uint8x16_t vdupq_n_u8(uint8_t value) { uint8x16_t r; for (int i = 0; i < 16; i++) r.lane[i] = value; return r; }
+inline uint16x8_t vdupq_n_u16(uint16_t value) { uint16x8_t r; for (int i = 0; i < 8; i++) r.lane[i] = value; return r; }
+inline int32x2_t vdup_n_s32(int32_t value) { int32x2_t r; r.lane[0] = r.lane[1] = value; return r; }
+inline float32x4_t vdupq_n_f32(float value) { float32x4_t r; for (int i = 0; i < 4; i++) r.lane[i] = value; return r; }
+
+inline int32_t vget_lane_s32(int32x2_t a, int lane) { return a.lane[lane]; }
+inline float vget_lane_f32(float32x2_t a, int lane) { return a.lane[lane]; }
+inline int32x2_t vset_lane_s32(int32_t value, int32x2_t a, int lane) { a.lane[lane] = value; return a; }
+
+inline int16x4_t vget_low_s16(int16x8_t a) { int16x4_t r; memcpy(r.lane, a.lane, sizeof(r.lane)); return r; }
+inline int16x4_t vget_high_s16(int16x8_t a) { int16x4_t r; memcpy(r.lane, a.lane + 4, sizeof(r.lane)); return r; }
+inline float32x2_t vget_low_f32(float32x4_t a) { float32x2_t r; memcpy(r.lane, a.lane, sizeof(r.lane)); return r; }
+inline float32x2_t vget_high_f32(float32x4_t a) { float32x2_t r; memcpy(r.lane, a.lane + 2, sizeof(r.lane)); return r; }
+
+inline int32x4_t vcombine_s32(int32x2_t low, int32x2_t high)
+{
+    int32x4_t r = {{ low.lane[0], low.lane[1], high.lane[0], high.lane[1] }};
+    return r;
+}
+
+inline uint16x8_t vcombine_u16(uint16x4_t low, uint16x4_t high)
+{
+    uint16x8_t r;
+    memcpy(r.lane, low.lane, sizeof(low.lane));
+    memcpy(r.lane + 4, high.lane, sizeof(high.lane));
+    return r;
+}
+
+inline int16x4_t vreinterpret_s16_s32(int32x2_t a) { int16x4_t r; memcpy(r.lane, a.lane, sizeof(r.lane)); return r; }
+
+inline uint32x4x2_t vzipq_u32(uint32x4_t a, uint32x4_t b)
+{
+    uint32x4x2_t r = {{
+        {{ a.lane[0], b.lane[0], a.lane[1], b.lane[1] }},
+        {{ a.lane[2], b.lane[2], a.lane[3], b.lane[3] }},
+    }};
+    return r;
+}
+
+// bitwise and compares, true lanes are all ones
+
+inline uint8x16_t vandq_u8(uint8x16_t a, uint8x16_t b) { for (int i = 0; i < 16; i++) a.lane[i] &= b.lane[i]; return a; }
+inline uint8x16_t vorrq_u8(uint8x16_t a, uint8x16_t b) { for (int i = 0; i < 16; i++) a.lane[i] |= b.lane[i]; return a; }
+inline uint32x4_t vorrq_u32(uint32x4_t a, uint32x4_t b) { for (int i = 0; i < 4; i++) a.lane[i] |= b.lane[i]; return a; }
+inline uint32x4_t vbicq_u32(uint32x4_t a, uint32x4_t b) { for (int i = 0; i < 4; i++) a.lane[i] &= ~b.lane[i]; return a; }
+
+inline uint8x16_t vbslq_u8(uint8x16_t mask, uint8x16_t a, uint8x16_t b)
+{
+    for (int i = 0; i < 16; i++) mask.lane[i] = (mask.lane[i] & a.lane[i]) | (~mask.lane[i] & b.lane[i]);
+    return mask;
+}
+
+inline uint32x4_t vbslq_u32(uint32x4_t mask, uint32x4_t a, uint32x4_t b)
+{
+    for (int i = 0; i < 4; i++) mask.lane[i] = (mask.lane[i] & a.lane[i]) | (~mask.lane[i] & b.lane[i]);
+    return mask;
+}
+
+inline uint8x16_t vceqq_u8(uint8x16_t a, uint8x16_t b) { for (int i = 0; i < 16; i++) a.lane[i] = (a.lane[i] == b.lane[i]) ? 0xFF : 0; return a; }
+inline uint8x16_t vtstq_u8(uint8x16_t a, uint8x16_t b) { for (int i = 0; i < 16; i++) a.lane[i] = (a.lane[i] & b.lane[i]) ? 0xFF : 0; return a; }
+inline uint32x4_t vceqq_u32(uint32x4_t a, uint32x4_t b) { for (int i = 0; i < 4; i++) a.lane[i] = (a.lane[i] == b.lane[i]) ? 0xFFFFFFFF : 0; return a; }
+
+// integer arithmetic
+
+inline uint8x16_t vrhaddq_u8(uint8x16_t a, uint8x16_t b)
+{
+    for (int i = 0; i < 16; i++) a.lane[i] = (uint8_t)((a.lane[i] + b.lane[i] + 1) >> 1);
+    return a;
+}
+
+inline uint16x8_t vaddq_u16(uint16x8_t a, uint16x8_t b) { for (int i = 0; i < 8; i++) a.lane[i] += b.lane[i]; return a; }
+inline int32x2_t vadd_s32(int32x2_t a, int32x2_t b) { for (int i = 0; i < 2; i++) a.lane[i] = (int32_t)((uint32_t)a.lane[i] + (uint32_t)b.lane[i]); return a; }
+inline int32x2_t vsub_s32(int32x2_t a, int32x2_t b) { for (int i = 0; i < 2; i++) a.lane[i] = (int32_t)((uint32_t)a.lane[i] - (uint32_t)b.lane[i]); return a; }
+
+inline uint16x8_t vpaddlq_u8(uint8x16_t a)
+{
+    uint16x8_t r;
+    for (int i = 0; i < 8; i++) r.lane[i] = a.lane[i * 2] + a.lane[i * 2 + 1];
+    return r;
+}
+
+inline uint32x4_t vpaddlq_u16(uint16x8_t a)
+{
+    uint32x4_t r;
+    for (int i = 0; i < 4; i++) r.lane[i] = a.lane[i * 2] + a.lane[i * 2 + 1];
+    return r;
+}
+
+// rounding narrows add half before shifting, without overflowing the wide lane
+inline uint8x8_t vrshrn_n_u16(uint16x8_t a, int shift)
+{
+    uint8x8_t r;
+    for (int i = 0; i < 8; i++) r.lane[i] = (uint8_t)(((uint32_t)a.lane[i] + (1u << (shift - 1))) >> shift);
+    return r;
+}
+
+inline uint16x4_t vrshrn_n_u32(uint32x4_t a, int shift)
+{
+    uint16x4_t r;
+    for (int i = 0; i < 4; i++) r.lane[i] = (uint16_t)(((uint64_t)a.lane[i] + (1u << (shift - 1))) >> shift);
+    return r;
+}
+
+inline uint8x8_t vmovn_u16(uint16x8_t a) { uint8x8_t r; for (int i = 0; i < 8; i++) r.lane[i] = (uint8_t)a.lane[i]; return r; }
+
+inline int16x4_t vqmovn_s32(int32x4_t a)
+{
+    int16x4_t r;
+    for (int i = 0; i < 4; i++) r.lane[i] = (int16_t)((a.lane[i] < -32768) ? -32768 : ((a.lane[i] > 32767) ? 32767 : a.lane[i]));
+    return r;
+}
+
+inline int32x2_t vshr_n_s32(int32x2_t a, int shift) { for (int i = 0; i < 2; i++) a.lane[i] >>= shift; return a; }
+
+// shifts left by the low byte of each lane of b, negative amounts shift right (arithmetic)
+inline int32x2_t vshl_s32(int32x2_t a, int32x2_t b)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        int8_t shift = (int8_t)b.lane[i];
+        if (shift >= 32) a.lane[i] = 0;
+        else if (shift >= 0) a.lane[i] = (int32_t)((uint32_t)a.lane[i] << shift);
+        else a.lane[i] = (shift <= -32) ? (a.lane[i] >> 31) : (a.lane[i] >> -shift);
+    }
+    return a;
+}
+
+inline int32x4_t vmlal_s16(int32x4_t a, int16x4_t b, int16x4_t c)
+{
+    for (int i = 0; i < 4; i++) a.lane[i] = (int32_t)((uint32_t)a.lane[i] + (uint32_t)((int32_t)b.lane[i] * c.lane[i]));
+    return a;
+}
+
+// floating point, multiply-accumulates round the product before adding like VMLA does
+
+inline float32x4_t vsubq_f32(float32x4_t a, float32x4_t b) { for (int i = 0; i < 4; i++) a.lane[i] -= b.lane[i]; return a; }
+inline float32x2_t vadd_f32(float32x2_t a, float32x2_t b) { for (int i = 0; i < 2; i++) a.lane[i] += b.lane[i]; return a; }
+
+inline float32x4_t vmlaq_f32(float32x4_t a, float32x4_t b, float32x4_t c)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        float product = b.lane[i] * c.lane[i];
+        a.lane[i] += product;
+    }
+    return a;
+}
+
+inline float32x4_t vmlaq_n_f32(float32x4_t a, float32x4_t b, float c)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        float product = b.lane[i] * c;
+        a.lane[i] += product;
+    }
+    return a;
+}
+
+inline float32x2_t vpadd_f32(float32x2_t a, float32x2_t b)
+{
+    float32x2_t r = {{ a.lane[0] + a.lane[1], b.lane[0] + b.lane[1] }};
+    return r;
+}